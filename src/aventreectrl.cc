@@ -160,7 +160,7 @@ void AvenTreeCtrl::FillTree(const wxString& root_name)
     wxString current_prefix;
     wxTreeItemId current_id = treeroot;
 
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     while (pos != m_Parent->GetLabelsEnd()) {
 	LabelInfo* label = *pos++;
 
@@ -0,0 +1,99 @@
+//
+//  bvh.cc
+//
+//  Bounding volume hierarchy over items with axis-aligned bounding boxes.
+//
+//  Copyright (C) 2026 agent
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "bvh.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void
+BVH::build(const vector<BoundingBox>& boxes, unsigned max_leaf_items)
+{
+    clear();
+    if (boxes.empty()) return;
+
+    vector<Vector3> centres;
+    centres.reserve(boxes.size());
+    items.reserve(boxes.size());
+    for (unsigned i = 0; i != boxes.size(); ++i) {
+	centres.push_back(boxes[i].centre());
+	items.push_back(i);
+    }
+
+    nodes.resize(1);
+    build(boxes, centres, 0, 0, boxes.size(), max(max_leaf_items, 1u));
+}
+
+void
+BVH::build(const vector<BoundingBox>& boxes, const vector<Vector3>& centres,
+	   unsigned node, unsigned first, unsigned count,
+	   unsigned max_leaf_items)
+{
+    if (count <= max_leaf_items) {
+	BoundingBox box;
+	for (unsigned i = first; i != first + count; ++i) {
+	    box.add(boxes[items[i]]);
+	}
+	nodes[node].box = box;
+	nodes[node].child = 0;
+	nodes[node].leaf = leaves.size();
+	leaves.push_back(Leaf{first, count, node});
+	return;
+    }
+
+    BoundingBox centre_box;
+    for (unsigned i = first; i != first + count; ++i) {
+	centre_box.add(centres[items[i]]);
+    }
+
+    // Split at the median of the centres along the longest axis of their
+    // extent, which gives a balanced tree of compact clusters.
+    Vector3 ext = centre_box.GetMax() - centre_box.GetMin();
+    double (Vector3::*get)() const = &Vector3::GetX;
+    if (ext.GetY() > ext.GetX() && ext.GetY() >= ext.GetZ()) {
+	get = &Vector3::GetY;
+    } else if (ext.GetZ() > ext.GetX() && ext.GetZ() > ext.GetY()) {
+	get = &Vector3::GetZ;
+    }
+    auto begin = items.begin() + first;
+    auto mid = begin + count / 2;
+    nth_element(begin, mid, begin + count,
+		[&](unsigned a, unsigned b) {
+		    return (centres[a].*get)() < (centres[b].*get)();
+		});
+
+    unsigned child = nodes.size();
+    nodes[node].child = child;
+    nodes.resize(child + 2);
+    build(boxes, centres, child, first, count / 2, max_leaf_items);
+    build(boxes, centres, child + 1, first + count / 2, count - count / 2,
+	  max_leaf_items);
+    // Note that nodes may have been reallocated by the recursive calls.
+    BoundingBox box = nodes[child].box;
+    box.add(nodes[child + 1].box);
+    nodes[node].box = box;
+}
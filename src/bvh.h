@@ -0,0 +1,135 @@
+//
+//  bvh.h
+//
+//  Bounding volume hierarchy over items with axis-aligned bounding boxes.
+//
+//  Copyright (C) 2026 agent
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+
+#ifndef bvh_h
+#define bvh_h
+
+#include "vector3.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+class BoundingBox {
+    Vector3 lo, hi;
+
+  public:
+    // An empty box.
+    BoundingBox() : lo(HUGE_VAL, HUGE_VAL, HUGE_VAL),
+		    hi(-HUGE_VAL, -HUGE_VAL, -HUGE_VAL) { }
+
+    bool empty() const { return lo.GetX() > hi.GetX(); }
+
+    const Vector3& GetMin() const { return lo; }
+    const Vector3& GetMax() const { return hi; }
+
+    Vector3 centre() const { return (lo + hi) * 0.5; }
+
+    // The length of the diagonal.
+    double diameter() const { return empty() ? 0.0 : (hi - lo).magnitude(); }
+
+    void add(const Vector3& v) {
+	lo.assign(std::min(lo.GetX(), v.GetX()),
+		  std::min(lo.GetY(), v.GetY()),
+		  std::min(lo.GetZ(), v.GetZ()));
+	hi.assign(std::max(hi.GetX(), v.GetX()),
+		  std::max(hi.GetY(), v.GetY()),
+		  std::max(hi.GetZ(), v.GetZ()));
+    }
+
+    void add(const BoundingBox& box) {
+	if (!box.empty()) {
+	    add(box.lo);
+	    add(box.hi);
+	}
+    }
+
+    // Add a point and everything within distance r of it in each axis.
+    void add(const Vector3& v, double r) {
+	add(v - Vector3(r, r, r));
+	add(v + Vector3(r, r, r));
+    }
+};
+
+// Items are grouped into leaves of up to a given size, each of which is a
+// compact cluster in space.  Each node's box contains the boxes of everything
+// below it, so a whole subtree can be rejected by testing one box.
+class BVH {
+  public:
+    struct Node {
+	BoundingBox box;
+	// For an internal node, the index of the first of its two children
+	// (the second immediately follows it).  For a leaf, 0 (the root node
+	// can't be anyone's child).
+	unsigned child;
+	// For a leaf, the index of the leaf.
+	unsigned leaf;
+    };
+
+    struct Leaf {
+	// The leaf's items are items[first] to items[first + count - 1].
+	unsigned first, count;
+	unsigned node;
+    };
+
+  private:
+    std::vector<Node> nodes;
+
+    std::vector<Leaf> leaves;
+
+    // Item numbers in leaf order.
+    std::vector<unsigned> items;
+
+    void build(const std::vector<BoundingBox>& boxes,
+	       const std::vector<Vector3>& centres,
+	       unsigned node, unsigned first, unsigned count,
+	       unsigned max_leaf_items);
+
+  public:
+    void clear() {
+	nodes.clear();
+	leaves.clear();
+	items.clear();
+    }
+
+    // Build the hierarchy over items 0 to boxes.size() - 1, where item i has
+    // bounding box boxes[i].
+    void build(const std::vector<BoundingBox>& boxes,
+	       unsigned max_leaf_items);
+
+    bool empty() const { return nodes.empty(); }
+
+    // The root is node 0 (if !empty()).
+    const Node& GetNode(unsigned i) const { return nodes[i]; }
+
+    unsigned GetNumLeaves() const { return leaves.size(); }
+
+    const Leaf& GetLeaf(unsigned i) const { return leaves[i]; }
+
+    const BoundingBox& GetLeafBox(unsigned i) const {
+	return nodes[leaves[i].node].box;
+    }
+
+    unsigned GetItem(unsigned i) const { return items[i]; }
+};
+
+#endif
@@ -42,8 +42,11 @@
 #include "netskel.h"
 #include "osdepend.h"
 #include "out.h"
+#include "profile.h"
+#include "solvecache.h"
 #include "str.h"
 #include "validate.h"
+#include "watch.h"
 #include "whichos.h"
 
 #if OS_WIN32
@@ -58,6 +61,11 @@
 
 /* Globals */
 node *stnlist = NULL;
+osarena prefix_arena = OSARENA_INIT("prefix", prefix);
+osarena ident_arena = OSARENA_INIT("ident", char);
+osarena node_arena = OSARENA_INIT("node", node);
+osarena linkfor_arena = OSARENA_INIT("linkfor", linkfor);
+osarena linkrev_arena = OSARENA_INIT("linkrev", linkrev);
 settings *pcs;
 prefix *root;
 prefix *anon_list = NULL;
@@ -74,6 +82,8 @@ bool fMute = fFalse; /* just show errors */
 bool fSuppress = fFalse; /* only output 3d file */
 static bool fLog = fFalse; /* stdout to .log file */
 static bool f_warnings_are_errors = fFalse; /* turn warnings into errors */
+int n_threads = 1; /* threads to use for solving */
+static char *fnm_profile = NULL; /* file to write --profile JSON to */
 
 nosurveylink *nosurveyhead;
 
@@ -89,6 +99,9 @@ bool fExplicitTitle = fFalse;
 char *fnm_output_base = NULL;
 int fnm_output_base_is_dir = 0;
 
+/* If non-NULL, the .3d file is being written to this temporary file. */
+char *fnm_3d_tmp = NULL;
+
 lrudlist * model = NULL;
 lrud ** next_lrud = NULL;
 
@@ -105,6 +118,12 @@ static const struct option long_opts[] = {
    {"warnings-are-errors", no_argument, 0, 'w'},
    {"log", no_argument, 0, 1},
    {"3d-version", required_argument, 0, 'v'},
+   {"threads", required_argument, 0, 3},
+   {"profile", optional_argument, 0, 4},
+   {"solve-cache", no_argument, 0, 5},
+#if WATCH_SUPPORTED
+   {"watch", no_argument, 0, 6},
+#endif
 #if OS_WIN32
    {"pause", no_argument, 0, 2},
 #endif
@@ -129,6 +148,18 @@ static struct help_msg help[] = {
    {HLP_ENCODELONG(6),	      /*log output to .log file*/170, 0},
    /* TRANSLATORS: --help output for cavern --3d-version option */
    {HLP_ENCODELONG(7),	      /*specify the 3d file format version to output*/171, 0},
+   /* TRANSLATORS: --help output for cavern --threads option */
+   {HLP_ENCODELONG(8),	      /*number of threads to use for solving the network*/523, 0},
+   /* TRANSLATORS: --help output for cavern --profile option.  JSON is a
+    * file format and PROFILE is the name of the option's optional argument,
+    * so neither should be translated. */
+   {HLP_ENCODELONG(9),	      /*report time and memory used by each phase (and write as JSON to PROFILE)*/524, 0},
+   /* TRANSLATORS: --help output for cavern --solve-cache option */
+   {HLP_ENCODELONG(10),	      /*reuse solutions for unchanged parts of the network from last time*/525, 0},
+#if WATCH_SUPPORTED
+   /* TRANSLATORS: --help output for cavern --watch option */
+   {HLP_ENCODELONG(11),	      /*process the data again whenever an input file changes*/526, 0},
+#endif
  /*{'z',			"set optimizations for network reduction"},*/
    {0, 0, 0}
 };
@@ -196,8 +227,9 @@ main(int argc, char **argv)
    pcs->max_declination = -HUGE_VAL;
 
    /* Set up root of prefix hierarchy */
-   root = osnew(prefix);
+   root = osarena_new(&prefix_arena, prefix);
    root->up = root->right = root->down = NULL;
+   root->child_index = NULL;
    root->stn = NULL;
    root->pos = NULL;
    root->ident = NULL;
@@ -273,6 +305,23 @@ main(int argc, char **argv)
        case 1:
 	 fLog = fTrue;
 	 break;
+       case 3:
+	 n_threads = cmdline_int_arg();
+	 if (n_threads < 1) n_threads = 1;
+	 break;
+       case 4:
+	 profiling = 1;
+	 osfree(fnm_profile); /* in case of multiple --profile options */
+	 fnm_profile = optarg ? osstrdup(optarg) : NULL;
+	 break;
+       case 5:
+	 solve_caching = 1;
+	 break;
+       case 6:
+	 /* Reuse the solutions for any parts of the network which haven't
+	  * changed since last time. */
+	 watching = solve_caching = 1;
+	 break;
 #if OS_WIN32
        case 2:
 	 atexit(pause_on_exit);
@@ -282,6 +331,13 @@ main(int argc, char **argv)
       }
    }
 
+   if (watching) {
+      watch_inputs(argv + optind);
+      /* We're now in a child process, so restart the clocks. */
+      tmUserStart = time(NULL);
+      tmCPUStart = clock();
+   }
+
    if (fLog) {
       char *fnm;
       if (!fnm_output_base) {
@@ -325,6 +381,7 @@ main(int argc, char **argv)
    atexit(delete_output_on_error);
 
    /* end of options, now process data files */
+   profile_begin(PROF_PARSE);
    while (argv[optind]) {
       const char *fnm = argv[optind];
 
@@ -343,6 +400,7 @@ main(int argc, char **argv)
       optind++;
    }
 
+   profile_end(PROF_PARSE, cStns);
    validate();
 
    report_declination(pcs);
@@ -351,14 +409,19 @@ main(int argc, char **argv)
    validate();
 
    /* close .3d file */
+   profile_begin(PROF_CLOSE_3D);
    if (!img_close(pimg)) {
       char *fnm = add_ext(fnm_output_base, EXT_SVX_3D);
       fatalerror(img_error2msg(img_error()), fnm);
    }
+   profile_end(PROF_CLOSE_3D, cLegs);
+   if (solve_caching) solve_cache_save();
    if (fhErrStat) safe_fclose(fhErrStat);
 
    out_current_action(msg(/*Calculating statistics*/120));
    if (!fMute) do_stats();
+   if (optimize & BITA('m')) osarena_report();
+   profile_report(fnm_profile);
    if (!fQuiet) {
       /* clock() typically wraps after 72 minutes, but there doesn't seem
        * to be a better way.  Still 72 minutes means some cave!
@@ -401,6 +464,14 @@ main(int argc, char **argv)
       printf(msg(/*There were %d warning(s).*/16), msg_warnings);
       putnl();
    }
+   if (fnm_3d_tmp) {
+      /* Now we know we're not going to delete the output, move the new .3d
+       * file into place. */
+      char *fnm = add_ext(fnm_output_base, EXT_SVX_3D);
+      if (rename(fnm_3d_tmp, fnm) != 0)
+	 fatalerror(/*Couldn’t write file “%s”*/402, fnm);
+      osfree(fnm);
+   }
    return EXIT_SUCCESS;
 }
 
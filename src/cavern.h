@@ -72,6 +72,7 @@ typedef double real; /* so we can change the precision used easily */
 
 extern char *fnm_output_base;
 extern int fnm_output_base_is_dir;
+extern char *fnm_3d_tmp;
 
 extern bool fExportUsed;
 
@@ -205,6 +206,8 @@ typedef real svar[6];
 /* station name */
 typedef struct Prefix {
    struct Prefix *up, *down, *right;
+   /* Index of children for a survey with lots of them, or NULL. */
+   struct Child_index *child_index;
    struct Node *stn;
    struct Pos *pos;
    const char *ident;
@@ -357,7 +360,11 @@ extern settings *pcs;
 extern prefix *root;
 extern prefix *anon_list;
 extern node *stnlist;
+/* Arenas for the station and leg structures (see osalloc.h) */
+extern osarena prefix_arena, ident_arena, node_arena;
+extern osarena linkfor_arena, linkrev_arena;
 extern unsigned long optimize;
+extern int n_threads;
 extern char * proj_str_out;
 extern PJ * pj_cached;
 
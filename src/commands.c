@@ -1018,9 +1018,9 @@ cmd_fix(void)
 	 }
 	 stn = StnFromPfx(fix_name);
 	 if (!fixed(stn)) {
-	    node *fixpt = osnew(node);
+	    node *fixpt = osarena_new(&node_arena, node);
 	    prefix *name;
-	    name = osnew(prefix);
+	    name = osarena_new(&prefix_arena, prefix);
 	    name->pos = osnew(pos);
 	    name->ident = NULL;
 	    name->shape = 0;
@@ -24,6 +24,10 @@
 
 #include <limits.h>
 #include <stdarg.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
 
 #include "debug.h"
 #include "cavern.h"
@@ -34,6 +38,7 @@
 #include "netbits.h"
 #include "netskel.h"
 #include "readval.h"
+#include "watch.h"
 #include "datain.h"
 #include "commands.h"
 #include "out.h"
@@ -80,17 +85,14 @@ void
 get_pos(filepos *fp)
 {
    fp->ch = ch;
-   fp->offset = ftell(file.fh);
-   if (fp->offset == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+   fp->offset = file_offset();
 }
 
 void
 set_pos(const filepos *fp)
 {
    ch = fp->ch;
-   if (fseek(file.fh, fp->offset, SEEK_SET) == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+   file.p = file.buf + fp->offset;
 }
 
 static void
@@ -121,17 +123,13 @@ error_list_parent_files(void)
 static void
 show_line(int col, int width)
 {
-   /* Rewind to beginning of line. */
-   long cur_pos = ftell(file.fh);
+   const char *p;
    int tabs = 0;
-   if (cur_pos < 0 || fseek(file.fh, file.lpos, SEEK_SET) == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
 
-   /* Read the whole line and write it out. */
+   /* Write out the whole line. */
    PUTC(' ', STDERR);
-   while (1) {
-      int c = GETC(file.fh);
-      /* Note: isEol() is true for EOF */
+   for (p = file.buf + file.lpos; p != file.end; ++p) {
+      int c = (unsigned char)*p;
       if (isEol(c)) break;
       if (c == '\t') ++tabs;
       PUTC(c, STDERR);
@@ -146,10 +144,9 @@ show_line(int col, int width)
       } else {
 	 /* Copy tabs from line, replacing other characters with spaces - this
 	  * means that the caret should line up correctly. */
-	 if (fseek(file.fh, file.lpos, SEEK_SET) == -1)
-	    fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+	 p = file.buf + file.lpos;
 	 while (--col) {
-	    int c = GETC(file.fh);
+	    int c = (p != file.end ? *p++ : ' ');
 	    if (c != '\t') c = ' ';
 	    PUTC(c, STDERR);
 	 }
@@ -161,35 +158,21 @@ show_line(int col, int width)
       }
       fputnl(STDERR);
    }
-
-   /* Revert to where we were. */
-   if (fseek(file.fh, cur_pos, SEEK_SET) == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
 }
 
 char*
 grab_line(void)
 {
-   /* Rewind to beginning of line. */
-   long cur_pos = ftell(file.fh);
+   const char *start = file.buf + file.lpos;
+   const char *q;
    char *p = NULL;
    int len = 0;
-   if (cur_pos < 0 || fseek(file.fh, file.lpos, SEEK_SET) == -1)
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
-
-   /* Read the whole line into a string. */
-   while (1) {
-      int c = GETC(file.fh);
-      /* Note: isEol() is true for EOF */
-      if (isEol(c)) break;
-      s_catchar(&p, &len, (char)c);
-   }
 
-   /* Revert to where we were. */
-   if (fseek(file.fh, cur_pos, SEEK_SET) == -1) {
-      free(p);
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
+   /* Copy the whole line into a string. */
+   for (q = start; q != file.end; ++q) {
+      if (isEol((unsigned char)*q)) break;
    }
+   if (q != start) s_catlen(&p, &len, start, (int)(q - start));
 
    return p;
 }
@@ -204,7 +187,7 @@ compile_v_report_fpos(int severity, long fpos, int en, va_list ap)
    if (fpos >= file.lpos)
       col = fpos - file.lpos - caret_width;
    v_report(severity, file.filename, file.line, col, en, ap);
-   if (file.fh) show_line(col, caret_width);
+   if (file.buf) show_line(col, caret_width);
 }
 
 static void
@@ -212,9 +195,9 @@ compile_v_report(int diag_flags, int en, va_list ap)
 {
    int severity = (diag_flags & DIAG_SEVERITY_MASK);
    if (diag_flags & (DIAG_COL|DIAG_BUF)) {
-      if (file.fh) {
+      if (file.buf) {
 	 if (diag_flags & DIAG_BUF) caret_width = strlen(buffer);
-	 compile_v_report_fpos(severity, ftell(file.fh), en, ap);
+	 compile_v_report_fpos(severity, file_offset(), en, ap);
 	 if (diag_flags & DIAG_BUF) caret_width = 0;
 	 if (diag_flags & DIAG_SKIP) skipline();
 	 return;
@@ -222,7 +205,7 @@ compile_v_report(int diag_flags, int en, va_list ap)
    }
    error_list_parent_files();
    v_report(severity, file.filename, file.line, 0, en, ap);
-   if (file.fh) {
+   if (file.buf) {
       if (diag_flags & DIAG_BUF) {
 	 show_line(0, strlen(buffer));
       } else {
@@ -284,11 +267,11 @@ compile_diagnostic(int diag_flags, int en, ...)
       char *p = NULL;
       int alloced = 0;
       skipblanks();
-      caret_width = ftell(file.fh);
+      caret_width = file_offset();
       read_string(&p, &alloced);
       osfree(p);
       /* We want to include any quotes, so can't use strlen(p). */
-      caret_width = ftell(file.fh) - caret_width;
+      caret_width = file_offset() - caret_width;
       compile_v_report(diag_flags|DIAG_COL, en, ap);
       caret_width = 0;
    } else {
@@ -434,7 +417,7 @@ process_eol(void)
       }
       if (ch == '\n') eolchar = ch;
    }
-   file.lpos = ftell(file.fh) - 1;
+   file.lpos = file_offset() - 1;
 }
 
 static bool
@@ -479,10 +462,10 @@ read_reading(reading r, bool f_optional)
 	q = Q_NULL; /* Suppress compiler warning */;
 	BUG("Unexpected case");
    }
-   LOC(r) = ftell(file.fh);
+   LOC(r) = file_offset();
    /* since we don't handle bearings in read_readings, it's never quadrant */
    VAL(r) = read_numeric_multi(f_optional, fFalse, &n_readings);
-   WID(r) = ftell(file.fh) - LOC(r);
+   WID(r) = file_offset() - LOC(r);
    VAR(r) = var(q);
    if (n_readings > 1) VAR(r) /= sqrt(n_readings);
 }
@@ -508,9 +491,9 @@ read_bearing_or_omit(reading r)
 	q = Q_NULL; /* Suppress compiler warning */;
 	BUG("Unexpected case");
    }
-   LOC(r) = ftell(file.fh);
+   LOC(r) = file_offset();
    VAL(r) = read_bearing_multi_or_omit(quadrants, &n_readings);
-   WID(r) = ftell(file.fh) - LOC(r);
+   WID(r) = file_offset() - LOC(r);
    VAR(r) = var(q);
    if (n_readings > 1) VAR(r) /= sqrt(n_readings);
 }
@@ -525,6 +508,46 @@ nextch_handling_eol(void)
    }
 }
 
+/* Read the whole of the file fh into memory for the lexer.  We use mmap() if
+ * we can, otherwise (e.g. for a pipe) we read it in large blocks.
+ */
+static void
+read_file_contents(parse *f, FILE *fh)
+{
+   char *buf;
+   size_t size = 0, alloc = 65536;
+#ifdef HAVE_MMAP
+   struct stat sb;
+   int fd = fileno(fh);
+   if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0 &&
+       (off_t)(size_t)sb.st_size == sb.st_size) {
+      void *p = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+	 f->buf = f->p = p;
+	 f->end = f->buf + (size_t)sb.st_size;
+	 f->mapped = fTrue;
+	 return;
+      }
+   }
+#endif
+   buf = osmalloc(alloc);
+   while (1) {
+      size_t n = fread(buf + size, 1, alloc - size, fh);
+      size += n;
+      if (size < alloc) {
+	 if (ferror(fh))
+	    fatalerror_in_file(f->filename, 0, /*Error reading file*/18);
+	 if (feof(fh)) break;
+	 continue;
+      }
+      alloc *= 2;
+      buf = osrealloc(buf, alloc);
+   }
+   f->buf = f->p = buf;
+   f->end = buf + size;
+   f->mapped = fFalse;
+}
+
 #define LITLEN(S) (sizeof(S"") - 1)
 #define has_ext(F,L,E) ((L) > LITLEN(E) + 1 &&\
 			(F)[(L) - LITLEN(E) - 1] == FNM_SEP_EXT &&\
@@ -560,10 +583,13 @@ data_file(const char *pth, const char *fnm)
 	 fmt = FMT_MAK;
       }
 
+      watch_note_input(filename);
+
       file_store = file;
-      if (file.fh) file.parent = &file_store;
-      file.fh = fh;
+      if (file.buf) file.parent = &file_store;
       file.filename = filename;
+      read_file_contents(&file, fh);
+      (void)fclose(fh);
       file.line = 1;
       file.lpos = 0;
       file.reported_where = fFalse;
@@ -574,7 +600,7 @@ data_file(const char *pth, const char *fnm)
 	    nextch();
 	    file.lpos = 3;
 	 } else {
-	    rewind(fh);
+	    file.p = file.buf + 1;
 	    ch = 0xef;
 	 }
       }
@@ -660,7 +686,7 @@ data_file(const char *pth, const char *fnm)
 #endif
 
    if (fmt == FMT_DAT) {
-      while (ch != EOF && !ferror(file.fh)) {
+      while (ch != EOF) {
 	 static const reading compass_order[] = {
 	    Fr, To, Tape, CompassDATComp, CompassDATClino,
 	    CompassDATLeft, CompassDATRight, CompassDATUp, CompassDATDown,
@@ -765,7 +791,7 @@ data_file(const char *pth, const char *fnm)
       pcs->ordering = NULL; /* Avoid free() of static array. */
       pop_settings();
    } else if (fmt == FMT_MAK) {
-      while (ch != EOF && !ferror(file.fh)) {
+      while (ch != EOF) {
 	 if (ch == '#') {
 	    /* include a file */
 	    int ch_store;
@@ -859,7 +885,7 @@ data_file(const char *pth, const char *fnm)
       }
       pop_settings();
    } else {
-      while (ch != EOF && !ferror(file.fh)) {
+      while (ch != EOF) {
 	 if (!process_non_data_line()) {
 	    f_export_ok = fFalse;
 	    switch (pcs->style) {
@@ -903,10 +929,14 @@ data_file(const char *pth, const char *fnm)
 
    pcs->begin_lineno = begin_lineno_store;
 
-   if (ferror(file.fh))
-      fatalerror_in_file(file.filename, 0, /*Error reading file*/18);
-
-   (void)fclose(file.fh);
+#ifdef HAVE_MMAP
+   if (file.mapped) {
+      munmap((void *)file.buf, file.end - file.buf);
+   } else
+#endif
+   {
+      osfree((void *)file.buf);
+   }
 
    file = file_store;
 
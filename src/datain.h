@@ -22,12 +22,14 @@
 # include <setjmp.h>
 #endif
 
-#include <stdio.h> /* for FILE */
-
 #include "message.h" /* for DIAG_WARN, etc */
 
 typedef struct parse {
-   FILE *fh;
+   /* The contents of the file being read (NULL if there isn't one), the next
+    * character to read, and the end of the contents. */
+   const char *buf, *p, *end;
+   /* True if buf was mapped with mmap(), false if it was read into memory. */
+   bool mapped;
    const char *filename;
    unsigned int line;
    long lpos;
@@ -42,7 +44,10 @@ extern int ch;
 extern parse file;
 extern bool f_export_ok;
 
-#define nextch() (ch = GETC(file.fh))
+#define nextch() (ch = (file.p != file.end ? (unsigned char)*file.p++ : EOF))
+
+/* Offset in the current file just after ch. */
+#define file_offset() ((long)(file.p - file.buf))
 
 typedef struct {
    long offset;
@@ -164,8 +164,10 @@ static const char *layer_name(int mask) {
     return "";
 }
 
-static double marker_size; /* for station markers */
-static double grid; /* grid spacing (or 0 for no grid) */
+/* These are set by each call to Export(), which ExportInParallel() makes in
+ * several threads at once. */
+static thread_local double marker_size; /* for station markers */
+static thread_local double grid; /* grid spacing (or 0 for no grid) */
 
 const int *
 ExportFilter::passes() const
@@ -561,68 +563,76 @@ Skencil::footer(void)
    }
 }
 
-typedef struct point {
-   img_point p;
-   const char *label;
-   struct point *next;
-} point;
+// Map from the exact coordinates of a station to its name.
+class StationNames {
+    struct Slot {
+	double x, y, z;
+	// One more than the offset of the name in names, or 0 if unused.
+	size_t name;
+    };
 
-#define HTAB_SIZE 0x2000
+    // Open addressing with linear probing.  The size is a power of two and
+    // at most half the slots are used.
+    vector<Slot> slots;
 
-static point **htab;
+    size_t used = 0;
 
-static void
-set_name(const img_point *p, const char *s)
-{
-   int hash;
-   point *pt;
-   union {
-      char data[sizeof(int) * 3];
-      int x[3];
-   } u;
-
-   u.x[0] = (int)(p->x * 100);
-   u.x[1] = (int)(p->y * 100);
-   u.x[2] = (int)(p->z * 100);
-   hash = (hash_data(u.data, sizeof(int) * 3) & (HTAB_SIZE - 1));
-   for (pt = htab[hash]; pt; pt = pt->next) {
-      if (pt->p.x == p->x && pt->p.y == p->y && pt->p.z == p->z) {
-	 /* already got name for these coordinates */
-	 /* FIXME: what about multiple names for the same station? */
-	 return;
-      }
-   }
+    // The names, each nul-terminated.
+    string names;
 
-   pt = osnew(point);
-   pt->label = osstrdup(s);
-   pt->p = *p;
-   pt->next = htab[hash];
-   htab[hash] = pt;
+    // -0.0 compares equal to 0.0 but has different bits.
+    static double canonical(double v) { return v == 0.0 ? 0.0 : v; }
 
-   return;
-}
+    size_t find_slot(double x, double y, double z) const {
+	double key[3] = { x, y, z };
+	size_t mask = slots.size() - 1;
+	size_t i = hash64_data(key, sizeof(key)) & mask;
+	while (slots[i].name) {
+	    const Slot& slot = slots[i];
+	    if (slot.x == x && slot.y == y && slot.z == z) break;
+	    i = (i + 1) & mask;
+	}
+	return i;
+    }
 
-static const char *
-find_name(const img_point *p)
-{
-   int hash;
-   point *pt;
-   union {
-      char data[sizeof(int) * 3];
-      int x[3];
-   } u;
-   wxASSERT(p);
-
-   u.x[0] = (int)(p->x * 100);
-   u.x[1] = (int)(p->y * 100);
-   u.x[2] = (int)(p->z * 100);
-   hash = (hash_data(u.data, sizeof(int) * 3) & (HTAB_SIZE - 1));
-   for (pt = htab[hash]; pt; pt = pt->next) {
-      if (pt->p.x == p->x && pt->p.y == p->y && pt->p.z == p->z)
-	 return pt->label;
-   }
-   return "?";
-}
+    void grow() {
+	vector<Slot> old(slots.empty() ? 1024 : slots.size() * 2);
+	swap(old, slots);
+	for (const Slot& slot : old) {
+	    if (slot.name) slots[find_slot(slot.x, slot.y, slot.z)] = slot;
+	}
+    }
+
+  public:
+    // If there's already a name for these coordinates, keep it.
+    void set(const img_point* p, const char* s) {
+	// FIXME: what about multiple names for the same station?
+	if ((used + 1) * 2 > slots.size()) grow();
+	double x = canonical(p->x);
+	double y = canonical(p->y);
+	double z = canonical(p->z);
+	Slot& slot = slots[find_slot(x, y, z)];
+	if (slot.name) return;
+	slot.x = x;
+	slot.y = y;
+	slot.z = z;
+	slot.name = names.size() + 1;
+	names += s;
+	names += '\0';
+	++used;
+    }
+
+    // Returns "?" if there's no name for these coordinates.  The returned
+    // pointer is only valid until the next call to set().
+    const char* find(const img_point* p) const {
+	if (used == 0) return "?";
+	const Slot& slot = slots[find_slot(canonical(p->x),
+					   canonical(p->y),
+					   canonical(p->z))];
+	if (!slot.name) return "?";
+	return names.data() + slot.name - 1;
+    }
+};
 
 class SVG : public ExportFilter {
     const char * to_close;
@@ -631,6 +641,7 @@ class SVG : public ExportFilter {
     /* for station labels */
     double text_height;
     char pending[1024];
+    StationNames station_names;
 
   public:
     SVG(double scale, double text_height_)
@@ -671,8 +682,6 @@ SVG::header(const char * title, const char *, time_t,
 {
    const char *unit = "mm";
    const double SVG_MARGIN = 5.0; // In units of "unit".
-   htab = (point **)osmalloc(HTAB_SIZE * ossizeof(point *));
-   for (size_t i = 0; i < HTAB_SIZE; ++i) htab[i] = NULL;
    fprintf(fh, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
    double width = (max_x - min_x) * factor + SVG_MARGIN * 2;
    double height = (max_y - min_y) * factor + SVG_MARGIN * 2;
@@ -746,7 +755,7 @@ SVG::label(const img_point *p, const char *s, bool fSurface, int)
 	   p->x * factor, p->y * -factor);
    html_escape(fh, s);
    fputs("</text>\n", fh);
-   set_name(p, s);
+   station_names.set(p, s);
 }
 
 void
@@ -754,7 +763,8 @@ SVG::cross(const img_point *p, bool fSurface)
 {
    (void)fSurface; /* unused */
    fprintf(fh, "<circle id=\"%s\" cx=\"%.3f\" cy=\"%.3f\" r=\"%.3f\"/>\n",
-	   find_name(p), p->x * factor, p->y * -factor, marker_size * SQRT_2);
+	   station_names.find(p), p->x * factor, p->y * -factor,
+	   marker_size * SQRT_2);
    fprintf(fh, "<path d=\"M%.3f %.3fL%.3f %.3fM%.3f %.3fL%.3f %.3f\"/>\n",
 	   p->x * factor - marker_size, p->y * -factor - marker_size,
 	   p->x * factor + marker_size, p->y * -factor + marker_size,
@@ -829,6 +839,8 @@ SVG::footer()
 class PLT : public ExportFilter {
     string escaped;
 
+    StationNames station_names;
+
     const char * find_name_plt(const img_point *p);
 
     double min_N, max_N, min_E, max_E, min_A, max_A;
@@ -858,8 +870,6 @@ PLT::header(const char *title, const char *, time_t,
 {
    // FIXME: allow survey to be set from aven somehow!
    const char *survey = NULL;
-   htab = (point **)osmalloc(HTAB_SIZE * ossizeof(point *));
-   for (size_t i = 0; i < HTAB_SIZE; ++i) htab[i] = NULL;
    /* Survex is E, N, Alt - PLT file is N, E, Alt */
    min_N = min_y / METRES_PER_FOOT;
    max_N = max_y / METRES_PER_FOOT;
@@ -894,7 +904,7 @@ PLT::line(const img_point *p1, const img_point *p, unsigned flags, bool fPending
 const char *
 PLT::find_name_plt(const img_point *p)
 {
-    const char * s = find_name(p);
+    const char * s = station_names.find(p);
     escaped.resize(0);
 
     // PLT format can't handle spaces or control characters, so escape them
@@ -922,7 +932,7 @@ void
 PLT::label(const img_point *p, const char *s, bool fSurface, int)
 {
    (void)fSurface; /* unused */
-   set_name(p, s);
+   station_names.set(p, s);
 }
 
 void
@@ -1340,16 +1350,17 @@ transform_point(const Point& pos, const Vector3* pre_offset,
     p->z = -(z * SINT + tmp * COST);
 }
 
-bool
-Export(const wxString &fnm_out, const wxString &title,
-       const wxString &datestamp,
-       const Model& model,
-       const SurveyFilter* filter,
-       double pan, double tilt, int show_mask, export_format format,
-       double grid_, double text_height, double marker_size_,
-       double scale)
+// The locale is per-process, so this has to be set up by the caller.
+static bool
+export_in_c_locale(const wxString &fnm_out, const wxString &title,
+		   const wxString &datestamp,
+		   const Model& model,
+		   const SurveyFilter* filter,
+		   double pan, double tilt, int show_mask,
+		   export_format format,
+		   double grid_, double text_height, double marker_size_,
+		   double scale)
 {
-   UseNumericCLocale dummy;
    int fPendingMove = 0;
    img_point p, p1;
    const int *pass;
@@ -1462,10 +1473,11 @@ Export(const wxString &fnm_out, const wxString &title,
 		}
 	    }
 	}
-	list<LabelInfo*>::const_iterator pos = model.GetLabels();
-	list<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
+	vector<LabelInfo*>::const_iterator pos = model.GetLabels();
+	vector<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
 	for ( ; pos != end; ++pos) {
-	    if (filter && !filter->CheckVisible((*pos)->GetText()))
+	    if (filter && !filter->CheckVisible((*pos)->get_text_data(),
+						(*pos)->get_text_length()))
 		continue;
 
 	    transform_point(**pos, pre_offset, COS, SIN, COST, SINT, &p);
@@ -1565,10 +1577,11 @@ Export(const wxString &fnm_out, const wxString &title,
 	  }
       }
       if (pass_mask & (STNS|LABELS|ENTS|FIXES|EXPORTS)) {
-	  list<LabelInfo*>::const_iterator pos = model.GetLabels();
-	  list<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
+	  vector<LabelInfo*>::const_iterator pos = model.GetLabels();
+	  vector<LabelInfo*>::const_iterator end = model.GetLabelsEnd();
 	  for ( ; pos != end; ++pos) {
-	      if (filter && !filter->CheckVisible((*pos)->GetText()))
+	      if (filter && !filter->CheckVisible((*pos)->get_text_data(),
+						  (*pos)->get_text_length()))
 		  continue;
 
 	      transform_point(**pos, pre_offset, COS, SIN, COST, SINT, &p);
@@ -1659,7 +1672,98 @@ Export(const wxString &fnm_out, const wxString &title,
    }
    filt->footer();
    delete filt;
-   osfree(htab);
-   htab = NULL;
    return true;
 }
+
+bool
+Export(const wxString &fnm_out, const wxString &title,
+       const wxString &datestamp,
+       const Model& model,
+       const SurveyFilter* filter,
+       double pan, double tilt, int show_mask, export_format format,
+       double grid_, double text_height, double marker_size_,
+       double scale)
+{
+   UseNumericCLocale dummy;
+   return export_in_c_locale(fnm_out, title, datestamp, model, filter,
+			     pan, tilt, show_mask, format,
+			     grid_, text_height, marker_size_, scale);
+}
+
+// The parameters which are the same for every job in ExportInParallel().
+struct ExportSettings {
+    const wxString & title;
+    const wxString & datestamp;
+    const Model & model;
+    const SurveyFilter * filter;
+    double grid, text_height, marker_size, scale;
+};
+
+static void
+run_export_job(ExportJob & job, const ExportSettings & s)
+{
+   try {
+      job.ok = export_in_c_locale(job.fnm_out, s.title, s.datestamp,
+				  s.model, s.filter,
+				  job.pan, job.tilt, job.show_mask, job.format,
+				  s.grid, s.text_height, s.marker_size,
+				  s.scale);
+   } catch (const wxString & m) {
+      job.error = m;
+   }
+}
+
+// Runs one job of ExportInParallel() in a worker thread.
+class ExportThread : public wxThread {
+    ExportJob & job;
+    const ExportSettings & settings;
+
+  public:
+    ExportThread(ExportJob & job_, const ExportSettings & settings_)
+	: wxThread(wxTHREAD_JOINABLE), job(job_), settings(settings_) { }
+
+    ExitCode Entry() {
+	run_export_job(job, settings);
+	return 0;
+    }
+};
+
+void
+ExportInParallel(vector<ExportJob> & jobs,
+		 const wxString &title,
+		 const wxString &datestamp,
+		 const Model& model,
+		 const SurveyFilter* filter,
+		 double grid_, double text_height, double marker_size_,
+		 double scale)
+{
+   UseNumericCLocale dummy;
+   ExportSettings settings = {
+      title, datestamp, model, filter,
+      grid_, text_height, marker_size_, scale
+   };
+
+   // The tubes are set up lazily on first use, so do that before any
+   // threads might try to.
+   model.prepare_tubes();
+
+   vector<ExportThread*> threads;
+   for (size_t i = 0; i + 1 < jobs.size(); ++i) {
+      ExportThread* thread = new ExportThread(jobs[i], settings);
+      if (thread->Run() != wxTHREAD_NO_ERROR) {
+	 // Couldn't start a thread, so just do this job here.
+	 delete thread;
+	 run_export_job(jobs[i], settings);
+	 continue;
+      }
+      threads.push_back(thread);
+   }
+
+   // Do the last job in this thread.
+   if (!jobs.empty()) run_export_job(jobs.back(), settings);
+
+   for (ExportThread* thread : threads) {
+      thread->Wait();
+      delete thread;
+   }
+}
@@ -25,6 +25,8 @@
 
 #include "wx.h"
 
+#include <vector>
+
 class Model;
 class SurveyFilter;
 
@@ -90,4 +92,26 @@ bool Export(const wxString &fnm_out, const wxString &title,
 	    double grid_, double text_height_, double marker_size_,
 	    double scale);
 
+// One output for ExportInParallel().
+struct ExportJob {
+    wxString fnm_out;
+    export_format format;
+    int show_mask;
+    double pan, tilt;
+
+    // Set by ExportInParallel() to whether fnm_out was written.
+    bool ok = false;
+    // Set by ExportInParallel() if an error was reported by throwing.
+    wxString error;
+};
+
+// Export the model to each of jobs, each in its own thread.
+void ExportInParallel(std::vector<ExportJob>& jobs,
+		      const wxString &title,
+		      const wxString &datestamp,
+		      const Model& model,
+		      const SurveyFilter* filter,
+		      double grid_, double text_height, double marker_size_,
+		      double scale);
+
 #endif
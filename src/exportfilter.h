@@ -38,7 +38,11 @@ class ExportFilter {
     virtual const int * passes() const;
     virtual bool fopen(const wxString& fnm_out) {
 	fh = wxFopen(fnm_out.fn_str(), wxT("wb"));
-	return (fh != NULL);
+	if (!fh) return false;
+	// Filters mostly write small pieces at a time, so a large buffer
+	// saves a lot of calls to write().
+	setvbuf(fh, NULL, _IOFBF, 65536);
+	return true;
     }
     virtual void header(const char* title,
 			const char* datestamp_string,
@@ -59,7 +59,11 @@ typedef struct POINT {
    char fDone;
    char fBroken;
    splay *splays;
+   /* Legs attached to this point (chained via fr_next or to_next). */
+   struct LEG *legs;
    struct POINT *next;
+   /* Next point in the same point_htab bucket. */
+   struct POINT *hash_next;
 } point;
 
 typedef struct LEG {
@@ -70,6 +74,8 @@ typedef struct LEG {
    char broken;
    int flags;
    struct LEG *next;
+   /* Next leg in fr->legs and to->legs respectively. */
+   struct LEG *fr_next, *to_next;
 } leg;
 
 /* Values for leg.broken: */
@@ -81,9 +87,9 @@ typedef struct LEG {
 #define ERIGHT 0x02
 #define ESWAP  0x04
 
-static point headpoint = {{0, 0, 0}, 0, NULL, 0, 0, 0, 0, NULL, NULL};
+static point headpoint = {{0, 0, 0}, 0, NULL, 0, 0, 0, 0, NULL, NULL, NULL, NULL};
 
-static leg headleg = {NULL, NULL, NULL, 0, 0, 0, 0, NULL};
+static leg headleg = {NULL, NULL, NULL, 0, 0, 0, 0, NULL, NULL, NULL};
 
 static img *pimg_out;
 
@@ -121,11 +127,64 @@ find_prefix(const char *prefix)
    return p->label;
 }
 
+/* Hash table of points keyed on their coordinates, so find_point() doesn't
+ * need to scan every point.  The size is always a power of 2. */
+static point **point_htab = NULL;
+static size_t point_htab_size = 0;
+static size_t n_points = 0;
+
+#define POINT_HTAB_INITIAL_SIZE 0x2000
+
+static unsigned
+hash_point(const img_point *pt)
+{
+   /* Adding 0.0 turns -0.0 into 0.0, as they compare equal so must hash the
+    * same. */
+   double c[3];
+   const unsigned char *b = (const unsigned char *)c;
+   unsigned h = 2166136261u;
+   size_t i;
+   c[0] = pt->x + 0.0;
+   c[1] = pt->y + 0.0;
+   c[2] = pt->z + 0.0;
+   /* FNV-1a */
+   for (i = 0; i < sizeof(c); i++) h = (h ^ b[i]) * 16777619u;
+   return h;
+}
+
+static void
+grow_point_htab(void)
+{
+   size_t new_size = point_htab_size ? point_htab_size * 2 :
+				       POINT_HTAB_INITIAL_SIZE;
+   point **new_htab = osmalloc(ossizeof(point*) * new_size);
+   size_t i;
+   for (i = 0; i < new_size; ++i) new_htab[i] = NULL;
+   for (i = 0; i < point_htab_size; ++i) {
+      point *p = point_htab[i];
+      while (p) {
+	 point *next = p->hash_next;
+	 size_t h = hash_point(&p->p) & (new_size - 1);
+	 p->hash_next = new_htab[h];
+	 new_htab[h] = p;
+	 p = next;
+      }
+   }
+   osfree(point_htab);
+   point_htab = new_htab;
+   point_htab_size = new_size;
+}
+
 static point *
 find_point(const img_point *pt)
 {
    point *p;
-   for (p = headpoint.next; p != NULL; p = p->next) {
+   size_t h;
+
+   if (n_points >= point_htab_size) grow_point_htab();
+
+   h = hash_point(pt) & (point_htab_size - 1);
+   for (p = point_htab[h]; p != NULL; p = p->hash_next) {
       if (pt->x == p->p.x && pt->y == p->p.y && pt->z == p->p.z) {
 	 return p;
       }
@@ -140,8 +199,12 @@ find_point(const img_point *pt)
    p->fDone = 0;
    p->fBroken = 0;
    p->splays = NULL;
+   p->legs = NULL;
    p->next = headpoint.next;
    headpoint.next = p;
+   p->hash_next = point_htab[h];
+   point_htab[h] = p;
+   ++n_points;
    return p;
 }
 
@@ -164,6 +227,23 @@ add_leg(point *fr, point *to, const char *prefix, int flags)
    l->broken = 0;
    l->flags = flags;
    headleg.next = l;
+   /* Add to the front of each point's list of legs, so each list is in the
+    * same order as the headleg list. */
+   l->fr_next = fr->legs;
+   fr->legs = l;
+   if (to != fr) {
+      l->to_next = to->legs;
+      to->legs = l;
+   } else {
+      l->to_next = NULL;
+   }
+}
+
+/* The leg after l in the list of legs attached to p. */
+static leg *
+next_leg(const leg *l, const point *p)
+{
+   return l->fr == p ? l->fr_next : l->to_next;
 }
 
 static void
@@ -802,7 +882,7 @@ static void
 do_stn(point *p, double X, const char *prefix, int dir, int labOnly,
        double odx, double ody)
 {
-   leg *l, *lp;
+   leg *l;
    double dX;
    const stn *s;
    int odir = dir;
@@ -834,13 +914,11 @@ do_stn(point *p, double X, const char *prefix, int dir, int labOnly,
     * follow legs in the same survey for the first pass.
     */
    for (try_all = 0; try_all != 2; ++try_all) {
-      lp = &headleg;
-      for (l = lp->next; l; lp = l, l = lp->next) {
+      for (l = p->legs; l; l = next_leg(l, p)) {
 	 dir = odir;
 	 if (l->fDone) {
-	    /* this case happens iff a recursive call causes the next leg to be
-	     * removed, leaving our next pointing to a leg which has been dealt
-	     * with... */
+	    /* Either we've already followed this leg, or we arrived here along
+	     * it, or a recursive call has followed it from the other end. */
 	    continue;
 	 }
 	 if (!try_all && l->prefix != prefix) {
@@ -858,7 +936,6 @@ do_stn(point *p, double X, const char *prefix, int dir, int labOnly,
 	    continue;
 	 }
 	 if (l->broken & break_flag) continue;
-	 lp->next = l->next;
 	 /* adjust direction of extension if necessary */
 	 dir = adjust_direction(dir, p->dir);
 	 dir = adjust_direction(dir, l->dir);
@@ -887,7 +964,6 @@ do_stn(point *p, double X, const char *prefix, int dir, int labOnly,
 	 l->fDone = 1;
 	 /* l->broken doesn't have break_flag set as we checked that above. */
 	 do_stn(p2, X2, l->prefix, dir, l->broken, dx, dy);
-	 l = lp;
 	 if (--order == 0) return;
       }
    }
@@ -28,6 +28,7 @@
 
 #include <assert.h>
 #include <float.h>
+#include <algorithm>
 
 #include "aven.h"
 #include "aventreectrl.h"
@@ -70,6 +71,10 @@ const Double LOG_LEN_MAX = 1.5;
 // labels.
 const unsigned int QUANTISE_FACTOR = 2;
 
+// With an orthographic view, labels are placed over an area extending this
+// fraction of the window size beyond each edge.
+const double LABEL_MARGIN = 0.25;
+
 #include "avenpal.h"
 
 static const int INDICATOR_BOX_SIZE = 60;
@@ -96,8 +101,8 @@ static const gla_colour SEL_COLOUR = col_WHITE;
 // by error for legs not in a loop.
 static const gla_colour NODATA_COLOUR = col_LIGHT_GREY_2;
 
-// Number of entries across and down the hit-test grid:
-#define HITTEST_SIZE 20
+// How surface legs are shown if they would otherwise be faded.
+static const unsigned SHOW_DASHED_AND_FADED = unsigned(-1);
 
 // How close the pointer needs to be to a station to be considered:
 #define MEASURE_THRESHOLD 7
@@ -128,6 +133,7 @@ GfxCore::GfxCore(MainFrm* parent, wxWindow* parent_win, GUIControl* control) :
     m_ScaleBarWidth(0),
     m_Control(control),
     m_LabelGrid(NULL),
+    m_LabelGridSize(0),
     m_Parent(parent),
     m_DoneFirstShow(false),
     m_TiltAngle(0.0),
@@ -163,8 +169,6 @@ GfxCore::GfxCore(MainFrm* parent, wxWindow* parent_win, GUIControl* control) :
     m_Percent(false),
     m_HitTestDebug(false),
     m_RenderStats(false),
-    m_PointGrid(NULL),
-    m_HitTestGridValid(false),
     m_here(NULL),
     m_there(NULL),
     presentation_mode(0),
@@ -177,8 +181,6 @@ GfxCore::GfxCore(MainFrm* parent, wxWindow* parent_win, GUIControl* control) :
     last_time(0),
     n_tris(0)
 {
-    AddQuad = &GfxCore::AddQuadrilateralDepth;
-    AddPoly = &GfxCore::AddPolylineDepth;
     wxConfigBase::Get()->Read(wxT("metric"), &m_Metric, true);
     wxConfigBase::Get()->Read(wxT("degrees"), &m_Degrees, true);
     wxConfigBase::Get()->Read(wxT("percent"), &m_Percent, false);
@@ -195,8 +197,6 @@ GfxCore::GfxCore(MainFrm* parent, wxWindow* parent_win, GUIControl* control) :
 GfxCore::~GfxCore()
 {
     TryToFreeArrays();
-
-    delete[] m_PointGrid;
 }
 
 void GfxCore::TryToFreeArrays()
@@ -204,6 +204,7 @@ void GfxCore::TryToFreeArrays()
     // Free up any memory allocated for arrays.
     delete[] m_LabelGrid;
     m_LabelGrid = NULL;
+    m_LabelGridSize = 0;
 }
 
 //
@@ -218,7 +219,6 @@ void GfxCore::Initialise(bool same_file)
 
     m_DoneFirstShow = false;
 
-    m_HitTestGridValid = false;
     m_here = NULL;
     m_there = NULL;
 
@@ -231,7 +231,8 @@ void GfxCore::Initialise(bool same_file)
 
     m_HaveData = true;
 
-    // Clear any cached OpenGL lists which depend on the data.
+    // Clear any cached geometry and OpenGL lists which depend on the data.
+    InvalidateGeometry();
     InvalidateList(LIST_SCALE_BAR);
     InvalidateList(LIST_DEPTH_KEY);
     InvalidateList(LIST_DATE_KEY);
@@ -286,13 +287,14 @@ void GfxCore::FirstShow()
     GLACanvas::FirstShow();
 
     const unsigned int quantise(GetFontSize() / QUANTISE_FACTOR);
-    list<LabelInfo*>::iterator pos = m_Parent->GetLabelsNC();
+    vector<LabelInfo*>::iterator pos = m_Parent->GetLabelsNC();
     while (pos != m_Parent->GetLabelsNCEnd()) {
 	LabelInfo* label = *pos++;
 	// Calculate and set the label width for use when plotting
 	// none-overlapping labels.
 	int ext_x;
-	GLACanvas::GetTextExtent(label->GetText(), &ext_x, NULL);
+	GLACanvas::GetTextExtent(label->get_text_data(),
+				 label->get_text_length(), &ext_x, NULL);
 	label->set_width(unsigned(ext_x) / quantise + 1);
     }
 
@@ -312,7 +314,6 @@ void GfxCore::SetScale(Double scale)
     }
 
     m_Scale = scale;
-    m_HitTestGridValid = false;
     if (m_here && m_here == &temp_here) SetHere();
 
     GLACanvas::SetScale(scale);
@@ -393,22 +394,26 @@ void GfxCore::OnPaint(wxPaintEvent&)
 	// Set up model transformation matrix.
 	SetDataTransform();
 
+	if (m_Legs || m_Tubes || m_Surface) {
+	    FindLeafSizes();
+	}
+
 	if (m_Legs || m_Tubes) {
 	    if (m_Tubes) {
 		EnableSmoothPolygons(true); // FIXME: allow false for wireframe view
-		DrawList(LIST_TUBES);
+		DrawModelList(LIST_TUBES);
 		DisableSmoothPolygons();
 	    }
 
 	    // Draw the underground legs.  Do this last so that anti-aliasing
 	    // works over polygons.
 	    SetColour(col_GREEN);
-	    DrawList(LIST_UNDERGROUND_LEGS);
+	    DrawModelList(LIST_UNDERGROUND_LEGS);
 	}
 
 	if (m_Surface) {
 	    // Draw the surface legs.
-	    DrawList(LIST_SURFACE_LEGS);
+	    DrawModelList(LIST_SURFACE_LEGS);
 	}
 
 	if (m_BoundingBox) {
@@ -461,36 +466,9 @@ void GfxCore::OnPaint(wxPaintEvent&)
 	}
 
 	if (m_HitTestDebug) {
-	    // Show the hit test grid bucket sizes...
-	    SetColour(m_HitTestGridValid ? col_LIGHT_GREY : col_DARK_GREY);
-	    if (m_PointGrid) {
-		for (int i = 0; i != HITTEST_SIZE; ++i) {
-		    int x = (GetXSize() + 1) * i / HITTEST_SIZE + 2;
-		    for (int j = 0; j != HITTEST_SIZE; ++j) {
-			int square = i + j * HITTEST_SIZE;
-			unsigned long bucket_size = m_PointGrid[square].size();
-			if (bucket_size) {
-			    int y = (GetYSize() + 1) * (HITTEST_SIZE - 1 - j) / HITTEST_SIZE;
-			    DrawIndicatorText(x, y, wxString::Format(wxT("%lu"), bucket_size));
-			}
-		    }
-		}
-	    }
-
-	    EnableDashedLines();
-	    BeginLines();
-	    for (int i = 0; i != HITTEST_SIZE; ++i) {
-		int x = (GetXSize() + 1) * i / HITTEST_SIZE;
-		PlaceIndicatorVertex(x, 0);
-		PlaceIndicatorVertex(x, GetYSize());
-	    }
-	    for (int j = 0; j != HITTEST_SIZE; ++j) {
-		int y = (GetYSize() + 1) * (HITTEST_SIZE - 1 - j) / HITTEST_SIZE;
-		PlaceIndicatorVertex(0, y);
-		PlaceIndicatorVertex(GetXSize(), y);
-	    }
-	    EndLines();
-	    DisableDashedLines();
+	    // Show the size and position of each leaf of the station index
+	    // which is in view.
+	    DrawStationIndexLeaves();
 	}
 
 	long now = timer.Time();
@@ -961,75 +939,185 @@ void GfxCore::Draw2dIndicators()
     }
 }
 
-void GfxCore::NattyDrawNames()
+bool GfxCore::PlacedLabelsStillValid(double origin_x, double origin_y) const
 {
-    // Draw station names, without overlapping.
+    // With a perspective view, translating changes the relative positions of
+    // the labels on screen.
+    if (!m_PlacedLabelsValid || GetPerspective()) return false;
+
+    if (GetXSize() != m_PlacedXSize || GetYSize() != m_PlacedYSize ||
+	GetFontSize() != m_PlacedFontSize) {
+	return false;
+    }
+
+    // Only the last column of the modelview matrix changes when the view is
+    // translated.
+    if (memcmp(GetModelviewMatrix(), m_PlacedModelview,
+	       sizeof(m_PlacedModelview)) != 0 ||
+	memcmp(GetProjectionMatrix(), m_PlacedProjection,
+	       sizeof(m_PlacedProjection)) != 0) {
+	return false;
+    }
+
+    // Labels were only placed a limited distance beyond the edges of the
+    // window.
+    return fabs(origin_x - m_PlacedOriginX) <= GetXSize() * LABEL_MARGIN &&
+	   fabs(origin_y - m_PlacedOriginY) <= GetYSize() * LABEL_MARGIN;
+}
+
+void GfxCore::PlaceLabels(double origin_x, double origin_y, double margin)
+{
+    // Decide which station names to draw, without overlapping.
+
+    m_PlacedLabels.clear();
+    m_PlacedLabelsValid = false;
+    const BVH& index = m_Parent->GetStationIndex();
+    if (index.empty()) return;
 
     const unsigned int quantise(GetFontSize() / QUANTISE_FACTOR);
-    const unsigned int quantised_x = GetXSize() / quantise;
-    const unsigned int quantised_y = GetYSize() / quantise;
+    const unsigned int margin_x = unsigned(GetXSize() * margin) / quantise;
+    const unsigned int margin_y = unsigned(GetYSize() * margin) / quantise;
+    const unsigned int quantised_x = GetXSize() / quantise + 2 * margin_x;
+    const unsigned int quantised_y = GetYSize() / quantise + 2 * margin_y;
     const size_t buffer_size = quantised_x * quantised_y;
 
-    if (!m_LabelGrid) m_LabelGrid = new char[buffer_size];
+    if (buffer_size > m_LabelGridSize) {
+	delete[] m_LabelGrid;
+	m_LabelGrid = new char[buffer_size];
+	m_LabelGridSize = buffer_size;
+    }
 
     memset((void*) m_LabelGrid, 0, buffer_size);
 
-    const SurveyFilter* filter = m_Parent->GetTreeFilter();
-    list<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
-    for ( ; label != m_Parent->GetLabelsEnd(); ++label) {
-	if (m_Splays == SHOW_HIDE && (*label)->IsSplayEnd())
-	    continue;
-
-	if (!((m_Surface && (*label)->IsSurface()) ||
-	      (m_Legs && (*label)->IsUnderground()) ||
-	      (!(*label)->IsSurface() && !(*label)->IsUnderground()))) {
-	    // if this station isn't to be displayed, skip to the next
-	    // (last case is for stns with no legs attached)
+    // Find the labels in parts of the model which are in view.  Marking
+    // them and then scanning the marks puts them in order of priority more
+    // cheaply than sorting when much of the model is in view.
+    vector<const LabelInfo*> in_view(m_Parent->GetLabelsEnd() -
+				     m_Parent->GetLabels());
+    vector<unsigned> todo(1, 0);
+    while (!todo.empty()) {
+	const BVH::Node& node = index.GetNode(todo.back());
+	todo.pop_back();
+	if (GetScreenSize(node.box, margin) < 0) continue;
+	if (node.child) {
+	    todo.push_back(node.child);
+	    todo.push_back(node.child + 1);
 	    continue;
 	}
-	if (filter && !filter->CheckVisible((*label)->GetText()))
-	    continue;
+	const BVH::Leaf& leaf = index.GetLeaf(node.leaf);
+	for (unsigned i = leaf.first; i != leaf.first + leaf.count; ++i) {
+	    const LabelInfo* label = m_Parent->GetIndexedStation(index.GetItem(i));
+	    in_view[label->get_plot_order()] = label;
+	}
+    }
+    vector<const LabelInfo*> candidates;
+    for (const LabelInfo* label : in_view) {
+	if (label) candidates.push_back(label);
+    }
 
-	double x, y, z;
+    // Apply a small shift so that translating the view doesn't make which
+    // labels are displayed change as the resulting twinkling effect is
+    // distracting.
+    double grid_x = origin_x - floor(origin_x / quantise) * quantise;
+    double grid_y = origin_y - floor(origin_y / quantise) * quantise;
+    grid_x -= double(margin_x * quantise);
+    grid_y -= double(margin_y * quantise);
 
-	Transform(**label, &x, &y, &z);
-	// Check if the label is behind us (in perspective view).
-	if (z <= 0.0 || z >= 1.0) continue;
+    const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    // Highlighted stations are found by the user searching for them, so
+    // label these in preference to anything else.
+    int first_pass = m_Parent->GetNumHighlightedPts() ? 0 : 1;
+    for (int pass = first_pass; pass != 2; ++pass) {
+	for (const LabelInfo* label : candidates) {
+	    if (label->IsHighLighted() != (pass == 0))
+		continue;
 
-	// Apply a small shift so that translating the view doesn't make which
-	// labels are displayed change as the resulting twinkling effect is
-	// distracting.
-	double tx, ty, tz;
-	Transform(Vector3(), &tx, &ty, &tz);
-	tx -= floor(tx / quantise) * quantise;
-	ty -= floor(ty / quantise) * quantise;
+	    if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
+		continue;
+
+	    if (!((m_Surface && label->IsSurface()) ||
+		  (m_Legs && label->IsUnderground()) ||
+		  (!label->IsSurface() && !label->IsUnderground()))) {
+		// if this station isn't to be displayed, skip to the next
+		// (last case is for stns with no legs attached)
+		continue;
+	    }
+	    if (filter && !filter->CheckVisible(label->get_text_data(),
+						label->get_text_length()))
+		continue;
+
+	    double x, y, z;
 
-	tx = x - tx;
-	if (tx < 0) continue;
+	    Transform(*label, &x, &y, &z);
+	    // Check if the label is behind us (in perspective view).
+	    if (z <= 0.0 || z >= 1.0) continue;
 
-	ty = y - ty;
-	if (ty < 0) continue;
+	    double tx = x - grid_x;
+	    if (tx < 0) continue;
 
-	unsigned int iy = unsigned(ty) / quantise;
-	if (iy >= quantised_y) continue;
-	unsigned int width = (*label)->get_width();
-	unsigned int ix = unsigned(tx) / quantise;
-	if (ix + width >= quantised_x) continue;
+	    double ty = y - grid_y;
+	    if (ty < 0) continue;
 
-	char * test = m_LabelGrid + ix + iy * quantised_x;
-	if (memchr(test, 1, width)) continue;
+	    unsigned int iy = unsigned(ty) / quantise;
+	    if (iy >= quantised_y) continue;
+	    unsigned int width = label->get_width();
+	    unsigned int ix = unsigned(tx) / quantise;
+	    if (ix + width >= quantised_x) continue;
+
+	    char * test = m_LabelGrid + ix + iy * quantised_x;
+	    if (memchr(test, 1, width)) continue;
+
+	    m_PlacedLabels.push_back({label, x - origin_x, y - origin_y});
+
+	    if (iy > QUANTISE_FACTOR) iy = QUANTISE_FACTOR;
+	    test -= quantised_x * iy;
+	    iy += 4;
+	    while (--iy && test < m_LabelGrid + buffer_size) {
+		memset(test, 1, width);
+		test += quantised_x;
+	    }
+	}
+    }
+
+    m_PlacedLabelsValid = true;
+    memcpy(m_PlacedModelview, GetModelviewMatrix(), sizeof(m_PlacedModelview));
+    memcpy(m_PlacedProjection, GetProjectionMatrix(),
+	   sizeof(m_PlacedProjection));
+    m_PlacedXSize = GetXSize();
+    m_PlacedYSize = GetYSize();
+    m_PlacedFontSize = GetFontSize();
+    m_PlacedOriginX = origin_x;
+    m_PlacedOriginY = origin_y;
+}
+
+void GfxCore::NattyDrawNames()
+{
+    // Draw station names, without overlapping.
+
+    double origin_x, origin_y, origin_z;
+    Transform(Vector3(), &origin_x, &origin_y, &origin_z);
+
+    if (!PlacedLabelsStillValid(origin_x, origin_y)) {
+	// With an orthographic view, also place labels a little way beyond
+	// the edges of the window so the placements can be reused while the
+	// view is dragged around.
+	PlaceLabels(origin_x, origin_y, GetPerspective() ? 0.0 : LABEL_MARGIN);
+    }
+
+    const double quantise(GetFontSize() / QUANTISE_FACTOR);
+    for (const PlacedLabel& placed : m_PlacedLabels) {
+	double x = origin_x + placed.x;
+	double y = origin_y + placed.y;
+	if (x >= GetXSize() || x + placed.label->get_width() * quantise < 0 ||
+	    y - GetFontSize() >= GetYSize() || y + GetFontSize() < 0) {
+	    // Off screen.
+	    continue;
+	}
 
 	x += 3;
 	y -= GetFontSize() / 2;
-	DrawIndicatorText((int)x, (int)y, (*label)->GetText());
-
-	if (iy > QUANTISE_FACTOR) iy = QUANTISE_FACTOR;
-	test -= quantised_x * iy;
-	iy += 4;
-	while (--iy && test < m_LabelGrid + buffer_size) {
-	    memset(test, 1, width);
-	    test += quantised_x;
-	}
+	DrawIndicatorText((int)x, (int)y, placed.label->get_text_data(),
+			  placed.label->get_text_length());
     }
 }
 
@@ -1037,7 +1125,7 @@ void GfxCore::SimpleDrawNames()
 {
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
     // Draw all station names, without worrying about overlaps
-    list<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator label = m_Parent->GetLabels();
     for ( ; label != m_Parent->GetLabelsEnd(); ++label) {
 	if (m_Splays == SHOW_HIDE && (*label)->IsSplayEnd())
 	    continue;
@@ -1049,7 +1137,8 @@ void GfxCore::SimpleDrawNames()
 	    // (last case is for stns with no legs attached)
 	    continue;
 	}
-	if (filter && !filter->CheckVisible((*label)->GetText()))
+	if (filter && !filter->CheckVisible((*label)->get_text_data(),
+					    (*label)->get_text_length()))
 	    continue;
 
 	double x, y, z;
@@ -1060,7 +1149,8 @@ void GfxCore::SimpleDrawNames()
 
 	x += 3;
 	y -= GetFontSize() / 2;
-	DrawIndicatorText((int)x, (int)y, (*label)->GetText());
+	DrawIndicatorText((int)x, (int)y, (*label)->get_text_data(),
+			  (*label)->get_text_length());
     }
 }
 
@@ -1473,10 +1563,22 @@ void GfxCore::DrawScaleBar()
     DrawIndicatorText(SCALE_BAR_OFFSET_X * GetContentScaleFactor() + size - text_width, text_y, str);
 }
 
-bool GfxCore::CheckHitTestGrid(const wxPoint& point, bool centre)
+void GfxCore::DrawStationIndexLeaves()
 {
-    if (Animating()) return false;
+    const BVH& index = m_Parent->GetStationIndex();
+    for (unsigned i = 0; i != index.GetNumLeaves(); ++i) {
+	const BoundingBox& box = index.GetLeafBox(i);
+	if (GetScreenSize(box) < 0) continue;
+	double x, y, z;
+	Transform(box.centre(), &x, &y, &z);
+	if (z <= 0.0 || z >= 1.0) continue;
+	DrawIndicatorText(int(x), int(y),
+			  wxString::Format(wxT("%u"), index.GetLeaf(i).count));
+    }
+}
 
+bool GfxCore::CheckHitTest(const wxPoint& point, bool centre)
+{
     if (point.x < 0 || point.x >= GetXSize() ||
 	point.y < 0 || point.y >= GetYSize()) {
 	return false;
@@ -1484,37 +1586,75 @@ bool GfxCore::CheckHitTestGrid(const wxPoint& point, bool centre)
 
     SetDataTransform();
 
-    if (!m_HitTestGridValid) CreateHitTestGrid();
-
-    int grid_x = point.x * HITTEST_SIZE / (GetXSize() + 1);
-    int grid_y = point.y * HITTEST_SIZE / (GetYSize() + 1);
+    // Transform() gives y measured up from the bottom of the window.
+    const double point_x = point.x;
+    const double point_y = GetYSize() - point.y;
+    const double threshold = sqrt(double(sqrd_measure_threshold));
 
-    LabelInfo *best = NULL;
+    const LabelInfo *best = NULL;
     int dist_sqrd = sqrd_measure_threshold;
-    int square = grid_x + grid_y * HITTEST_SIZE;
-    list<LabelInfo*>::iterator iter = m_PointGrid[square].begin();
+    const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    const BVH& index = m_Parent->GetStationIndex();
+    vector<unsigned> todo;
+    if (!index.empty()) todo.push_back(0);
+    while (!todo.empty()) {
+	const BVH::Node& node = index.GetNode(todo.back());
+	todo.pop_back();
+	if (!BoxNearPoint(node.box, point_x, point_y, threshold)) continue;
+	if (node.child) {
+	    todo.push_back(node.child);
+	    todo.push_back(node.child + 1);
+	    continue;
+	}
 
-    while (iter != m_PointGrid[square].end()) {
-	LabelInfo *pt = *iter++;
+	const BVH::Leaf& leaf = index.GetLeaf(node.leaf);
+	for (unsigned i = leaf.first; i != leaf.first + leaf.count; ++i) {
+	    const LabelInfo* pt = m_Parent->GetIndexedStation(index.GetItem(i));
 
-	double cx, cy, cz;
+	    if (m_Splays == SHOW_HIDE && pt->IsSplayEnd())
+		continue;
 
-	Transform(*pt, &cx, &cy, &cz);
+	    if (!((m_Surface && pt->IsSurface()) ||
+		  (m_Legs && pt->IsUnderground()) ||
+		  (!pt->IsSurface() && !pt->IsUnderground()))) {
+		// if this station isn't to be displayed, skip to the next
+		// (last case is for stns with no legs attached)
+		continue;
+	    }
+
+	    if (filter && !filter->CheckVisible(pt->get_text_data(),
+						pt->get_text_length()))
+		continue;
 
-	cy = GetYSize() - cy;
+	    double cx, cy, cz;
 
-	int dx = point.x - int(cx);
-	int ds = dx * dx;
-	if (ds >= dist_sqrd) continue;
-	int dy = point.y - int(cy);
+	    Transform(*pt, &cx, &cy, &cz);
+	    // Check if the station is behind us (in perspective view).
+	    if (cz <= 0.0 || cz >= 1.0) continue;
 
-	ds += dy * dy;
-	if (ds >= dist_sqrd) continue;
+	    // Quickly reject stations which are too far away (and could
+	    // overflow the integer calculations below).
+	    if (fabs(cx - point_x) > threshold + 1.0 ||
+		fabs(cy - point_y) > threshold + 1.0) continue;
 
-	dist_sqrd = ds;
-	best = pt;
+	    cy = GetYSize() - cy;
 
-	if (ds == 0) break;
+	    int dx = point.x - int(cx);
+	    int ds = dx * dx;
+	    if (ds > dist_sqrd) continue;
+	    int dy = point.y - int(cy);
+
+	    ds += dy * dy;
+	    if (ds > dist_sqrd) continue;
+	    // If two stations are equally close, prefer the one which would
+	    // be labelled in preference.
+	    if (ds == dist_sqrd &&
+		(!best || pt->get_plot_order() > best->get_plot_order()))
+		continue;
+
+	    dist_sqrd = ds;
+	    best = pt;
+	}
     }
 
     if (best) {
@@ -1565,8 +1705,6 @@ void GfxCore::OnSize(wxSizeEvent& event)
     if (m_DoneFirstShow) {
 	TryToFreeArrays();
 
-	m_HitTestGridValid = false;
-
 	ForceRefresh();
     }
 }
@@ -1879,12 +2017,13 @@ void GfxCore::HighlightSurvey()
     double y_min = HUGE_VAL, y_max = -HUGE_VAL;
     double xpy_min = HUGE_VAL, xpy_max = -HUGE_VAL;
     double xmy_min = HUGE_VAL, xmy_max = -HUGE_VAL;
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     double x_tot = 0, y_tot = 0;
     size_t c = 0;
     while (pos != m_Parent->GetLabelsEnd()) {
 	const LabelInfo* label = *pos++;
-	if (!filter.CheckVisible(label->GetText()))
+	if (!filter.CheckVisible(label->get_text_data(),
+				 label->get_text_length()))
 	    continue;
 
 	double x, y, z;
@@ -1968,11 +2107,12 @@ void GfxCore::ZoomToSurvey(const wxString& survey) {
     Double zmin = DBL_MAX;
     Double zmax = -DBL_MAX;
 
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     while (pos != m_Parent->GetLabelsEnd()) {
 	LabelInfo* label = *pos++;
 
-	if (!filter.CheckVisible(label->GetText()))
+	if (!filter.CheckVisible(label->get_text_data(),
+				 label->get_text_length()))
 	    continue;
 
 	if (label->GetX() < xmin) xmin = label->GetX();
@@ -2011,57 +2151,6 @@ void GfxCore::SetThere(const LabelInfo * p)
     RefreshLine(m_here, old, m_there);
 }
 
-void GfxCore::CreateHitTestGrid()
-{
-    if (!m_PointGrid) {
-	// Initialise hit-test grid.
-	m_PointGrid = new list<LabelInfo*>[HITTEST_SIZE * HITTEST_SIZE];
-    } else {
-	// Clear hit-test grid.
-	for (int i = 0; i < HITTEST_SIZE * HITTEST_SIZE; i++) {
-	    m_PointGrid[i].clear();
-	}
-    }
-
-    const SurveyFilter* filter = m_Parent->GetTreeFilter();
-    // Fill the grid.
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
-    list<LabelInfo*>::const_iterator end = m_Parent->GetLabelsEnd();
-    while (pos != end) {
-	LabelInfo* label = *pos++;
-
-	if (m_Splays == SHOW_HIDE && label->IsSplayEnd())
-	    continue;
-
-	if (!((m_Surface && label->IsSurface()) ||
-	      (m_Legs && label->IsUnderground()) ||
-	      (!label->IsSurface() && !label->IsUnderground()))) {
-	    // if this station isn't to be displayed, skip to the next
-	    // (last case is for stns with no legs attached)
-	    continue;
-	}
-
-	if (filter && !filter->CheckVisible(label->GetText()))
-	    continue;
-
-	// Calculate screen coordinates.
-	double cx, cy, cz;
-	Transform(*label, &cx, &cy, &cz);
-	if (cx < 0 || cx >= GetXSize()) continue;
-	if (cy < 0 || cy >= GetYSize()) continue;
-
-	cy = GetYSize() - cy;
-
-	// On-screen, so add to hit-test grid...
-	int grid_x = int(cx * HITTEST_SIZE / (GetXSize() + 1));
-	int grid_y = int(cy * HITTEST_SIZE / (GetYSize() + 1));
-
-	m_PointGrid[grid_x + grid_y * HITTEST_SIZE].push_back(label);
-    }
-
-    m_HitTestGridValid = true;
-}
-
 //
 //  Methods for controlling the orientation of the survey
 //
@@ -2077,7 +2166,6 @@ void GfxCore::TurnCave(Double angle)
 	m_PanAngle += 360.0;
     }
 
-    m_HitTestGridValid = false;
     if (m_here && m_here == &temp_here) SetHere();
 
     SetRotation(m_PanAngle, m_TiltAngle);
@@ -2115,7 +2203,6 @@ void GfxCore::TiltCave(Double tilt_angle)
 	m_TiltAngle += tilt_angle;
     }
 
-    m_HitTestGridValid = false;
     if (m_here && m_here == &temp_here) SetHere();
 
     SetRotation(m_PanAngle, m_TiltAngle);
@@ -2124,7 +2211,6 @@ void GfxCore::TiltCave(Double tilt_angle)
 void GfxCore::TranslateCave(int dx, int dy)
 {
     AddTranslationScreenCoordinates(dx, dy);
-    m_HitTestGridValid = false;
 
     if (m_here && m_here == &temp_here) SetHere();
 
@@ -2530,7 +2616,6 @@ void GfxCore::ToggleFlag(bool* flag, int update)
     } else if (update == UPDATE_BLOBS_AND_CROSSES) {
 	UpdateBlobs();
 	InvalidateList(LIST_CROSSES);
-	m_HitTestGridValid = false;
     }
     ForceRefresh();
 }
@@ -2580,7 +2665,6 @@ void GfxCore::ClearTreeSelection()
 void GfxCore::CentreOn(const Point &p)
 {
     SetTranslation(-p);
-    m_HitTestGridValid = false;
 
     ForceRefresh();
 }
@@ -2641,7 +2725,7 @@ void GfxCore::GenerateList(unsigned int l)
 	    BeginCrosses();
 	    SetColour(col_LIGHT_GREY);
 	    const SurveyFilter* filter = m_Parent->GetTreeFilter();
-	    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+	    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
 	    while (pos != m_Parent->GetLabelsEnd()) {
 		const LabelInfo* label = *pos++;
 
@@ -2653,7 +2737,8 @@ void GfxCore::GenerateList(unsigned int l)
 		    (!label->IsSurface() && !label->IsUnderground())) {
 		    // Check if this station should be displayed
 		    // (last case above is for stns with no legs attached)
-		    if (filter && !filter->CheckVisible(label->GetText()))
+		    if (filter && !filter->CheckVisible(label->get_text_data(),
+							label->get_text_length()))
 			continue;
 		    DrawCross(label->GetX(), label->GetY(), label->GetZ());
 		}
@@ -2683,91 +2768,308 @@ void GfxCore::ToggleSmoothShading()
     ForceRefresh();
 }
 
+// Draw leg clusters less than this many pixels across on screen using a
+// simplified version of each traverse.
+const double LEG_LOD_PIXELS = 64.0;
+
+// Don't draw tube clusters less than this many pixels across on screen.
+const double TUBE_LOD_PIXELS = 2.0;
+
 void GfxCore::GenerateDisplayList(bool surface)
 {
-    unsigned surf_or_not = surface ? img_FLAG_SURFACE : 0;
     // Generate the display list for the surface or underground legs.
-    for (int f = 0; f != 8; ++f) {
-	if ((f & img_FLAG_SURFACE) != surf_or_not) continue;
-	const unsigned SHOW_DASHED_AND_FADED = unsigned(-1);
-	unsigned style = SHOW_NORMAL;
-	if ((f & img_FLAG_SPLAY) && m_Splays != SHOW_NORMAL) {
-	    style = m_Splays;
-	} else if (f & img_FLAG_DUPLICATE) {
-	    style = m_Dupes;
-	}
-	if (f & img_FLAG_SURFACE) {
-	    if (style == SHOW_FADED) {
-		style = SHOW_DASHED_AND_FADED;
-	    } else {
-		style = SHOW_DASHED;
-	    }
-	}
+    DrawGeometry(PrepareLegGeometry(surface), false, NULL);
+}
 
-	switch (style) {
-	    case SHOW_HIDE:
-		continue;
-	    case SHOW_FADED:
-		SetAlpha(0.4);
-		break;
-	    case SHOW_DASHED:
-		EnableDashedLines();
-		break;
-	    case SHOW_DASHED_AND_FADED:
-		SetAlpha(0.4);
-		EnableDashedLines();
-		break;
-	}
+ColourableGeometry& GfxCore::PrepareLegGeometry(bool surface)
+{
+    ColourableGeometry& geom =
+	surface ? m_SurfaceLegGeometry : m_UndergroundLegGeometry;
+    if (!geom.valid) GenerateLegGeometry(geom, surface);
 
-	void (GfxCore::* add_poly)(const traverse&);
+    if (!geom.coloured) {
+	int colour_by = m_ColourBy;
 	if (surface) {
-	    switch (m_ColourBy) {
+	    switch (colour_by) {
 		case COLOUR_BY_ERROR:
 		case COLOUR_BY_H_ERROR:
 		case COLOUR_BY_V_ERROR:
-		    add_poly = &GfxCore::AddPolylineError;
-		    break;
 		case COLOUR_BY_STYLE:
-		    add_poly = &GfxCore::AddPolylineStyle;
 		    break;
 		default:
-		    add_poly = &GfxCore::AddPolyline;
+		    colour_by = COLOUR_BY_NONE;
+	    }
+	}
+	ColourGeometry(geom, colour_by);
+    }
+    return geom;
+}
+
+void GfxCore::DrawGeometry(const ColourableGeometry& geom, bool tubes,
+			   const vector<double>* leaf_sizes)
+{
+    // If leaf_sizes is NULL draw everything in full detail, otherwise skip
+    // clusters which are out of view and use the coarse version of those
+    // which are small on screen.
+    BeginVertexArray(geom.vertices);
+    bool dashed = false;
+    for (const ColourableGeometry::Cluster& cluster : geom.clusters) {
+	size_t first_run = cluster.first_run;
+	size_t end_run = cluster.end_run;
+	if (leaf_sizes) {
+	    double size = (*leaf_sizes)[cluster.leaf];
+	    if (size < 0) continue;
+	    if (size < geom.coarse_below) {
+		first_run = cluster.first_coarse_run;
+		end_run = cluster.end_coarse_run;
+	    }
+	}
+	for (size_t r = first_run; r != end_run; ++r) {
+	    const ColourableGeometry::Run& run = geom.runs[r];
+	    if (tubes) {
+		DrawQuadrilateralsFromArray(run.first, run.count);
+		continue;
+	    }
+	    unsigned style = GetLegStyle(run.flags);
+	    if (style == SHOW_HIDE) continue;
+	    bool want_dashed = (style == SHOW_DASHED ||
+				style == SHOW_DASHED_AND_FADED);
+	    if (want_dashed != dashed) {
+		if (want_dashed) {
+		    EnableDashedLines();
+		} else {
+		    DisableDashedLines();
+		}
+		dashed = want_dashed;
 	    }
+	    DrawPolylineFromArray(run.first, run.count);
+	}
+    }
+    if (dashed) DisableDashedLines();
+    EndVertexArray();
+}
+
+void GfxCore::FindLeafSizes()
+{
+    // Find how big each leaf of the spatial index appears in the current
+    // view, walking down from the root so that we don't need to look at the
+    // leaves under a node which is out of view.
+    const BVH& index = m_Parent->GetSpatialIndex();
+    m_LeafSizes.assign(index.GetNumLeaves(), -1.0);
+    if (index.empty()) return;
+    vector<unsigned> stack(1, 0);
+    while (!stack.empty()) {
+	const BVH::Node& node = index.GetNode(stack.back());
+	stack.pop_back();
+	double size = GetScreenSize(node.box);
+	if (size < 0) continue;
+	if (node.child) {
+	    stack.push_back(node.child);
+	    stack.push_back(node.child + 1);
 	} else {
-	    add_poly = AddPoly;
+	    m_LeafSizes[node.leaf] = size;
 	}
+    }
+}
 
-	const SurveyFilter* filter = m_Parent->GetTreeFilter();
-	list<traverse>::const_iterator trav = m_Parent->traverses_begin(f, filter);
-	list<traverse>::const_iterator tend = m_Parent->traverses_end(f);
-	while (trav != tend) {
-	    (this->*add_poly)(*trav);
-	    trav = m_Parent->traverses_next(f, filter, trav);
+void GfxCore::DrawModelList(drawing_list l)
+{
+    // Drawing a cached list is faster than drawing from the vertex arrays,
+    // so only bypass it if skipping the parts of the model which are out
+    // of view and simplifying those which are small on screen at least
+    // halves the number of vertices to draw.
+    vector<ColourableGeometry*> geoms;
+    switch (l) {
+	case LIST_UNDERGROUND_LEGS:
+	    geoms.push_back(&PrepareLegGeometry(false));
+	    break;
+	case LIST_SURFACE_LEGS:
+	    geoms.push_back(&PrepareLegGeometry(true));
+	    break;
+	case LIST_TUBES:
+	    PrepareTubeGeometry();
+	    for (ColourableGeometry& geom : m_TubeGeometry) {
+		geoms.push_back(&geom);
+	    }
+	    break;
+	default:
+	    break;
+    }
+
+    size_t n_vertices = 0, n_to_draw = 0;
+    for (const ColourableGeometry* geom : geoms) {
+	for (const ColourableGeometry::Cluster& cluster : geom->clusters) {
+	    n_vertices += cluster.n_vertices;
+	    double size = m_LeafSizes[cluster.leaf];
+	    if (size < 0) continue;
+	    if (size < geom->coarse_below) {
+		n_to_draw += cluster.n_coarse_vertices;
+	    } else {
+		n_to_draw += cluster.n_vertices;
+	    }
 	}
+    }
 
-	switch (style) {
-	    case SHOW_FADED:
-		SetAlpha(1.0);
-		break;
-	    case SHOW_DASHED:
-		DisableDashedLines();
-		break;
-	    case SHOW_DASHED_AND_FADED:
-		DisableDashedLines();
-		SetAlpha(1.0);
-		break;
+    if (n_to_draw * 2 > n_vertices) {
+	DrawList(l);
+	return;
+    }
+
+    for (const ColourableGeometry* geom : geoms) {
+	DrawGeometry(*geom, l == LIST_TUBES, &m_LeafSizes);
+    }
+}
+
+void ColourableGeometry::AddCluster(unsigned leaf, size_t first_run,
+				    size_t first_coarse_run)
+{
+    if (first_run == runs.size()) return;
+    Cluster cluster;
+    cluster.leaf = leaf;
+    cluster.first_run = first_run;
+    cluster.end_run = first_coarse_run;
+    cluster.first_coarse_run = first_coarse_run;
+    cluster.end_coarse_run = runs.size();
+    cluster.n_vertices = 0;
+    for (size_t r = first_run; r != first_coarse_run; ++r) {
+	cluster.n_vertices += runs[r].count;
+    }
+    cluster.n_coarse_vertices = 0;
+    for (size_t r = first_coarse_run; r != runs.size(); ++r) {
+	cluster.n_coarse_vertices += runs[r].count;
+    }
+    clusters.push_back(cluster);
+}
+
+// Generates the passage tubes for some leaves of the spatial index in a
+// worker thread.
+class SkinPassageThread : public wxThread {
+    const GfxCore& gfx;
+
+    ColourableGeometry& geom;
+
+    const vector<const vector<XSect>*>& tubes;
+
+    const vector<size_t>& leaf_start;
+
+    unsigned leaf_begin, leaf_end;
+
+  public:
+    SkinPassageThread(const GfxCore& gfx_, ColourableGeometry& geom_,
+		      const vector<const vector<XSect>*>& tubes_,
+		      const vector<size_t>& leaf_start_,
+		      unsigned leaf_begin_, unsigned leaf_end_)
+	: wxThread(wxTHREAD_JOINABLE), gfx(gfx_), geom(geom_),
+	  tubes(tubes_), leaf_start(leaf_start_),
+	  leaf_begin(leaf_begin_), leaf_end(leaf_end_) { }
+
+    ExitCode Entry() {
+	gfx.SkinPassages(geom, tubes, leaf_start, leaf_begin, leaf_end);
+	return 0;
+    }
+};
+
+// Don't bother starting a thread for fewer cross-sections than this.
+const size_t MIN_XSECTS_PER_THREAD = 1000;
+
+void GfxCore::GenerateTubeGeometry()
+{
+    // Collect the tubes in the order of the leaves of the spatial index they
+    // are in, so that the tubes in leaf l are tubes[leaf_start[l]] to
+    // tubes[leaf_start[l + 1] - 1].
+    const BVH& index = m_Parent->GetSpatialIndex();
+    unsigned n_leaves = index.GetNumLeaves();
+    vector<const vector<XSect>*> tubes;
+    vector<size_t> leaf_start;
+    vector<size_t> leaf_xsects;
+    size_t n_xsects = 0;
+    for (unsigned leaf = 0; leaf != n_leaves; ++leaf) {
+	leaf_start.push_back(tubes.size());
+	const BVH::Leaf& items = index.GetLeaf(leaf);
+	size_t xsects = 0;
+	for (unsigned i = items.first; i != items.first + items.count; ++i) {
+	    const vector<XSect>* tube =
+		m_Parent->GetIndexedTube(index.GetItem(i));
+	    if (tube) {
+		tubes.push_back(tube);
+		xsects += tube->size();
+	    }
+	}
+	leaf_xsects.push_back(xsects);
+	n_xsects += xsects;
+    }
+    leaf_start.push_back(tubes.size());
+
+    // Each tube is skinned independently, so split the leaves into parts
+    // with roughly equal numbers of cross-sections and generate each part in
+    // a separate thread.
+    size_t n_parts = max(wxThread::GetCPUCount(), 1);
+    n_parts = min(n_parts, max(n_xsects / MIN_XSECTS_PER_THREAD, size_t(1)));
+    m_TubeGeometry.clear();
+    m_TubeGeometry.resize(n_parts);
+
+    vector<SkinPassageThread*> threads;
+    unsigned begin = 0;
+    size_t xsects_done = 0;
+    for (size_t part = 0; part != n_parts; ++part) {
+	unsigned end = begin;
+	size_t xsects_target = n_xsects * (part + 1) / n_parts;
+	while (end != n_leaves && xsects_done < xsects_target) {
+	    xsects_done += leaf_xsects[end];
+	    ++end;
 	}
+	if (part + 1 == n_parts) end = n_leaves;
+
+	ColourableGeometry& geom = m_TubeGeometry[part];
+	geom.coarse_below = TUBE_LOD_PIXELS;
+	SkinPassageThread* thread = NULL;
+	if (part + 1 != n_parts) {
+	    // Generate the last part in this thread.
+	    thread = new SkinPassageThread(*this, geom, tubes, leaf_start,
+					   begin, end);
+	    if (thread->Run() != wxTHREAD_NO_ERROR) {
+		delete thread;
+		thread = NULL;
+	    }
+	}
+	if (thread) {
+	    threads.push_back(thread);
+	} else {
+	    SkinPassages(geom, tubes, leaf_start, begin, end);
+	}
+	begin = end;
+    }
+
+    for (SkinPassageThread* thread : threads) {
+	thread->Wait();
+	delete thread;
+    }
+
+    for (ColourableGeometry& geom : m_TubeGeometry) {
+	geom.valid = true;
+    }
+    m_TubeGeometryValid = true;
+}
+
+void GfxCore::PrepareTubeGeometry()
+{
+    if (!m_TubeGeometryValid) GenerateTubeGeometry();
+
+    for (ColourableGeometry& geom : m_TubeGeometry) {
+	if (geom.coloured) continue;
+	// FIXME: support tube colouring by style
+	ColourGeometry(geom,
+		       m_ColourBy == COLOUR_BY_STYLE ? COLOUR_BY_NONE : m_ColourBy);
     }
 }
 
 void GfxCore::GenerateDisplayListTubes()
 {
     // Generate the display list for the tubes.
-    list<vector<XSect>>::iterator trav = m_Parent->tubes_begin();
-    list<vector<XSect>>::iterator tend = m_Parent->tubes_end();
-    while (trav != tend) {
-	SkinPassage(*trav);
-	++trav;
+    PrepareTubeGeometry();
+
+    for (const ColourableGeometry& geom : m_TubeGeometry) {
+	DrawGeometry(geom, true, NULL);
     }
 }
 
@@ -3238,7 +3540,7 @@ void GfxCore::GenerateBlobsDisplayList()
     // Plot blobs.
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
     gla_colour prev_col = col_BLACK; // not a colour used for blobs
-    list<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
+    vector<LabelInfo*>::const_iterator pos = m_Parent->GetLabels();
     BeginBlobs();
     while (pos != m_Parent->GetLabelsEnd()) {
 	const LabelInfo* label = *pos++;
@@ -3259,7 +3561,8 @@ void GfxCore::GenerateBlobsDisplayList()
 	    // (last case is for stns with no legs attached)
 	    continue;
 	}
-	if (filter && !filter->CheckVisible(label->GetText()))
+	if (filter && !filter->CheckVisible(label->get_text_data(),
+					    label->get_text_length()))
 	    continue;
 
 	gla_colour col;
@@ -3328,16 +3631,9 @@ void GfxCore::DrawIndicators()
     }
 }
 
-void GfxCore::PlaceVertexWithColour(const Vector3 & v,
-				    glaTexCoord tex_x, glaTexCoord tex_y,
-				    Double factor)
+GLAPen GfxCore::GetDepthPen(Double z) const
 {
-    SetColour(col_WHITE, factor);
-    PlaceVertex(v, tex_x, tex_y);
-}
-
-void GfxCore::SetDepthColour(Double z, Double factor) {
-    // Set the drawing colour based on the altitude.
+    // Return the colour to use for the altitude.
     Double z_ext = m_Parent->GetDepthExtent();
 
     z -= m_Parent->GetDepthMin();
@@ -3346,8 +3642,7 @@ void GfxCore::SetDepthColour(Double z, Double factor) {
     if (z > z_ext) z = z_ext;
 
     if (z == 0) {
-	SetColour(GetPen(0), factor);
-	return;
+	return GetPen(0);
     }
 
     assert(z_ext > 0.0);
@@ -3374,26 +3669,13 @@ void GfxCore::SetDepthColour(Double z, Double factor) {
 
 	pen1.Interpolate(pen2, into_band);
     }
-    SetColour(pen1, factor);
+    return pen1;
 }
 
-void GfxCore::PlaceVertexWithDepthColour(const Vector3 &v, Double factor)
-{
-    SetDepthColour(v.GetZ(), factor);
-    PlaceVertex(v);
-}
-
-void GfxCore::PlaceVertexWithDepthColour(const Vector3 &v,
-					 glaTexCoord tex_x, glaTexCoord tex_y,
-					 Double factor)
-{
-    SetDepthColour(v.GetZ(), factor);
-    PlaceVertex(v, tex_x, tex_y);
-}
-
-void GfxCore::SplitLineAcrossBands(int band, int band2,
-				   const Vector3 &p, const Vector3 &q,
-				   Double factor)
+void GfxCore::SplitLineAcrossBands(ColourableGeometry& geom,
+				   const ColourableGeometry::VertexInfo& info,
+				   int band, int band2,
+				   const Vector3 &p, const Vector3 &q)
 {
     const int step = (band < band2) ? 1 : -1;
     for (int i = band; i != band2; i += step) {
@@ -3409,7 +3691,7 @@ void GfxCore::SplitLineAcrossBands(int band, int band2,
 	const Double x = p.GetX() + t * (q.GetX() - p.GetX());
 	const Double y = p.GetY() + t * (q.GetY() - p.GetY());
 
-	PlaceVertexWithDepthColour(Vector3(x, y, z), factor);
+	geom.AddVertex(Vector3(x, y, z), info);
     }
 }
 
@@ -3417,7 +3699,7 @@ void GfxCore::SplitPolyAcrossBands(vector<vector<Split>>& splits,
 				   int band, int band2,
 				   const Vector3 &p, const Vector3 &q,
 				   glaTexCoord ptx, glaTexCoord pty,
-				   glaTexCoord w, glaTexCoord h)
+				   glaTexCoord w, glaTexCoord h) const
 {
     const int step = (band < band2) ? 1 : -1;
     for (int i = band; i != band2; i += step) {
@@ -3470,79 +3752,183 @@ Double GfxCore::GetDepthBoundaryBetweenBands(int a, int b) const
     return (z_ext * band / (GetNumColourBands() - 1)) + m_Parent->GetDepthMin();
 }
 
-void GfxCore::AddPolyline(const traverse & centreline)
+static void
+SetSurveyColour(ColourableGeometry::VertexInfo& info, const char* p, size_t len)
 {
-    BeginPolyline();
-    SetColour(col_WHITE);
-    vector<PointInfo>::const_iterator i = centreline.begin();
-    PlaceVertex(*i);
-    ++i;
-    while (i != centreline.end()) {
-	PlaceVertex(*i);
-	++i;
-    }
-    EndPolyline();
+    // Set the colour based on hash of survey name.
+    int hash = hash_data(p, len);
+    wxImage::HSVValue hsv((hash & 0xff) / 256.0, (((hash >> 8) & 0x7f) | 0x80) / 256.0, 0.9);
+    wxImage::RGBValue rgb = wxImage::HSVtoRGB(hsv);
+    info.survey_rgb[0] = rgb.red;
+    info.survey_rgb[1] = rgb.green;
+    info.survey_rgb[2] = rgb.blue;
 }
 
-void GfxCore::AddPolylineShadow(const traverse & centreline)
+void GfxCore::GenerateLegGeometry(ColourableGeometry& geom, bool surface)
 {
-    BeginPolyline();
-    const double z = -0.5 * m_Parent->GetExtent().GetZ();
-    vector<PointInfo>::const_iterator i = centreline.begin();
-    PlaceVertex(i->GetX(), i->GetY(), z);
-    ++i;
-    while (i != centreline.end()) {
-	PlaceVertex(i->GetX(), i->GetY(), z);
-	++i;
+    // Generate the geometry for each leaf of the spatial index separately,
+    // so that we can skip leaves which are out of view.
+    geom.clear();
+    geom.coarse_below = LEG_LOD_PIXELS;
+    unsigned surf_or_not = surface ? img_FLAG_SURFACE : 0;
+    const SurveyFilter* filter = m_Parent->GetTreeFilter();
+    const BVH& index = m_Parent->GetSpatialIndex();
+    vector<pair<const traverse*, unsigned>> travs;
+    for (unsigned leaf = 0; leaf != index.GetNumLeaves(); ++leaf) {
+	travs.clear();
+	const BVH::Leaf& items = index.GetLeaf(leaf);
+	for (unsigned i = items.first; i != items.first + items.count; ++i) {
+	    unsigned flags;
+	    const traverse* trav =
+		m_Parent->GetIndexedTraverse(index.GetItem(i), flags);
+	    if (!trav || (flags & img_FLAG_SURFACE) != surf_or_not) continue;
+	    if (filter && !filter->CheckVisible(trav->name)) continue;
+	    travs.emplace_back(trav, flags);
+	}
+	// Group the traverses by flags, which means fewer changes of state
+	// when drawing.
+	stable_sort(travs.begin(), travs.end(),
+		    [](const pair<const traverse*, unsigned>& a,
+		       const pair<const traverse*, unsigned>& b) {
+			return a.second < b.second;
+		    });
+
+	size_t first_run = geom.runs.size();
+	for (auto& trav : travs) {
+	    AddPolyline(geom, *trav.first, trav.second);
+	}
+	// Simplifying to within this tolerance means the coarse version is
+	// within about a pixel of the full version when drawn.
+	double tolerance = index.GetLeafBox(leaf).diameter() / LEG_LOD_PIXELS;
+	size_t first_coarse_run = geom.runs.size();
+	for (auto& trav : travs) {
+	    AddPolyline(geom, *trav.first, trav.second, tolerance);
+	}
+	geom.AddCluster(leaf, first_run, first_coarse_run);
+    }
+    geom.valid = true;
+}
+
+// Return which points of a polyline to keep so that the polyline through
+// just those points is within tolerance of the original, using the
+// Douglas-Peucker algorithm.
+static vector<bool>
+simplify_polyline(const vector<PointInfo>& points, double tolerance)
+{
+    vector<bool> keep(points.size());
+    keep.front() = keep.back() = true;
+    double tolerance_sqrd = tolerance * tolerance;
+    vector<pair<size_t, size_t>> stack;
+    stack.emplace_back(0, points.size() - 1);
+    while (!stack.empty()) {
+	size_t a = stack.back().first;
+	size_t b = stack.back().second;
+	stack.pop_back();
+	Vector3 ab = points[b] - points[a];
+	double ab_sqrd = dot(ab, ab);
+	double max_sqrd = 0.0;
+	size_t furthest = a;
+	for (size_t i = a + 1; i < b; ++i) {
+	    Vector3 ap = points[i] - points[a];
+	    if (ab_sqrd > 0.0) {
+		double t = min(max(dot(ap, ab) / ab_sqrd, 0.0), 1.0);
+		ap -= t * ab;
+	    }
+	    double d_sqrd = dot(ap, ap);
+	    if (d_sqrd > max_sqrd) {
+		max_sqrd = d_sqrd;
+		furthest = i;
+	    }
+	}
+	if (max_sqrd > tolerance_sqrd) {
+	    keep[furthest] = true;
+	    stack.emplace_back(a, furthest);
+	    stack.emplace_back(furthest, b);
+	}
     }
-    EndPolyline();
+    return keep;
 }
 
-void GfxCore::AddPolylineDepth(const traverse & centreline)
+void GfxCore::AddPolyline(ColourableGeometry& geom,
+			  const traverse & centreline,
+			  unsigned flags, double tolerance)
 {
-    BeginPolyline();
+    ColourableGeometry::Run run;
+    run.first = geom.vertices.size();
+    run.flags = flags;
+    run.style = centreline.style;
+    for (int e = 0; e != 3; ++e) run.errors[e] = centreline.errors[e];
+
+    ColourableGeometry::VertexInfo info;
+    info.shade = 1.0f;
+    const wxScopedCharBuffer name = centreline.name.utf8_str();
+    SetSurveyColour(info, name.data(), name.length());
+
+    // If tolerance is non-zero, generate a simplified version using only
+    // some of the points (and not splitting legs across depth bands).
+    vector<bool> keep;
+    if (tolerance > 0.0) keep = simplify_polyline(centreline, tolerance);
+
+    // Lines are drawn with flat shading, so each leg is drawn in the colour
+    // of the vertex at its end.  The colour of the first vertex only matters
+    // when colouring by depth, but give it the values for the first leg.
     vector<PointInfo>::const_iterator i, prev_i;
     i = centreline.begin();
+    Vector3 delta = *(i + 1) - *i;
+    info.date = i->GetDate();
+    info.gradient = delta.gradient();
+    info.length = delta.magnitude();
     int band0 = GetDepthColour(i->GetZ());
-    PlaceVertexWithDepthColour(*i);
+    geom.AddVertex(*i, info);
     prev_i = i;
     ++i;
     while (i != centreline.end()) {
+	if (!keep.empty() && !keep[i - centreline.begin()]) {
+	    ++i;
+	    continue;
+	}
+	delta = *i - *prev_i;
+	info.date = i->GetDate();
+	info.gradient = delta.gradient();
+	info.length = delta.magnitude();
+	// Split legs where they cross the boundary between depth colour
+	// bands whatever we're currently colouring by, so the geometry
+	// doesn't depend on that.  Surface legs are never coloured by depth.
 	int band = GetDepthColour(i->GetZ());
-	if (band != band0) {
-	    SplitLineAcrossBands(band0, band, *prev_i, *i);
+	if (band != band0 && !(flags & img_FLAG_SURFACE) && keep.empty()) {
+	    SplitLineAcrossBands(geom, info, band0, band, *prev_i, *i);
 	    band0 = band;
 	}
-	PlaceVertexWithDepthColour(*i);
+	geom.AddVertex(*i, info);
 	prev_i = i;
 	++i;
     }
-    EndPolyline();
+    run.count = geom.vertices.size() - run.first;
+    geom.runs.push_back(run);
 }
 
-void GfxCore::AddQuadrilateral(const Vector3 &a, const Vector3 &b,
-			       const Vector3 &c, const Vector3 &d)
+void GfxCore::AddPolylineShadow(const traverse & centreline)
 {
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-    PlaceVertexWithColour(a, 0, 0, factor);
-    PlaceVertexWithColour(b, w, 0, factor);
-    PlaceVertexWithColour(c, w, h, factor);
-    PlaceVertexWithColour(d, 0, h, factor);
-    EndQuadrilaterals();
+    BeginPolyline();
+    const double z = -0.5 * m_Parent->GetExtent().GetZ();
+    vector<PointInfo>::const_iterator i = centreline.begin();
+    PlaceVertex(i->GetX(), i->GetY(), z);
+    ++i;
+    while (i != centreline.end()) {
+	PlaceVertex(i->GetX(), i->GetY(), z);
+	++i;
+    }
+    EndPolyline();
 }
 
-void GfxCore::AddQuadrilateralDepth(const Vector3 &a, const Vector3 &b,
-				    const Vector3 &c, const Vector3 &d)
+void GfxCore::AddQuadrilateral(ColourableGeometry& geom,
+			       ColourableGeometry::VertexInfo info,
+			       const Vector3 &a, const Vector3 &b,
+			       const Vector3 &c, const Vector3 &d) const
 {
     Vector3 normal = (a - c) * (d - b);
     normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
+    info.shade = dot(normal, light) * .3 + .7;
     int a_band, b_band, c_band, d_band;
     a_band = GetDepthColour(a.GetZ());
     a_band = min(max(a_band, 0), GetNumColourBands());
@@ -3556,237 +3942,107 @@ void GfxCore::AddQuadrilateralDepth(const Vector3 &a, const Vector3 &b,
     glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
     int min_band = min(min(a_band, b_band), min(c_band, d_band));
     int max_band = max(max(a_band, b_band), max(c_band, d_band));
-    if (min_band == max_band) {
-	// Simple case - the polygon is entirely within one band.
-	BeginPolygon();
-////	PlaceNormal(normal);
-	PlaceVertexWithDepthColour(a, 0, 0, factor);
-	PlaceVertexWithDepthColour(b, w, 0, factor);
-	PlaceVertexWithDepthColour(c, w, h, factor);
-	PlaceVertexWithDepthColour(d, 0, h, factor);
-	EndPolygon();
-    } else {
-	// We need to make a separate polygon for each depth band...
-	vector<vector<Split>> splits;
-	splits.resize(max_band + 1);
-	splits[a_band].push_back(Split(a, 0, 0));
-	if (a_band != b_band) {
-	    SplitPolyAcrossBands(splits, a_band, b_band, a, b, 0, 0, w, 0);
-	}
-	splits[b_band].push_back(Split(b, w, 0));
-	if (b_band != c_band) {
-	    SplitPolyAcrossBands(splits, b_band, c_band, b, c, w, 0, 0, h);
-	}
-	splits[c_band].push_back(Split(c, w, h));
-	if (c_band != d_band) {
-	    SplitPolyAcrossBands(splits, c_band, d_band, c, d, w, h, -w, 0);
-	}
-	splits[d_band].push_back(Split(d, 0, h));
-	if (d_band != a_band) {
-	    SplitPolyAcrossBands(splits, d_band, a_band, d, a, 0, h, 0, -h);
-	}
-	for (int band = min_band; band <= max_band; ++band) {
-	    BeginPolygon();
-	    for (auto&& item : splits[band]) {
-		PlaceVertexWithDepthColour(item.vec, item.tx, item.ty, factor);
-	    }
-	    EndPolygon();
-	}
+    vector<vector<Split>> splits;
+    splits.resize(max_band + 1);
+    // We make a separate polygon for each depth band whatever we're currently
+    // colouring by, so the geometry doesn't depend on that.
+    splits[a_band].push_back(Split(a, 0, 0));
+    if (a_band != b_band) {
+	SplitPolyAcrossBands(splits, a_band, b_band, a, b, 0, 0, w, 0);
+    }
+    splits[b_band].push_back(Split(b, w, 0));
+    if (b_band != c_band) {
+	SplitPolyAcrossBands(splits, b_band, c_band, b, c, w, 0, 0, h);
+    }
+    splits[c_band].push_back(Split(c, w, h));
+    if (c_band != d_band) {
+	SplitPolyAcrossBands(splits, c_band, d_band, c, d, w, h, -w, 0);
+    }
+    splits[d_band].push_back(Split(d, 0, h));
+    if (d_band != a_band) {
+	SplitPolyAcrossBands(splits, d_band, a_band, d, a, 0, h, 0, -h);
+    }
+    for (int band = min_band; band <= max_band; ++band) {
+	AddPolygon(geom, info, normal, splits[band]);
+    }
+}
+
+void GfxCore::AddPolygon(ColourableGeometry& geom,
+			 const ColourableGeometry::VertexInfo& info,
+			 const Vector3& normal,
+			 const vector<Split>& points) const
+{
+    // Add a convex polygon as quadrilaterals which share its first point.  If
+    // it has an odd number of sides, the last quadrilateral is a triangle with
+    // a repeated point.
+    const size_t n = points.size();
+    for (size_t i = 2; i < n; i += 2) {
+	geom.AddVertex(points[0], normal, info);
+	geom.AddVertex(points[i - 1], normal, info);
+	geom.AddVertex(points[i], normal, info);
+	geom.AddVertex(points[min(i + 1, n - 1)], normal, info);
     }
 }
 
-void GfxCore::SetColourFromDate(int date, Double factor)
+GLAPen GfxCore::GetDatePen(int date) const
 {
-    // Set the drawing colour based on a date.
+    // Return the colour to use for a date.
 
     if (date == -1) {
 	// Undated.
-	SetColour(NODATA_COLOUR, factor);
-	return;
+	return GLAPen(NODATA_COLOUR);
     }
 
     int date_offset = date - m_Parent->GetDateMin();
     if (date_offset == 0) {
 	// Earliest date - handle as a special case for the single date case.
-	SetColour(GetPen(0), factor);
-	return;
+	return GetPen(0);
     }
 
     int date_ext = m_Parent->GetDateExtent();
     Double how_far = (Double)date_offset / date_ext;
     assert(how_far >= 0.0);
     assert(how_far <= 1.0);
-    SetColourFrom01(how_far, factor);
+    return GetPenFrom01(how_far);
 }
 
-void GfxCore::AddPolylineDate(const traverse & centreline)
+GLAPen GfxCore::GetErrorPen(double E) const
 {
-    BeginPolyline();
-    auto i = centreline.begin();
-    int date = i->GetDate();
-    SetColourFromDate(date, 1.0);
-    PlaceVertex(*i);
-    while (++i != centreline.end()) {
-	int newdate = i->GetDate();
-	if (newdate != date) {
-	    date = newdate;
-	    SetColourFromDate(date, 1.0);
-	}
-	PlaceVertex(*i);
-    }
-    EndPolyline();
-}
-
-static int static_date_hack; // FIXME
-
-void GfxCore::AddQuadrilateralDate(const Vector3 &a, const Vector3 &b,
-				   const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromDate(static_date_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-static double static_E_hack; // FIXME
-
-void GfxCore::SetColourFromError(double E, Double factor)
-{
-    // Set the drawing colour based on an error value.
+    // Return the colour to use for an error value.
 
     if (E < 0) {
-	SetColour(NODATA_COLOUR, factor);
-	return;
+	return GLAPen(NODATA_COLOUR);
     }
 
     Double how_far = E / MAX_ERROR;
     assert(how_far >= 0.0);
     if (how_far > 1.0) how_far = 1.0;
-    SetColourFrom01(how_far, factor);
-}
-
-void GfxCore::AddQuadrilateralError(const Vector3 &a, const Vector3 &b,
-				    const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromError(static_E_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-void GfxCore::AddPolylineError(const traverse & centreline)
-{
-    BeginPolyline();
-    SetColourFromError(centreline.errors[error_type], 1.0);
-    for (auto i = centreline.begin(); i != centreline.end(); ++i) {
-	PlaceVertex(*i);
-    }
-    EndPolyline();
+    return GetPenFrom01(how_far);
 }
 
 // gradient is in *radians*.
-void GfxCore::SetColourFromGradient(double gradient, Double factor)
+GLAPen GfxCore::GetGradientPen(double gradient) const
 {
-    // Set the drawing colour based on the gradient of the leg.
+    // Return the colour to use for the gradient of a leg.
 
     const Double GRADIENT_MAX = M_PI_2;
     gradient = fabs(gradient);
     Double how_far = gradient / GRADIENT_MAX;
-    SetColourFrom01(how_far, factor);
+    return GetPenFrom01(how_far);
 }
 
-void GfxCore::AddPolylineGradient(const traverse & centreline)
+GLAPen GfxCore::GetLengthPen(double length) const
 {
-    BeginPolyline();
-    auto i = centreline.begin();
-    auto prev_i = i;
-    PlaceVertex(*i);
-    while (++i != centreline.end()) {
-	SetColourFromGradient((*i - *prev_i).gradient(), 1.0);
-	PlaceVertex(*i);
-	prev_i = i;
-    }
-    EndPolyline();
-}
-
-static double static_gradient_hack; // FIXME
-
-void GfxCore::AddQuadrilateralGradient(const Vector3 &a, const Vector3 &b,
-				       const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromGradient(static_gradient_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-void GfxCore::SetColourFromLength(double length, Double factor)
-{
-    // Set the drawing colour based on log(length_of_leg).
+    // Return the colour to use for log(length_of_leg).
 
     Double log_len = log10(length);
     Double how_far = log_len / LOG_LEN_MAX;
     how_far = max(how_far, 0.0);
     how_far = min(how_far, 1.0);
-    SetColourFrom01(how_far, factor);
+    return GetPenFrom01(how_far);
 }
 
-void GfxCore::SetColourFromSurvey(const wxString& survey)
-{
-    // Set the drawing colour based on hash of name.
-    int hash = hash_string(survey.utf8_str());
-    wxImage::HSVValue hsv((hash & 0xff) / 256.0, (((hash >> 8) & 0x7f) | 0x80) / 256.0, 0.9);
-    wxImage::RGBValue rgb = wxImage::HSVtoRGB(hsv);
-    GLAPen pen;
-    pen.SetColour(rgb.red / 256.0, rgb.green / 256.0, rgb.blue / 256.0);
-    SetColour(pen);
-}
-
-void GfxCore::SetColourFromSurveyStation(const wxString& name, Double factor)
-{
-    // Set the drawing colour based on hash of survey name.
-    const char* p = name.utf8_str();
-    const char* q = strrchr(p, m_Parent->GetSeparator());
-    size_t len = q ? (q - p) : strlen(p);
-    int hash = hash_data(p, len);
-    wxImage::HSVValue hsv((hash & 0xff) / 256.0, (((hash >> 8) & 0x7f) | 0x80) / 256.0, 0.9);
-    wxImage::RGBValue rgb = wxImage::HSVtoRGB(hsv);
-    GLAPen pen;
-    pen.SetColour(rgb.red / 256.0, rgb.green / 256.0, rgb.blue / 256.0);
-    SetColour(pen, factor);
-}
-
-void GfxCore::SetColourFrom01(double how_far, Double factor)
+GLAPen GfxCore::GetPenFrom01(double how_far) const
 {
     double b;
     double into_band = modf(how_far * (GetNumColourBands() - 1), &b);
@@ -3797,125 +4053,120 @@ void GfxCore::SetColourFrom01(double how_far, Double factor)
 	const GLAPen& pen2 = GetPen(band + 1);
 	pen1.Interpolate(pen2, into_band);
     }
-    SetColour(pen1, factor);
+    return pen1;
 }
 
-void GfxCore::AddPolylineLength(const traverse & centreline)
+unsigned GfxCore::GetLegStyle(unsigned flags) const
 {
-    BeginPolyline();
-    auto i = centreline.begin();
-    auto prev_i = i;
-    PlaceVertex(*i);
-    while (++i != centreline.end()) {
-	SetColourFromLength((*i - *prev_i).magnitude(), 1.0);
-	PlaceVertex(*i);
-	prev_i = i;
+    // Return how to show legs with the given flags (tubes have flags 0 so
+    // are always SHOW_NORMAL).
+    unsigned style = SHOW_NORMAL;
+    if ((flags & img_FLAG_SPLAY) && m_Splays != SHOW_NORMAL) {
+	style = m_Splays;
+    } else if (flags & img_FLAG_DUPLICATE) {
+	style = m_Dupes;
     }
-    EndPolyline();
-}
-
-static double static_length_hack; // FIXME
-
-void GfxCore::AddQuadrilateralLength(const Vector3 &a, const Vector3 &b,
-				     const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromLength(static_length_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
-}
-
-void GfxCore::AddPolylineSurvey(const traverse & centreline)
-{
-    BeginPolyline();
-    SetColourFromSurvey(centreline.name);
-    for (auto i = centreline.begin(); i != centreline.end(); ++i) {
-	PlaceVertex(*i);
+    if (flags & img_FLAG_SURFACE) {
+	if (style == SHOW_FADED) {
+	    style = SHOW_DASHED_AND_FADED;
+	} else {
+	    style = SHOW_DASHED;
+	}
     }
-    EndPolyline();
-}
-
-static const wxString* static_survey_hack;
-
-void GfxCore::AddQuadrilateralSurvey(const Vector3 &a, const Vector3 &b,
-				     const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromSurveyStation(*static_survey_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
+    return style;
 }
 
-void GfxCore::AddPolylineStyle(const traverse & centreline)
+void GfxCore::ColourGeometry(ColourableGeometry& geom, int colour_by)
 {
-    BeginPolyline();
-    SetColour(style_colours[centreline.style + 1]);
-//    SetColourFromStyle(centreline.style);
-    for (auto i = centreline.begin(); i != centreline.end(); ++i) {
-	PlaceVertex(*i);
+    // Set the colour of each vertex.  This only needs a pass over the
+    // vertices, so is much quicker than generating the geometry again.
+    for (const ColourableGeometry::Run& run : geom.runs) {
+	unsigned style = GetLegStyle(run.flags);
+	if (style == SHOW_HIDE) continue;
+	double alpha = 1.0;
+	if (style == SHOW_FADED || style == SHOW_DASHED_AND_FADED) alpha = 0.4;
+	for (size_t i = run.first; i != run.first + run.count; ++i) {
+	    const ColourableGeometry::VertexInfo& info = geom.info[i];
+	    GLAPen pen;
+	    switch (colour_by) {
+		case COLOUR_BY_DEPTH:
+		    pen = GetDepthPen(geom.vertices.GetZ(i));
+		    break;
+		case COLOUR_BY_DATE:
+		    pen = GetDatePen(info.date);
+		    break;
+		case COLOUR_BY_ERROR:
+		case COLOUR_BY_H_ERROR:
+		case COLOUR_BY_V_ERROR:
+		    pen = GetErrorPen(run.errors[error_type]);
+		    break;
+		case COLOUR_BY_GRADIENT:
+		    pen = GetGradientPen(info.gradient);
+		    break;
+		case COLOUR_BY_LENGTH:
+		    pen = GetLengthPen(info.length);
+		    break;
+		case COLOUR_BY_SURVEY:
+		    pen.SetColour(info.survey_rgb[0] / 256.0,
+				  info.survey_rgb[1] / 256.0,
+				  info.survey_rgb[2] / 256.0);
+		    break;
+		case COLOUR_BY_STYLE:
+		    pen = GLAPen(style_colours[run.style + 1]);
+		    break;
+		default: // case COLOUR_BY_NONE:
+		    pen = GLAPen(col_WHITE);
+		    break;
+	    }
+	    geom.vertices.SetColour(i, pen, info.shade, alpha);
+	}
     }
-    EndPolyline();
+    geom.coloured = true;
 }
 
-#if 0
-static int static_style_hack;
-
-void GfxCore::AddQuadrilateralStyle(const Vector3 &a, const Vector3 &b,
-				    const Vector3 &c, const Vector3 &d)
-{
-    Vector3 normal = (a - c) * (d - b);
-    normal.normalise();
-    Double factor = dot(normal, light) * .3 + .7;
-    glaTexCoord w(((b - a).magnitude() + (d - c).magnitude()) * .5);
-    glaTexCoord h(((b - c).magnitude() + (d - a).magnitude()) * .5);
-    // FIXME: should plot triangles instead to avoid rendering glitches.
-    BeginQuadrilaterals();
-////    PlaceNormal(normal);
-    SetColourFromSurveyStation(*static_survey_hack, factor);
-    PlaceVertex(a, 0, 0);
-    PlaceVertex(b, w, 0);
-    PlaceVertex(c, w, h);
-    PlaceVertex(d, 0, h);
-    EndQuadrilaterals();
+void
+GfxCore::SkinPassages(ColourableGeometry& geom,
+		      const vector<const vector<XSect>*>& tubes,
+		      const vector<size_t>& leaf_start,
+		      unsigned leaf_begin, unsigned leaf_end) const
+{
+    for (unsigned leaf = leaf_begin; leaf != leaf_end; ++leaf) {
+	ColourableGeometry::Run run;
+	run.first = geom.vertices.size();
+	for (size_t i = leaf_start[leaf]; i != leaf_start[leaf + 1]; ++i) {
+	    SkinPassage(geom, *tubes[i]);
+	}
+	run.count = geom.vertices.size() - run.first;
+	if (run.count == 0) continue;
+	// FIXME: it's not simple to set the colour of a tube based on error,
+	// so for now they're coloured as if the error were zero.
+	run.flags = 0;
+	run.style = img_STYLE_NORMAL;
+	for (int e = 0; e != 3; ++e) run.errors[e] = 0.0;
+	size_t first_run = geom.runs.size();
+	geom.runs.push_back(run);
+	// There's no coarse version - tubes are just not drawn when they're
+	// too small on screen to show any detail.
+	geom.AddCluster(leaf, first_run, geom.runs.size());
+    }
 }
-#endif
 
 void
-GfxCore::SkinPassage(vector<XSect> & centreline)
+GfxCore::SkinPassage(ColourableGeometry& geom,
+		     const vector<XSect> & centreline) const
 {
     const SurveyFilter* filter = m_Parent->GetTreeFilter();
     assert(centreline.size() > 1);
     Vector3 U[4];
-    XSect* prev_pt_v = NULL;
+    const XSect* prev_pt_v = NULL;
     Vector3 last_right(1.0, 0.0, 0.0);
+    ColourableGeometry::VertexInfo info;
 
-//  FIXME: it's not simple to set the colour of a tube based on error...
-//    static_E_hack = something...
-    vector<XSect>::iterator i = centreline.begin();
+    vector<XSect>::const_iterator i = centreline.begin();
     vector<XSect>::size_type segment = 0;
     while (i != centreline.end()) {
 	// get the coordinates of this vertex
-	XSect & pt_v = *i++;
+	const XSect & pt_v = *i++;
 
 	bool cover_end = false;
 
@@ -3923,7 +4174,14 @@ GfxCore::SkinPassage(vector<XSect> & centreline)
 
 	const Vector3 up_v(0.0, 0.0, 1.0);
 
-	static_survey_hack = &(pt_v.GetLabel());
+	{
+	    // Colour by the survey the station is in.
+	    const wxString& label = pt_v.GetLabel();
+	    const wxScopedCharBuffer name = label.utf8_str();
+	    const char* p = name.data();
+	    const char* q = strrchr(p, m_Parent->GetSeparator());
+	    SetSurveyColour(info, p, q ? size_t(q - p) : strlen(p));
+	}
 	if (segment == 0) {
 	    assert(i != centreline.end());
 	    // first segment
@@ -3948,7 +4206,9 @@ GfxCore::SkinPassage(vector<XSect> & centreline)
 	    }
 
 	    cover_end = true;
-	    static_date_hack = next_pt_v.GetDate();
+	    info.date = next_pt_v.GetDate();
+	    info.length = leg_v.magnitude();
+	    info.gradient = leg_v.gradient();
 	} else if (segment + 1 == centreline.size()) {
 	    // last segment
 
@@ -3969,7 +4229,7 @@ GfxCore::SkinPassage(vector<XSect> & centreline)
 	    }
 
 	    cover_end = true;
-	    static_date_hack = pt_v.GetDate();
+	    info.date = pt_v.GetDate();
 	} else {
 	    assert(i != centreline.end());
 	    // Intermediate segment.
@@ -4059,7 +4319,7 @@ GfxCore::SkinPassage(vector<XSect> & centreline)
 		up = up_v;
 	    }
 	    last_right = right;
-	    static_date_hack = pt_v.GetDate();
+	    info.date = pt_v.GetDate();
 	}
 
 	// Scale to unit vectors in the LRUD plane.
@@ -4079,24 +4339,24 @@ GfxCore::SkinPassage(vector<XSect> & centreline)
 	v[3] = pt_v.GetPoint() - right * l - up * d;
 
 	if (segment > 0) {
+	    const Vector3 & delta = pt_v - *prev_pt_v;
+	    info.length = delta.magnitude();
+	    info.gradient = delta.gradient();
 	    if (!filter || (filter->CheckVisible(pt_v.GetLabel()) &&
 			    filter->CheckVisible(prev_pt_v->GetLabel()))) {
-		const Vector3 & delta = pt_v - *prev_pt_v;
-		static_length_hack = delta.magnitude();
-		static_gradient_hack = delta.gradient();
-		(this->*AddQuad)(v[0], v[1], U[1], U[0]);
-		(this->*AddQuad)(v[2], v[3], U[3], U[2]);
-		(this->*AddQuad)(v[1], v[2], U[2], U[1]);
-		(this->*AddQuad)(v[3], v[0], U[0], U[3]);
+		AddQuadrilateral(geom, info, v[0], v[1], U[1], U[0]);
+		AddQuadrilateral(geom, info, v[2], v[3], U[3], U[2]);
+		AddQuadrilateral(geom, info, v[1], v[2], U[2], U[1]);
+		AddQuadrilateral(geom, info, v[3], v[0], U[0], U[3]);
 	    }
 	}
 
 	if (cover_end) {
 	    if (!filter || filter->CheckVisible(pt_v.GetLabel())) {
 		if (segment == 0) {
-		    (this->*AddQuad)(v[0], v[1], v[2], v[3]);
+		    AddQuadrilateral(geom, info, v[0], v[1], v[2], v[3]);
 		} else {
-		    (this->*AddQuad)(v[3], v[2], v[1], v[0]);
+		    AddQuadrilateral(geom, info, v[3], v[2], v[1], v[0]);
 		}
 	    }
 	}
@@ -4200,44 +4460,6 @@ void GfxCore::PlayPres(double speed, bool change_speed) {
 
 void GfxCore::SetColourBy(int colour_by) {
     m_ColourBy = colour_by;
-    switch (colour_by) {
-	case COLOUR_BY_DEPTH:
-	    AddQuad = &GfxCore::AddQuadrilateralDepth;
-	    AddPoly = &GfxCore::AddPolylineDepth;
-	    break;
-	case COLOUR_BY_DATE:
-	    AddQuad = &GfxCore::AddQuadrilateralDate;
-	    AddPoly = &GfxCore::AddPolylineDate;
-	    break;
-	case COLOUR_BY_ERROR:
-	case COLOUR_BY_H_ERROR:
-	case COLOUR_BY_V_ERROR:
-	    AddQuad = &GfxCore::AddQuadrilateralError;
-	    AddPoly = &GfxCore::AddPolylineError;
-	    break;
-	case COLOUR_BY_GRADIENT:
-	    AddQuad = &GfxCore::AddQuadrilateralGradient;
-	    AddPoly = &GfxCore::AddPolylineGradient;
-	    break;
-	case COLOUR_BY_LENGTH:
-	    AddQuad = &GfxCore::AddQuadrilateralLength;
-	    AddPoly = &GfxCore::AddPolylineLength;
-	    break;
-	case COLOUR_BY_SURVEY:
-	    AddQuad = &GfxCore::AddQuadrilateralSurvey;
-	    AddPoly = &GfxCore::AddPolylineSurvey;
-	    break;
-	case COLOUR_BY_STYLE:
-	    // FIXME: support quad colouring by style
-	    AddQuad = &GfxCore::AddQuadrilateral;
-	    AddPoly = &GfxCore::AddPolylineStyle;
-	    break;
-	default: // case COLOUR_BY_NONE:
-	    AddQuad = &GfxCore::AddQuadrilateral;
-	    AddPoly = &GfxCore::AddPolyline;
-	    break;
-    }
-
     switch (colour_by) {
 	case COLOUR_BY_ERROR:
 	    error_type = traverse::ERROR_3D;
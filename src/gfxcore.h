@@ -31,6 +31,7 @@
 
 #include "img_hosted.h"
 
+#include "bvh.h"
 #include "guicontrol.h"
 #include "labelinfo.h"
 #include "vector3.h"
@@ -121,6 +122,73 @@ struct Split {
 	: vec(vec_), tx(tx_), ty(ty_) { }
 };
 
+// Legs or passage tubes, kept so that they can be recoloured (e.g. when the
+// user changes how they're coloured) without generating them again.
+struct ColourableGeometry {
+    // The values the colour of a vertex can depend on (apart from its
+    // position).
+    struct VertexInfo {
+	int date;
+	float gradient;
+	float length;
+	// Shading factor (always 1.0 for legs).
+	float shade;
+	unsigned char survey_rgb[3];
+    };
+
+    // A polyline for legs, or quadrilaterals for tubes.
+    struct Run {
+	size_t first, count;
+	// Leg flags (img_FLAG_SURFACE, etc) - always 0 for tubes.
+	unsigned flags;
+	int style;
+	double errors[3];
+    };
+
+    // The runs in a leaf of the model's spatial index.  The coarse runs are
+    // a simplified version to draw when the leaf is small on screen.
+    struct Cluster {
+	unsigned leaf;
+	size_t first_run, end_run;
+	size_t first_coarse_run, end_coarse_run;
+	size_t n_vertices, n_coarse_vertices;
+    };
+
+    GLAVertexArray vertices;
+    vector<VertexInfo> info;
+    vector<Run> runs;
+    vector<Cluster> clusters;
+    // Draw the coarse runs for clusters which are less than this many pixels
+    // across on screen.
+    double coarse_below = 0.0;
+    bool valid = false;
+    // Are the colours of the vertices up to date?
+    bool coloured = false;
+
+    void clear() {
+	vertices.clear();
+	info.clear();
+	runs.clear();
+	clusters.clear();
+	valid = false;
+	coloured = false;
+    }
+
+    // Add a cluster for runs from first_run onwards (if there are any).
+    void AddCluster(unsigned leaf, size_t first_run, size_t first_coarse_run);
+
+    void AddVertex(const Vector3& v, const VertexInfo& vertex_info) {
+	vertices.AddVertex(v);
+	info.push_back(vertex_info);
+    }
+
+    void AddVertex(const Split& split, const Vector3& normal,
+		   const VertexInfo& vertex_info) {
+	vertices.AddVertex(split.vec, split.tx, split.ty, normal);
+	info.push_back(vertex_info);
+    }
+};
+
 // It's pointless to redraw the screen as often as we can on a fast machine,
 // since the display hardware will only update so many times per second.
 // This is the maximum framerate we'll redraw at.
@@ -184,6 +252,7 @@ public:
 private:
     GUIControl* m_Control;
     char* m_LabelGrid;
+    size_t m_LabelGridSize;
     MainFrm* m_Parent;
     bool m_DoneFirstShow;
     Double m_TiltAngle;
@@ -224,9 +293,6 @@ private:
     bool m_HitTestDebug;
     bool m_RenderStats;
 
-    list<LabelInfo*> *m_PointGrid;
-    bool m_HitTestGridValid;
-
     LabelInfo temp_here;
     const LabelInfo * m_here;
     const LabelInfo * m_there;
@@ -274,30 +340,60 @@ private:
     long last_time;
     size_t n_tris;
 
-    void PlaceVertexWithColour(const Vector3 &v, Double factor = 1.0);
-    void PlaceVertexWithColour(const Vector3 & v,
-			       glaTexCoord tex_x, glaTexCoord tex_y,
-			       Double factor);
-    void SetDepthColour(Double z, Double factor);
-    void PlaceVertexWithDepthColour(const Vector3 & v, Double factor = 1.0);
-    void PlaceVertexWithDepthColour(const Vector3 & v,
-				    glaTexCoord tex_x, glaTexCoord tex_y,
-				    Double factor);
-
-    void SetColourFrom01(double how_far, Double factor);
-
-    void SetColourFromDate(int date, Double factor);
-    void SetColourFromError(double E, Double factor);
-    void SetColourFromGradient(double angle, Double factor);
-    void SetColourFromLength(double len, Double factor);
-    void SetColourFromSurvey(const wxString& survey);
-    void SetColourFromSurveyStation(const wxString& survey, Double factor);
+    ColourableGeometry m_UndergroundLegGeometry;
+    ColourableGeometry m_SurfaceLegGeometry;
+    // The tubes are generated in parallel, in one part per thread.
+    vector<ColourableGeometry> m_TubeGeometry;
+    bool m_TubeGeometryValid = false;
+
+    // How many pixels across each leaf of the model's spatial index appears
+    // in the current view, or -1 if it's out of view.
+    vector<double> m_LeafSizes;
+
+    // The labels NattyDrawNames() last decided to draw, with positions
+    // relative to where the origin was projected to.
+    struct PlacedLabel {
+	const LabelInfo* label;
+	double x, y;
+    };
+    vector<PlacedLabel> m_PlacedLabels;
+
+    // The view m_PlacedLabels was worked out for.  They can be reused if
+    // only the translation has changed since.
+    bool m_PlacedLabelsValid = false;
+    GLdouble m_PlacedModelview[12];
+    GLdouble m_PlacedProjection[16];
+    int m_PlacedXSize, m_PlacedYSize, m_PlacedFontSize;
+    double m_PlacedOriginX, m_PlacedOriginY;
+
+    GLAPen GetDepthPen(Double z) const;
+    GLAPen GetPenFrom01(double how_far) const;
+    GLAPen GetDatePen(int date) const;
+    GLAPen GetErrorPen(double E) const;
+    GLAPen GetGradientPen(double angle) const;
+    GLAPen GetLengthPen(double len) const;
+
+    unsigned GetLegStyle(unsigned flags) const;
+    void ColourGeometry(ColourableGeometry& geom, int colour_by);
+    ColourableGeometry& PrepareLegGeometry(bool surface);
+    void PrepareTubeGeometry();
+    void DrawGeometry(const ColourableGeometry& geom, bool tubes,
+		      const vector<double>* leaf_sizes);
+    void FindLeafSizes();
+    void DrawModelList(drawing_list l);
 
     int GetClinoOffset() const;
     void DrawTick(int angle_cw);
     void DrawArrow(gla_colour col1, gla_colour col2);
 
-    void SkinPassage(vector<XSect> & centreline);
+    friend class SkinPassageThread;
+    void SkinPassages(ColourableGeometry& geom,
+		      const vector<const vector<XSect>*>& tubes,
+		      const vector<size_t>& leaf_start,
+		      unsigned leaf_begin, unsigned leaf_end) const;
+    void SkinPassage(ColourableGeometry& geom,
+		     const vector<XSect> & centreline) const;
+    void GenerateTubeGeometry();
 
     virtual void GenerateList(unsigned int l);
     void GenerateDisplayList(bool surface);
@@ -326,6 +422,8 @@ private:
     void Draw2dIndicators();
     void DrawGrid();
 
+    bool PlacedLabelsStillValid(double origin_x, double origin_y) const;
+    void PlaceLabels(double origin_x, double origin_y, double margin);
     void NattyDrawNames();
     void SimpleDrawNames();
 
@@ -333,7 +431,7 @@ private:
 
     void Repaint();
 
-    void CreateHitTestGrid();
+    void DrawStationIndexLeaves();
 
     int GetCompassXPosition() const;
     int GetClinoXPosition() const;
@@ -381,6 +479,20 @@ public:
     void SetHere(const LabelInfo * p = NULL);
     void SetThere(const LabelInfo * p = NULL);
 
+    // Drop any pointers we hold to labels, as they're about to be deleted.
+    void ForgetLabels() {
+	SetHere();
+	SetThere();
+	LabelsReordered();
+    }
+
+    // Call when the order of the labels (which gives their priority for
+    // being drawn) changes.
+    void LabelsReordered() {
+	m_PlacedLabels.clear();
+	m_PlacedLabelsValid = false;
+    }
+
     const LabelInfo* GetThere() const { return m_there; }
 
     void CentreOn(const Point &p);
@@ -500,7 +612,6 @@ public:
 	InvalidateList(LIST_SURFACE_LEGS);
 	InvalidateList(LIST_UNDERGROUND_LEGS);
 	InvalidateList(LIST_CROSSES);
-	m_HitTestGridValid = false;
 	ForceRefresh();
     }
     void SetDupesMode(int mode) {
@@ -565,7 +676,7 @@ public:
     bool GetPercent() const { return m_Percent; }
     bool GetTubes() const { return m_Tubes; }
 
-    bool CheckHitTestGrid(const wxPoint& point, bool centre);
+    bool CheckHitTest(const wxPoint& point, bool centre);
 
     void ClearTreeSelection();
 
@@ -581,45 +692,31 @@ public:
 
     void DragFinished();
 
-    void SplitLineAcrossBands(int band, int band2,
-			      const Vector3 &p, const Vector3 &q,
-			      Double factor = 1.0);
+    void SplitLineAcrossBands(ColourableGeometry& geom,
+			      const ColourableGeometry::VertexInfo& info,
+			      int band, int band2,
+			      const Vector3 &p, const Vector3 &q);
     void SplitPolyAcrossBands(vector<vector<Split>>& splits,
 			      int band, int band2,
 			      const Vector3 &p, const Vector3 &q,
 			      glaTexCoord ptx, glaTexCoord pty,
-			      glaTexCoord w, glaTexCoord h);
+			      glaTexCoord w, glaTexCoord h) const;
     int GetDepthColour(Double z) const;
     Double GetDepthBoundaryBetweenBands(int a, int b) const;
-    void AddPolyline(const traverse & centreline);
-    void AddPolylineDepth(const traverse & centreline);
-    void AddPolylineDate(const traverse & centreline);
-    void AddPolylineError(const traverse & centreline);
-    void AddPolylineGradient(const traverse & centreline);
-    void AddPolylineLength(const traverse & centreline);
-    void AddPolylineSurvey(const traverse & centreline);
-    void AddPolylineStyle(const traverse & centreline);
-    void AddQuadrilateral(const Vector3 &a, const Vector3 &b,
-			  const Vector3 &c, const Vector3 &d);
+    void GenerateLegGeometry(ColourableGeometry& geom, bool surface);
+    void AddPolyline(ColourableGeometry& geom, const traverse & centreline,
+		     unsigned flags, double tolerance = 0.0);
     void AddPolylineShadow(const traverse & centreline);
-    void AddQuadrilateralDepth(const Vector3 &a, const Vector3 &b,
-			       const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralDate(const Vector3 &a, const Vector3 &b,
-			      const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralError(const Vector3 &a, const Vector3 &b,
-			       const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralGradient(const Vector3 &a, const Vector3 &b,
-				  const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralLength(const Vector3 &a, const Vector3 &b,
-				const Vector3 &c, const Vector3 &d);
-    void AddQuadrilateralSurvey(const Vector3 &a, const Vector3 &b,
-				const Vector3 &c, const Vector3 &d);
+    void AddQuadrilateral(ColourableGeometry& geom,
+			  ColourableGeometry::VertexInfo info,
+			  const Vector3 &a, const Vector3 &b,
+			  const Vector3 &c, const Vector3 &d) const;
+    void AddPolygon(ColourableGeometry& geom,
+		    const ColourableGeometry::VertexInfo& info,
+		    const Vector3& normal,
+		    const vector<Split>& points) const;
     void MoveViewer(double forward, double up, double right);
 
-    void (GfxCore::* AddQuad)(const Vector3 &a, const Vector3 &b,
-			      const Vector3 &c, const Vector3 &d);
-    void (GfxCore::* AddPoly)(const traverse & centreline);
-
     PresentationMark GetView() const;
     void SetView(const PresentationMark & p);
     void PlayPres(double speed, bool change_speed = true);
@@ -638,7 +735,39 @@ public:
 
     bool HandleRClick(wxPoint point);
 
+    void InvalidateGeometry() {
+	m_UndergroundLegGeometry.clear();
+	m_SurfaceLegGeometry.clear();
+	m_TubeGeometry.clear();
+	m_TubeGeometryValid = false;
+    }
+
+    virtual void InvalidateList(unsigned int l) {
+	// The colours of the geometry for these lists need to be updated too.
+	switch (l) {
+	    case LIST_UNDERGROUND_LEGS:
+		m_UndergroundLegGeometry.coloured = false;
+		break;
+	    case LIST_SURFACE_LEGS:
+		m_SurfaceLegGeometry.coloured = false;
+		break;
+	    case LIST_TUBES:
+		for (ColourableGeometry& geom : m_TubeGeometry) {
+		    geom.coloured = false;
+		}
+		break;
+	    case LIST_BLOBS:
+		// Which stations get blobs and which get labels depend on
+		// the same things (highlighting, the tree filter, which legs
+		// are shown, ...)
+		m_PlacedLabelsValid = false;
+		break;
+	}
+	GLACanvas::InvalidateList(l);
+    }
+
     void InvalidateAllLists() {
+	InvalidateGeometry();
 	for (int i = 0; i < LIST_LIMIT_; ++i) {
 	    InvalidateList(i);
 	}
@@ -31,6 +31,7 @@
 #include <algorithm>
 
 #include "aven.h"
+#include "bvh.h"
 #include "gla.h"
 #include "gllogerror.h"
 #include "message.h"
@@ -332,6 +333,13 @@ static const ColourTriple COLOURS[] = {
     { 255, 0, 255 },   // magenta
 };
 
+GLAPen::GLAPen(gla_colour colour)
+{
+    components[0] = COLOURS[colour].r / 255.0;
+    components[1] = COLOURS[colour].g / 255.0;
+    components[2] = COLOURS[colour].b / 255.0;
+}
+
 bool GLAList::need_to_generate() {
     // Bail out if the list is already cached, or can't usefully be cached.
     if (flags & (GLACanvas::CACHED|GLACanvas::NEVER_CACHE))
@@ -1127,15 +1135,26 @@ void GLACanvas::DrawText(glaCoord x, glaCoord y, glaCoord z, const wxString& str
 }
 
 void GLACanvas::DrawIndicatorText(int x, int y, const wxString& str)
+{
+    DrawIndicatorText(x, y, str.data(), str.size());
+}
+
+void GLACanvas::DrawIndicatorText(int x, int y, const wxChar* str, size_t len)
 {
     glRasterPos2d(x, y);
     CHECK_GL_ERROR("DrawIndicatorText", "glRasterPos2d");
-    m_Font.write_string(str.data(), str.size());
+    m_Font.write_string(str, len);
 }
 
 void GLACanvas::GetTextExtent(const wxString& str, int * x_ext, int * y_ext) const
 {
-    m_Font.get_text_extent(str.data(), str.size(), x_ext, y_ext);
+    GetTextExtent(str.data(), str.size(), x_ext, y_ext);
+}
+
+void GLACanvas::GetTextExtent(const wxChar* str, size_t len,
+			      int * x_ext, int * y_ext) const
+{
+    m_Font.get_text_extent(str, len, x_ext, y_ext);
 }
 
 void GLACanvas::BeginQuadrilaterals()
@@ -1272,6 +1291,60 @@ void GLACanvas::PlaceIndicatorVertex(glaCoord x, glaCoord y)
     PlaceVertex(x, y, 0.0);
 }
 
+void GLACanvas::BeginVertexArray(const GLAVertexArray & array)
+{
+    // Prepare to draw from a vertex array.  Vertex arrays are in OpenGL 1.1
+    // so we can rely on them being available.  If we're compiling an OpenGL
+    // list, the vertex data gets copied into the list.
+
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    CHECK_GL_ERROR("BeginVertexArray", "glPushClientAttrib");
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, array.coords.data());
+    CHECK_GL_ERROR("BeginVertexArray", "glVertexPointer");
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(4, GL_FLOAT, 0, array.colours.data());
+    CHECK_GL_ERROR("BeginVertexArray", "glColorPointer");
+    if (!array.tex_coords.empty()) {
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, 0, array.tex_coords.data());
+	CHECK_GL_ERROR("BeginVertexArray", "glTexCoordPointer");
+    }
+    if (!array.normals.empty()) {
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glNormalPointer(GL_FLOAT, 0, array.normals.data());
+	CHECK_GL_ERROR("BeginVertexArray", "glNormalPointer");
+    }
+}
+
+void GLACanvas::EndVertexArray()
+{
+    glPopClientAttrib();
+    CHECK_GL_ERROR("EndVertexArray", "glPopClientAttrib");
+}
+
+void GLACanvas::DrawPolylineFromArray(size_t first, size_t count)
+{
+    // Draw a polyline from count vertices in the current vertex array.
+
+#ifdef GLA_DEBUG
+    m_Vertices += count;
+#endif
+    glDrawArrays(GL_LINE_STRIP, first, count);
+    CHECK_GL_ERROR("DrawPolylineFromArray", "glDrawArrays GL_LINE_STRIP");
+}
+
+void GLACanvas::DrawQuadrilateralsFromArray(size_t first, size_t count)
+{
+    // Draw quadrilaterals from count vertices in the current vertex array.
+
+#ifdef GLA_DEBUG
+    m_Vertices += count;
+#endif
+    glDrawArrays(GL_QUADS, first, count);
+    CHECK_GL_ERROR("DrawQuadrilateralsFromArray", "glDrawArrays GL_QUADS");
+}
+
 void GLACanvas::BeginBlobs()
 {
     // Commence drawing of a set of blobs.
@@ -1606,6 +1679,96 @@ bool GLACanvas::Transform(const Vector3 & v,
 		      x_out, y_out, z_out);
 }
 
+// Convert from data coordinates to clip coordinates.
+static void
+to_clip(const GLdouble* modelview, const GLdouble* projection,
+	const Vector3& v, double clip[4])
+{
+    double eye[4];
+    for (int i = 0; i != 4; ++i) {
+	eye[i] = modelview[i] * v.GetX() +
+		 modelview[4 + i] * v.GetY() +
+		 modelview[8 + i] * v.GetZ() +
+		 modelview[12 + i];
+    }
+    for (int i = 0; i != 4; ++i) {
+	clip[i] = projection[i] * eye[0] +
+		  projection[4 + i] * eye[1] +
+		  projection[8 + i] * eye[2] +
+		  projection[12 + i] * eye[3];
+    }
+}
+
+double GLACanvas::GetScreenSize(const BoundingBox& box, double margin) const
+{
+    if (box.empty()) return -1;
+
+    // The box can't be visible if all its corners are outside the same one
+    // of the six planes bounding the view volume.  A box which is outside
+    // the view volume but not wholly outside any one plane (which can happen
+    // near the corners) is treated as visible.
+    const Vector3& lo = box.GetMin();
+    const Vector3& hi = box.GetMax();
+    const double expand[3] = { 1.0 + 2.0 * margin, 1.0 + 2.0 * margin, 1.0 };
+    unsigned outside_all = 0x3f;
+    for (int corner = 0; corner != 8 && outside_all; ++corner) {
+	Vector3 v((corner & 1) ? hi.GetX() : lo.GetX(),
+		  (corner & 2) ? hi.GetY() : lo.GetY(),
+		  (corner & 4) ? hi.GetZ() : lo.GetZ());
+	double clip[4];
+	to_clip(modelview_matrix, projection_matrix, v, clip);
+	unsigned outside = 0;
+	for (int axis = 0; axis != 3; ++axis) {
+	    double w = clip[3] * expand[axis];
+	    if (clip[axis] < -w) outside |= 1 << (axis * 2);
+	    if (clip[axis] > w) outside |= 2 << (axis * 2);
+	}
+	outside_all &= outside;
+    }
+    if (outside_all) return -1;
+
+    // Use the size of a sphere around the box at the depth of its centre.
+    // With an orthographic projection, w is always 1 so this doesn't depend
+    // on the rotation of the view.
+    double clip[4];
+    to_clip(modelview_matrix, projection_matrix, box.centre(), clip);
+    double diameter = box.diameter();
+    if (m_Perspective && clip[3] <= diameter * 0.5) {
+	// The viewer is inside or very close to the box.
+	return HUGE_VAL;
+    }
+    return diameter * projection_matrix[0] * viewport[2] * 0.5 / clip[3];
+}
+
+bool GLACanvas::BoxNearPoint(const BoundingBox& box,
+			     double x, double y, double r) const
+{
+    if (box.empty()) return false;
+
+    // Find the extent of the box's projection from those of its corners.
+    const Vector3& lo = box.GetMin();
+    const Vector3& hi = box.GetMax();
+    double x_min = HUGE_VAL, x_max = -HUGE_VAL;
+    double y_min = HUGE_VAL, y_max = -HUGE_VAL;
+    for (int corner = 0; corner != 8; ++corner) {
+	Vector3 v((corner & 1) ? hi.GetX() : lo.GetX(),
+		  (corner & 2) ? hi.GetY() : lo.GetY(),
+		  (corner & 4) ? hi.GetZ() : lo.GetZ());
+	double clip[4];
+	to_clip(modelview_matrix, projection_matrix, v, clip);
+	// A corner level with or behind the viewer doesn't project sensibly,
+	// so just assume the box might be near the point.
+	if (clip[3] <= 0.0) return true;
+	double wx = viewport[0] + (clip[0] / clip[3] + 1.0) * viewport[2] * 0.5;
+	double wy = viewport[1] + (clip[1] / clip[3] + 1.0) * viewport[3] * 0.5;
+	x_min = min(x_min, wx);
+	x_max = max(x_max, wx);
+	y_min = min(y_min, wy);
+	y_max = max(y_max, wy);
+    }
+    return x >= x_min - r && x <= x_max + r && y >= y_min - r && y <= y_max + r;
+}
+
 void GLACanvas::ReverseTransform(Double x, Double y,
 				 double* x_out, double* y_out, double* z_out) const
 {
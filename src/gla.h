@@ -35,6 +35,8 @@ using namespace std;
 
 #include "glbitmapfont.h"
 
+class BoundingBox;
+
 class GfxCore;
 
 string GetGLSystemDescription();
@@ -71,6 +73,7 @@ class GLAPen {
 
 public:
     GLAPen();
+    explicit GLAPen(gla_colour colour);
 
     void SetColour(double red, double green, double blue); // arguments in range 0 to 1.0
     void Interpolate(const GLAPen&, double how_far);
@@ -99,6 +102,60 @@ class GLAList {
     }
 };
 
+// Vertices stored in client-side arrays, along with a colour for each.
+//
+// This allows geometry to be generated once and then drawn with different
+// colours just by updating the colours.
+class GLAVertexArray {
+    friend class GLACanvas;
+
+    vector<GLfloat> coords;
+    vector<GLfloat> tex_coords;
+    vector<GLfloat> normals;
+    vector<GLfloat> colours;
+
+  public:
+    void clear() {
+	coords.clear();
+	tex_coords.clear();
+	normals.clear();
+	colours.clear();
+    }
+
+    size_t size() const { return coords.size() / 3; }
+
+    // Texture coordinates and normals must either be specified for all
+    // vertices or none.
+    void AddVertex(const Vector3 & v) {
+	coords.push_back(v.GetX());
+	coords.push_back(v.GetY());
+	coords.push_back(v.GetZ());
+	colours.resize(colours.size() + 4);
+    }
+    void AddVertex(const Vector3 & v, glaTexCoord tex_x, glaTexCoord tex_y) {
+	AddVertex(v);
+	tex_coords.push_back(tex_x);
+	tex_coords.push_back(tex_y);
+    }
+    void AddVertex(const Vector3 & v, glaTexCoord tex_x, glaTexCoord tex_y,
+		   const Vector3 & normal) {
+	AddVertex(v, tex_x, tex_y);
+	normals.push_back(normal.GetX());
+	normals.push_back(normal.GetY());
+	normals.push_back(normal.GetZ());
+    }
+
+    glaCoord GetZ(size_t i) const { return coords[i * 3 + 2]; }
+
+    void SetColour(size_t i, const GLAPen& pen, double rgb_scale, double alpha) {
+	GLfloat * p = &colours[i * 4];
+	p[0] = pen.GetRed() * rgb_scale;
+	p[1] = pen.GetGreen() * rgb_scale;
+	p[2] = pen.GetBlue() * rgb_scale;
+	p[3] = alpha;
+    }
+};
+
 class GLACanvas : public wxGLCanvas {
     friend class GLAList; // For flag values.
 
@@ -193,7 +250,7 @@ public:
     void DrawList(unsigned int l);
     void DrawListZPrepass(unsigned int l);
     void DrawList2D(unsigned int l, glaCoord x, glaCoord y, Double rotation);
-    void InvalidateList(unsigned int l) {
+    virtual void InvalidateList(unsigned int l) {
 	if (l < drawing_lists.size()) {
 	    // Invalidate any existing cached list.
 	    drawing_lists[l].invalidate_if(CACHED);
@@ -210,7 +267,10 @@ public:
 
     void DrawText(glaCoord x, glaCoord y, glaCoord z, const wxString& str);
     void DrawIndicatorText(int x, int y, const wxString& str);
+    void DrawIndicatorText(int x, int y, const wxChar* str, size_t len);
     void GetTextExtent(const wxString& str, int * x_ext, int * y_ext) const;
+    void GetTextExtent(const wxChar* str, size_t len,
+		       int * x_ext, int * y_ext) const;
 
     void BeginQuadrilaterals();
     void EndQuadrilaterals();
@@ -231,6 +291,11 @@ public:
     void BeginCrosses();
     void EndCrosses();
 
+    void BeginVertexArray(const GLAVertexArray & array);
+    void EndVertexArray();
+    void DrawPolylineFromArray(size_t first, size_t count);
+    void DrawQuadrilateralsFromArray(size_t first, size_t count);
+
     void DrawRectangle(gla_colour fill, gla_colour edge,
 		       glaCoord x0, glaCoord y0, glaCoord w, glaCoord h);
     void DrawShadedRectangle(const GLAPen & fill_bot, const GLAPen & fill_top,
@@ -281,6 +346,22 @@ public:
     bool Transform(const Vector3 & v, double* x_out, double* y_out, double* z_out) const;
     void ReverseTransform(Double x, Double y, double* x_out, double* y_out, double* z_out) const;
 
+    // Returns -1 if box is entirely outside the view, otherwise roughly how
+    // many pixels across it appears (HUGE_VAL if it may fill the view).
+    //
+    // If margin is non-zero, the view is treated as extending that fraction
+    // of its width and height beyond each edge.
+    double GetScreenSize(const BoundingBox& box, double margin = 0.0) const;
+
+    // Returns false if no part of box can appear within distance r of window
+    // position (x, y) (in the coordinate system Transform() returns).
+    bool BoxNearPoint(const BoundingBox& box, double x, double y,
+		      double r) const;
+
+    // The data transform, as last set by SetDataTransform().
+    const GLdouble* GetModelviewMatrix() const { return modelview_matrix; }
+    const GLdouble* GetProjectionMatrix() const { return projection_matrix; }
+
     int GetFontSize() const { return m_Font.get_font_size(); }
 
     void ToggleSmoothShading();
@@ -33,67 +33,15 @@
 #include <math.h>
 
 #include "useful.h"
-#include <proj.h>
-
-#include "aven.h"
-#include "message.h"
 
 using namespace std;
 
-#define WGS84_DATUM_STRING "EPSG:4326"
-
-static void
-html_escape(FILE *fh, const char *s)
+GPX::GPX(const char * input_datum) : out(input_datum)
 {
-    while (*s) {
-	switch (*s) {
-	    case '<':
-		fputs("&lt;", fh);
-		break;
-	    case '>':
-		fputs("&gt;", fh);
-		break;
-	    case '&':
-		fputs("&amp;", fh);
-		break;
-	    default:
-		PUTC(*s, fh);
-	}
-	++s;
-    }
-}
-
-static void discarding_proj_logger(void *, int, const char *) { }
-
-GPX::GPX(const char * input_datum)
-{
-    /* Prevent stderr spew from PROJ. */
-    proj_log_func(PJ_DEFAULT_CTX, nullptr, discarding_proj_logger);
-
-    pj = proj_create_crs_to_crs(PJ_DEFAULT_CTX,
-				input_datum, WGS84_DATUM_STRING,
-				NULL);
-
-    if (pj) {
-	// Normalise the output order so x is longitude and y latitude - by
-	// default new PROJ has them switched for EPSG:4326 which just seems
-	// confusing.
-	PJ* pj_norm = proj_normalize_for_visualization(PJ_DEFAULT_CTX, pj);
-	proj_destroy(pj);
-	pj = pj_norm;
-    }
-
-    if (!pj) {
-	wxString m = wmsg(/*Failed to initialise input coordinate system “%s”*/287);
-	m = wxString::Format(m.c_str(), input_datum);
-	throw m;
-    }
 }
 
 GPX::~GPX()
 {
-    if (pj)
-	proj_destroy(pj);
     free((void*)trk_name);
 }
 
@@ -108,17 +56,17 @@ GPX::passes() const
 void GPX::header(const char * title, const char *, time_t datestamp_numeric,
 		 double, double, double, double, double, double)
 {
-    fputs(
+    out.put(
 "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
 "<gpx version=\"1.0\" creator=\"" PACKAGE_STRING " (aven) - https://survex.com/\""
 " xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\""
 " xmlns=\"http://www.topografix.com/GPX/1/0\""
 " xsi:schemaLocation=\"http://www.topografix.com/GPX/1/0"
-" http://www.topografix.com/GPX/1/0/gpx.xsd\">\n", fh);
+" http://www.topografix.com/GPX/1/0/gpx.xsd\">\n");
     if (title) {
-	fputs("<name>", fh);
-	html_escape(fh, title);
-	fputs("</name>\n", fh);
+	out.put("<name>");
+	out.put_escaped(title);
+	out.put("</name>\n");
 	trk_name = strdup(title);
     }
     if (datestamp_numeric != time_t(-1)) {
@@ -126,9 +74,9 @@ void GPX::header(const char * title, const char *, time_t datestamp_numeric,
 	if (tm) {
 	    char buf[32];
 	    if (strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", tm)) {
-		fputs("<time>", fh);
-		fputs(buf, fh);
-		fputs("</time>\n", fh);
+		out.put("<time>");
+		out.put(buf);
+		out.put("</time>\n");
 	    }
 	}
     }
@@ -138,86 +86,76 @@ void GPX::header(const char * title, const char *, time_t datestamp_numeric,
     // to WGS84 lat+long...
 }
 
+void
+GPX::put_lon_lat_ele(const img_point *p)
+{
+    // %.8f is at worst just over 1mm.
+    unsigned point = out.add_point(p->x, p->y, p->z);
+    out.put(" lon=\"");
+    out.put_lon(point);
+    out.put("\" lat=\"");
+    out.put_lat(point);
+    out.put("\"><ele>");
+    out.put_alt(point);
+    out.put("</ele>");
+}
+
 void
 GPX::line(const img_point *p1, const img_point *p, unsigned /*flags*/, bool fPendingMove)
 {
     if (fPendingMove) {
+	if (out.want_flush()) out.flush(fh);
 	if (in_trkseg) {
-	    fputs("</trkseg><trkseg>\n", fh);
+	    out.put("</trkseg><trkseg>\n");
 	} else {
-	    fputs("<trk>", fh);
+	    out.put("<trk>");
 	    if (trk_name) {
-		fputs("<name>", fh);
-		html_escape(fh, trk_name);
-		fputs("</name>", fh);
+		out.put("<name>");
+		out.put_escaped(trk_name);
+		out.put("</name>");
 	    }
-	    fputs("<trkseg>\n", fh);
+	    out.put("<trkseg>\n");
 	    in_trkseg = true;
 	}
-	PJ_COORD coord = {p1->x, p1->y, p1->z, HUGE_VAL};
-	coord = proj_trans(pj, PJ_FWD, coord);
-	if (coord.xyzt.x == HUGE_VAL ||
-	    coord.xyzt.y == HUGE_VAL ||
-	    coord.xyzt.z == HUGE_VAL) {
-	    // FIXME report errors
-	}
-	// %.8f is at worst just over 1mm.
-	fprintf(fh, "<trkpt lon=\"%.8f\" lat=\"%.8f\"><ele>%.2f</ele></trkpt>\n",
-		coord.xyzt.x,
-		coord.xyzt.y,
-		coord.xyzt.z);
+	out.put("<trkpt");
+	put_lon_lat_ele(p1);
+	out.put("</trkpt>\n");
     }
 
-    PJ_COORD coord = {p->x, p->y, p->z, HUGE_VAL};
-    coord = proj_trans(pj, PJ_FWD, coord);
-    if (coord.xyzt.x == HUGE_VAL ||
-	coord.xyzt.y == HUGE_VAL ||
-	coord.xyzt.z == HUGE_VAL) {
-	// FIXME report errors
-    }
-    // %.8f is at worst just over 1mm.
-    fprintf(fh, "<trkpt lon=\"%.8f\" lat=\"%.8f\"><ele>%.2f</ele></trkpt>\n",
-	    coord.xyzt.x,
-	    coord.xyzt.y,
-	    coord.xyzt.z);
+    out.put("<trkpt");
+    put_lon_lat_ele(p);
+    out.put("</trkpt>\n");
 }
 
 void
 GPX::label(const img_point *p, const char *s, bool /*fSurface*/, int type)
 {
-    PJ_COORD coord = {p->x, p->y, p->z, HUGE_VAL};
-    coord = proj_trans(pj, PJ_FWD, coord);
-    if (coord.xyzt.x == HUGE_VAL ||
-	coord.xyzt.y == HUGE_VAL ||
-	coord.xyzt.z == HUGE_VAL) {
-	// FIXME report errors
-    }
-    // %.8f is at worst just over 1mm.
-    fprintf(fh, "<wpt lon=\"%.8f\" lat=\"%.8f\"><ele>%.2f</ele><name>",
-	    coord.xyzt.x,
-	    coord.xyzt.y,
-	    coord.xyzt.z);
-    html_escape(fh, s);
-    fputs("</name>", fh);
+    out.put("<wpt");
+    put_lon_lat_ele(p);
+    out.put("<name>");
+    out.put_escaped(s);
+    out.put("</name>");
     // Add a "pin" symbol with colour matching what aven shows.
     switch (type) {
 	case FIXES:
-	    fputs("<sym>Pin, Red</sym>", fh);
+	    out.put("<sym>Pin, Red</sym>");
 	    break;
 	case EXPORTS:
-	    fputs("<sym>Pin, Blue</sym>", fh);
+	    out.put("<sym>Pin, Blue</sym>");
 	    break;
 	case ENTS:
-	    fputs("<sym>Pin, Green</sym>", fh);
+	    out.put("<sym>Pin, Green</sym>");
 	    break;
     }
-    fputs("</wpt>\n", fh);
+    out.put("</wpt>\n");
+    if (out.want_flush()) out.flush(fh);
 }
 
 void
 GPX::footer()
 {
     if (in_trkseg)
-	fputs("</trkseg></trk>\n", fh);
-    fputs("</gpx>\n", fh);
+	out.put("</trkseg></trk>\n");
+    out.put("</gpx>\n");
+    out.flush(fh);
 }
@@ -21,12 +21,14 @@
 
 #include "exportfilter.h"
 
-#include <proj.h>
+#include "wgs84writer.h"
 
 class GPX : public ExportFilter {
-    PJ* pj = NULL;
+    WGS84Writer out;
     bool in_trkseg = false;
     const char * trk_name = NULL;
+
+    void put_lon_lat_ele(const img_point *p);
   public:
     explicit GPX(const char * input_datum);
     ~GPX();
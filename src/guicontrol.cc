@@ -233,7 +233,7 @@ void GUIControl::HandleNonDrag(const wxPoint & point) {
 	    }
 	}
     }
-    if (m_View->CheckHitTestGrid(point, false)) {
+    if (m_View->CheckHitTest(point, false)) {
 	m_View->UpdateCursor(GfxCore::CURSOR_POINTING_HAND);
     } else if (m_View->PointWithinScaleBar(point)) {
 	m_View->UpdateCursor(GfxCore::CURSOR_HORIZONTAL_RESIZE);
@@ -395,7 +395,7 @@ void GUIControl::OnLButtonUp(wxMouseEvent& event)
 
 	if (event.GetPosition() == m_DragRealStart) {
 	    // Just a "click"...
-	    m_View->CheckHitTestGrid(m_DragStart, true);
+	    m_View->CheckHitTest(m_DragStart, true);
 	    RestoreCursor();
 	} else {
 	    HandleNonDrag(event.GetPosition());
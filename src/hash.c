@@ -18,6 +18,7 @@
  */
 
 #include <ctype.h>
+#include <string.h>
 
 #include "debug.h"
 #include "hash.h"
@@ -54,3 +55,35 @@ hash_data(const char *p, size_t len)
       hash = (hash * HASH_PRIME + *(const unsigned char*)p) & 0x7fff;
    return hash;
 }
+
+/* This is MurmurHash64A, which Austin Appleby placed in the public domain. */
+uint64_t
+hash64_data(const void *p, size_t len)
+{
+   const uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+   const int r = 47;
+   const unsigned char *q = (const unsigned char *)p;
+   uint64_t hash = UINT64_C(0x5bd1e9955bd1e995) ^ (len * m);
+   SVX_ASSERT(p || len == 0);
+   while (len >= 8) {
+      uint64_t k;
+      memcpy(&k, q, 8);
+      k *= m;
+      k ^= k >> r;
+      k *= m;
+      hash ^= k;
+      hash *= m;
+      q += 8;
+      len -= 8;
+   }
+   if (len) {
+      uint64_t k = 0;
+      while (len--) k = (k << 8) | q[len];
+      hash ^= k;
+      hash *= m;
+   }
+   hash ^= hash >> r;
+   hash *= m;
+   hash ^= hash >> r;
+   return hash;
+}
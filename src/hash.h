@@ -17,6 +17,9 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,6 +28,13 @@ int hash_string(const char *p);
 int hash_lc_string(const char *p);
 int hash_data(const char *p, size_t len);
 
+/* The functions above only return 15 bits.  This returns 64 well-mixed bits,
+ * so it's suitable for tables of any size (mask off as many low bits as
+ * needed).  The result depends on the byte order, so it shouldn't be stored
+ * in files.
+ */
+uint64_t hash64_data(const void *p, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -40,11 +40,12 @@
 
 # define HPGL_CROSS_SIZE 28 /* length of cross arms (in HPGL units) */
 
-static long xpPageWidth, ypPageDepth;
+/* Several exports may be running in different threads at once. */
+static thread_local long xpPageWidth, ypPageDepth;
 
 static long x_org = 0, y_org = 0;
 static bool fNewLines = fTrue;
-static bool fOriginInCentre = fFalse;
+static thread_local bool fOriginInCentre = fFalse;
 
 /* Check if this line intersects the current page */
 /* Initialise HPGL routines. */
@@ -29,6 +29,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
 
 #include "img.h"
 
@@ -243,6 +247,37 @@ getu16(FILE *fh)
    return (unsigned short)get16(fh);
 }
 
+/* Functions for decoding format version >= 8 data from memory.  Callers must
+ * check there's enough data left first using DATA_LEFT().
+ */
+#define DATA_LEFT(P) ((size_t)((P)->data_end - (P)->data_ptr))
+
+static unsigned short
+data_getu16(img *pimg)
+{
+   const unsigned char *q = pimg->data_ptr;
+   pimg->data_ptr += 2;
+   return (unsigned short)(q[0] | (q[1] << 8));
+}
+
+static short
+data_get16(img *pimg)
+{
+   return (short)data_getu16(pimg);
+}
+
+static INT32_T
+data_get32(img *pimg)
+{
+   const unsigned char *q = pimg->data_ptr;
+   UINT32_T w = q[0];
+   w |= (UINT32_T)q[1] << 8l;
+   w |= (UINT32_T)q[2] << 16l;
+   w |= (UINT32_T)q[3] << 24l;
+   pimg->data_ptr += 4;
+   return (INT32_T)w;
+}
+
 #include <math.h>
 
 #if !defined HAVE_LROUND && !defined HAVE_DECL_LROUND
@@ -437,6 +472,634 @@ img_open_survey(const char *fnm, const char *survey)
    return pimg;
 }
 
+/* Read the rest of the data from pimg->fh into memory so we can decode it
+ * without the overhead of going through stdio for each byte.  We use mmap() if
+ * we can, otherwise (e.g. for a pipe) we read it in large blocks.
+ */
+static int
+load_data(img *pimg)
+{
+   unsigned char *buf;
+   size_t size = 0, alloc = 65536;
+#ifdef HAVE_MMAP
+   struct stat sb;
+   int fd = fileno(pimg->fh);
+   long pos = ftell(pimg->fh);
+   if (pos >= 0 && fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+       sb.st_size > pos && (off_t)(size_t)sb.st_size == sb.st_size) {
+      void *p = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+	 pimg->data_buf = p;
+	 pimg->data_buf_len = (size_t)sb.st_size;
+	 pimg->data_mapped = 1;
+	 pimg->data_start = (const unsigned char *)p + pos;
+	 pimg->data_end = (const unsigned char *)p + (size_t)sb.st_size;
+	 pimg->data_ptr = pimg->data_start;
+	 return 1;
+      }
+   }
+#endif
+   buf = (unsigned char *)xosmalloc(alloc);
+   if (!buf) {
+      img_errno = IMG_OUTOFMEMORY;
+      return 0;
+   }
+   while (1) {
+      unsigned char *b;
+      size += fread(buf + size, 1, alloc - size, pimg->fh);
+      if (size < alloc) {
+	 if (ferror(pimg->fh)) {
+	    osfree(buf);
+	    img_errno = IMG_READERROR;
+	    return 0;
+	 }
+	 if (feof(pimg->fh)) break;
+	 continue;
+      }
+      alloc *= 2;
+      b = (unsigned char *)xosrealloc(buf, alloc);
+      if (!b) {
+	 osfree(buf);
+	 img_errno = IMG_OUTOFMEMORY;
+	 return 0;
+      }
+      buf = b;
+   }
+   pimg->data_buf = buf;
+   pimg->data_buf_len = size;
+   pimg->data_start = pimg->data_ptr = buf;
+   pimg->data_end = buf + size;
+   return 1;
+}
+
+static void
+free_data(img *pimg)
+{
+   if (!pimg->data_buf) return;
+#ifdef HAVE_MMAP
+   if (pimg->data_mapped) {
+      munmap(pimg->data_buf, pimg->data_buf_len);
+   } else
+#endif
+   {
+      osfree(pimg->data_buf);
+   }
+   pimg->data_buf = NULL;
+}
+
+/* Survey prefix index (format version >= 8).
+ *
+ * When writing, we split the items into chunks at points where the survey
+ * changes, and note
+ * the survey prefix which all the legs and stations in each chunk are in,
+ * along with the state a reader needs to start decoding at the start of the
+ * chunk (the label buffer, style, dates, and if the chunk starts part way
+ * along a traverse, the point the first leg starts from).  This is written
+ * after the end of data marker, so readers which don't know about it never
+ * see it.
+ *
+ * When reading with a survey filter, we use the index (if there is one) to
+ * skip over chunks which can't contain anything in the requested survey.
+ */
+
+/* Once a chunk is at least INDEX_CHUNK_MIN bytes, we end it if the survey
+ * changes in a way which would shorten its survey prefix, and once it's at
+ * least INDEX_CHUNK_MAX bytes we end it if the survey changes at all.
+ */
+#define INDEX_CHUNK_MIN 4096
+#define INDEX_CHUNK_MAX 16384
+#define INDEX_MAGIC "Svx3dIdx"
+
+typedef struct {
+   /* Offset from the start of the item data. */
+   unsigned long offset;
+   int style;
+   int days1, days2;
+   /* If the chunk starts with a leg continuing from the previous chunk, the
+    * point it starts from (in cm). */
+   int has_pt;
+   INT32_T pt[3];
+   char *label;
+   size_t label_len;
+   char *prefix;
+   size_t prefix_len;
+} index_entry;
+
+typedef struct {
+   char *s;
+   size_t len, size;
+} index_str;
+
+struct img_index {
+   index_entry *entries;
+   size_t n_entries, max_entries;
+
+   /* When reading, the entry for the next chunk and where it starts. */
+   size_t next;
+   const unsigned char *next_start;
+
+   /* When writing: */
+   /* Number of bytes written so far by v8_putc(), etc. */
+   unsigned long pos;
+   /* Common survey prefix of the items in the current chunk before the last
+    * point where we could start a new chunk. */
+   index_str prefix;
+   int have_prefix;
+   /* The last point where we could start a new chunk, the state there, and
+    * the common survey prefix of the items since. */
+   int have_cut;
+   index_entry cut;
+   index_str cut_label;
+   index_str cut_prefix;
+   int have_cut_prefix;
+   /* The survey of the last item with one. */
+   index_str last;
+   /* Non-zero if we're part way through writing a passage of img_XSECT. */
+   int in_passage;
+   /* If the last item was a leg or move, the point it ended at (in cm). */
+   int have_pt;
+   INT32_T pt[3];
+};
+
+/* Functions for writing format version 8 item data, which keep count of the
+ * bytes written so that the index knows where each chunk starts.  All the
+ * item data and the index entries must be written using these. */
+static void
+v8_putc(img *pimg, int c)
+{
+   PUTC(c, pimg->fh);
+   if (pimg->index) pimg->index->pos += 1;
+}
+
+static void
+v8_put16(img *pimg, short word)
+{
+   put16(word, pimg->fh);
+   if (pimg->index) pimg->index->pos += 2;
+}
+
+static void
+v8_put32(img *pimg, INT32_T word)
+{
+   put32(word, pimg->fh);
+   if (pimg->index) pimg->index->pos += 4;
+}
+
+static void
+v8_write(img *pimg, const char *s, size_t len)
+{
+   if (len == 0) return;
+   fwrite(s, len, 1, pimg->fh);
+   if (pimg->index) pimg->index->pos += len;
+}
+
+static int
+index_str_set(index_str *b, const char *s, size_t len)
+{
+   if (len >= b->size) {
+      size_t new_size = len + 64;
+      char *p = (char *)xosrealloc(b->s, new_size);
+      if (!p) return 0;
+      b->s = p;
+      b->size = new_size;
+   }
+   memcpy(b->s, s, len);
+   b->s[len] = '\0';
+   b->len = len;
+   return 1;
+}
+
+static char *
+index_memdup(const char *s, size_t len)
+{
+   char *p = (char *)xosmalloc(len + 1);
+   if (p) {
+      memcpy(p, s, len);
+      p[len] = '\0';
+   }
+   return p;
+}
+
+static void
+index_free(img *pimg)
+{
+   struct img_index *idx = pimg->index;
+   size_t i;
+   if (!idx) return;
+   for (i = 0; i < idx->n_entries; ++i) {
+      osfree(idx->entries[i].label);
+      osfree(idx->entries[i].prefix);
+   }
+   osfree(idx->entries);
+   osfree(idx->prefix.s);
+   osfree(idx->cut_label.s);
+   osfree(idx->cut_prefix.s);
+   osfree(idx->last.s);
+   osfree(idx);
+   pimg->index = NULL;
+}
+
+static struct img_index *
+index_new(void)
+{
+   struct img_index *idx = osnew(struct img_index);
+   if (!idx) return NULL;
+   memset(idx, 0, sizeof(struct img_index));
+   return idx;
+}
+
+/* Add an entry, taking ownership of label and prefix (which may be NULL). */
+static index_entry *
+index_add_entry(struct img_index *idx)
+{
+   index_entry *e;
+   if (idx->n_entries == idx->max_entries) {
+      size_t new_max = idx->max_entries ? idx->max_entries * 2 : 64;
+      e = (index_entry *)xosrealloc(idx->entries, new_max * sizeof(index_entry));
+      if (!e) return NULL;
+      idx->entries = e;
+      idx->max_entries = new_max;
+   }
+   e = &idx->entries[idx->n_entries++];
+   memset(e, 0, sizeof(index_entry));
+   return e;
+}
+
+/* Create an index for writing, with an entry for the first chunk. */
+static struct img_index *
+index_new_for_write(void)
+{
+   struct img_index *idx = index_new();
+   index_entry *e;
+   if (!idx) return NULL;
+   e = index_add_entry(idx);
+   if (!e || !(e->label = index_memdup("", 0))) {
+      osfree(idx->entries);
+      osfree(idx);
+      return NULL;
+   }
+   e->style = img_STYLE_UNKNOWN;
+   e->days1 = e->days2 = -1;
+   return idx;
+}
+
+/* Return the length of the longest common prefix of surveys a and b which is
+ * a whole number of levels.
+ */
+static size_t
+common_survey_prefix(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+   size_t i = 0, last_sep = 0;
+   while (i < a_len && i < b_len && a[i] == b[i]) {
+      if (a[i] == '.') last_sep = i;
+      ++i;
+   }
+   if (i == a_len && (i == b_len || b[i] == '.')) return i;
+   if (i == b_len && a[i] == '.') return i;
+   return last_sep;
+}
+
+/* Write a number of days (or -1 for none) in the index. */
+static void
+index_put_days(img *pimg, int days)
+{
+   v8_put16(pimg, (short)(days < 0 ? 0xffff : days));
+}
+
+/* Record the current state of pimg as somewhere a chunk could start.  line
+ * is non-zero if the next item is a leg continuing from the last point.
+ */
+static int
+index_cut_point(img *pimg, int line)
+{
+   struct img_index *idx = pimg->index;
+   if (idx->have_cut_prefix) {
+      /* Fold the items since the last cut point into the current chunk. */
+      if (idx->have_prefix) {
+	 idx->prefix.len = common_survey_prefix(idx->prefix.s, idx->prefix.len,
+						idx->cut_prefix.s,
+						idx->cut_prefix.len);
+      } else {
+	 if (!index_str_set(&idx->prefix, idx->cut_prefix.s,
+			    idx->cut_prefix.len))
+	    return 0;
+	 idx->have_prefix = 1;
+      }
+      idx->have_cut_prefix = 0;
+   }
+   idx->have_cut = 1;
+   idx->cut.offset = idx->pos;
+   idx->cut.has_pt = line;
+   memcpy(idx->cut.pt, idx->pt, sizeof(idx->pt));
+   idx->cut.style = pimg->oldstyle;
+#if IMG_API_VERSION == 0
+   idx->cut.days1 = pimg->olddate1 ? pimg->olddate1 / 86400 + 25567 : -1;
+   idx->cut.days2 = pimg->olddate2 ? pimg->olddate2 / 86400 + 25567 : -1;
+#else /* IMG_API_VERSION == 1 */
+   idx->cut.days1 = pimg->olddays1;
+   idx->cut.days2 = pimg->olddays2;
+#endif
+   return index_str_set(&idx->cut_label, pimg->label_buf, pimg->label_len);
+}
+
+/* Finish the current chunk, setting its survey prefix. */
+static int
+index_end_chunk(struct img_index *idx)
+{
+   index_entry *e = &idx->entries[idx->n_entries - 1];
+   if (idx->have_prefix) {
+      e->prefix_len = idx->prefix.len;
+      e->prefix = index_memdup(idx->prefix.s, idx->prefix.len);
+   } else {
+      e->prefix_len = 0;
+      e->prefix = index_memdup("", 0);
+   }
+   return e->prefix != NULL;
+}
+
+/* Start a new chunk at the last cut point. */
+static int
+index_start_chunk(struct img_index *idx)
+{
+   index_entry *e;
+   if (!index_end_chunk(idx)) return 0;
+   e = index_add_entry(idx);
+   if (!e) return 0;
+   *e = idx->cut;
+   e->label_len = idx->cut_label.len;
+   e->label = index_memdup(idx->cut_label.s, idx->cut_label.len);
+   if (!e->label) return 0;
+   idx->have_cut = 0;
+   idx->have_prefix = 0;
+   return 1;
+}
+
+/* Note that the next item is in survey s (of length len). */
+static int
+index_add_survey(struct img_index *idx, const char *s, size_t len)
+{
+   /* We can only start a new chunk if there's a cut point after the last
+    * item with a survey. */
+   if (idx->have_cut && !idx->have_cut_prefix && idx->have_prefix &&
+       (len != idx->last.len || memcmp(s, idx->last.s, len) != 0)) {
+      unsigned long size;
+      size = idx->cut.offset - idx->entries[idx->n_entries - 1].offset;
+      if (size >= INDEX_CHUNK_MAX ||
+	  (size >= INDEX_CHUNK_MIN &&
+	   common_survey_prefix(idx->prefix.s, idx->prefix.len,
+				s, len) < idx->prefix.len)) {
+	 if (!index_start_chunk(idx)) return 0;
+      }
+   }
+   if (!idx->have_cut_prefix) {
+      if (!index_str_set(&idx->cut_prefix, s, len)) return 0;
+      idx->have_cut_prefix = 1;
+   } else {
+      idx->cut_prefix.len = common_survey_prefix(idx->cut_prefix.s,
+						 idx->cut_prefix.len, s, len);
+   }
+   return index_str_set(&idx->last, s, len);
+}
+
+/* Update the index for an item about to be written. */
+static void
+index_write_item(img *pimg, int code, int flags, const char *s,
+		 double x, double y, double z)
+{
+   struct img_index *idx = pimg->index;
+   const char *survey;
+   size_t len;
+   if (!idx->in_passage) {
+      /* We can start a chunk at a leg which continues from a leg or move
+       * since the reader can turn it into a move and a leg, or at the start
+       * of a passage. */
+      int line = (code == img_LINE && idx->have_pt);
+      if (code == img_MOVE || code == img_LABEL || code == img_XSECT || line) {
+	 if (!index_cut_point(pimg, line)) goto failed;
+      }
+   }
+   idx->have_pt = (code == img_LINE || code == img_MOVE);
+   if (idx->have_pt) {
+      idx->pt[0] = (INT32_T)my_lround(x * 100.0);
+      idx->pt[1] = (INT32_T)my_lround(y * 100.0);
+      idx->pt[2] = (INT32_T)my_lround(z * 100.0);
+   }
+   switch (code) {
+      case img_LINE:
+	 survey = s ? s : "";
+	 len = strlen(survey);
+	 break;
+      case img_XSECT:
+	 idx->in_passage = !(flags & img_XFLAG_END);
+	 /* FALLTHRU */
+      case img_LABEL: {
+	 const char *p = strrchr(s, '.');
+	 survey = s;
+	 len = p ? (size_t)(p - s) : 0;
+	 break;
+      }
+      default:
+	 return;
+   }
+   if (!index_add_survey(idx, survey, len)) goto failed;
+   return;
+
+failed:
+   /* Out of memory - just don't write an index. */
+   index_free(pimg);
+}
+
+/* Write the index after the end of data marker.  end is the offset of the
+ * end of data marker. */
+static void
+index_write(img *pimg, unsigned long end)
+{
+   struct img_index *idx = pimg->index;
+   index_entry *e;
+   unsigned long start;
+   size_t i;
+
+   if (idx->n_entries < 2) {
+      /* Not worth having an index for a single chunk. */
+      return;
+   }
+
+   /* Finish off the last chunk, and add a final entry for the end of data
+    * marker (which is always included). */
+   if (!index_cut_point(pimg, 0) || !index_end_chunk(idx)) return;
+   e = index_add_entry(idx);
+   if (!e) return;
+   *e = idx->cut;
+   e->offset = end;
+   e->label_len = idx->cut_label.len;
+   e->label = index_memdup(idx->cut_label.s, idx->cut_label.len);
+   e->prefix = index_memdup("", 0);
+   if (!e->label || !e->prefix) return;
+
+   start = idx->pos;
+   for (i = 0; i < idx->n_entries; ++i) {
+      e = &idx->entries[i];
+      v8_put32(pimg, (INT32_T)e->offset);
+      v8_putc(pimg, e->style < 0 ? 0xff : e->style);
+      index_put_days(pimg, e->days1);
+      index_put_days(pimg, e->days2);
+      v8_putc(pimg, e->has_pt);
+      if (e->has_pt) {
+	 v8_put32(pimg, e->pt[0]);
+	 v8_put32(pimg, e->pt[1]);
+	 v8_put32(pimg, e->pt[2]);
+      }
+      v8_put32(pimg, (INT32_T)e->label_len);
+      v8_write(pimg, e->label, e->label_len);
+      v8_put32(pimg, (INT32_T)e->prefix_len);
+      v8_write(pimg, e->prefix, e->prefix_len);
+   }
+   /* The entries are followed by a fixed size trailer which isn't included
+    * in the length. */
+   put32((INT32_T)idx->n_entries, pimg->fh);
+   put32((INT32_T)(idx->pos - start), pimg->fh);
+   fputs(INDEX_MAGIC, pimg->fh);
+}
+
+/* Read the index if the item data is followed by one. */
+static void
+index_read(img *pimg)
+{
+   const unsigned char *p = pimg->data_end;
+   const unsigned char *index_end;
+   struct img_index *idx;
+   unsigned long n, len, prev_offset = 0;
+   size_t i;
+
+   if (DATA_LEFT(pimg) < 16 ||
+       memcmp(p - 8, INDEX_MAGIC, 8) != 0) {
+      return;
+   }
+   pimg->data_ptr = p - 16;
+   n = (UINT32_T)data_get32(pimg);
+   len = (UINT32_T)data_get32(pimg);
+   pimg->data_ptr = pimg->data_start;
+   index_end = p - 16;
+   if (n < 2 || len > (size_t)(index_end - pimg->data_start) ||
+       n > len / 18) {
+      return;
+   }
+
+   idx = index_new();
+   if (!idx) return;
+   pimg->index = idx;
+   pimg->data_ptr = index_end - len;
+   for (i = 0; i < n; ++i) {
+      index_entry *e = index_add_entry(idx);
+      if (!e) goto bad_index;
+      if ((size_t)(index_end - pimg->data_ptr) < 14) goto bad_index;
+      e->offset = (UINT32_T)data_get32(pimg);
+      e->style = *pimg->data_ptr++;
+      if (e->style == 0xff) e->style = img_STYLE_UNKNOWN;
+      e->days1 = data_getu16(pimg);
+      if (e->days1 == 0xffff) e->days1 = -1;
+      e->days2 = data_getu16(pimg);
+      if (e->days2 == 0xffff) e->days2 = -1;
+      e->has_pt = *pimg->data_ptr++;
+      if (e->has_pt) {
+	 if ((size_t)(index_end - pimg->data_ptr) < 16) goto bad_index;
+	 e->pt[0] = data_get32(pimg);
+	 e->pt[1] = data_get32(pimg);
+	 e->pt[2] = data_get32(pimg);
+      }
+      e->label_len = (UINT32_T)data_get32(pimg);
+      if ((size_t)(index_end - pimg->data_ptr) < e->label_len + 4)
+	 goto bad_index;
+      e->label = index_memdup((const char *)pimg->data_ptr, e->label_len);
+      pimg->data_ptr += e->label_len;
+      e->prefix_len = (UINT32_T)data_get32(pimg);
+      if ((size_t)(index_end - pimg->data_ptr) < e->prefix_len)
+	 goto bad_index;
+      e->prefix = index_memdup((const char *)pimg->data_ptr, e->prefix_len);
+      pimg->data_ptr += e->prefix_len;
+      if (!e->label || !e->prefix) goto bad_index;
+      /* Chunks must be in order and start before the index. */
+      if ((i ? e->offset <= prev_offset : e->offset != 0) ||
+	  e->offset >= (size_t)(index_end - len - pimg->data_start)) {
+	 goto bad_index;
+      }
+      prev_offset = e->offset;
+   }
+   pimg->data_ptr = pimg->data_start;
+   idx->next = 0;
+   idx->next_start = pimg->data_start;
+   return;
+
+bad_index:
+   /* Just ignore an index we can't make sense of. */
+   pimg->data_ptr = pimg->data_start;
+   index_free(pimg);
+}
+
+/* Could chunk e contain items in the survey we're filtering by? */
+static int
+index_chunk_included(const img *pimg, const index_entry *e)
+{
+   size_t l = pimg->survey_len;
+   if (e->prefix_len <= l) {
+      /* The chunk's survey prefix is the survey or one of its parents.
+       * Note that pimg->survey has a '.' appended. */
+      return memcmp(e->prefix, pimg->survey, e->prefix_len) == 0 &&
+	     (e->prefix_len == 0 || pimg->survey[e->prefix_len] == '.');
+   }
+   /* The chunk's survey prefix is within the survey. */
+   return memcmp(e->prefix, pimg->survey, l) == 0 && e->prefix[l] == '.';
+}
+
+/* We've reached the start of the next chunk - skip over any chunks which
+ * can't contain items in the survey we're filtering by.
+ */
+static void
+index_skip(img *pimg)
+{
+   struct img_index *idx = pimg->index;
+   size_t i = idx->next;
+   /* The final entry is for the end of data marker, which we always want. */
+   while (i < idx->n_entries - 1 &&
+	  !index_chunk_included(pimg, &idx->entries[i])) {
+      ++i;
+   }
+   if (i != idx->next) {
+      const index_entry *e = &idx->entries[i];
+      if (check_label_space(pimg, e->label_len + 1)) {
+	 pimg->data_ptr = pimg->data_start + e->offset;
+	 memcpy(pimg->label_buf, e->label, e->label_len + 1);
+	 pimg->label_len = e->label_len;
+	 pimg->style = e->style;
+#if IMG_API_VERSION == 0
+	 pimg->date1 = e->days1 < 0 ? 0 : (e->days1 - 25567) * 86400;
+	 pimg->date2 = e->days2 < 0 ? 0 : (e->days2 - 25567) * 86400;
+#else /* IMG_API_VERSION == 1 */
+	 pimg->days1 = e->days1;
+	 pimg->days2 = e->days2;
+#endif
+	 if (e->has_pt) {
+	    /* Return a move to where the first leg starts from. */
+	    pimg->mv.x = e->pt[0] / 100.0;
+	    pimg->mv.y = e->pt[1] / 100.0;
+	    pimg->mv.z = e->pt[2] / 100.0;
+	    pimg->pending = 15;
+	 } else {
+	    pimg->pending = 0;
+	 }
+      } else {
+	 /* Just decode the chunk. */
+	 i = idx->next;
+      }
+   }
+   idx->next = i + 1;
+   if (idx->next < idx->n_entries) {
+      idx->next_start = pimg->data_start + idx->entries[idx->next].offset;
+   } else {
+      idx->next_start = NULL;
+   }
+}
+
 img *
 img_read_stream_survey(FILE *stream, int (*close_func)(FILE*),
 		       const char *fnm,
@@ -474,6 +1137,13 @@ img_read_stream_survey(FILE *stream, int (*close_func)(FILE*),
    pimg->fRead = 1; /* reading from this file */
    img_errno = IMG_NONE;
 
+   pimg->data_start = pimg->data_ptr = pimg->data_end = NULL;
+   pimg->data_buf = NULL;
+   pimg->data_mapped = 0;
+   pimg->items_labels = NULL;
+   pimg->items_labels_size = 0;
+   pimg->index = NULL;
+
    pimg->flags = 0;
    pimg->filename_opened = NULL;
 
@@ -484,6 +1154,7 @@ img_read_stream_survey(FILE *stream, int (*close_func)(FILE*),
     * to detect whether we MOVE or LINE */
    pimg->label_len = 0;
    pimg->label_buf[0] = '\0';
+   pimg->label = pimg->label_buf;
 
    pimg->survey = NULL;
    pimg->survey_len = 0;
@@ -997,6 +1668,12 @@ bad_3d_date:
 
    pimg->start = ftell(pimg->fh);
 
+   if (pimg->version >= 8) {
+      if (!load_data(pimg)) goto error;
+      /* The index is only useful when filtering by survey. */
+      if (pimg->survey_len) index_read(pimg);
+   }
+
    return pimg;
 }
 
@@ -1007,11 +1684,19 @@ img_rewind(img *pimg)
       img_errno = IMG_WRITEERROR;
       return 0;
    }
-   if (fseek(pimg->fh, pimg->start, SEEK_SET) != 0) {
-      img_errno = IMG_READERROR;
-      return 0;
+   if (pimg->data_buf) {
+      pimg->data_ptr = pimg->data_start;
+      if (pimg->index) {
+	 pimg->index->next = 0;
+	 pimg->index->next_start = pimg->data_start;
+      }
+   } else {
+      if (fseek(pimg->fh, pimg->start, SEEK_SET) != 0) {
+	 img_errno = IMG_READERROR;
+	 return 0;
+      }
+      clearerr(pimg->fh);
    }
-   clearerr(pimg->fh);
    /* [VERSION_SURVEX_POS] already skipped heading line, or there wasn't one
     * [version 0] not in the middle of a 'LINE' command
     * [version >= 3] not in the middle of turning a LINE into a MOVE */
@@ -1025,7 +1710,15 @@ img_rewind(img *pimg)
    /* for VERSION_CMAP_SHOT, we store the last station here to detect whether
     * we MOVE or LINE */
    pimg->label_len = 0;
+   pimg->label_buf[0] = '\0';
    pimg->style = img_STYLE_UNKNOWN;
+   /* Reset the date too, so reading after img_rewind() gives the same as
+    * reading after opening the file. */
+#if IMG_API_VERSION == 0
+   pimg->date1 = pimg->date2 = 0;
+#else /* IMG_API_VERSION == 1 */
+   pimg->days1 = pimg->days2 = -1;
+#endif
    return 1;
 }
 
@@ -1163,6 +1856,9 @@ img_write_stream(FILE *stream, int (*close_func)(FILE*),
    pimg->length = 0.0;
    pimg->E = pimg->H = pimg->V = 0.0;
 
+   /* If we fail to allocate this, we just don't write an index. */
+   pimg->index = (pimg->version >= 8) ? index_new_for_write() : NULL;
+
    /* Don't check for write errors now - let img_close() report them... */
    return pimg;
 }
@@ -1275,6 +1971,31 @@ read_v3label(img *pimg)
    return 0;
 }
 
+static int
+data_read_coord(img *pimg, img_point *pt)
+{
+   SVX_ASSERT(pt);
+   if (DATA_LEFT(pimg) < 12) {
+      img_errno = IMG_BADFORMAT;
+      return 0;
+   }
+   pt->x = data_get32(pimg) / 100.0;
+   pt->y = data_get32(pimg) / 100.0;
+   pt->z = data_get32(pimg) / 100.0;
+   return 1;
+}
+
+static int
+data_skip_coord(img *pimg)
+{
+   if (DATA_LEFT(pimg) < 12) {
+      img_errno = IMG_BADFORMAT;
+      return 0;
+   }
+   pimg->data_ptr += 12;
+   return 1;
+}
+
 static int
 read_v8label(img *pimg, int common_flag, size_t common_val)
 {
@@ -1284,42 +2005,28 @@ read_v8label(img *pimg, int common_flag, size_t common_val)
       if (common_val == 0) return 0;
       add = del = common_val;
    } else {
-      int ch = GETC(pimg->fh);
-      if (ch == EOF) {
-	 img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
-	 return img_BAD;
-      }
+      int ch;
+      if (DATA_LEFT(pimg) < 1) goto bad_format;
+      ch = *pimg->data_ptr++;
       if (ch != 0x00) {
 	 del = ch >> 4;
 	 add = ch & 0x0f;
       } else {
-	 ch = GETC(pimg->fh);
-	 if (ch == EOF) {
-	    img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
-	    return img_BAD;
-	 }
+	 if (DATA_LEFT(pimg) < 1) goto bad_format;
+	 ch = *pimg->data_ptr++;
 	 if (ch != 0xff) {
 	    del = ch;
 	 } else {
-	    del = get32(pimg->fh);
-	    if (ferror(pimg->fh)) {
-	       img_errno = IMG_READERROR;
-	       return img_BAD;
-	    }
-	 }
-	 ch = GETC(pimg->fh);
-	 if (ch == EOF) {
-	    img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
-	    return img_BAD;
+	    if (DATA_LEFT(pimg) < 4) goto bad_format;
+	    del = data_get32(pimg);
 	 }
+	 if (DATA_LEFT(pimg) < 1) goto bad_format;
+	 ch = *pimg->data_ptr++;
 	 if (ch != 0xff) {
 	    add = ch;
 	 } else {
-	    add = get32(pimg->fh);
-	    if (ferror(pimg->fh)) {
-	       img_errno = IMG_READERROR;
-	       return img_BAD;
-	    }
+	    if (DATA_LEFT(pimg) < 4) goto bad_format;
+	    add = data_get32(pimg);
 	 }
       }
 
@@ -1328,19 +2035,21 @@ read_v8label(img *pimg, int common_flag, size_t common_val)
 	 return img_BAD;
       }
    }
-   if (del > pimg->label_len) {
-      img_errno = IMG_BADFORMAT;
-      return img_BAD;
-   }
+   if (del > pimg->label_len) goto bad_format;
    pimg->label_len -= del;
    q = pimg->label_buf + pimg->label_len;
    pimg->label_len += add;
-   if (add && fread(q, add, 1, pimg->fh) != 1) {
-      img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
-      return img_BAD;
+   if (add) {
+      if (DATA_LEFT(pimg) < add) goto bad_format;
+      memcpy(q, pimg->data_ptr, add);
+      pimg->data_ptr += add;
    }
    q[add] = '\0';
    return 0;
+
+bad_format:
+   img_errno = IMG_BADFORMAT;
+   return img_BAD;
 }
 
 static int img_read_item_new(img *pimg, img_point *p);
@@ -1365,6 +2074,307 @@ img_read_item(img *pimg, img_point *p)
    }
 }
 
+/* Where we've got to in filling the img_read_items() label pool. */
+typedef struct {
+   /* Bytes of the pool used so far. */
+   size_t used;
+   /* The offset and length of the last label added. */
+   size_t last, last_len;
+} items_pool;
+
+/* Add label (which is len bytes long) to the img_read_items() label pool.
+ *
+ * Returns 0 if we fail to allocate memory.
+ */
+static int
+items_pool_add(img *pimg, items_pool *pool, const char *label, size_t len)
+{
+   if (pool->used + len + 1 > pimg->items_labels_size) {
+      size_t new_size = pimg->items_labels_size * 2;
+      char *b;
+      if (new_size < pool->used + len + 1) new_size = pool->used + len + 257;
+      b = (char *)xosrealloc(pimg->items_labels, new_size);
+      if (!b) {
+	 img_errno = IMG_OUTOFMEMORY;
+	 return 0;
+      }
+      pimg->items_labels = b;
+      pimg->items_labels_size = new_size;
+   }
+   memcpy(pimg->items_labels + pool->used, label, len);
+   pimg->items_labels[pool->used + len] = '\0';
+   pool->last = pool->used;
+   pool->last_len = len;
+   pool->used += len + 1;
+   return 1;
+}
+
+/* Decode format version 8 items for img_read_items().
+ *
+ * This gives the same items as calling img_read_item_new() repeatedly, but
+ * decodes straight from the data in memory into items in a single loop, and
+ * only copies the label into the pool when it changes.  It's only used when
+ * we aren't filtering by survey, so there's no survey filtering or index
+ * skipping to handle here, and pimg->pending can only be 0 or 256.
+ */
+static size_t
+read_items_v8(img *pimg, img_item *items, size_t max_items, items_pool *pool)
+{
+   size_t n = 0;
+   /* Non-zero if the label has changed since it was last added to the
+    * pool. */
+   int label_changed = 1;
+   pimg->label = pimg->label_buf;
+   while (n < max_items) {
+      img_item *item = &items[n++];
+      int opt;
+      item->flags = 0;
+      item->l = item->r = item->u = item->d = -1.0;
+      if (pimg->pending == 256) {
+	 pimg->pending = 0;
+	 item->code = img_XSECT_END;
+	 goto got_item;
+      }
+      /* Handle any style and date changes before the next item. */
+      while (1) {
+	 if (DATA_LEFT(pimg) < 1) goto bad_format;
+	 opt = *pimg->data_ptr++;
+	 if (opt <= 4) {
+	    if (opt == 0 && pimg->style == 0) {
+	       /* End of data marker. */
+	       item->code = img_STOP;
+	       item->label = 0;
+	       item->label_len = 0;
+	       return n;
+	    }
+	    /* STYLE */
+	    pimg->style = opt;
+	    continue;
+	 }
+	 switch (opt) {
+	    case 0x10: /* No date info */
+#if IMG_API_VERSION == 0
+	       pimg->date1 = pimg->date2 = 0;
+#else /* IMG_API_VERSION == 1 */
+	       pimg->days1 = pimg->days2 = -1;
+#endif
+	       continue;
+	    case 0x11: { /* Single date */
+	       int days1;
+	       if (DATA_LEFT(pimg) < 2) goto bad_format;
+	       days1 = (int)data_getu16(pimg);
+#if IMG_API_VERSION == 0
+	       pimg->date2 = pimg->date1 = (days1 - 25567) * 86400;
+#else /* IMG_API_VERSION == 1 */
+	       pimg->days2 = pimg->days1 = days1;
+#endif
+	       continue;
+	    }
+	    case 0x12: { /* Date range (short) */
+	       int days1, days2;
+	       if (DATA_LEFT(pimg) < 3) goto bad_format;
+	       days1 = (int)data_getu16(pimg);
+	       days2 = days1 + *pimg->data_ptr++ + 1;
+#if IMG_API_VERSION == 0
+	       pimg->date1 = (days1 - 25567) * 86400;
+	       pimg->date2 = (days2 - 25567) * 86400;
+#else /* IMG_API_VERSION == 1 */
+	       pimg->days1 = days1;
+	       pimg->days2 = days2;
+#endif
+	       continue;
+	    }
+	    case 0x13: { /* Date range (long) */
+	       int days1, days2;
+	       if (DATA_LEFT(pimg) < 4) goto bad_format;
+	       days1 = (int)data_getu16(pimg);
+	       days2 = (int)data_getu16(pimg);
+#if IMG_API_VERSION == 0
+	       pimg->date1 = (days1 - 25567) * 86400;
+	       pimg->date2 = (days2 - 25567) * 86400;
+#else /* IMG_API_VERSION == 1 */
+	       pimg->days1 = days1;
+	       pimg->days2 = days2;
+#endif
+	       continue;
+	    }
+	 }
+	 break;
+      }
+
+      if (opt >= 0x80) {
+	 if (read_v8label(pimg, 0, 0) == img_BAD) goto bad;
+	 label_changed = 1;
+	 item->code = img_LABEL;
+	 item->flags = opt & 0x7f;
+      } else if (opt >= 0x40) {
+	 /* If bit 0x20 is set, the leg is in the same survey as the last
+	  * item. */
+	 if (!(opt & 0x20)) {
+	    if (read_v8label(pimg, 0, 0) == img_BAD) goto bad;
+	    label_changed = 1;
+	 }
+	 item->code = img_LINE;
+	 item->flags = opt & 0x1f;
+      } else if (opt == 15) {
+	 item->code = img_MOVE;
+      } else {
+	 switch (opt) {
+	    case 0x1f: /* Error info */
+	       if (DATA_LEFT(pimg) < 20) goto bad_format;
+	       item->code = img_ERROR_INFO;
+	       item->n_legs = data_get32(pimg);
+	       item->length = data_get32(pimg) / 100.0;
+	       item->E = data_get32(pimg) / 100.0;
+	       item->H = data_get32(pimg) / 100.0;
+	       item->V = data_get32(pimg) / 100.0;
+	       goto got_item;
+	    case 0x30: case 0x31: /* LRUD */
+	    case 0x32: case 0x33: /* Big LRUD! */
+	       if (read_v8label(pimg, 0, 0) == img_BAD) goto bad;
+	       label_changed = 1;
+	       if (opt < 0x32) {
+		  if (DATA_LEFT(pimg) < 8) goto bad_format;
+		  item->l = data_get16(pimg) / 100.0;
+		  item->r = data_get16(pimg) / 100.0;
+		  item->u = data_get16(pimg) / 100.0;
+		  item->d = data_get16(pimg) / 100.0;
+	       } else {
+		  if (DATA_LEFT(pimg) < 16) goto bad_format;
+		  item->l = data_get32(pimg) / 100.0;
+		  item->r = data_get32(pimg) / 100.0;
+		  item->u = data_get32(pimg) / 100.0;
+		  item->d = data_get32(pimg) / 100.0;
+	       }
+	       /* If this is the last cross-section in this passage, set
+		* pending so we return img_XSECT_END next. */
+	       if (opt & 0x01) pimg->pending = 256;
+	       item->code = img_XSECT;
+	       goto got_item;
+	    default:
+	       /* 5-14 are reserved, and 0x14 - 0x1e, 0x20 - 0x2f and 0x34 -
+		* 0x3f are currently unallocated. */
+	       goto bad_format;
+	 }
+      }
+
+      if (DATA_LEFT(pimg) < 12) goto bad_format;
+      item->p.x = data_get32(pimg) / 100.0;
+      item->p.y = data_get32(pimg) / 100.0;
+      item->p.z = data_get32(pimg) / 100.0;
+
+got_item:
+      item->style = pimg->style;
+#if IMG_API_VERSION == 0
+      item->date1 = pimg->date1;
+      item->date2 = pimg->date2;
+#else /* IMG_API_VERSION == 1 */
+      item->days1 = pimg->days1;
+      item->days2 = pimg->days2;
+#endif
+      if (label_changed) {
+	 if (!items_pool_add(pimg, pool, pimg->label_buf, pimg->label_len))
+	    goto bad;
+	 label_changed = 0;
+      }
+      item->label = pool->last;
+      item->label_len = pool->last_len;
+   }
+   return n;
+
+bad_format:
+   img_errno = IMG_BADFORMAT;
+bad:
+   items[n - 1].code = img_BAD;
+   items[n - 1].label = 0;
+   items[n - 1].label_len = 0;
+   return n;
+}
+
+size_t
+img_read_items(img *pimg, img_item *items, size_t max_items,
+	       const char **labels)
+{
+   size_t n = 0;
+   items_pool pool;
+   if (!pimg->items_labels) {
+      pimg->items_labels = (char *)xosmalloc(256);
+      if (!pimg->items_labels) {
+	 img_errno = IMG_OUTOFMEMORY;
+	 *labels = "";
+	 if (max_items == 0) return 0;
+	 items[0].code = img_BAD;
+	 items[0].label = 0;
+	 items[0].label_len = 0;
+	 return 1;
+      }
+      pimg->items_labels_size = 256;
+   }
+   /* Offset 0 in the pool is always an empty label, which is what the
+    * img_STOP or img_BAD item gets. */
+   pimg->items_labels[0] = '\0';
+   pool.used = 1;
+   pool.last = 0;
+   pool.last_len = 0;
+
+   if (pimg->version >= 8 && !pimg->survey_len) {
+      n = read_items_v8(pimg, items, max_items, &pool);
+      *labels = pimg->items_labels;
+      return n;
+   }
+
+   /* For other formats, or when filtering by survey, read each item with
+    * img_read_item(). */
+   while (n < max_items) {
+      img_item *item = &items[n++];
+      size_t len;
+      int code = img_read_item(pimg, &item->p);
+      item->code = code;
+      if (code == img_STOP || code == img_BAD) {
+	 item->label = 0;
+	 item->label_len = 0;
+	 break;
+      }
+      item->flags = pimg->flags;
+      item->style = pimg->style;
+#if IMG_API_VERSION == 0
+      item->date1 = pimg->date1;
+      item->date2 = pimg->date2;
+#else /* IMG_API_VERSION == 1 */
+      item->days1 = pimg->days1;
+      item->days2 = pimg->days2;
+#endif
+      item->l = pimg->l;
+      item->r = pimg->r;
+      item->u = pimg->u;
+      item->d = pimg->d;
+      if (code == img_ERROR_INFO) {
+	 item->n_legs = pimg->n_legs;
+	 item->length = pimg->length;
+	 item->E = pimg->E;
+	 item->H = pimg->H;
+	 item->V = pimg->V;
+      }
+
+      /* Only add the label to the pool if it differs from the previous one,
+       * which avoids copying the survey name for every leg. */
+      len = strlen(pimg->label);
+      if (len != pool.last_len ||
+	  memcmp(pimg->items_labels + pool.last, pimg->label, len) != 0) {
+	 if (!items_pool_add(pimg, &pool, pimg->label, len)) {
+	    item->code = img_BAD;
+	    item->label = 0;
+	    item->label_len = 0;
+	    break;
+	 }
+      }
+      item->label = pool.last;
+      item->label_len = len;
+   }
+   *labels = pimg->items_labels;
+   return n;
+}
+
 static int
 img_read_item_new(img *pimg, img_point *p)
 {
@@ -1382,12 +2392,11 @@ img_read_item_new(img *pimg, img_point *p)
       return img_LINE;
    }
    again3: /* label to goto if we get a prefix, date, or lrud */
+   if (pimg->index && pimg->data_ptr == pimg->index->next_start)
+      index_skip(pimg);
    pimg->label = pimg->label_buf;
-   opt = GETC(pimg->fh);
-   if (opt == EOF) {
-      img_errno = feof(pimg->fh) ? IMG_BADFORMAT : IMG_READERROR;
-      return img_BAD;
-   }
+   if (DATA_LEFT(pimg) < 1) goto bad_format;
+   opt = *pimg->data_ptr++;
    if (opt >> 6 == 0) {
       if (opt <= 4) {
 	 if (opt == 0 && pimg->style == 0)
@@ -1407,7 +2416,9 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x11: { /* Single date */
-		  int days1 = (int)getu16(pimg->fh);
+		  int days1;
+		  if (DATA_LEFT(pimg) < 2) goto bad_format;
+		  days1 = (int)data_getu16(pimg);
 #if IMG_API_VERSION == 0
 		  pimg->date2 = pimg->date1 = (days1 - 25567) * 86400;
 #else /* IMG_API_VERSION == 1 */
@@ -1416,8 +2427,10 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x12: { /* Date range (short) */
-		  int days1 = (int)getu16(pimg->fh);
-		  int days2 = days1 + GETC(pimg->fh) + 1;
+		  int days1, days2;
+		  if (DATA_LEFT(pimg) < 3) goto bad_format;
+		  days1 = (int)data_getu16(pimg);
+		  days2 = days1 + *pimg->data_ptr++ + 1;
 #if IMG_API_VERSION == 0
 		  pimg->date1 = (days1 - 25567) * 86400;
 		  pimg->date2 = (days2 - 25567) * 86400;
@@ -1428,8 +2441,10 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x13: { /* Date range (long) */
-		  int days1 = (int)getu16(pimg->fh);
-		  int days2 = (int)getu16(pimg->fh);
+		  int days1, days2;
+		  if (DATA_LEFT(pimg) < 4) goto bad_format;
+		  days1 = (int)data_getu16(pimg);
+		  days2 = (int)data_getu16(pimg);
 #if IMG_API_VERSION == 0
 		  pimg->date1 = (days1 - 25567) * 86400;
 		  pimg->date2 = (days2 - 25567) * 86400;
@@ -1440,26 +2455,29 @@ img_read_item_new(img *pimg, img_point *p)
 		  break;
 	      }
 	      case 0x1f: /* Error info */
-		  pimg->n_legs = get32(pimg->fh);
-		  pimg->length = get32(pimg->fh) / 100.0;
-		  pimg->E = get32(pimg->fh) / 100.0;
-		  pimg->H = get32(pimg->fh) / 100.0;
-		  pimg->V = get32(pimg->fh) / 100.0;
+		  if (DATA_LEFT(pimg) < 20) goto bad_format;
+		  pimg->n_legs = data_get32(pimg);
+		  pimg->length = data_get32(pimg) / 100.0;
+		  pimg->E = data_get32(pimg) / 100.0;
+		  pimg->H = data_get32(pimg) / 100.0;
+		  pimg->V = data_get32(pimg) / 100.0;
 		  return img_ERROR_INFO;
 	      case 0x30: case 0x31: /* LRUD */
 	      case 0x32: case 0x33: /* Big LRUD! */
 		  if (read_v8label(pimg, 0, 0) == img_BAD) return img_BAD;
 		  pimg->flags = (int)opt & 0x01;
 		  if (opt < 0x32) {
-		      pimg->l = get16(pimg->fh) / 100.0;
-		      pimg->r = get16(pimg->fh) / 100.0;
-		      pimg->u = get16(pimg->fh) / 100.0;
-		      pimg->d = get16(pimg->fh) / 100.0;
+		      if (DATA_LEFT(pimg) < 8) goto bad_format;
+		      pimg->l = data_get16(pimg) / 100.0;
+		      pimg->r = data_get16(pimg) / 100.0;
+		      pimg->u = data_get16(pimg) / 100.0;
+		      pimg->d = data_get16(pimg) / 100.0;
 		  } else {
-		      pimg->l = get32(pimg->fh) / 100.0;
-		      pimg->r = get32(pimg->fh) / 100.0;
-		      pimg->u = get32(pimg->fh) / 100.0;
-		      pimg->d = get32(pimg->fh) / 100.0;
+		      if (DATA_LEFT(pimg) < 16) goto bad_format;
+		      pimg->l = data_get32(pimg) / 100.0;
+		      pimg->r = data_get32(pimg) / 100.0;
+		      pimg->u = data_get32(pimg) / 100.0;
+		      pimg->d = data_get32(pimg) / 100.0;
 		  }
 		  if (!stn_included(pimg)) {
 		      return img_XSECT_END;
@@ -1472,15 +2490,13 @@ img_read_item_new(img *pimg, img_point *p)
 		  }
 		  return img_XSECT;
 	      default: /* 0x25 - 0x2f and 0x34 - 0x3f are currently unallocated. */
-		  img_errno = IMG_BADFORMAT;
-		  return img_BAD;
+		  goto bad_format;
 	  }
 	  goto again3;
       }
       if (opt != 15) {
 	 /* 1-14 and 16-31 reserved */
-	 img_errno = IMG_BADFORMAT;
-	 return img_BAD;
+	 goto bad_format;
       }
       result = img_MOVE;
    } else if (opt >= 0x80) {
@@ -1489,7 +2505,7 @@ img_read_item_new(img *pimg, img_point *p)
       result = img_LABEL;
 
       if (!stn_included(pimg)) {
-	 if (!skip_coord(pimg->fh)) return img_BAD;
+	 if (!data_skip_coord(pimg)) return img_BAD;
 	 pimg->pending = 0;
 	 goto again3;
       }
@@ -1501,25 +2517,28 @@ img_read_item_new(img *pimg, img_point *p)
       result = img_LINE;
 
       if (!survey_included(pimg)) {
-	 if (!read_coord(pimg->fh, &(pimg->mv))) return img_BAD;
+	 if (!data_read_coord(pimg, &(pimg->mv))) return img_BAD;
 	 pimg->pending = 15;
 	 goto again3;
       }
 
       if (pimg->pending) {
 	 *p = pimg->mv;
-	 if (!read_coord(pimg->fh, &(pimg->mv))) return img_BAD;
+	 if (!data_read_coord(pimg, &(pimg->mv))) return img_BAD;
 	 pimg->pending = opt;
 	 return img_MOVE;
       }
       pimg->flags = (int)opt & 0x1f;
    } else {
-      img_errno = IMG_BADFORMAT;
-      return img_BAD;
+      goto bad_format;
    }
-   if (!read_coord(pimg->fh, p)) return img_BAD;
+   if (!data_read_coord(pimg, p)) return img_BAD;
    pimg->pending = 0;
    return result;
+
+bad_format:
+   img_errno = IMG_BADFORMAT;
+   return img_BAD;
 }
 
 static int
@@ -2429,30 +3448,29 @@ write_v8label(img *pimg, int opt, int common_flag, size_t common_val,
    add = strlen(s + len);
 
    if (add == common_val && del == common_val) {
-      PUTC(opt | common_flag, pimg->fh);
+      v8_putc(pimg, opt | common_flag);
    } else {
-      PUTC(opt, pimg->fh);
+      v8_putc(pimg, opt);
       if (del <= 15 && add <= 15 && (del || add)) {
-	 PUTC((del << 4) | add, pimg->fh);
+	 v8_putc(pimg, (del << 4) | add);
       } else {
-	 PUTC(0x00, pimg->fh);
+	 v8_putc(pimg, 0x00);
 	 if (del < 0xff) {
-	    PUTC(del, pimg->fh);
+	    v8_putc(pimg, del);
 	 } else {
-	    PUTC(0xff, pimg->fh);
-	    put32(del, pimg->fh);
+	    v8_putc(pimg, 0xff);
+	    v8_put32(pimg, del);
 	 }
 	 if (add < 0xff) {
-	    PUTC(add, pimg->fh);
+	    v8_putc(pimg, add);
 	 } else {
-	    PUTC(0xff, pimg->fh);
-	    put32(add, pimg->fh);
+	    v8_putc(pimg, 0xff);
+	    v8_put32(pimg, add);
 	 }
       }
    }
 
-   if (add)
-      fwrite(s + len, add, 1, pimg->fh);
+   v8_write(pimg, s + len, add);
 
    pimg->label_len = len + add;
    if (add > del && !check_label_space(pimg, pimg->label_len + 1))
@@ -2484,37 +3502,37 @@ img_write_item_date_new(img *pimg)
 
     if (same) {
 	if (unset) {
-	    PUTC(0x10, pimg->fh);
+	    v8_putc(pimg, 0x10);
 	} else {
-	    PUTC(0x11, pimg->fh);
+	    v8_putc(pimg, 0x11);
 #if IMG_API_VERSION == 0
-	    put16(pimg->date1 / 86400 + 25567, pimg->fh);
+	    v8_put16(pimg, pimg->date1 / 86400 + 25567);
 #else /* IMG_API_VERSION == 1 */
-	    put16(pimg->days1, pimg->fh);
+	    v8_put16(pimg, pimg->days1);
 #endif
 	}
     } else {
 #if IMG_API_VERSION == 0
 	int diff = (pimg->date2 - pimg->date1) / 86400;
 	if (diff > 0 && diff <= 256) {
-	    PUTC(0x12, pimg->fh);
-	    put16(pimg->date1 / 86400 + 25567, pimg->fh);
-	    PUTC(diff - 1, pimg->fh);
+	    v8_putc(pimg, 0x12);
+	    v8_put16(pimg, pimg->date1 / 86400 + 25567);
+	    v8_putc(pimg, diff - 1);
 	} else {
-	    PUTC(0x13, pimg->fh);
-	    put16(pimg->date1 / 86400 + 25567, pimg->fh);
-	    put16(pimg->date2 / 86400 + 25567, pimg->fh);
+	    v8_putc(pimg, 0x13);
+	    v8_put16(pimg, pimg->date1 / 86400 + 25567);
+	    v8_put16(pimg, pimg->date2 / 86400 + 25567);
 	}
 #else /* IMG_API_VERSION == 1 */
 	int diff = pimg->days2 - pimg->days1;
 	if (diff > 0 && diff <= 256) {
-	    PUTC(0x12, pimg->fh);
-	    put16(pimg->days1, pimg->fh);
-	    PUTC(diff - 1, pimg->fh);
+	    v8_putc(pimg, 0x12);
+	    v8_put16(pimg, pimg->days1);
+	    v8_putc(pimg, diff - 1);
 	} else {
-	    PUTC(0x13, pimg->fh);
-	    put16(pimg->days1, pimg->fh);
-	    put16(pimg->days2, pimg->fh);
+	    v8_putc(pimg, 0x13);
+	    v8_put16(pimg, pimg->days1);
+	    v8_put16(pimg, pimg->days2);
 	}
 #endif
     }
@@ -2639,6 +3657,7 @@ static void
 img_write_item_new(img *pimg, int code, int flags, const char *s,
 		   double x, double y, double z)
 {
+   if (pimg->index) index_write_item(pimg, code, flags, s, x, y, z);
    switch (code) {
     case img_LABEL:
       write_v8label(pimg, 0x80 | flags, 0, -1, s);
@@ -2660,20 +3679,20 @@ img_write_item_new(img *pimg, int code, int flags, const char *s,
       write_v8label(pimg, 0x30 | flags, 0, -1, s);
       if (flags & 2) {
 	 /* Big passage!  Need to use 4 bytes. */
-	 put32(l, pimg->fh);
-	 put32(r, pimg->fh);
-	 put32(u, pimg->fh);
-	 put32(d, pimg->fh);
+	 v8_put32(pimg, l);
+	 v8_put32(pimg, r);
+	 v8_put32(pimg, u);
+	 v8_put32(pimg, d);
       } else {
-	 put16(l, pimg->fh);
-	 put16(r, pimg->fh);
-	 put16(u, pimg->fh);
-	 put16(d, pimg->fh);
+	 v8_put16(pimg, l);
+	 v8_put16(pimg, r);
+	 v8_put16(pimg, u);
+	 v8_put16(pimg, d);
       }
       return;
     }
     case img_MOVE:
-      PUTC(15, pimg->fh);
+      v8_putc(pimg, 15);
       break;
     case img_LINE:
       img_write_item_date_new(pimg);
@@ -2684,7 +3703,7 @@ img_write_item_new(img *pimg, int code, int flags, const char *s,
 	    case img_STYLE_CARTESIAN:
 	    case img_STYLE_CYLPOLAR:
 	    case img_STYLE_NOSURVEY:
-	       PUTC(pimg->style, pimg->fh);
+	       v8_putc(pimg, pimg->style);
 	       break;
 	  }
 	  pimg->oldstyle = pimg->style;
@@ -2694,7 +3713,10 @@ img_write_item_new(img *pimg, int code, int flags, const char *s,
     default: /* ignore for now */
       return;
    }
-   write_coord(pimg->fh, x, y, z);
+   /* Output in cm. */
+   v8_put32(pimg, (INT32_T)my_lround(x * 100.0));
+   v8_put32(pimg, (INT32_T)my_lround(y * 100.0));
+   v8_put32(pimg, (INT32_T)my_lround(z * 100.0));
 }
 
 static void
@@ -2814,12 +3836,12 @@ void
 img_write_errors(img *pimg, int n_legs, double length,
 		 double E, double H, double V)
 {
-    PUTC((pimg->version >= 8 ? 0x1f : 0x22), pimg->fh);
-    put32(n_legs, pimg->fh);
-    put32((INT32_T)my_lround(length * 100.0), pimg->fh);
-    put32((INT32_T)my_lround(E * 100.0), pimg->fh);
-    put32((INT32_T)my_lround(H * 100.0), pimg->fh);
-    put32((INT32_T)my_lround(V * 100.0), pimg->fh);
+    v8_putc(pimg, (pimg->version >= 8 ? 0x1f : 0x22));
+    v8_put32(pimg, n_legs);
+    v8_put32(pimg, (INT32_T)my_lround(length * 100.0));
+    v8_put32(pimg, (INT32_T)my_lround(E * 100.0));
+    v8_put32(pimg, (INT32_T)my_lround(H * 100.0));
+    v8_put32(pimg, (INT32_T)my_lround(V * 100.0));
 }
 
 int
@@ -2833,7 +3855,12 @@ img_close(img *pimg)
 	    osfree(pimg->title);
 	    osfree(pimg->cs);
 	    osfree(pimg->datestamp);
+	    osfree(pimg->items_labels);
+	    free_data(pimg);
+	    index_free(pimg);
 	 } else {
+	    /* Offset of the end of data marker in the item data. */
+	    unsigned long end = pimg->index ? pimg->index->pos : 0;
 	    /* write end of data marker */
 	    switch (pimg->version) {
 	     case 1:
@@ -2850,6 +3877,10 @@ img_close(img *pimg)
 	       PUTC(0, pimg->fh);
 	       break;
 	    }
+	    if (pimg->index) {
+	       index_write(pimg, end);
+	       index_free(pimg);
+	    }
 	 }
 	 if (ferror(pimg->fh)) result = 0;
 	 if (pimg->close_func && pimg->close_func(pimg->fh))
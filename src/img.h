@@ -196,8 +196,44 @@ typedef struct {
    int olddays1, olddays2;
 #endif
    int oldstyle;
+   /* For format version >= 8, the item data is read into memory (mapping
+    * the file if we can) and decoded from there rather than via stdio. */
+   const unsigned char *data_start, *data_ptr, *data_end;
+   void *data_buf;
+   size_t data_buf_len;
+   int data_mapped;
+   /* Label pool for img_read_items(). */
+   char *items_labels;
+   size_t items_labels_size;
+   /* Survey prefix index - built when writing format version >= 8, and used
+    * when reading with a survey filter if the file has one. */
+   struct img_index *index;
 } img;
 
+/* An item read by img_read_items(). */
+typedef struct {
+   /* img_XXXX as #define-d above */
+   int code;
+   /* These are the values the corresponding members of the img struct would
+    * have after img_read_item() returned this item. */
+   int flags;
+   int style;
+#if IMG_API_VERSION == 0
+   time_t date1, date2;
+#else /* IMG_API_VERSION == 1 */
+   int days1, days2;
+#endif
+   /* Offset of the label in the label pool, and its length. */
+   size_t label, label_len;
+   img_point p;
+   /* For img_XSECT: */
+   double l, r, u, d;
+   /* For img_ERROR_INFO: */
+   int n_legs;
+   double length;
+   double E, H, V;
+} img_item;
+
 /* Which version of the file format to output (defaults to newest) */
 extern unsigned int img_output_version;
 
@@ -222,6 +258,10 @@ extern unsigned int img_output_version;
  * survey points to a survey name to restrict reading to (or NULL for all
  * survey data in the file)
  *
+ * If the file has a survey index, parts of the file which can't contain
+ * anything in survey are skipped, so img_MOVE and img_ERROR_INFO items from
+ * those parts won't be returned.
+ *
  * Returns pointer to an img struct or NULL
  */
 img *img_open_survey(const char *fnm, const char *survey);
@@ -346,6 +386,30 @@ img *img_write_stream(FILE *stream, int (*close_func)(FILE*),
  */
 int img_read_item(img *pimg, img_point *p);
 
+/* Read a block of items from a processed survey data file
+ *
+ * This returns the same items as calling img_read_item() repeatedly would,
+ * but with the details of each item copied out of pimg into an array, and
+ * the labels collected into a pool so that the caller doesn't need to copy
+ * them.
+ *
+ * pimg is a pointer to an img struct returned by img_open()
+ *
+ * items points to an array of max_items img_item structs to fill in
+ *
+ * labels is set to point to the label pool for this block - the label member
+ * of each item is an offset into it of a nul-terminated string.  Consecutive
+ * items in a block with the same label (e.g. legs in the same survey) share
+ * the same offset.  The pool belongs to pimg and is only valid until the next
+ * call to img_read_items(), img_read_item(), img_rewind() or img_close().
+ *
+ * Returns the number of items read.  This is only less than max_items if the
+ * last item read is img_STOP or img_BAD (which is included in the count, and
+ * has an empty label).
+ */
+size_t img_read_items(img *pimg, img_item *items, size_t max_items,
+		      const char **labels);
+
 /* Write a item to a .3d file
  *
  * pimg is a pointer to an img struct returned by img_open_write()
@@ -22,9 +22,106 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "img.h"
 
+/* The items img_read_item() returned, to compare with what img_read_items()
+ * returns.  The label member of each is an offset into expected_labels. */
+static img_item *expected = NULL;
+static size_t n_expected = 0, max_expected = 0;
+static char *expected_labels = NULL;
+static size_t expected_labels_len = 0, expected_labels_size = 0;
+
+/* Record the item img_read_item() just returned.  Returns 0 if we fail to
+ * allocate memory. */
+static int
+record_item(const img *pimg, int code, const img_point *pt)
+{
+    img_item *item;
+    size_t len = strlen(pimg->label);
+    if (n_expected == max_expected) {
+	max_expected = max_expected ? max_expected * 2 : 256;
+	expected = realloc(expected, max_expected * sizeof(img_item));
+	if (!expected) return 0;
+    }
+    if (expected_labels_len + len + 1 > expected_labels_size) {
+	expected_labels_size = (expected_labels_len + len + 1) * 2;
+	expected_labels = realloc(expected_labels, expected_labels_size);
+	if (!expected_labels) return 0;
+    }
+    item = &expected[n_expected++];
+    item->code = code;
+    item->flags = pimg->flags;
+    item->style = pimg->style;
+#if IMG_API_VERSION == 0
+    item->date1 = pimg->date1;
+    item->date2 = pimg->date2;
+#else /* IMG_API_VERSION == 1 */
+    item->days1 = pimg->days1;
+    item->days2 = pimg->days2;
+#endif
+    item->label = expected_labels_len;
+    item->label_len = len;
+    memcpy(expected_labels + expected_labels_len, pimg->label, len + 1);
+    expected_labels_len += len + 1;
+    item->p = *pt;
+    item->l = pimg->l;
+    item->r = pimg->r;
+    item->u = pimg->u;
+    item->d = pimg->d;
+    item->n_legs = pimg->n_legs;
+    item->length = pimg->length;
+    item->E = pimg->E;
+    item->H = pimg->H;
+    item->V = pimg->V;
+    return 1;
+}
+
+/* Check item (with its label in labels) matches the expected item e.
+ * Returns NULL if so, or else a description of the problem. */
+static const char *
+check_item(const img_item *item, const char *labels, const img_item *e)
+{
+    const char *label = labels + item->label;
+    if (item->code != e->code) return "returned a different item";
+    if (strlen(label) != item->label_len) return "returned bad label length";
+    if (item->code == img_STOP) {
+	if (item->label_len != 0) return "returned a label for img_STOP";
+	return NULL;
+    }
+    if (strcmp(label, expected_labels + e->label) != 0)
+	return "returned a different label";
+    if (item->flags != e->flags || item->style != e->style)
+	return "returned different flags or style";
+#if IMG_API_VERSION == 0
+    if (item->date1 != e->date1 || item->date2 != e->date2)
+	return "returned different dates";
+#else /* IMG_API_VERSION == 1 */
+    if (item->days1 != e->days1 || item->days2 != e->days2)
+	return "returned different dates";
+#endif
+    if (item->l != e->l || item->r != e->r ||
+	item->u != e->u || item->d != e->d)
+	return "returned different LRUD";
+    switch (item->code) {
+	case img_MOVE:
+	case img_LINE:
+	case img_LABEL:
+	    if (item->p.x != e->p.x || item->p.y != e->p.y ||
+		item->p.z != e->p.z)
+		return "returned a different point";
+	    break;
+	case img_ERROR_INFO:
+	    if (item->n_legs != e->n_legs || item->length != e->length ||
+		item->E != e->E || item->H != e->H || item->V != e->V)
+		return "returned different error info";
+	    break;
+    }
+    return NULL;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -33,6 +130,7 @@ main(int argc, char **argv)
     img *pimg;
     unsigned long c_stations = 0;
     unsigned long c_legs = 0;
+    size_t i_expected;
 
     if (argc < 2 || argc > 3) {
 	fprintf(stderr, "Syntax: %s 3DFILE [SURVEY]\n", argv[0]);
@@ -61,6 +159,11 @@ main(int argc, char **argv)
     while (1) {
 	img_point pt;
 	int code = img_read_item(pimg, &pt);
+	if (code != img_BAD && !record_item(pimg, code, &pt)) {
+	    img_close(pimg);
+	    fprintf(stderr, "%s: out of memory\n", argv[0]);
+	    return 1;
+	}
 	if (code == img_STOP) break;
 	switch (code) {
 	    case img_LINE:
@@ -79,6 +182,49 @@ main(int argc, char **argv)
 
     printf("Stations: %lu\nLegs: %lu\n", c_stations, c_legs);
 
+    /* Check img_read_items() returns the same items.  Use a small block size
+     * so we test items spanning several blocks. */
+    if (!img_rewind(pimg)) {
+	img_close(pimg);
+	fprintf(stderr, "%s: img_rewind failed (error code %d)\n",
+		argv[0], (int)img_error());
+	return 1;
+    }
+    i_expected = 0;
+    while (1) {
+	img_item items[7];
+	const char *labels;
+	const char *err = NULL;
+	size_t i;
+	size_t n = img_read_items(pimg, items, sizeof(items) / sizeof(items[0]),
+				  &labels);
+	for (i = 0; i != n; ++i) {
+	    if (items[i].code == img_BAD) {
+		img_close(pimg);
+		fprintf(stderr, "%s: img_read_items failed (error code "
+			"%d)\n", argv[0], (int)img_error());
+		return 1;
+	    }
+	    if (i_expected == n_expected) {
+		err = "returned too many items";
+	    } else {
+		err = check_item(&items[i], labels, &expected[i_expected++]);
+	    }
+	    if (err) break;
+	}
+	if (!err && i_expected != n_expected &&
+	    n < sizeof(items) / sizeof(items[0])) {
+	    err = "returned too few items";
+	}
+	if (err) {
+	    img_close(pimg);
+	    fprintf(stderr, "%s: img_read_items %s (item %lu)\n",
+		    argv[0], err, (unsigned long)i_expected);
+	    return 1;
+	}
+	if (i_expected == n_expected) break;
+    }
+
     img_close(pimg);
 
     return 0;
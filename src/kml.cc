@@ -32,68 +32,12 @@
 #include <math.h>
 
 #include "useful.h"
-#include <proj.h>
-
-#include "aven.h"
-#include "message.h"
 
 using namespace std;
 
-#define WGS84_DATUM_STRING "EPSG:4326"
-
-static void
-html_escape(FILE *fh, const char *s)
-{
-    while (*s) {
-	switch (*s) {
-	    case '<':
-		fputs("&lt;", fh);
-		break;
-	    case '>':
-		fputs("&gt;", fh);
-		break;
-	    case '&':
-		fputs("&amp;", fh);
-		break;
-	    default:
-		PUTC(*s, fh);
-	}
-	++s;
-    }
-}
-
-static void discarding_proj_logger(void *, int, const char *) { }
-
 KML::KML(const char * input_datum, bool clamp_to_ground_)
-    : clamp_to_ground(clamp_to_ground_)
-{
-    /* Prevent stderr spew from PROJ. */
-    proj_log_func(PJ_DEFAULT_CTX, nullptr, discarding_proj_logger);
-
-    pj = proj_create_crs_to_crs(PJ_DEFAULT_CTX,
-				input_datum, WGS84_DATUM_STRING,
-				NULL);
-
-    if (pj) {
-	// Normalise the output order so x is longitude and y latitude - by
-	// default new PROJ has them switched for EPSG:4326 which just seems
-	// confusing.
-	PJ* pj_norm = proj_normalize_for_visualization(PJ_DEFAULT_CTX, pj);
-	proj_destroy(pj);
-	pj = pj_norm;
-    }
-
-    if (!pj) {
-	wxString m = wmsg(/*Failed to initialise input coordinate system “%s”*/287);
-	m = wxString::Format(m.c_str(), input_datum);
-	throw m;
-    }
-}
-
-KML::~KML()
+    : out(input_datum), clamp_to_ground(clamp_to_ground_)
 {
-    if (pj)
-	proj_destroy(pj);
 }
 
 const int *
@@ -109,123 +53,95 @@ KML::passes() const
 void KML::header(const char * title, const char *, time_t,
 		 double, double, double, double, double, double)
 {
-    fputs(
+    out.put(
 "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-"<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n", fh);
-    fputs("<Document><name>", fh);
-    html_escape(fh, title);
-    fputs("</name>\n", fh);
+"<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n");
+    out.put("<Document><name>");
+    out.put_escaped(title);
+    out.put("</name>\n");
     // Set up styles for the icons to reduce the file size.
-    fputs("<Style id=\"fix\"><IconStyle>"
-	  "<Icon><href>http://maps.google.com/mapfiles/kml/paddle/red-blank.png</href></Icon>"
-	  "</IconStyle></Style>\n", fh);
-    fputs("<Style id=\"exp\"><IconStyle>"
-	  "<Icon><href>http://maps.google.com/mapfiles/kml/paddle/blu-blank.png</href></Icon>"
-	  "</IconStyle></Style>\n", fh);
-    fputs("<Style id=\"ent\"><IconStyle>"
-	  "<Icon><href>http://maps.google.com/mapfiles/kml/paddle/grn-blank.png</href></Icon>"
-	  "</IconStyle></Style>\n", fh);
+    out.put("<Style id=\"fix\"><IconStyle>"
+	    "<Icon><href>http://maps.google.com/mapfiles/kml/paddle/red-blank.png</href></Icon>"
+	    "</IconStyle></Style>\n");
+    out.put("<Style id=\"exp\"><IconStyle>"
+	    "<Icon><href>http://maps.google.com/mapfiles/kml/paddle/blu-blank.png</href></Icon>"
+	    "</IconStyle></Style>\n");
+    out.put("<Style id=\"ent\"><IconStyle>"
+	    "<Icon><href>http://maps.google.com/mapfiles/kml/paddle/grn-blank.png</href></Icon>"
+	    "</IconStyle></Style>\n");
     // FIXME: does KML allow bounds?
     // NB Lat+long bounds are not necessarily the same as the bounds in survex
     // coords translated to WGS84 lat+long...
 }
 
+void
+KML::put_point(unsigned point, char sep)
+{
+    // %.8f is at worst just over 1mm.
+    out.put_lon(point);
+    out.put(',');
+    out.put_lat(point);
+    out.put(',');
+    out.put_alt(point);
+    out.put(sep);
+}
+
+void
+KML::maybe_flush()
+{
+    if (out.want_flush()) out.flush(fh);
+}
+
 void
 KML::start_pass(int)
 {
     if (in_linestring) {
-	fputs("</coordinates></LineString></MultiGeometry></Placemark>\n", fh);
+	out.put("</coordinates></LineString></MultiGeometry></Placemark>\n");
 	in_linestring = false;
     }
+    maybe_flush();
 }
 
 void
 KML::line(const img_point *p1, const img_point *p, unsigned /*flags*/, bool fPendingMove)
 {
     if (fPendingMove) {
+	maybe_flush();
 	if (!in_linestring) {
 	    in_linestring = true;
-	    fputs("<Placemark><MultiGeometry>\n", fh);
+	    out.put("<Placemark><MultiGeometry>\n");
 	} else {
-	    fputs("</coordinates></LineString>\n", fh);
+	    out.put("</coordinates></LineString>\n");
 	}
 	if (clamp_to_ground) {
-	    fputs("<LineString><coordinates>\n", fh);
+	    out.put("<LineString><coordinates>\n");
 	} else {
-	    fputs("<LineString><altitudeMode>absolute</altitudeMode><coordinates>\n", fh);
+	    out.put("<LineString><altitudeMode>absolute</altitudeMode><coordinates>\n");
 	}
 
-	PJ_COORD coord = {p1->x, p1->y, p1->z, HUGE_VAL};
-	coord = proj_trans(pj, PJ_FWD, coord);
-	if (coord.xyzt.x == HUGE_VAL ||
-	    coord.xyzt.y == HUGE_VAL ||
-	    coord.xyzt.z == HUGE_VAL) {
-	    // FIXME report errors
-	}
-	// %.8f is at worst just over 1mm.
-	fprintf(fh, "%.8f,%.8f,%.2f\n",
-		coord.xyzt.x,
-		coord.xyzt.y,
-		coord.xyzt.z);
+	put_point(out.add_point(p1->x, p1->y, p1->z), '\n');
     }
 
-    PJ_COORD coord = {p->x, p->y, p->z, HUGE_VAL};
-    coord = proj_trans(pj, PJ_FWD, coord);
-    if (coord.xyzt.x == HUGE_VAL ||
-	coord.xyzt.y == HUGE_VAL ||
-	coord.xyzt.z == HUGE_VAL) {
-	// FIXME report errors
-    }
-    // %.8f is at worst just over 1mm.
-    fprintf(fh, "%.8f,%.8f,%.2f\n",
-	    coord.xyzt.x,
-	    coord.xyzt.y,
-	    coord.xyzt.z);
+    put_point(out.add_point(p->x, p->y, p->z), '\n');
 }
 
 void
 KML::xsect(const img_point *p, double angle, double d1, double d2)
 {
     if (clamp_to_ground) {
-	fputs("<Placemark><name></name><LineString><coordinates>", fh);
+	out.put("<Placemark><name></name><LineString><coordinates>");
     } else {
-	fputs("<Placemark><name></name><LineString><altitudeMode>absolute</altitudeMode><coordinates>", fh);
+	out.put("<Placemark><name></name><LineString><altitudeMode>absolute</altitudeMode><coordinates>");
     }
 
     double s = sin(rad(angle));
     double c = cos(rad(angle));
 
-    {
-	PJ_COORD coord = {p->x + s * d1, p->y + c * d1, p->z, HUGE_VAL};
-	coord = proj_trans(pj, PJ_FWD, coord);
-	if (coord.xyzt.x == HUGE_VAL ||
-	    coord.xyzt.y == HUGE_VAL ||
-	    coord.xyzt.z == HUGE_VAL) {
-	    // FIXME report errors
-	}
-	// %.8f is at worst just over 1mm.
-	fprintf(fh, "%.8f,%.8f,%.2f ",
-		coord.xyzt.x,
-		coord.xyzt.y,
-		coord.xyzt.z);
-    }
-
-    {
-	PJ_COORD coord = {p->x - s * d2, p->y - c * d2, p->z, HUGE_VAL};
-	coord = proj_trans(pj, PJ_FWD, coord);
-	if (coord.xyzt.x == HUGE_VAL ||
-	    coord.xyzt.y == HUGE_VAL ||
-	    coord.xyzt.z == HUGE_VAL) {
-	    // FIXME report errors
-	}
-	// %.8f is at worst just over 1mm.
-	fprintf(fh, "%.8f,%.8f,%.2f\n",
-		coord.xyzt.x,
-		coord.xyzt.y,
-		coord.xyzt.z);
-    }
+    put_point(out.add_point(p->x + s * d1, p->y + c * d1, p->z), ' ');
+    put_point(out.add_point(p->x - s * d2, p->y - c * d2, p->z), '\n');
 
-    fputs("</coordinates></LineString></Placemark>\n", fh);
+    out.put("</coordinates></LineString></Placemark>\n");
+    maybe_flush();
 }
 
 void
@@ -233,9 +149,9 @@ KML::wall(const img_point *p, double angle, double d)
 {
     if (!in_wall) {
 	if (clamp_to_ground) {
-	    fputs("<Placemark><name></name><LineString><coordinates>", fh);
+	    out.put("<Placemark><name></name><LineString><coordinates>");
 	} else {
-	    fputs("<Placemark><name></name><LineString><altitudeMode>absolute</altitudeMode><coordinates>", fh);
+	    out.put("<Placemark><name></name><LineString><altitudeMode>absolute</altitudeMode><coordinates>");
 	}
 	in_wall = true;
     }
@@ -243,18 +159,8 @@ KML::wall(const img_point *p, double angle, double d)
     double s = sin(rad(angle));
     double c = cos(rad(angle));
 
-    PJ_COORD coord = {p->x + s * d, p->y + c * d, p->z, HUGE_VAL};
-    coord = proj_trans(pj, PJ_FWD, coord);
-    if (coord.xyzt.x == HUGE_VAL ||
-	coord.xyzt.y == HUGE_VAL ||
-	coord.xyzt.z == HUGE_VAL) {
-	// FIXME report errors
-    }
-    // %.8f is at worst just over 1mm.
-    fprintf(fh, "%.8f,%.8f,%.2f\n",
-	    coord.xyzt.x,
-	    coord.xyzt.y,
-	    coord.xyzt.z);
+    put_point(out.add_point(p->x + s * d, p->y + c * d, p->z), '\n');
+    maybe_flush();
 }
 
 void
@@ -263,27 +169,10 @@ KML::passage(const img_point *p, double angle, double d1, double d2)
     double s = sin(rad(angle));
     double c = cos(rad(angle));
 
-    PJ_COORD coord1 = {p->x + s * d1, p->y + c * d1, p->z, HUGE_VAL};
-    coord1 = proj_trans(pj, PJ_FWD, coord1);
-    if (coord1.xyzt.x == HUGE_VAL ||
-	coord1.xyzt.y == HUGE_VAL ||
-	coord1.xyzt.z == HUGE_VAL) {
-	// FIXME report errors
-    }
-    double x1 = coord1.xyzt.x;
-    double y1 = coord1.xyzt.y;
-    double z1 = coord1.xyzt.z;
-
-    PJ_COORD coord2 = {p->x - s * d2, p->y - c * d2, p->z, HUGE_VAL};
-    coord2 = proj_trans(pj, PJ_FWD, coord2);
-    if (coord2.xyzt.x == HUGE_VAL ||
-	coord2.xyzt.y == HUGE_VAL ||
-	coord2.xyzt.z == HUGE_VAL) {
-	// FIXME report errors
-    }
-    double x2 = coord2.xyzt.x;
-    double y2 = coord2.xyzt.y;
-    double z2 = coord2.xyzt.z;
+    // We refer back to the points from the previous call, so mustn't flush
+    // until tube_end() is called.
+    unsigned point1 = out.add_point(p->x + s * d1, p->y + c * d1, p->z);
+    unsigned point2 = out.add_point(p->x - s * d2, p->y - c * d2, p->z);
 
     // Define each passage as a multigeometry comprising of one quadrilateral
     // per section.  This prevents invalid geometry (such as self-intersecting
@@ -291,83 +180,83 @@ KML::passage(const img_point *p, double angle, double d1, double d2)
 
     if (!in_passage){
 	in_passage = true;
-	fputs("<Placemark><name></name><MultiGeometry>\n", fh);
+	out.put("<Placemark><name></name><MultiGeometry>\n");
     } else {
 	if (clamp_to_ground) {
-	    fputs("<Polygon>"
-		  "<outerBoundaryIs><LinearRing><coordinates>\n", fh);
+	    out.put("<Polygon>"
+		    "<outerBoundaryIs><LinearRing><coordinates>\n");
 	} else {
-	    fputs("<Polygon><altitudeMode>absolute</altitudeMode>"
-		  "<outerBoundaryIs><LinearRing><coordinates>\n", fh);
+	    out.put("<Polygon><altitudeMode>absolute</altitudeMode>"
+		    "<outerBoundaryIs><LinearRing><coordinates>\n");
 	}
 
 	// Draw anti-clockwise around the ring.
-	fprintf(fh, "%.8f,%.8f,%.2f\n", v2.GetX(), v2.GetY(), v2.GetZ());
-	fprintf(fh, "%.8f,%.8f,%.2f\n", v1.GetX(), v1.GetY(), v1.GetZ());
+	put_point(prev_point2, '\n');
+	put_point(prev_point1, '\n');
 
-	fprintf(fh, "%.8f,%.8f,%.2f\n", x1, y1, z1);
-	fprintf(fh, "%.8f,%.8f,%.2f\n", x2, y2, z2);
+	put_point(point1, '\n');
+	put_point(point2, '\n');
 
 	// Close the ring.
-	fprintf(fh, "%.8f,%.8f,%.2f\n", v2.GetX(), v2.GetY(), v2.GetZ());
+	put_point(prev_point2, '\n');
 
-	fputs("</coordinates></LinearRing></outerBoundaryIs>"
-	      "</Polygon>\n", fh);
+	out.put("</coordinates></LinearRing></outerBoundaryIs>"
+		"</Polygon>\n");
     }
 
-    v2 = Vector3(x2, y2, z2);
-    v1 = Vector3(x1, y1, z1);
+    prev_point1 = point1;
+    prev_point2 = point2;
 }
 
 void
 KML::tube_end()
 {
     if (in_passage){
-	fputs("</MultiGeometry></Placemark>\n", fh);
+	out.put("</MultiGeometry></Placemark>\n");
 	in_passage = false;
     }
     if (in_wall) {
-	fputs("</coordinates></LineString></Placemark>\n", fh);
+	out.put("</coordinates></LineString></Placemark>\n");
 	in_wall = false;
     }
+    maybe_flush();
 }
 
 void
 KML::label(const img_point *p, const char *s, bool /*fSurface*/, int type)
 {
-    PJ_COORD coord = {p->x, p->y, p->z, HUGE_VAL};
-    coord = proj_trans(pj, PJ_FWD, coord);
-    if (coord.xyzt.x == HUGE_VAL ||
-	coord.xyzt.y == HUGE_VAL ||
-	coord.xyzt.z == HUGE_VAL) {
-	// FIXME report errors
-    }
+    out.put("<Placemark><Point><coordinates>");
     // %.8f is at worst just over 1mm.
-    fprintf(fh, "<Placemark><Point><coordinates>%.8f,%.8f,%.2f</coordinates></Point><name>",
-	    coord.xyzt.x,
-	    coord.xyzt.y,
-	    coord.xyzt.z);
-    html_escape(fh, s);
-    fputs("</name>", fh);
+    unsigned point = out.add_point(p->x, p->y, p->z);
+    out.put_lon(point);
+    out.put(',');
+    out.put_lat(point);
+    out.put(',');
+    out.put_alt(point);
+    out.put("</coordinates></Point><name>");
+    out.put_escaped(s);
+    out.put("</name>");
     // Add a "pin" symbol with colour matching what aven shows.
     switch (type) {
 	case FIXES:
-	    fputs("<styleUrl>#fix</styleUrl>", fh);
+	    out.put("<styleUrl>#fix</styleUrl>");
 	    break;
 	case EXPORTS:
-	    fputs("<styleUrl>#exp</styleUrl>", fh);
+	    out.put("<styleUrl>#exp</styleUrl>");
 	    break;
 	case ENTS:
-	    fputs("<styleUrl>#ent</styleUrl>", fh);
+	    out.put("<styleUrl>#ent</styleUrl>");
 	    break;
     }
-    fputs("</Placemark>\n", fh);
+    out.put("</Placemark>\n");
+    maybe_flush();
 }
 
 void
 KML::footer()
 {
     if (in_linestring)
-	fputs("</coordinates></LineString></MultiGeometry></Placemark>\n", fh);
-    fputs("</Document></kml>\n", fh);
+	out.put("</coordinates></LineString></MultiGeometry></Placemark>\n");
+    out.put("</Document></kml>\n");
+    out.flush(fh);
 }
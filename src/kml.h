@@ -20,22 +20,22 @@
 
 #include "exportfilter.h"
 
-#include <proj.h>
-
-#include "vector3.h"
-
-#include <vector>
+#include "wgs84writer.h"
 
 class KML : public ExportFilter {
-    PJ* pj = NULL;
+    WGS84Writer out;
     bool in_linestring = false;
     bool in_wall = false;
     bool in_passage = false;
     bool clamp_to_ground;
-    Vector3 v1, v2;
+    // The points from the previous call to passage().
+    unsigned prev_point1, prev_point2;
+
+    void put_point(unsigned point, char sep);
+
+    void maybe_flush();
   public:
     KML(const char * input_datum, bool clamp_to_ground_);
-    ~KML();
     const int * passes() const;
     void header(const char *, const char *, time_t,
 		double, double, double,
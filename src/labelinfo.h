@@ -30,6 +30,10 @@
 #include "vector3.h"
 #include "wx.h"
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 // macOS headers pollute the global namespace with generic names like
 // "class Point", which clashes with our "class Point".  So for __WXMAC__
 // put our class in a namespace and define Point as a macro.
@@ -61,23 +65,69 @@ class Point : public Vector3 {
 #define LFLAG_ENTRANCE		0x40
 #define LFLAG_HIGHLIGHTED	0x80
 
+// Storage for the names of stations.  The names are packed one after another
+// into large blocks, which uses much less memory than a wxString for each, and
+// the pointers returned by add() remain valid as more names are added.
+class LabelNamePool {
+    std::vector<std::unique_ptr<wxChar[]>> blocks;
+
+    // Space remaining in the last block.
+    wxChar* next = NULL;
+    size_t avail = 0;
+
+    enum { BLOCK_SIZE = 65536 };
+
+  public:
+    const wxChar* add(const wxString& s) {
+	size_t len = s.length();
+	if (len > avail) {
+	    size_t block_size = std::max(len, size_t(BLOCK_SIZE));
+	    blocks.emplace_back(new wxChar[block_size]);
+	    next = blocks.back().get();
+	    avail = block_size;
+	}
+	wxChar* p = next;
+	std::copy(s.begin(), s.end(), p);
+	next += len;
+	avail -= len;
+	return p;
+    }
+
+    void clear() {
+	blocks.clear();
+	next = NULL;
+	avail = 0;
+    }
+};
+
 class LabelInfo : public Point {
-    wxString text;
+    // The name is stored in a LabelNamePool owned by the Model.
+    const wxChar* text;
+    unsigned text_len;
     unsigned width;
     int flags;
+    // Position in the order labels are tried in when deciding which to plot.
+    unsigned plot_order;
 
 public:
     wxTreeItemId tree_id;
 
-    LabelInfo() : Point(), text(), flags(0) { }
-    LabelInfo(const img_point &pt, const wxString &text_, int flags_)
-	: Point(pt), text(text_), flags(flags_) {
-	if (text.empty())
+    LabelInfo() : Point(), text(NULL), text_len(0), flags(0), plot_order(0) { }
+    LabelInfo(const img_point &pt, const wxChar* text_, size_t text_len_,
+	      int flags_, unsigned plot_order_)
+	: Point(pt), text(text_), text_len(text_len_), flags(flags_),
+	  plot_order(plot_order_) {
+	if (text_len == 0)
 	    flags &= ~LFLAG_NOT_ANON;
     }
-    const wxString & GetText() const { return text; }
+    wxString GetText() const {
+	return text_len ? wxString(text, text_len) : wxString();
+    }
+    // Access the name without the overhead of constructing a wxString.
+    const wxChar* get_text_data() const { return text; }
+    size_t get_text_length() const { return text_len; }
     wxString name_or_anon() const {
-	if (!text.empty()) return text;
+	if (text_len) return GetText();
 	/* TRANSLATORS: Used in place of the station name when talking about an
 	 * anonymous station. */
 	return wmsg(/*anonymous station*/56);
@@ -87,6 +137,8 @@ public:
     void clear_flags(int mask) { flags &= ~mask; }
     unsigned get_width() const { return width; }
     void set_width(unsigned width_) { width = width_; }
+    unsigned get_plot_order() const { return plot_order; }
+    void set_plot_order(unsigned order) { plot_order = order; }
 
     bool IsEntrance() const { return (flags & LFLAG_ENTRANCE) != 0; }
     bool IsFixedPt() const { return (flags & LFLAG_FIXED) != 0; }
@@ -0,0 +1,272 @@
+//
+//  labelsearch.cc
+//
+//  Index for finding stations by name.
+//
+//  Copyright (C) 2026 agent
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "labelsearch.h"
+
+#include <string.h>
+#include <wctype.h>
+
+using namespace std;
+
+// Append the lower case version of Unicode character ch to out as UTF-8.
+static void
+append_folded(string& out, unsigned ch)
+{
+    // wint_t may only be 16 bits (e.g. on Microsoft Windows).
+    if (ch < 0x10000 || sizeof(wint_t) > 2) ch = towlower(ch);
+    if (ch < 0x80) {
+	out += char(ch);
+    } else if (ch < 0x800) {
+	out += char(0xc0 | (ch >> 6));
+	out += char(0x80 | (ch & 0x3f));
+    } else if (ch < 0x10000) {
+	out += char(0xe0 | (ch >> 12));
+	out += char(0x80 | ((ch >> 6) & 0x3f));
+	out += char(0x80 | (ch & 0x3f));
+    } else {
+	out += char(0xf0 | (ch >> 18));
+	out += char(0x80 | ((ch >> 12) & 0x3f));
+	out += char(0x80 | ((ch >> 6) & 0x3f));
+	out += char(0x80 | (ch & 0x3f));
+    }
+}
+
+static void
+append_folded(string& out, const wxChar* p, size_t len)
+{
+    const wxChar* end = p + len;
+    while (p != end) {
+	unsigned ch = *p++;
+	if (sizeof(wxChar) == 2 && ch >= 0xd800 && ch < 0xdc00 &&
+	    p != end && unsigned(*p) >= 0xdc00 && unsigned(*p) < 0xe000) {
+	    // UTF-16 surrogate pair.
+	    ch = 0x10000 + ((ch - 0xd800) << 10) + (unsigned(*p++) - 0xdc00);
+	}
+	append_folded(out, ch);
+    }
+}
+
+// Return a pointer to the start of the UTF-8 character after the one p
+// points to.
+static inline const char*
+next_char(const char* p)
+{
+    do {
+	++p;
+    } while ((*p & 0xc0) == 0x80);
+    return p;
+}
+
+// Match NUL-terminated UTF-8 name against pattern [pat, pat_end), where '*'
+// matches any sequence of characters and '?' any single character.
+static bool
+glob_match(const char* name, const char* pat, const char* pat_end)
+{
+    // Where to resume if we need to let the most recent '*' match more.
+    const char* star_pat = NULL;
+    const char* star_name = NULL;
+    while (*name) {
+	if (pat != pat_end) {
+	    if (*pat == '*') {
+		star_pat = ++pat;
+		star_name = name;
+		continue;
+	    }
+	    if (*pat == '?') {
+		++pat;
+		name = next_char(name);
+		continue;
+	    }
+	    if (*pat == *name) {
+		++pat;
+		++name;
+		continue;
+	    }
+	}
+	if (!star_pat) return false;
+	pat = star_pat;
+	name = star_name = next_char(star_name);
+    }
+    while (pat != pat_end && *pat == '*') ++pat;
+    return pat == pat_end;
+}
+
+void
+LabelSearch::build(vector<LabelInfo*>::const_iterator begin,
+		   vector<LabelInfo*>::const_iterator end)
+{
+    clear();
+    labels.assign(begin, end);
+    starts.reserve(labels.size());
+    for (const LabelInfo* label : labels) {
+	starts.push_back(names.size());
+	append_folded(names, label->get_text_data(), label->get_text_length());
+	names += '\0';
+    }
+}
+
+void
+LabelSearch::clear()
+{
+    labels.clear();
+    names.clear();
+    starts.clear();
+    type = NONE;
+    needle.clear();
+    matches.clear();
+}
+
+bool
+LabelSearch::match(unsigned i) const
+{
+    const char* name = names.data() + starts[i];
+    switch (type) {
+	case SUBSTRING:
+	    return strstr(name, needle.c_str()) != NULL;
+	case PREFIX:
+	    return strncmp(name, needle.data(), needle.size()) == 0;
+	case GLOB:
+	    return glob_match(name, needle.data(), needle.data() + needle.size());
+	case NONE:
+	    break;
+    }
+    return false;
+}
+
+void
+LabelSearch::scan_all(vector<unsigned>& result) const
+{
+    if (type != SUBSTRING || needle.empty()) {
+	for (unsigned i = 0; i != labels.size(); ++i) {
+	    if (match(i)) result.push_back(i);
+	}
+	return;
+    }
+
+    // Search the whole buffer at once, which is much quicker than checking
+    // each name separately as most names won't contain even the first
+    // character of the needle.
+    const char* buf = names.data();
+    const char* p = buf;
+    const char* end = buf + names.size();
+    size_t len = needle.size();
+    unsigned i = 0;
+    while (true) {
+	p = static_cast<const char*>(memchr(p, needle[0], end - p));
+	if (!p || size_t(end - p) < len) break;
+	if (memcmp(p, needle.data(), len) != 0) {
+	    ++p;
+	    continue;
+	}
+	// The needle can't contain a zero byte so the match is within a
+	// single name.  Find which, then carry on from the start of the next.
+	size_t offset = p - buf;
+	while (i + 1 != labels.size() && starts[i + 1] <= offset) ++i;
+	result.push_back(i);
+	if (++i == labels.size()) break;
+	p = buf + starts[i];
+    }
+}
+
+bool
+LabelSearch::search(const wxString& pattern)
+{
+    query_type old_type = type;
+    string old_needle;
+    swap(needle, old_needle);
+    type = NONE;
+
+    if (!pattern.empty()) {
+	for (wxString::const_iterator i = pattern.begin(); i != pattern.end(); ++i) {
+	    append_folded(needle, wxUniChar(*i).GetValue());
+	}
+	type = GLOB;
+	if (needle.find_first_of("*?") == string::npos) {
+	    type = SUBSTRING;
+	} else {
+	    // Handle patterns with wildcards only at the start and/or end
+	    // without glob matching.
+	    size_t b = needle.find_first_not_of('*');
+	    size_t e = needle.find_last_not_of('*') + 1;
+	    if (b == string::npos) {
+		// Only '*' - everything matches, including anonymous stations.
+		type = SUBSTRING;
+		needle.clear();
+	    } else if (needle.find_first_of("*?", b) >= e &&
+		       e != needle.size()) {
+		type = (b == 0 ? PREFIX : SUBSTRING);
+		needle.erase(e);
+		needle.erase(0, b);
+	    }
+	}
+    }
+
+    vector<unsigned> new_matches;
+    if (type != NONE) {
+	// If every name matching this pattern must also match the previous one
+	// (as when the user adds to the pattern in the find box) then we only
+	// need to check the previous matches.
+	bool refine = false;
+	if (old_type == SUBSTRING) {
+	    refine = (type == SUBSTRING || type == PREFIX) &&
+		     needle.find(old_needle) != string::npos;
+	} else if (old_type == PREFIX) {
+	    refine = type == PREFIX &&
+		     needle.compare(0, old_needle.size(), old_needle) == 0;
+	}
+	if (refine) {
+	    for (unsigned i : matches) {
+		if (match(i)) new_matches.push_back(i);
+	    }
+	} else {
+	    scan_all(new_matches);
+	}
+    }
+
+    if (new_matches == matches) return false;
+
+    for (unsigned i : matches) {
+	labels[i]->clear_flags(LFLAG_HIGHLIGHTED);
+    }
+    for (unsigned i : new_matches) {
+	labels[i]->set_flags(LFLAG_HIGHLIGHTED);
+    }
+    swap(matches, new_matches);
+    return true;
+}
+
+void
+LabelSearch::get_plot_order(vector<LabelInfo*>& result) const
+{
+    result.clear();
+    result.reserve(labels.size());
+    for (unsigned i : matches) {
+	result.push_back(labels[i]);
+    }
+    for (LabelInfo* label : labels) {
+	if (!label->IsHighLighted()) result.push_back(label);
+    }
+}
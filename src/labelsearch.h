@@ -0,0 +1,103 @@
+//
+//  labelsearch.h
+//
+//  Index for finding stations by name.
+//
+//  Copyright (C) 2026 agent
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+
+#ifndef labelsearch_h
+#define labelsearch_h
+
+#include "labelinfo.h"
+
+#include <string>
+#include <vector>
+
+// Find stations whose names match a pattern typed into the find box, and
+// mark them as highlighted.
+//
+// Matching is case-insensitive.  A pattern without wildcards matches any
+// station whose name contains it.  A pattern containing '*' (any sequence
+// of characters) or '?' (any single character) has to match the whole name.
+//
+// The case-folded names are held end to end in a single buffer (in UTF-8),
+// which can be scanned quickly without a regular expression engine or
+// constructing a wxString for each station.  Each search remembers what
+// matched so that a pattern which extends the previous one (as happens as
+// the user types) only needs to check the stations which matched before.
+class LabelSearch {
+    enum query_type {
+	// No current search.
+	NONE,
+	// The name contains needle.
+	SUBSTRING,
+	// The name starts with needle.
+	PREFIX,
+	// The name matches needle as a glob pattern.
+	GLOB
+    };
+
+    // The labels in the order they should be tried in for plotting if none
+    // are highlighted.
+    std::vector<LabelInfo*> labels;
+
+    // The case-folded name of labels[i] starts at names[starts[i]] and is
+    // followed by a zero byte.
+    std::string names;
+
+    std::vector<size_t> starts;
+
+    query_type type = NONE;
+
+    // The case-folded pattern, with any '*' at the start or end removed for
+    // SUBSTRING and PREFIX.
+    std::string needle;
+
+    // Indices in labels of the currently highlighted labels, ascending.
+    std::vector<unsigned> matches;
+
+    bool match(unsigned i) const;
+
+    void scan_all(std::vector<unsigned>& result) const;
+
+  public:
+    // Build the index over the labels in [begin, end), which should be
+    // sorted into plotting order, and have no labels highlighted.
+    void build(std::vector<LabelInfo*>::const_iterator begin,
+	       std::vector<LabelInfo*>::const_iterator end);
+
+    // Forget the current labels (e.g. because they are about to be deleted).
+    void clear();
+
+    // Highlight exactly those labels which match pattern (an empty pattern
+    // matches nothing).
+    //
+    // Returns true if the set of highlighted labels changed.
+    bool search(const wxString& pattern);
+
+    // The number of labels currently highlighted.
+    size_t get_match_count() const { return matches.size(); }
+
+    // Put the labels into plotting order - the highlighted labels first, then
+    // the rest, each in the order passed to build().  This is the order that
+    // sorting with LabelPlotCmp would give, since the highlighted flag is
+    // the most significant one.
+    void get_plot_order(std::vector<LabelInfo*>& result) const;
+};
+
+#endif
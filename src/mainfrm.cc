@@ -39,16 +39,20 @@
 #include "useful.h"
 
 #include <wx/confbase.h>
+#include <wx/evtloop.h>
 //#include <wx/filefn.h>
 #include <wx/filename.h>
 #include <wx/image.h>
 #include <wx/imaglist.h>
 #include <wx/process.h>
-#include <wx/regex.h>
+#include <wx/progdlg.h>
+#include <wx/thread.h>
 #ifdef USING_GENERIC_TOOLBAR
 # include <wx/sysopt.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdlib>
 #include <float.h>
@@ -500,6 +504,10 @@ BEGIN_EVENT_TABLE(MainFrm, wxFrame)
     EVT_MENU(button_HIDE, MainFrm::OnHide)
     EVT_UPDATE_UI(button_HIDE, MainFrm::OnHideUpdate)
     EVT_IDLE(MainFrm::OnIdle)
+    EVT_TIMER(timer_RELOAD, MainFrm::OnReloadTimer)
+#if wxUSE_FSWATCHER
+    EVT_FSWATCHER(wxID_ANY, MainFrm::OnFileSystemEvent)
+#endif
 
     EVT_MENU(wxID_OPEN, MainFrm::OnOpen)
     EVT_MENU(menu_FILE_OPEN_TERRAIN, MainFrm::OnOpenTerrain)
@@ -668,34 +676,65 @@ BEGIN_EVENT_TABLE(MainFrm, wxFrame)
     EVT_UPDATE_UI(menu_CTL_PERCENT, MainFrm::OnTogglePercentUpdate)
 END_EVENT_TABLE()
 
+static inline int
+label_name_cmp(const LabelInfo* pt1, const LabelInfo* pt2, wxChar separator)
+{
+    return name_cmp(pt1->get_text_data(), pt1->get_text_length(),
+		    pt2->get_text_data(), pt2->get_text_length(), separator);
+}
+
 class LabelCmp : public greater<const LabelInfo*> {
     wxChar separator;
 public:
     explicit LabelCmp(wxChar separator_) : separator(separator_) {}
     bool operator()(const LabelInfo* pt1, const LabelInfo* pt2) {
-	return name_cmp(pt1->GetText(), pt2->GetText(), separator) < 0;
+	return label_name_cmp(pt1, pt2, separator) < 0;
     }
 };
 
 class LabelPlotCmp : public greater<const LabelInfo*> {
     wxChar separator;
+
+    // Return the offset of the leaf name (the part after the last
+    // separator) in label's name.
+    size_t leaf_offset(const LabelInfo* label) const {
+	const wxChar* text = label->get_text_data();
+	size_t i = label->get_text_length();
+	while (i && text[i - 1] != separator) --i;
+	return i;
+    }
+
+    // Return how many levels of survey the station is inside.
+    unsigned depth(const LabelInfo* label) const {
+	const wxChar* text = label->get_text_data();
+	return count(text, text + label->get_text_length(), separator);
+    }
+
 public:
     explicit LabelPlotCmp(wxChar separator_) : separator(separator_) {}
     bool operator()(const LabelInfo* pt1, const LabelInfo* pt2) {
 	int n = pt1->get_flags() - pt2->get_flags();
 	if (n) return n > 0;
-	wxString l1 = pt1->GetText().AfterLast(separator);
-	wxString l2 = pt2->GetText().AfterLast(separator);
-	n = name_cmp(l1, l2, separator);
+	// Prefer stations in surveys nearer the root of the survey tree, which
+	// are typically the more significant ones.
+	n = int(depth(pt1)) - int(depth(pt2));
+	if (n) return n < 0;
+	size_t leaf1 = leaf_offset(pt1);
+	size_t leaf2 = leaf_offset(pt2);
+	n = name_cmp(pt1->get_text_data() + leaf1,
+		     pt1->get_text_length() - leaf1,
+		     pt2->get_text_data() + leaf2,
+		     pt2->get_text_length() - leaf2,
+		     separator);
 	if (n) return n < 0;
 	// Prefer non-2-nodes...
 	// FIXME; implement
 	// if leaf names are the same, prefer shorter labels as we can
 	// display more of them
-	n = pt1->GetText().length() - pt2->GetText().length();
+	n = int(pt1->get_text_length()) - int(pt2->get_text_length());
 	if (n) return n < 0;
 	// make sure that we don't ever compare different labels as equal
-	return name_cmp(pt1->GetText(), pt2->GetText(), separator) < 0;
+	return label_name_cmp(pt1, pt2, separator) < 0;
     }
 };
 
@@ -736,6 +775,7 @@ MainFrm::MainFrm(const wxString& title, const wxPoint& pos, const wxSize& size)
 #ifdef PREFDLG
     , m_PrefsDlg(NULL)
 #endif
+    , m_ReloadTimer(this, timer_RELOAD)
 {
 #ifdef _WIN32
     // The peculiar name is so that the icon is the first in the file
@@ -1133,6 +1173,55 @@ void MainFrm::CreateSidePanel()
     m_Splitter->Initialize(m_Gfx);
 }
 
+// Loads a Model in a worker thread, tracking progress so it can be reported
+// from the UI thread.
+class ModelLoadThread : public wxThread, public ModelLoadProgress {
+    Model& model;
+
+    wxString file, prefix;
+
+    int result = 0;
+
+    std::atomic<int> progress{0};
+
+    std::atomic<bool> cancelled{false};
+
+    wxSemaphore done;
+
+  public:
+    // Progress is reported as an integer between 0 and this.
+    enum { PROGRESS_MAX = 1000 };
+
+    ModelLoadThread(Model& model_,
+		    const wxString& file_, const wxString& prefix_)
+	// Take deep copies of the strings, as they're used from another thread.
+	: wxThread(wxTHREAD_JOINABLE), model(model_),
+	  file(file_.c_str()), prefix(prefix_.c_str()) { }
+
+    ExitCode Entry() {
+	result = model.Load(file, prefix, this, true);
+	done.Post();
+	return 0;
+    }
+
+    bool Update(double fraction) {
+	progress = int(fraction * PROGRESS_MAX);
+	return !cancelled;
+    }
+
+    // Returns true if loading has finished (or been cancelled).
+    bool WaitUntilDone(unsigned long timeout_ms) {
+	return done.WaitTimeout(timeout_ms) == wxSEMA_NO_ERROR;
+    }
+
+    int GetProgress() const { return progress; }
+
+    void Cancel() { cancelled = true; }
+
+    // Only valid once Wait() has returned.
+    int GetResult() const { return result; }
+};
+
 bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
 {
     // Load survey data from file, centre the dataset around the origin,
@@ -1143,18 +1232,66 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     timer.Start();
 #endif
 
-    int err_msg_code = Model::Load(file, prefix);
+    // Load the data into a separate Model using a worker thread, so the
+    // window still redraws while a large file is loading, and the user can
+    // cancel if it's taking too long.  The current data stays as it is until
+    // the new data has loaded successfully.
+    Model model;
+    int err_msg_code;
+    ModelLoadThread loader(model, file, prefix);
+    m_Loading = true;
+    if (loader.Run() == wxTHREAD_NO_ERROR) {
+	// Only show a progress dialog if loading takes a noticeable time.
+	wxProgressDialog* progress = NULL;
+	wxStopWatch timer;
+	while (!loader.WaitUntilDone(50)) {
+	    if (!progress) {
+		if (timer.Time() < 500) {
+		    // Keep the window redrawing until we show the dialog, but
+		    // don't handle user input, which could start another load.
+		    wxEventLoopBase* loop = wxEventLoopBase::GetActive();
+		    if (loop) loop->YieldFor(wxEVT_CATEGORY_UI);
+		    continue;
+		}
+		progress = new wxProgressDialog(wxFileNameFromPath(file),
+						wmsg(/*Reading in data - please wait…*/105),
+						ModelLoadThread::PROGRESS_MAX,
+						this,
+						wxPD_APP_MODAL|wxPD_CAN_ABORT|wxPD_ELAPSED_TIME);
+	    }
+	    if (!progress->Update(loader.GetProgress())) {
+		loader.Cancel();
+	    }
+	}
+	delete progress;
+	loader.Wait();
+	err_msg_code = loader.GetResult();
+    } else {
+	err_msg_code = model.Load(file, prefix, NULL, true);
+    }
+    m_Loading = false;
+
+    if (err_msg_code == Model::LOAD_CANCELLED) {
+	return false;
+    }
     if (err_msg_code) {
 	wxString m = wxString::Format(wmsg(err_msg_code), file.c_str());
 	wxGetApp().ReportError(m);
 	return false;
     }
 
+    // Swap in the new data.  The old data is deleted when model goes out of
+    // scope, by which point the tree has been refilled so nothing refers to
+    // the old labels.
+    m_Gfx->ForgetLabels();
+    m_LabelSearch.clear();
+    swap(static_cast<Model&>(*this), model);
+
     // Update window title.
     SetTitle(GetSurveyTitle() + " - " APP_NAME);
 
     // Sort the labels ready for filling the tree.
-    m_Labels.sort(LabelCmp(GetSeparator()));
+    stable_sort(m_Labels.begin(), m_Labels.end(), LabelCmp(GetSeparator()));
 
     // Fill the tree of stations and prefixes.
     wxString root_name = wxFileNameFromPath(file);
@@ -1165,13 +1302,11 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     }
     m_Tree->FillTree(root_name);
 
-    // Sort labels so that entrances are displayed in preference,
-    // then fixed points, then exported points, then other points.
-    //
-    // Also sort by leaf name so that we'll tend to choose labels
-    // from different surveys, rather than labels from surveys which
-    // are earlier in the list.
-    m_Labels.sort(LabelPlotCmp(GetSeparator()));
+    SortLabelsForPlotting();
+
+    // No labels are highlighted yet, so this is the order to plot them in
+    // when nothing has been searched for.
+    m_LabelSearch.build(m_Labels.begin(), m_Labels.end());
 
     if (!m_FindBox->GetValue().empty()) {
 	// Highlight any stations matching the current search.
@@ -1183,6 +1318,29 @@ bool MainFrm::LoadData(const wxString& file, const wxString& prefix)
     return true;
 }
 
+void MainFrm::SortLabelsForPlotting()
+{
+    // Sort labels so that entrances are displayed in preference,
+    // then fixed points, then exported points, then other points, and
+    // stations in higher level surveys before those in lower level ones.
+    //
+    // Also sort by leaf name so that we'll tend to choose labels
+    // from different surveys, rather than labels from surveys which
+    // are earlier in the list.
+    stable_sort(m_Labels.begin(), m_Labels.end(), LabelPlotCmp(GetSeparator()));
+    UpdatePlotOrder();
+}
+
+void MainFrm::UpdatePlotOrder()
+{
+    // The label placement code finds labels via the station index, so
+    // record where each ended up.
+    for (size_t i = 0; i != m_Labels.size(); ++i) {
+	m_Labels[i]->set_plot_order(i);
+    }
+    m_Gfx->LabelsReordered();
+}
+
 #if 0
 // Run along a newly read in traverse and make up plausible LRUD where
 // it is missing.
@@ -1294,6 +1452,9 @@ void MainFrm::OpenFile(const wxString& file, const wxString& survey)
 		if (m_Splitter->IsSplit()) m_Splitter->Unsplit();
 	    }
 
+	    // We reprocess the data ourselves if it changes, so don't also
+	    // reload the .3d file we write.
+	    StopWatching();
 	    if (wxFileExists(file)) AddToFileHistory(file);
 	    log->process(file);
 	    // Log window will tell us to load file if it successfully completes.
@@ -1305,6 +1466,7 @@ void MainFrm::OpenFile(const wxString& file, const wxString& survey)
 	return;
     AddToFileHistory(file);
     InitialiseAfterLoad(file, survey);
+    WatchFile(file);
 
     // If aven is showing the log for a .svx file and you load a .3d file, then
     // at this point m_Log will be the log window for the .svx file, so destroy
@@ -1368,6 +1530,71 @@ void MainFrm::InitialiseAfterLoad(const wxString & file, const wxString & prefix
     m_Gfx->SetFocus();
 }
 
+void MainFrm::WatchFile(const wxString & file)
+{
+    // Reload the processed data if the file gets rewritten.  This allows
+    // "cavern --watch" to be used with aven to give a live view of the survey
+    // data being edited.
+    wxFileName fn(file);
+    fn.MakeAbsolute();
+    m_WatchedFile = fn.GetFullPath();
+    m_ReloadTimer.Stop();
+#if wxUSE_FSWATCHER
+    // The file system watcher can't be set up until the event loop is
+    // running, which it won't be yet for a file specified on the command line.
+    CallAfter(&MainFrm::StartWatching);
+#endif
+}
+
+void MainFrm::StopWatching()
+{
+    m_WatchedFile.clear();
+    m_ReloadTimer.Stop();
+#if wxUSE_FSWATCHER
+    if (m_FSWatcher) m_FSWatcher->RemoveAll();
+#endif
+}
+
+#if wxUSE_FSWATCHER
+void MainFrm::StartWatching()
+{
+    if (m_WatchedFile.empty()) return;
+    if (!m_FSWatcher) {
+	m_FSWatcher.reset(new wxFileSystemWatcher());
+	m_FSWatcher->SetOwner(this);
+    }
+    m_FSWatcher->RemoveAll();
+    // Watch the directory rather than the file itself, since cavern writes
+    // the new .3d file under a temporary name and renames it into place.
+    wxFileName dir = wxFileName::DirName(wxFileName(m_WatchedFile).GetPath());
+    m_FSWatcher->Add(dir, wxFSW_EVENT_CREATE|wxFSW_EVENT_RENAME|wxFSW_EVENT_MODIFY);
+}
+
+void MainFrm::OnFileSystemEvent(wxFileSystemWatcherEvent& event)
+{
+    if (m_WatchedFile.empty()) return;
+    const wxFileName & fn = (event.GetChangeType() == wxFSW_EVENT_RENAME) ?
+	event.GetNewPath() : event.GetPath();
+    if (fn.GetFullPath() != m_WatchedFile) return;
+    // Wait until the file has stopped changing before reloading it.
+    m_ReloadTimer.StartOnce(500);
+}
+#endif
+
+void MainFrm::OnReloadTimer(wxTimerEvent&)
+{
+    if (m_WatchedFile.empty()) return;
+    if (m_Loading) {
+	// We're part way through loading, so try again once that's done.
+	m_ReloadTimer.StartOnce(500);
+	return;
+    }
+    // If loading fails the error has been reported and we keep watching, so
+    // the next successful run will be picked up.
+    if (LoadData(m_FileProcessed, m_Survey))
+	InitialiseAfterLoad(m_File, m_Survey);
+}
+
 void MainFrm::HideLog(wxWindow * log_window)
 {
     if (!IsFullScreen()) {
@@ -1596,6 +1823,7 @@ void MainFrm::OnExtend(wxCommandEvent&)
 	wxGetApp().ReportError(m);
 	return;
     }
+    StopWatching();
     if (LoadData(output, wxString()))
 	InitialiseAfterLoad(output, wxString());
 }
@@ -2198,99 +2426,13 @@ void MainFrm::OnIdle(wxIdleEvent&)
 void MainFrm::DoFind()
 {
     pending_find = false;
-    wxBusyCursor hourglass;
-    // Find stations specified by a string or regular expression pattern.
-
-    wxString pattern = m_FindBox->GetValue();
-    if (pattern.empty()) {
-	// Hide any search result highlights.
-	list<LabelInfo*>::iterator pos = m_Labels.begin();
-	while (pos != m_Labels.end()) {
-	    LabelInfo* label = *pos++;
-	    label->clear_flags(LFLAG_HIGHLIGHTED);
-	}
-	m_NumHighlighted = 0;
-    } else {
-	int re_flags = wxRE_NOSUB;
-
-	if (true /* case insensitive */) {
-	    re_flags |= wxRE_ICASE;
-	}
-
-	bool substring = true;
-	if (false /*m_RegexpCheckBox->GetValue()*/) {
-	    re_flags |= wxRE_EXTENDED;
-	} else if (true /* simple glob-style */) {
-	    wxString pat;
-	    for (size_t i = 0; i < pattern.size(); i++) {
-	       wxChar ch = pattern[i];
-	       // ^ only special at start; $ at end.  But this is simpler...
-	       switch (ch) {
-		case '^': case '$': case '.': case '[': case '\\':
-		  pat += wxT('\\');
-		  pat += ch;
-		  break;
-		case '*':
-		  pat += wxT(".*");
-		  substring = false;
-		  break;
-		case '?':
-		  pat += wxT('.');
-		  substring = false;
-		  break;
-		default:
-		  pat += ch;
-	       }
-	    }
-	    pattern = pat;
-	    re_flags |= wxRE_BASIC;
-	} else {
-	    wxString pat;
-	    for (size_t i = 0; i < pattern.size(); i++) {
-	       wxChar ch = pattern[i];
-	       // ^ only special at start; $ at end.  But this is simpler...
-	       switch (ch) {
-		case '^': case '$': case '*': case '.': case '[': case '\\':
-		  pat += wxT('\\');
-	       }
-	       pat += ch;
-	    }
-	    pattern = pat;
-	    re_flags |= wxRE_BASIC;
-	}
-
-	if (!substring) {
-	    // FIXME "0u" required to avoid compilation error with g++-3.0
-	    if (pattern.empty() || pattern[0u] != '^') pattern = wxT('^') + pattern;
-	    // FIXME: this fails to cope with "\$" at the end of pattern...
-	    if (pattern[pattern.size() - 1] != '$') pattern += wxT('$');
-	}
-
-	wxRegEx regex;
-	if (!regex.Compile(pattern, re_flags)) {
-	    wxBell();
-	    return;
-	}
-
-	int found = 0;
-
-	list<LabelInfo*>::iterator pos = m_Labels.begin();
-	while (pos != m_Labels.end()) {
-	    LabelInfo* label = *pos++;
-
-	    if (regex.Matches(label->GetText())) {
-		label->set_flags(LFLAG_HIGHLIGHTED);
-		++found;
-	    } else {
-		label->clear_flags(LFLAG_HIGHLIGHTED);
-	    }
-	}
-
-	m_NumHighlighted = found;
-
-	// Re-sort so highlighted points get names in preference
-	if (found) m_Labels.sort(LabelPlotCmp(GetSeparator()));
+    // Find stations specified by a string or glob pattern.
+    if (m_LabelSearch.search(m_FindBox->GetValue())) {
+	// Reorder so highlighted points get names in preference.
+	m_LabelSearch.get_plot_order(m_Labels);
+	UpdatePlotOrder();
     }
+    m_NumHighlighted = m_LabelSearch.get_match_count();
 
     m_Gfx->UpdateBlobs();
     m_Gfx->ForceRefresh();
@@ -2318,7 +2460,7 @@ void MainFrm::OnGotoFound(wxCommandEvent&)
     Double zmin = DBL_MAX;
     Double zmax = -DBL_MAX;
 
-    list<LabelInfo*>::iterator pos = m_Labels.begin();
+    vector<LabelInfo*>::iterator pos = m_Labels.begin();
     while (pos != m_Labels.end()) {
 	LabelInfo* label = *pos++;
 
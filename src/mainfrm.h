@@ -30,12 +30,17 @@
 #include <wx/notebook.h>
 #include <wx/print.h>
 #include <wx/printdlg.h>
+#include <wx/timer.h>
+#if wxUSE_FSWATCHER
+# include <wx/fswatcher.h>
+#endif
 
 #include "aventreectrl.h"
 #include "gfxcore.h"
 #include "guicontrol.h"
 #include "img_hosted.h"
 #include "labelinfo.h"
+#include "labelsearch.h"
 #include "message.h"
 #include "model.h"
 #include "vector3.h"
@@ -43,6 +48,7 @@
 //#include "prefsdlg.h"
 
 #include <list>
+#include <memory>
 #include <vector>
 
 using namespace std;
@@ -148,7 +154,8 @@ enum {
     menu_SURVEY_HIDE_SIBLINGS,
     textctrl_FIND,
     button_HIDE,
-    listctrl_PRES
+    listctrl_PRES,
+    timer_RELOAD
 };
 
 class AvenPresList;
@@ -177,15 +184,42 @@ class MainFrm : public wxFrame, public Model {
     int m_NumHighlighted = 0;
     bool pending_find;
 
+    // Index of station names for the find box.
+    LabelSearch m_LabelSearch;
+
     bool fullscreen_showing_menus;
 
 #ifdef PREFDLG
     PrefsDlg* m_PrefsDlg;
 #endif
 
+    // The processed file we reload if it changes on disk (e.g. because it's
+    // being written by "cavern --watch"), or empty if we aren't watching.
+    wxString m_WatchedFile;
+#if wxUSE_FSWATCHER
+    std::unique_ptr<wxFileSystemWatcher> m_FSWatcher;
+#endif
+    // Used to wait for a changed file to settle before we reload it.
+    wxTimer m_ReloadTimer;
+
+    // True while LoadData() is waiting for data to load.
+    bool m_Loading = false;
+
+    void WatchFile(const wxString & file);
+    void StopWatching();
+#if wxUSE_FSWATCHER
+    void StartWatching();
+#endif
+
     bool ProcessSVXFile(const wxString & file);
 //    void FixLRUD(traverse & centreline);
 
+    // Sort the labels into the order they're tried in for plotting.
+    void SortLabelsForPlotting();
+
+    // Record the order of m_Labels in each label after reordering it.
+    void UpdatePlotOrder();
+
     void CreateMenuBar();
     void MakeToolBar();
     void CreateSidePanel();
@@ -212,6 +246,10 @@ public:
 
     void OnMRUFile(wxCommandEvent& event);
     void OpenFile(const wxString& file, const wxString& survey = wxString());
+#if wxUSE_FSWATCHER
+    void OnFileSystemEvent(wxFileSystemWatcherEvent& event);
+#endif
+    void OnReloadTimer(wxTimerEvent& event);
 
     void OnPresNewUpdate(wxUpdateUIEvent& event);
     void OnPresOpenUpdate(wxUpdateUIEvent& event);
@@ -27,6 +27,10 @@
 # include <config.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 #include "debug.h"
 #include "cavern.h"
 #include "filename.h"
@@ -34,6 +38,8 @@
 #include "netbits.h"
 #include "matrix.h"
 #include "out.h"
+#include "profile.h"
+#include "solvecache.h"
 
 #undef PRINT_MATRICES
 #define PRINT_MATRICES 0
@@ -50,6 +56,35 @@ static void print_matrix(real *M, real *B, long n);
 
 static void choleski(real *M, real *B, long n);
 
+/* If there are more than this many simultaneous equations to solve then we
+ * use the sparse solver by default (since the matrices we build have only a
+ * few non-zero entries per row, the dense solver's O(n^3) time and O(n^2)
+ * memory soon start to hurt).  "-zc" forces the dense solver and "-zs" the
+ * sparse one, which is useful for comparing them.
+ */
+#define SPARSE_THRESHOLD 60
+
+/* Upper triangle of a sparse symmetric matrix in compressed column form,
+ * with rows and columns permuted into a fill-reducing order, plus its
+ * LDL' factorisation.
+ */
+typedef struct {
+   long n; /* number of equations */
+   long *Ap, *Ai; /* column pointers and row indices */
+   real *Ax; /* values */
+   long *pinv; /* pinv[i] is the position of station i in the ordering */
+   long *Lp, *Li, *Parent, *Lnz;
+   real *Lx, *D;
+   /* Workspace for the numeric factorisation. */
+   real *Y;
+   long *Pattern, *Flag;
+} sparse_matrix;
+
+static void sparse_zero(sparse_matrix *S);
+static void sparse_add(sparse_matrix *S, long row, long col, real value);
+static void sparse_solve(sparse_matrix *S, real *B);
+static void sparse_free(sparse_matrix *S);
+
 #ifdef SOR
 static void sor(real *M, real *B, long n);
 #endif
@@ -59,80 +94,273 @@ static void sor(real *M, real *B, long n);
 	      /* +(Y>X?0*printf("row<col (line %d)\n",__LINE__):0) */
 /*#define M_(X, Y) ((real *)M)[((((OSSIZE_T)(Y)) * ((Y) + 1)) >> 1) + (X)]*/
 
-static int find_stn_in_tab(node *stn);
-static int add_stn_to_tab(node *stn);
-static void build_matrix(node *list);
+#ifdef NO_COVARIANCES
+# define FACTOR 1
+#else
+# define FACTOR 3
+#endif
 
-static long n_stn_tab;
+/* State for solving the matrix for one component of the network.  Several
+ * of these can be being solved at once in different threads. */
+typedef struct {
+   node *list;
+   long n_stn_tab;
+   pos **stn_tab;
+   /* Open addressing hash table mapping each pos in stn_tab to its index,
+    * so that looking up the station at each end of a leg is O(1).  Empty
+    * slots hold -1. */
+   long *stn_hash;
+   unsigned long stn_hash_mask;
+   /* If non-NULL, build_matrix() is assembling into this sparse matrix
+    * rather than the dense one. */
+   sparse_matrix *SM;
+   /* Whether to use the sparse solver for this matrix. */
+   bool use_sparse;
+   /* For --solve-cache: identifies this matrix, and whether the solution
+    * came from the cache (in which case there's nothing to build). */
+   solve_cache_key cache_key;
+   bool cached;
+   /* Elapsed time in seconds spent building and solving the matrix, reported
+    * by "-zt".  This is wall clock time rather than clock() since clock()
+    * counts the CPU time of every thread in the process, so would include
+    * work on other matrices with --threads. */
+   double assembly_time, factor_time;
+} matrix_state;
 
-static pos **stn_tab;
+static int find_stn_in_tab(const matrix_state *ms, node *stn);
+static int add_stn_to_tab(matrix_state *ms, node *stn);
+static bool use_cached_solution(matrix_state *ms);
+static void build_matrix(matrix_state *ms);
+static sparse_matrix *sparse_build(const matrix_state *ms);
 
-extern void
-solve_matrix(node *list)
+/* Add V to M(X, Y) in whichever form of matrix we're building. */
+static void
+add_to_M(const matrix_state *ms, real *M, long X, long Y, real V)
+{
+   if (ms->SM) {
+      sparse_add(ms->SM, X, Y, V);
+   } else {
+      M(X, Y) += V;
+   }
+}
+
+/* Find the unfixed stations in list and report what we're about to solve.
+ * Returns fFalse if there's nothing to do. */
+static bool
+matrix_setup(matrix_state *ms, node *list)
 {
    node *stn;
    long n = 0;
+   unsigned long i;
+   double tm;
    FOR_EACH_STN(stn, list) {
       if (!fixed(stn)) n++;
    }
-   if (n == 0) return;
+   if (n == 0) return fFalse;
+
+   ms->list = list;
+   ms->SM = NULL;
 
    /* we just need n to be a reasonable estimate >= the number
     * of stations left after reduction. If memory is
     * plentiful, we can be crass.
     */
-   stn_tab = osmalloc((OSSIZE_T)(n * ossizeof(pos*)));
-   n_stn_tab = 0;
+   ms->stn_tab = osmalloc((OSSIZE_T)(n * ossizeof(pos*)));
+   ms->n_stn_tab = 0;
+
+   /* Size the hash table to be at most half full. */
+   ms->stn_hash_mask = 15;
+   while (ms->stn_hash_mask < (unsigned long)n * 2)
+      ms->stn_hash_mask = ms->stn_hash_mask * 2 + 1;
+   ms->stn_hash = osmalloc((OSSIZE_T)((ms->stn_hash_mask + 1) * ossizeof(long)));
+   for (i = 0; i <= ms->stn_hash_mask; i++) ms->stn_hash[i] = -1;
+
+   ms->assembly_time = ms->factor_time = 0;
+   tm = elapsed_time();
 
    FOR_EACH_STN(stn, list) {
-      if (!fixed(stn)) add_stn_to_tab(stn);
+      if (!fixed(stn)) add_stn_to_tab(ms, stn);
    }
+   ms->assembly_time += elapsed_time() - tm;
 
-   if (n_stn_tab < n) {
+   if (ms->n_stn_tab < n) {
       /* release unused entries in stn_tab */
-      stn_tab = osrealloc(stn_tab, n_stn_tab * ossizeof(pos*));
+      ms->stn_tab = osrealloc(ms->stn_tab, ms->n_stn_tab * ossizeof(pos*));
+   }
+
+   if (optimize & BITA('s')) {
+      ms->use_sparse = fTrue;
+   } else if (optimize & BITA('c')) {
+      ms->use_sparse = fFalse;
+   } else {
+      ms->use_sparse = (ms->n_stn_tab * FACTOR > SPARSE_THRESHOLD);
+   }
+
+   ms->cached = (solve_caching && ms->n_stn_tab > 0 && use_cached_solution(ms));
+
+   if (!fQuiet) {
+      if (ms->n_stn_tab == 0)
+	 puts(msg(/*Network solved by reduction - no simultaneous equations to solve.*/74));
+      else if (ms->n_stn_tab == 1)
+	 out_current_action(msg(/*Solving one equation*/78));
+      else
+	 out_current_action1(msg(/*Solving %d simultaneous equations*/75), ms->n_stn_tab);
    }
+   return fTrue;
+}
 
-   build_matrix(list);
+static void
+matrix_finish(matrix_state *ms)
+{
 #if DEBUG_MATRIX
-   FOR_EACH_STN(stn, list) {
+   node *stn;
+   FOR_EACH_STN(stn, ms->list) {
       printf("(%8.2f, %8.2f, %8.2f ) ", POS(stn, 0), POS(stn, 1), POS(stn, 2));
       print_prefix(stn->name);
       putnl();
    }
 #endif
 
-   osfree(stn_tab);
+   if (solve_caching && ms->n_stn_tab > 0 && !ms->cached) {
+      real *coords = osmalloc(ms->n_stn_tab * 3 * ossizeof(real));
+      long m;
+      int i;
+      for (m = 0; m < ms->n_stn_tab; m++) {
+	 for (i = 0; i < 3; i++) coords[m * 3 + i] = ms->stn_tab[m]->p[i];
+      }
+      solve_cache_add(&ms->cache_key, coords);
+      osfree(coords);
+   }
+
+   if (optimize & BITA('t')) {
+      if (ms->cached) {
+	 printf("Matrix of %ld stations: solution from cache\n",
+		ms->n_stn_tab);
+      } else {
+	 printf("Matrix of %ld stations: assembly %.3fs, factorisation %.3fs\n",
+		ms->n_stn_tab,
+		ms->assembly_time, ms->factor_time);
+      }
+   }
+
+   osfree(ms->stn_hash);
+   osfree(ms->stn_tab);
 }
 
-#ifdef NO_COVARIANCES
-# define FACTOR 1
+extern void
+solve_matrix(node *list)
+{
+   matrix_state ms;
+   if (!matrix_setup(&ms, list)) return;
+   build_matrix(&ms);
+   matrix_finish(&ms);
+}
+
+#ifdef HAVE_PTHREAD_H
+/* Matrices waiting to be solved by the worker threads, and the index of the
+ * next one to hand out. */
+static matrix_state *work;
+static long *work_order;
+static long work_len, work_next;
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *
+matrix_worker(void *arg)
+{
+   (void)arg;
+   while (1) {
+      long i;
+      pthread_mutex_lock(&work_mutex);
+      i = work_next++;
+      pthread_mutex_unlock(&work_mutex);
+      if (i >= work_len) break;
+      build_matrix(&work[work_order[i]]);
+   }
+   return NULL;
+}
+
+/* Sort so that the biggest matrices get handed out first, which avoids
+ * being left waiting for a single thread to finish a big one at the end. */
+static int
+cmp_work(const void *a, const void *b)
+{
+   long i = *(const long *)a, j = *(const long *)b;
+   if (work[i].n_stn_tab != work[j].n_stn_tab)
+      return work[i].n_stn_tab > work[j].n_stn_tab ? -1 : 1;
+   return i < j ? -1 : (i > j);
+}
+#endif
+
+extern void
+solve_matrices(node **lists, long n_lists)
+{
+#ifdef HAVE_PTHREAD_H
+   pthread_t *threads;
+   long i, n_work = 0;
+   int t, n_workers;
+
+   if (n_threads <= 1 || n_lists <= 1) {
+      for (i = 0; i < n_lists; i++) solve_matrix(lists[i]);
+      return;
+   }
+
+   /* Set up all the matrices first, in order, so the progress messages
+    * come out just as they would if we solved them one at a time.  Each
+    * component's stations are disjoint from all the others, and the only
+    * stations from outside a component which solving it looks at are fixed
+    * points, so the matrices can then be built and solved in any order. */
+   work = osmalloc(n_lists * ossizeof(matrix_state));
+   for (i = 0; i < n_lists; i++) {
+      if (matrix_setup(&work[n_work], lists[i])) n_work++;
+   }
+   work_order = osmalloc((n_work + 1) * ossizeof(long));
+   for (i = 0; i < n_work; i++) work_order[i] = i;
+   qsort(work_order, n_work, sizeof(long), cmp_work);
+   work_len = n_work;
+   work_next = 0;
+
+   n_workers = n_threads;
+   if (n_workers > n_work) n_workers = (int)n_work;
+   threads = osmalloc(n_workers * ossizeof(pthread_t));
+   for (t = 0; t < n_workers; t++) {
+      if (pthread_create(&threads[t], NULL, matrix_worker, NULL) != 0) break;
+   }
+   n_workers = t;
+   /* Help out (or do all the work if we failed to create any threads). */
+   matrix_worker(NULL);
+   for (t = 0; t < n_workers; t++) pthread_join(threads[t], NULL);
+   osfree(threads);
+
+   for (i = 0; i < n_work; i++) matrix_finish(&work[i]);
+   osfree(work_order);
+   osfree(work);
+   work = NULL;
 #else
-# define FACTOR 3
+   long i;
+   for (i = 0; i < n_lists; i++) solve_matrix(lists[i]);
 #endif
+}
 
 static void
-build_matrix(node *list)
+build_matrix(matrix_state *ms)
 {
+   node *list = ms->list;
    real *M;
    real *B;
    int dim;
+   double tm;
 
-   if (n_stn_tab == 0) {
-      if (!fQuiet)
-	 puts(msg(/*Network solved by reduction - no simultaneous equations to solve.*/74));
-      return;
-   }
-   /* (OSSIZE_T) cast may be needed if n_stn_tab>=181 */
-   M = osmalloc((OSSIZE_T)((((OSSIZE_T)n_stn_tab * FACTOR * (n_stn_tab * FACTOR + 1)) >> 1)) * ossizeof(real));
-   B = osmalloc((OSSIZE_T)(n_stn_tab * FACTOR * ossizeof(real)));
+   if (ms->n_stn_tab == 0 || ms->cached) return;
 
-   if (!fQuiet) {
-      if (n_stn_tab == 1)
-	 out_current_action(msg(/*Solving one equation*/78));
-      else
-	 out_current_action1(msg(/*Solving %d simultaneous equations*/75), n_stn_tab);
+   tm = elapsed_time();
+   if (ms->use_sparse) {
+      M = NULL;
+      ms->SM = sparse_build(ms);
+   } else {
+      /* (OSSIZE_T) cast may be needed if ms->n_stn_tab>=181 */
+      M = osmalloc((OSSIZE_T)((((OSSIZE_T)ms->n_stn_tab * FACTOR * (ms->n_stn_tab * FACTOR + 1)) >> 1)) * ossizeof(real));
    }
+   B = osmalloc((OSSIZE_T)(ms->n_stn_tab * FACTOR * ossizeof(real)));
 
 #ifdef NO_COVARIANCES
    dim = 2;
@@ -146,10 +374,14 @@ build_matrix(node *list)
       /* Initialise M and B to zero - zeroing "linearly" will minimise
        * paging when the matrix is large */
       {
-	 int end = n_stn_tab * FACTOR;
+	 int end = ms->n_stn_tab * FACTOR;
 	 for (row = 0; row < end; row++) B[row] = (real)0.0;
-	 end = ((OSSIZE_T)n_stn_tab * FACTOR * (n_stn_tab * FACTOR + 1)) >> 1;
-	 for (row = 0; row < end; row++) M[row] = (real)0.0;
+	 if (ms->SM) {
+	    sparse_zero(ms->SM);
+	 } else {
+	    end = ((OSSIZE_T)ms->n_stn_tab * FACTOR * (ms->n_stn_tab * FACTOR + 1)) >> 1;
+	    for (row = 0; row < end; row++) M[row] = (real)0.0;
+	 }
       }
 
       /* Construct matrix - Go thru' stn list & add all forward legs between
@@ -160,8 +392,11 @@ build_matrix(node *list)
        * All legs between a fixed and an unfixed station are then considered
        * from the unfixed end (if we consider them from the fixed end we'd
        * need to somehow detect when we're at a fixed point cut line and work
-       * out which side we're dealing with at this time. */
-      FOR_EACH_STN(stn, list) {
+       * out which side we're dealing with at this time.
+       *
+       * We don't use FOR_EACH_STN() here since it iterates using a global,
+       * and this may be running in several threads at once. */
+      for (stn = list; stn; stn = stn->next) {
 #ifdef NO_COVARIANCES
 	 real e;
 #else
@@ -191,7 +426,7 @@ build_matrix(node *list)
 #endif /* DEBUG_MATRIX_BUILD */
 
 	 if (!fixed(stn)) {
-	    f = find_stn_in_tab(stn);
+	    f = find_stn_in_tab(ms, stn);
 	    for (dirn = 0; dirn <= 2 && stn->leg[dirn]; dirn++) {
 	       linkfor *leg = stn->leg[dirn];
 	       node *to = leg->l.to;
@@ -203,7 +438,7 @@ build_matrix(node *list)
 		  e = leg->v[dim];
 		  if (e != (real)0.0) {
 		     e = ((real)1.0) / e;
-		     M(f,f) += e;
+		     add_to_M(ms, M, f, f, e);
 		     B[f] += e * POS(to, dim);
 		     if (fRev) {
 			B[f] += leg->d[dim];
@@ -222,17 +457,17 @@ build_matrix(node *list)
 		     }
 		     mulsd(&b, &e, &a);
 		     for (i = 0; i < 3; i++) {
-			M(f * FACTOR + i, f * FACTOR + i) += e[i];
+			add_to_M(ms, M, f * FACTOR + i, f * FACTOR + i, e[i]);
 			B[f * FACTOR + i] += b[i];
 		     }
-		     M(f * FACTOR + 1, f * FACTOR) += e[3];
-		     M(f * FACTOR + 2, f * FACTOR) += e[4];
-		     M(f * FACTOR + 2, f * FACTOR + 1) += e[5];
+		     add_to_M(ms, M, f * FACTOR + 1, f * FACTOR, e[3]);
+		     add_to_M(ms, M, f * FACTOR + 2, f * FACTOR, e[4]);
+		     add_to_M(ms, M, f * FACTOR + 2, f * FACTOR + 1, e[5]);
 		  }
 #endif
 	       } else if (data_here(leg)) {
 		  /* forward leg, unfixed -> unfixed */
-		  t = find_stn_in_tab(to);
+		  t = find_stn_in_tab(ms, to);
 #if DEBUG_MATRIX
 		  printf("Leg %d to %d, var %f, delta %f\n", f, t, e,
 			 leg->d[dim]);
@@ -243,9 +478,9 @@ build_matrix(node *list)
 		  if (t != f && e != (real)0.0) {
 		     real a;
 		     e = ((real)1.0) / e;
-		     M(f,f) += e;
-		     M(t,t) += e;
-		     if (f < t) M(t,f) -= e; else M(f,t) -= e;
+		     add_to_M(ms, M, f, f, e);
+		     add_to_M(ms, M, t, t, e);
+		     if (f < t) add_to_M(ms, M, t, f, -e); else add_to_M(ms, M, f, t, -e);
 		     a = e * leg->d[dim];
 		     B[f] -= a;
 		     B[t] += a;
@@ -255,35 +490,35 @@ build_matrix(node *list)
 		     int i;
 		     mulsd(&a, &e, &leg->d);
 		     for (i = 0; i < 3; i++) {
-			M(f * FACTOR + i, f * FACTOR + i) += e[i];
-			M(t * FACTOR + i, t * FACTOR + i) += e[i];
+			add_to_M(ms, M, f * FACTOR + i, f * FACTOR + i, e[i]);
+			add_to_M(ms, M, t * FACTOR + i, t * FACTOR + i, e[i]);
 			if (f < t)
-			   M(t * FACTOR + i, f * FACTOR + i) -= e[i];
+			   add_to_M(ms, M, t * FACTOR + i, f * FACTOR + i, -e[i]);
 			else
-			   M(f * FACTOR + i, t * FACTOR + i) -= e[i];
+			   add_to_M(ms, M, f * FACTOR + i, t * FACTOR + i, -e[i]);
 			B[f * FACTOR + i] -= a[i];
 			B[t * FACTOR + i] += a[i];
 		     }
-		     M(f * FACTOR + 1, f * FACTOR) += e[3];
-		     M(t * FACTOR + 1, t * FACTOR) += e[3];
-		     M(f * FACTOR + 2, f * FACTOR) += e[4];
-		     M(t * FACTOR + 2, t * FACTOR) += e[4];
-		     M(f * FACTOR + 2, f * FACTOR + 1) += e[5];
-		     M(t * FACTOR + 2, t * FACTOR + 1) += e[5];
+		     add_to_M(ms, M, f * FACTOR + 1, f * FACTOR, e[3]);
+		     add_to_M(ms, M, t * FACTOR + 1, t * FACTOR, e[3]);
+		     add_to_M(ms, M, f * FACTOR + 2, f * FACTOR, e[4]);
+		     add_to_M(ms, M, t * FACTOR + 2, t * FACTOR, e[4]);
+		     add_to_M(ms, M, f * FACTOR + 2, f * FACTOR + 1, e[5]);
+		     add_to_M(ms, M, t * FACTOR + 2, t * FACTOR + 1, e[5]);
 		     if (f < t) {
-			M(t * FACTOR + 1, f * FACTOR) -= e[3];
-			M(t * FACTOR, f * FACTOR + 1) -= e[3];
-			M(t * FACTOR + 2, f * FACTOR) -= e[4];
-			M(t * FACTOR, f * FACTOR + 2) -= e[4];
-			M(t * FACTOR + 2, f * FACTOR + 1) -= e[5];
-			M(t * FACTOR + 1, f * FACTOR + 2) -= e[5];
+			add_to_M(ms, M, t * FACTOR + 1, f * FACTOR, -e[3]);
+			add_to_M(ms, M, t * FACTOR, f * FACTOR + 1, -e[3]);
+			add_to_M(ms, M, t * FACTOR + 2, f * FACTOR, -e[4]);
+			add_to_M(ms, M, t * FACTOR, f * FACTOR + 2, -e[4]);
+			add_to_M(ms, M, t * FACTOR + 2, f * FACTOR + 1, -e[5]);
+			add_to_M(ms, M, t * FACTOR + 1, f * FACTOR + 2, -e[5]);
 		     } else {
-			M(f * FACTOR + 1, t * FACTOR) -= e[3];
-			M(f * FACTOR, t * FACTOR + 1) -= e[3];
-			M(f * FACTOR + 2, t * FACTOR) -= e[4];
-			M(f * FACTOR, t * FACTOR + 2) -= e[4];
-			M(f * FACTOR + 2, t * FACTOR + 1) -= e[5];
-			M(f * FACTOR + 1, t * FACTOR + 2) -= e[5];
+			add_to_M(ms, M, f * FACTOR + 1, t * FACTOR, -e[3]);
+			add_to_M(ms, M, f * FACTOR, t * FACTOR + 1, -e[3]);
+			add_to_M(ms, M, f * FACTOR + 2, t * FACTOR, -e[4]);
+			add_to_M(ms, M, f * FACTOR, t * FACTOR + 2, -e[4]);
+			add_to_M(ms, M, f * FACTOR + 2, t * FACTOR + 1, -e[5]);
+			add_to_M(ms, M, f * FACTOR + 1, t * FACTOR + 2, -e[5]);
 		     }
 		  }
 #endif
@@ -292,52 +527,133 @@ build_matrix(node *list)
 	 }
       }
 
+      ms->assembly_time += elapsed_time() - tm;
+      tm = elapsed_time();
+
 #if PRINT_MATRICES
-      print_matrix(M, B, n_stn_tab * FACTOR); /* 'ave a look! */
+      if (!ms->SM) print_matrix(M, B, ms->n_stn_tab * FACTOR); /* 'ave a look! */
 #endif
 
+      if (ms->SM) {
+	 sparse_solve(ms->SM, B);
+      } else
 #ifdef SOR
       /* defined in network.c, may be altered by -z<letters> on command line */
       if (optimize & BITA('i'))
-	 sor(M, B, n_stn_tab * FACTOR);
+	 sor(M, B, ms->n_stn_tab * FACTOR);
       else
 #endif
-	 choleski(M, B, n_stn_tab * FACTOR);
+	 choleski(M, B, ms->n_stn_tab * FACTOR);
+
+      ms->factor_time += elapsed_time() - tm;
+      tm = elapsed_time();
 
       {
 	 int m;
-	 for (m = (int)(n_stn_tab - 1); m >= 0; m--) {
+	 for (m = (int)(ms->n_stn_tab - 1); m >= 0; m--) {
 #ifdef NO_COVARIANCES
-	    stn_tab[m]->p[dim] = B[m];
+	    ms->stn_tab[m]->p[dim] = B[m];
 	    if (dim == 0) {
-	       SVX_ASSERT2(pos_fixed(stn_tab[m]),
+	       SVX_ASSERT2(pos_fixed(ms->stn_tab[m]),
 		       "setting station coordinates didn't mark pos as fixed");
 	    }
 #else
 	    int i;
 	    for (i = 0; i < 3; i++) {
-	       stn_tab[m]->p[i] = B[m * FACTOR + i];
+	       ms->stn_tab[m]->p[i] = B[m * FACTOR + i];
 	    }
-	    SVX_ASSERT2(pos_fixed(stn_tab[m]),
+	    SVX_ASSERT2(pos_fixed(ms->stn_tab[m]),
 		    "setting station coordinates didn't mark pos as fixed");
 #endif
 	 }
 #if EXPLICIT_FIXED_FLAG
-	 for (m = n_stn_tab - 1; m >= 0; m--) fixpos(stn_tab[m]);
+	 for (m = ms->n_stn_tab - 1; m >= 0; m--) fixpos(ms->stn_tab[m]);
 #endif
       }
    }
    osfree(B);
-   osfree(M);
+   if (ms->SM) {
+      sparse_free(ms->SM);
+      ms->SM = NULL;
+   } else {
+      osfree(M);
+   }
+}
+
+/* Work out the key identifying the input to solving this matrix, and if the
+ * solution is in the cache, set the station positions from it. */
+static bool
+use_cached_solution(matrix_state *ms)
+{
+   solve_cache_key *key = &ms->cache_key;
+   const real *coords;
+   node *stn;
+   long m;
+   int i;
+
+   solve_cache_key_init(key, ms->n_stn_tab);
+   solve_cache_key_add(key, &ms->use_sparse, sizeof(ms->use_sparse));
+#ifdef SOR
+   {
+      bool use_sor = !ms->use_sparse && (optimize & BITA('i'));
+      solve_cache_key_add(key, &use_sor, sizeof(use_sor));
+   }
+#endif
+   /* Hash everything build_matrix() looks at, in the same order. */
+   for (stn = ms->list; stn; stn = stn->next) {
+      int f, dirn;
+      if (fixed(stn)) continue;
+      f = find_stn_in_tab(ms, stn);
+      solve_cache_key_add(key, &f, sizeof(f));
+      for (dirn = 0; dirn <= 2 && stn->leg[dirn]; dirn++) {
+	 linkfor *leg = stn->leg[dirn];
+	 node *to = leg->l.to;
+	 if (fixed(to)) {
+	    bool fRev = !data_here(leg);
+	    if (fRev) leg = reverse_leg(leg);
+	    solve_cache_key_add(key, &fRev, sizeof(fRev));
+	    solve_cache_key_add(key, POSD(to), sizeof(delta));
+	 } else if (data_here(leg)) {
+	    int t = find_stn_in_tab(ms, to);
+	    solve_cache_key_add(key, &t, sizeof(t));
+	 } else {
+	    continue;
+	 }
+	 solve_cache_key_add(key, leg->d, sizeof(leg->d));
+	 solve_cache_key_add(key, leg->v, sizeof(leg->v));
+      }
+   }
+
+   coords = solve_cache_find(key);
+   if (!coords) return fFalse;
+
+   for (m = 0; m < ms->n_stn_tab; m++) {
+      for (i = 0; i < 3; i++) ms->stn_tab[m]->p[i] = coords[m * 3 + i];
+#if EXPLICIT_FIXED_FLAG
+      fixpos(ms->stn_tab[m]);
+#endif
+   }
+   return fTrue;
+}
+
+static unsigned long
+hash_pos(const matrix_state *ms, const pos *p)
+{
+   /* Fibonacci hashing of the address - the low bits are always zero due to
+    * alignment, so we want the high bits of the product. */
+   unsigned long h = (unsigned long)(size_t)p;
+   h = (h >> 3) * 2654435761UL;
+   return (h ^ (h >> 16)) & ms->stn_hash_mask;
 }
 
 static int
-find_stn_in_tab(node *stn)
+find_stn_in_tab(const matrix_state *ms, node *stn)
 {
-   int i = 0;
    pos *p = stn->name->pos;
-   while (stn_tab[i] != p)
-      if (++i == n_stn_tab) {
+   unsigned long h = hash_pos(ms, p);
+   long i;
+   while ((i = ms->stn_hash[h]) < 0 || ms->stn_tab[i] != p) {
+      if (i < 0) {
 #if DEBUG_INVALID
 	 fputs("Station ", stderr);
 	 fprint_prefix(stderr, stn->name);
@@ -351,19 +667,23 @@ find_stn_in_tab(node *stn)
 #endif
 	 fatalerror(/*Bug in program detected! Please report this to the authors*/11);
       }
-   return i;
+      h = (h + 1) & ms->stn_hash_mask;
+   }
+   return (int)i;
 }
 
 static int
-add_stn_to_tab(node *stn)
+add_stn_to_tab(matrix_state *ms, node *stn)
 {
-   int i;
    pos *p = stn->name->pos;
-   for (i = 0; i < n_stn_tab; i++) {
-      if (stn_tab[i] == p) return i;
+   unsigned long h = hash_pos(ms, p);
+   while (ms->stn_hash[h] >= 0) {
+      if (ms->stn_tab[ms->stn_hash[h]] == p) return (int)ms->stn_hash[h];
+      h = (h + 1) & ms->stn_hash_mask;
    }
-   stn_tab[n_stn_tab++] = p;
-   return i;
+   ms->stn_hash[h] = ms->n_stn_tab;
+   ms->stn_tab[ms->n_stn_tab++] = p;
+   return (int)ms->stn_hash[h];
 }
 
 /* Solve MX=B for X by Choleski factorisation - modified Choleski actually
@@ -410,6 +730,419 @@ choleski(real *M, real *B, long n)
    /* printf("\n%ld/%ld\n\n",flops,flopsTot); */
 }
 
+/* Sparse LDL' solver.
+ *
+ * The matrix has a diagonal block for each station and an off-diagonal
+ * block only where a leg joins two stations, so for a large network it is
+ * almost entirely zeros.  We pick a fill-reducing order for the stations
+ * using the minimum degree heuristic, then factorise using an up-looking
+ * sparse LDL' (see Tim Davis' "Direct Methods for Sparse Linear Systems").
+ */
+
+typedef struct {
+   long degree;
+   long stn;
+} md_entry;
+
+/* Binary min-heap of md_entry ordered by degree, then station number (so
+ * the ordering we produce doesn't depend on anything but the network). */
+typedef struct {
+   md_entry *e;
+   long len, size;
+} md_heap;
+
+static bool
+md_less(const md_entry *a, const md_entry *b)
+{
+   return a->degree < b->degree ||
+	  (a->degree == b->degree && a->stn < b->stn);
+}
+
+static void
+md_heap_push(md_heap *h, long degree, long stn)
+{
+   long i = h->len++;
+   md_entry x;
+   x.degree = degree;
+   x.stn = stn;
+   if (i == h->size) {
+      h->size *= 2;
+      h->e = osrealloc(h->e, h->size * ossizeof(md_entry));
+   }
+   while (i > 0) {
+      long parent = (i - 1) >> 1;
+      if (!md_less(&x, &h->e[parent])) break;
+      h->e[i] = h->e[parent];
+      i = parent;
+   }
+   h->e[i] = x;
+}
+
+static md_entry
+md_heap_pop(md_heap *h)
+{
+   md_entry top = h->e[0];
+   md_entry last = h->e[--h->len];
+   long i = 0;
+   while (1) {
+      long child = 2 * i + 1;
+      if (child >= h->len) break;
+      if (child + 1 < h->len && md_less(&h->e[child + 1], &h->e[child]))
+	 child++;
+      if (!md_less(&h->e[child], &last)) break;
+      h->e[i] = h->e[child];
+      i = child;
+   }
+   h->e[i] = last;
+   return top;
+}
+
+/* Find a fill-reducing elimination order for the graph with n vertices
+ * given by xadj and adjncy (in compressed form) using the minimum degree
+ * heuristic.  Returns perm, where perm[k] is the k-th vertex to eliminate.
+ */
+static long *
+min_degree_order(long n, const long *xadj, const long *adjncy)
+{
+   long **nbrs = osmalloc(n * ossizeof(long *));
+   long *deg = osmalloc(n * ossizeof(long));
+   long *cap = osmalloc(n * ossizeof(long));
+   long *mark = osmalloc(n * ossizeof(long));
+   long *perm = osmalloc(n * ossizeof(long));
+   char *done = osmalloc(n);
+   md_heap heap;
+   long stamp = 0;
+   long i, k = 0;
+
+   heap.len = 0;
+   heap.size = n;
+   heap.e = osmalloc(heap.size * ossizeof(md_entry));
+
+   for (i = 0; i < n; i++) {
+      deg[i] = xadj[i + 1] - xadj[i];
+      cap[i] = deg[i] ? deg[i] : 1;
+      nbrs[i] = osmalloc(cap[i] * ossizeof(long));
+      memcpy(nbrs[i], adjncy + xadj[i], deg[i] * ossizeof(long));
+      mark[i] = 0;
+      done[i] = 0;
+      md_heap_push(&heap, deg[i], i);
+   }
+
+   while (k < n) {
+      md_entry top = md_heap_pop(&heap);
+      long v = top.stn;
+      long *vn;
+      long j;
+      /* Skip entries which are stale because the degree has changed. */
+      if (done[v] || top.degree != deg[v]) continue;
+      done[v] = 1;
+      perm[k++] = v;
+      vn = nbrs[v];
+      /* Eliminating v joins all its neighbours into a clique. */
+      for (j = 0; j < deg[v]; j++) {
+	 long u = vn[j];
+	 long *un = nbrs[u];
+	 long a, b;
+	 ++stamp;
+	 mark[u] = stamp;
+	 for (a = b = 0; a < deg[u]; a++) {
+	    if (un[a] != v) {
+	       mark[un[a]] = stamp;
+	       un[b++] = un[a];
+	    }
+	 }
+	 deg[u] = b;
+	 for (a = 0; a < deg[v]; a++) {
+	    long w = vn[a];
+	    if (mark[w] == stamp) continue;
+	    if (deg[u] == cap[u]) {
+	       cap[u] *= 2;
+	       nbrs[u] = un = osrealloc(un, cap[u] * ossizeof(long));
+	    }
+	    un[deg[u]++] = w;
+	 }
+	 md_heap_push(&heap, deg[u], u);
+      }
+      osfree(vn);
+   }
+
+   osfree(heap.e);
+   osfree(done);
+   osfree(mark);
+   osfree(cap);
+   osfree(deg);
+   osfree(nbrs);
+   return perm;
+}
+
+/* Work out the non-zero structure of the matrix for the network in list,
+ * pick an ordering, and do the symbolic part of the factorisation. */
+static sparse_matrix *
+sparse_build(const matrix_state *ms)
+{
+   sparse_matrix *S = osnew(sparse_matrix);
+   long n_stns = ms->n_stn_tab;
+   long n = n_stns * FACTOR;
+   long *edges = NULL;
+   long n_edges = 0, edges_size = 0;
+   long *xadj, *adjncy, *perm, *mark;
+   long i, k, p;
+   node *stn;
+
+   /* Find all legs between pairs of different unfixed stations (not using
+    * FOR_EACH_STN() as this may be running in several threads at once). */
+   for (stn = ms->list; stn; stn = stn->next) {
+      int dirn;
+      if (fixed(stn)) continue;
+      for (dirn = 0; dirn <= 2 && stn->leg[dirn]; dirn++) {
+	 linkfor *leg = stn->leg[dirn];
+	 long f, t;
+	 if (fixed(leg->l.to) || !data_here(leg)) continue;
+	 f = find_stn_in_tab(ms, stn);
+	 t = find_stn_in_tab(ms, leg->l.to);
+	 if (f == t) continue;
+	 if (n_edges == edges_size) {
+	    edges_size = edges_size ? edges_size * 2 : 64;
+	    edges = osrealloc(edges, 2 * edges_size * ossizeof(long));
+	 }
+	 edges[2 * n_edges] = f;
+	 edges[2 * n_edges + 1] = t;
+	 n_edges++;
+      }
+   }
+
+   /* Build the adjacency graph of the stations, dropping any repeated
+    * neighbours (from parallel legs). */
+   xadj = osmalloc((n_stns + 1) * ossizeof(long));
+   for (i = 0; i <= n_stns; i++) xadj[i] = 0;
+   for (i = 0; i < 2 * n_edges; i++) xadj[edges[i] + 1]++;
+   for (i = 0; i < n_stns; i++) xadj[i + 1] += xadj[i];
+   adjncy = osmalloc((2 * n_edges + 1) * ossizeof(long));
+   mark = osmalloc(n_stns * ossizeof(long));
+   for (i = 0; i < n_stns; i++) mark[i] = xadj[i];
+   for (i = 0; i < n_edges; i++) {
+      long f = edges[2 * i], t = edges[2 * i + 1];
+      adjncy[mark[f]++] = t;
+      adjncy[mark[t]++] = f;
+   }
+   osfree(edges);
+
+   for (i = 0; i < n_stns; i++) mark[i] = -1;
+   p = 0;
+   for (i = 0; i < n_stns; i++) {
+      long j = xadj[i], end = xadj[i + 1];
+      xadj[i] = p;
+      for ( ; j < end; j++) {
+	 long t = adjncy[j];
+	 if (mark[t] == i) continue;
+	 mark[t] = i;
+	 adjncy[p++] = t;
+      }
+   }
+   xadj[n_stns] = p;
+
+   perm = min_degree_order(n_stns, xadj, adjncy);
+   S->pinv = osmalloc(n_stns * ossizeof(long));
+   for (k = 0; k < n_stns; k++) S->pinv[perm[k]] = k;
+   osfree(perm);
+
+   /* Build the pattern of the upper triangle of the permuted matrix.  The
+    * column for each unknown has an entry for the unknowns of each
+    * neighbouring station earlier in the ordering, and for itself and any
+    * earlier unknowns for the same station. */
+   S->n = n;
+   S->Ap = osmalloc((n + 1) * ossizeof(long));
+   S->Ap[0] = 0;
+   for (i = 0; i < n_stns; i++) {
+      long q = S->pinv[i];
+      long lower = 0, j, c;
+      for (j = xadj[i]; j < xadj[i + 1]; j++) {
+	 if (S->pinv[adjncy[j]] < q) lower++;
+      }
+      for (c = 0; c < FACTOR; c++) {
+	 S->Ap[q * FACTOR + c + 1] = lower * FACTOR + c + 1;
+      }
+   }
+   for (k = 0; k < n; k++) S->Ap[k + 1] += S->Ap[k];
+   S->Ai = osmalloc(S->Ap[n] * ossizeof(long));
+   S->Ax = osmalloc(S->Ap[n] * ossizeof(real));
+   for (i = 0; i < n_stns; i++) {
+      long q = S->pinv[i];
+      long c;
+      for (c = 0; c < FACTOR; c++) {
+	 long j, r;
+	 p = S->Ap[q * FACTOR + c];
+	 for (j = xadj[i]; j < xadj[i + 1]; j++) {
+	    long q2 = S->pinv[adjncy[j]];
+	    if (q2 >= q) continue;
+	    for (r = 0; r < FACTOR; r++) S->Ai[p++] = q2 * FACTOR + r;
+	 }
+	 for (r = 0; r <= c; r++) S->Ai[p++] = q * FACTOR + r;
+      }
+   }
+   osfree(mark);
+   osfree(adjncy);
+   osfree(xadj);
+
+   /* Symbolic factorisation - find the elimination tree and the number of
+    * non-zeros in each column of L. */
+   S->Lp = osmalloc((n + 1) * ossizeof(long));
+   S->Parent = osmalloc(n * ossizeof(long));
+   S->Lnz = osmalloc(n * ossizeof(long));
+   S->Flag = osmalloc(n * ossizeof(long));
+   for (k = 0; k < n; k++) {
+      S->Parent[k] = -1;
+      S->Flag[k] = k;
+      S->Lnz[k] = 0;
+      for (p = S->Ap[k]; p < S->Ap[k + 1]; p++) {
+	 for (i = S->Ai[p]; i < k && S->Flag[i] != k; i = S->Parent[i]) {
+	    if (S->Parent[i] == -1) S->Parent[i] = k;
+	    S->Lnz[i]++;
+	    S->Flag[i] = k;
+	 }
+      }
+   }
+   S->Lp[0] = 0;
+   for (k = 0; k < n; k++) S->Lp[k + 1] = S->Lp[k] + S->Lnz[k];
+   S->Li = osmalloc((S->Lp[n] + 1) * ossizeof(long));
+   S->Lx = osmalloc((S->Lp[n] + 1) * ossizeof(real));
+   S->D = osmalloc(n * ossizeof(real));
+   S->Y = osmalloc(n * ossizeof(real));
+   S->Pattern = osmalloc(n * ossizeof(long));
+   return S;
+}
+
+static void
+sparse_zero(sparse_matrix *S)
+{
+   long p;
+   for (p = 0; p < S->Ap[S->n]; p++) S->Ax[p] = (real)0.0;
+}
+
+/* Add value to entry (row, col) of the matrix (in the unpermuted order, as
+ * used by M(), so row >= col). */
+static void
+sparse_add(sparse_matrix *S, long row, long col, real value)
+{
+   long r = S->pinv[row / FACTOR] * FACTOR + row % FACTOR;
+   long c = S->pinv[col / FACTOR] * FACTOR + col % FACTOR;
+   long p, end;
+   if (r > c) {
+      long tmp = r;
+      r = c;
+      c = tmp;
+   }
+   end = S->Ap[c + 1];
+   for (p = S->Ap[c]; p < end; p++) {
+      if (S->Ai[p] == r) {
+	 S->Ax[p] += value;
+	 return;
+      }
+   }
+   BUG("entry not in pattern of sparse matrix");
+}
+
+/* Numeric factorisation into LDL'. */
+static void
+sparse_factor(sparse_matrix *S)
+{
+   long n = S->n;
+   long k;
+   for (k = 0; k < n; k++) {
+      S->Y[k] = (real)0.0;
+      S->Flag[k] = -1;
+   }
+   for (k = 0; k < n; k++) {
+      long p, top = n;
+      S->Flag[k] = k;
+      S->Lnz[k] = 0;
+      /* Scatter column k into Y and find the pattern of row k of L by
+       * walking up the elimination tree. */
+      for (p = S->Ap[k]; p < S->Ap[k + 1]; p++) {
+	 long i = S->Ai[p];
+	 long len = 0;
+	 S->Y[i] += S->Ax[p];
+	 for ( ; S->Flag[i] != k; i = S->Parent[i]) {
+	    S->Pattern[len++] = i;
+	    S->Flag[i] = k;
+	 }
+	 while (len > 0) S->Pattern[--top] = S->Pattern[--len];
+      }
+      S->D[k] = S->Y[k];
+      S->Y[k] = (real)0.0;
+      for ( ; top < n; top++) {
+	 long i = S->Pattern[top];
+	 long p2 = S->Lp[i] + S->Lnz[i];
+	 real yi = S->Y[i];
+	 real l_ki;
+	 S->Y[i] = (real)0.0;
+	 for (p = S->Lp[i]; p < p2; p++) S->Y[S->Li[p]] -= S->Lx[p] * yi;
+	 l_ki = yi / S->D[i];
+	 S->D[k] -= l_ki * yi;
+	 S->Li[p2] = k;
+	 S->Lx[p2] = l_ki;
+	 S->Lnz[i]++;
+      }
+   }
+}
+
+/* Solve MX=B for X, overwriting B with X. */
+static void
+sparse_solve(sparse_matrix *S, real *B)
+{
+   long n = S->n;
+   real *X = S->Y;
+   long j, p;
+
+   sparse_factor(S);
+
+   for (j = 0; j < n; j++) {
+      X[S->pinv[j / FACTOR] * FACTOR + j % FACTOR] = B[j];
+   }
+
+   /* Multiply x by L inverse */
+   for (j = 0; j < n; j++) {
+      for (p = S->Lp[j]; p < S->Lp[j + 1]; p++) {
+	 X[S->Li[p]] -= S->Lx[p] * X[j];
+      }
+   }
+
+   /* Multiply x by D inverse */
+   for (j = 0; j < n; j++) {
+      X[j] /= S->D[j];
+   }
+
+   /* Multiply x by (L transpose) inverse */
+   for (j = n - 1; j >= 0; j--) {
+      for (p = S->Lp[j]; p < S->Lp[j + 1]; p++) {
+	 X[j] -= S->Lx[p] * X[S->Li[p]];
+      }
+   }
+
+   for (j = 0; j < n; j++) {
+      B[j] = X[S->pinv[j / FACTOR] * FACTOR + j % FACTOR];
+   }
+}
+
+static void
+sparse_free(sparse_matrix *S)
+{
+   osfree(S->Pattern);
+   osfree(S->Y);
+   osfree(S->D);
+   osfree(S->Lx);
+   osfree(S->Li);
+   osfree(S->Flag);
+   osfree(S->Lnz);
+   osfree(S->Parent);
+   osfree(S->Lp);
+   osfree(S->Ax);
+   osfree(S->Ai);
+   osfree(S->Ap);
+   osfree(S->pinv);
+   osfree(S);
+}
+
 #ifdef SOR
 /* factor to use for SOR (must have 1 <= SOR_factor < 2) */
 #define SOR_factor 1.93 /* 1.95 */
@@ -18,3 +18,7 @@
  */
 
 void solve_matrix(node *list);
+
+/* Solve the matrices for n_lists independent components of the network,
+ * using up to n_threads threads. */
+void solve_matrices(node **lists, long n_lists);
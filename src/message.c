@@ -157,6 +157,105 @@ osstrdup(const char *str)
    return p;
 }
 
+/* Size of the blocks arenas allocate objects from. */
+#define OSARENA_BLOCK_SIZE 65536
+
+/* Used to work out how to align objects allocated from an arena. */
+typedef union {
+   void *p;
+   double d;
+   long l;
+} osarena_align;
+
+static osarena *arena_list = NULL, **arena_list_end = &arena_list;
+
+/* Add arena to the list for osarena_report() if it isn't already on it. */
+static void
+osarena_register(osarena *arena)
+{
+   if (arena->next_arena == NULL && arena_list_end != &arena->next_arena) {
+      *arena_list_end = arena;
+      arena_list_end = &arena->next_arena;
+   }
+}
+
+static void
+osarena_new_block(osarena *arena, OSSIZE_T min_size)
+{
+   OSSIZE_T block_size = OSARENA_BLOCK_SIZE;
+   osarena_register(arena);
+   if (block_size < min_size) block_size = min_size;
+   arena->next = osmalloc(block_size);
+   arena->end = arena->next + block_size;
+}
+
+void *
+osarena_alloc(osarena *arena)
+{
+   void *p = arena->free_list;
+   if (p) {
+      arena->free_list = *(void **)p;
+   } else {
+      OSSIZE_T size = arena->size;
+      if (arena->end == NULL) {
+	 /* First allocation - round up the size so objects are aligned. */
+	 OSSIZE_T align = sizeof(osarena_align);
+	 size = (size + align - 1) / align * align;
+	 arena->size = size;
+      }
+      if ((OSSIZE_T)(arena->end - arena->next) < size)
+	 osarena_new_block(arena, size);
+      p = arena->next;
+      arena->next += size;
+   }
+   if (++arena->count > arena->peak_count) arena->peak_count = arena->count;
+   arena->bytes += arena->size;
+   if (arena->bytes > arena->peak_bytes) arena->peak_bytes = arena->bytes;
+   return p;
+}
+
+void
+osarena_free(osarena *arena, void *p)
+{
+   *(void **)p = arena->free_list;
+   arena->free_list = p;
+   --arena->count;
+   arena->bytes -= arena->size;
+}
+
+char *
+osarena_strdup(osarena *arena, const char *str)
+{
+   char *p;
+   OSSIZE_T len = strlen(str) + 1;
+   if (len > OSARENA_BLOCK_SIZE / 4) {
+      /* Allocate long strings separately rather than wasting the rest of the
+       * current block. */
+      osarena_register(arena);
+      p = osmalloc(len);
+   } else {
+      if ((OSSIZE_T)(arena->end - arena->next) < len)
+	 osarena_new_block(arena, len);
+      p = arena->next;
+      arena->next += len;
+   }
+   memcpy(p, str, len);
+   arena->peak_count = ++arena->count;
+   arena->peak_bytes = (arena->bytes += len);
+   return p;
+}
+
+void
+osarena_report(void)
+{
+   const osarena *arena;
+   printf("%-12s %12s %12s\n", "Arena", "Peak count", "Peak bytes");
+   for (arena = arena_list; arena; arena = arena->next_arena) {
+      printf("%-12s %12lu %12lu\n", arena->name, arena->peak_count,
+	     (unsigned long)arena->peak_bytes);
+   }
+}
+
 /* osfree is usually just a macro in osalloc.h */
 #ifdef TOMBSTONES
 void
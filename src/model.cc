@@ -31,7 +31,9 @@
 #include "img_hosted.h"
 #include "useful.h"
 
+#include <algorithm>
 #include <cfloat>
+#include <cstddef>
 #include <map>
 
 using namespace std;
@@ -47,8 +49,34 @@ img2aven(int flags)
     return img2aven_tab[flags];
 }
 
-int Model::Load(const wxString& file, const wxString& prefix)
+// Estimate what fraction of the survey data has been read so far.
+static double
+load_fraction(const img* survey, double file_size)
 {
+    if (survey->data_start) {
+	// Format version 8 data is decoded from memory.
+	ptrdiff_t len = survey->data_end - survey->data_start;
+	if (len <= 0) return 1.0;
+	return double(survey->data_ptr - survey->data_start) / double(len);
+    }
+    if (file_size <= 0) return 0.0;
+    long pos = ftell(survey->fh);
+    if (pos < 0) return 0.0;
+    return min(double(pos) / file_size, 1.0);
+}
+
+int Model::Load(const wxString& file, const wxString& prefix,
+		ModelLoadProgress* progress, bool for_display)
+{
+    // If we've already loaded this file and it hasn't changed since, we can
+    // just load the model we built from it last time.
+    string cache_key;
+    m_LoadedFromCache = for_display && LoadCache(file, prefix, cache_key);
+    if (m_LoadedFromCache) {
+	BuildSpatialIndex();
+	return 0;
+    }
+
     // Load the processed survey data.
     img* survey = img_read_stream_survey(wxFopen(file, wxT("rb")),
 					 fclose,
@@ -60,6 +88,12 @@ int Model::Load(const wxString& file, const wxString& prefix)
 
     m_IsExtendedElevation = survey->is_extended_elevation;
 
+    double file_size = 0;
+    if (progress && !survey->data_start) {
+	wxStructStat st;
+	if (wxStat(file, &st) == 0) file_size = st.st_size;
+    }
+
     // Create a list of all the leg vertices, counting them and finding the
     // extent of the survey at the same time.
 
@@ -74,8 +108,8 @@ int Model::Load(const wxString& file, const wxString& prefix)
 
     // FIXME: discard existing presentation? ask user about saving if we do!
 
-    // Delete any existing list entries.
-    m_Labels.clear();
+    // Delete any existing labels.
+    ClearLabels();
 
     double xmin = DBL_MAX;
     double xmax = -DBL_MAX;
@@ -103,9 +137,10 @@ int Model::Load(const wxString& file, const wxString& prefix)
     vector<XSect> * current_tube = NULL;
 
     map<wxString, LabelInfo *> labelmap;
-    list<LabelInfo*>::const_iterator last_mapped_label = m_Labels.begin();
+    // The first n_mapped_labels entries in m_Labels are in labelmap.
+    size_t n_mapped_labels = 0;
 
-    int result;
+    int result = img_STOP;
     img_point prev_pt = {0,0,0};
     bool current_polyline_is_surface = false;
     int current_flags = 0;
@@ -119,246 +154,254 @@ int Model::Load(const wxString& file, const wxString& prefix)
     // generated for the current traverse.
     size_t n_traverses[8];
     memset(n_traverses, 0, sizeof(n_traverses));
+    // Read items a block at a time, which avoids a function call per item.
+    vector<img_item> items(1024);
     do {
-#if 0
-	if (++items % 200 == 0) {
-	    long pos = ftell(survey->fh);
-	    int progress = int((double(pos) / double(file_size)) * 100.0);
-	    // SetProgress(progress);
-	}
-#endif
+	const char * labels;
+	size_t n_items = img_read_items(survey, &items[0], items.size(),
+					&labels);
+	// Labels in the same block with the same offset are the same, so we can
+	// avoid comparing the label string for each leg.
+	const char * current_label_ptr = NULL;
+	for (size_t i = 0; i != n_items; ++i) {
+	    const img_item & item = items[i];
+	    const img_point & pt = item.p;
+	    const char * item_label = labels + item.label;
+	    result = item.code;
+	    switch (result) {
+		case img_MOVE:
+		    memset(n_traverses, 0, sizeof(n_traverses));
+		    pending_move = true;
+		    prev_pt = pt;
+		    break;
 
-	img_point pt;
-	result = img_read_item(survey, &pt);
-	switch (result) {
-	    case img_MOVE:
-		memset(n_traverses, 0, sizeof(n_traverses));
-		pending_move = true;
-		prev_pt = pt;
-		break;
-
-	    case img_LINE: {
-		// Update survey extents.
-		if (pt.x < xmin) xmin = pt.x;
-		if (pt.x > xmax) xmax = pt.x;
-		if (pt.y < ymin) ymin = pt.y;
-		if (pt.y > ymax) ymax = pt.y;
-		if (pt.z < zmin) zmin = pt.z;
-		if (pt.z > zmax) zmax = pt.z;
-
-		int date = survey->days1;
-		if (date != -1) {
-		    date += (survey->days2 - date) / 2;
-		    if (date < m_DateMin) m_DateMin = date;
-		    if (date > datemax) datemax = date;
-		} else {
-		    complete_dateinfo = false;
-		}
+		case img_LINE: {
+		    // Update survey extents.
+		    if (pt.x < xmin) xmin = pt.x;
+		    if (pt.x > xmax) xmax = pt.x;
+		    if (pt.y < ymin) ymin = pt.y;
+		    if (pt.y > ymax) ymax = pt.y;
+		    if (pt.z < zmin) zmin = pt.z;
+		    if (pt.z > zmax) zmax = pt.z;
+
+		    int date = item.days1;
+		    if (date != -1) {
+			date += (item.days2 - date) / 2;
+			if (date < m_DateMin) m_DateMin = date;
+			if (date > datemax) datemax = date;
+		    } else {
+			complete_dateinfo = false;
+		    }
 
-		int flags = survey->flags &
-		    (img_FLAG_SURFACE|img_FLAG_SPLAY|img_FLAG_DUPLICATE);
-		bool is_surface = (flags & img_FLAG_SURFACE);
-		bool is_splay = (flags & img_FLAG_SPLAY);
-		bool is_dupe = (flags & img_FLAG_DUPLICATE);
+		    int flags = item.flags &
+			(img_FLAG_SURFACE|img_FLAG_SPLAY|img_FLAG_DUPLICATE);
+		    bool is_surface = (flags & img_FLAG_SURFACE);
+		    bool is_splay = (flags & img_FLAG_SPLAY);
+		    bool is_dupe = (flags & img_FLAG_DUPLICATE);
 
-		if (!is_surface) {
-		    if (pt.z < m_DepthMin) m_DepthMin = pt.z;
-		    if (pt.z > depthmax) depthmax = pt.z;
-		}
-		if (is_splay)
-		    m_HasSplays = true;
-		if (is_dupe)
-		    m_HasDupes = true;
-		if (pending_move ||
-		    current_flags != flags ||
-		    current_label != survey->label ||
-		    current_style != survey->style) {
-		    if (!current_polyline_is_surface && current_traverse) {
-			//FixLRUD(*current_traverse);
+		    if (!is_surface) {
+			if (pt.z < m_DepthMin) m_DepthMin = pt.z;
+			if (pt.z > depthmax) depthmax = pt.z;
+		    }
+		    if (is_splay)
+			m_HasSplays = true;
+		    if (is_dupe)
+			m_HasDupes = true;
+		    bool label_changed = false;
+		    if (item_label != current_label_ptr) {
+			label_changed = (current_label != item_label);
+			current_label_ptr = item_label;
 		    }
+		    if (pending_move ||
+			current_flags != flags ||
+			label_changed ||
+			current_style != item.style) {
+			if (!current_polyline_is_surface && current_traverse) {
+			    //FixLRUD(*current_traverse);
+			}
 
-		    ++n_traverses[flags];
-		    // Start new traverse (surface or underground).
-		    if (is_surface) {
-			m_HasSurfaceLegs = true;
-		    } else {
-			m_HasUndergroundLegs = true;
-			// The previous point was at a surface->ug transition.
-			if (current_polyline_is_surface) {
-			    if (prev_pt.z < m_DepthMin) m_DepthMin = prev_pt.z;
-			    if (prev_pt.z > depthmax) depthmax = prev_pt.z;
+			++n_traverses[flags];
+			// Start new traverse (surface or underground).
+			if (is_surface) {
+			    m_HasSurfaceLegs = true;
+			} else {
+			    m_HasUndergroundLegs = true;
+			    // The previous point was at a surface->ug transition.
+			    if (current_polyline_is_surface) {
+				if (prev_pt.z < m_DepthMin) m_DepthMin = prev_pt.z;
+				if (prev_pt.z > depthmax) depthmax = prev_pt.z;
+			    }
+			}
+			traverses[flags].push_back(traverse(item_label));
+			current_traverse = &traverses[flags].back();
+			current_traverse->flags = item.flags;
+			current_traverse->style = item.style;
+
+			current_polyline_is_surface = is_surface;
+			current_flags = flags;
+			current_label = item_label;
+			current_style = item.style;
+
+			if (pending_move) {
+			    // Update survey extents.  We only need to do this if
+			    // there's a pending move, since for a surface <->
+			    // underground transition, we'll already have handled
+			    // this point.
+			    if (prev_pt.x < xmin) xmin = prev_pt.x;
+			    if (prev_pt.x > xmax) xmax = prev_pt.x;
+			    if (prev_pt.y < ymin) ymin = prev_pt.y;
+			    if (prev_pt.y > ymax) ymax = prev_pt.y;
+			    if (prev_pt.z < zmin) zmin = prev_pt.z;
+			    if (prev_pt.z > zmax) zmax = prev_pt.z;
 			}
-		    }
-		    traverses[flags].push_back(traverse(survey->label));
-		    current_traverse = &traverses[flags].back();
-		    current_traverse->flags = survey->flags;
-		    current_traverse->style = survey->style;
-
-		    current_polyline_is_surface = is_surface;
-		    current_flags = flags;
-		    current_label = survey->label;
-		    current_style = survey->style;
-
-		    if (pending_move) {
-			// Update survey extents.  We only need to do this if
-			// there's a pending move, since for a surface <->
-			// underground transition, we'll already have handled
-			// this point.
-			if (prev_pt.x < xmin) xmin = prev_pt.x;
-			if (prev_pt.x > xmax) xmax = prev_pt.x;
-			if (prev_pt.y < ymin) ymin = prev_pt.y;
-			if (prev_pt.y > ymax) ymax = prev_pt.y;
-			if (prev_pt.z < zmin) zmin = prev_pt.z;
-			if (prev_pt.z > zmax) zmax = prev_pt.z;
-		    }
 
-		    current_traverse->push_back(PointInfo(prev_pt));
-		}
+			current_traverse->push_back(PointInfo(prev_pt));
+		    }
 
-		current_traverse->push_back(PointInfo(pt, date));
+		    current_traverse->push_back(PointInfo(pt, date));
 
-		prev_pt = pt;
-		pending_move = false;
-		break;
-	    }
+		    prev_pt = pt;
+		    pending_move = false;
+		    break;
+		}
 
-	    case img_LABEL: {
-		wxString s(survey->label, wxConvUTF8);
-		if (s.empty()) {
-		    // If label isn't valid UTF-8 then this conversion will
-		    // give an empty string.  In this case, assume that the
-		    // label is CP1252 (the Microsoft superset of ISO8859-1).
-		    static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
-		    s = wxString(survey->label, ConvCP1252);
+		case img_LABEL: {
+		    wxString s(item_label, wxConvUTF8);
 		    if (s.empty()) {
-			// Or if that doesn't work (ConvCP1252 doesn't like
-			// strings with some bytes in) let's just go for
-			// ISO8859-1.
-			s = wxString(survey->label, wxConvISO8859_1);
+			// If label isn't valid UTF-8 then this conversion will
+			// give an empty string.  In this case, assume that the
+			// label is CP1252 (the Microsoft superset of ISO8859-1).
+			static wxCSConv ConvCP1252(wxFONTENCODING_CP1252);
+			s = wxString(item_label, ConvCP1252);
+			if (s.empty()) {
+			    // Or if that doesn't work (ConvCP1252 doesn't like
+			    // strings with some bytes in) let's just go for
+			    // ISO8859-1.
+			    s = wxString(item_label, wxConvISO8859_1);
+			}
 		    }
+		    int flags = img2aven(item.flags);
+		    LabelInfo* label = AddLabel(pt, s, flags);
+		    if (label->IsEntrance()) {
+			m_NumEntrances++;
+		    }
+		    if (label->IsFixedPt()) {
+			m_NumFixedPts++;
+		    }
+		    if (label->IsExportedPt()) {
+			m_NumExportedPts++;
+		    }
+		    break;
 		}
-		int flags = img2aven(survey->flags);
-		LabelInfo* label = new LabelInfo(pt, s, flags);
-		if (label->IsEntrance()) {
-		    m_NumEntrances++;
-		}
-		if (label->IsFixedPt()) {
-		    m_NumFixedPts++;
-		}
-		if (label->IsExportedPt()) {
-		    m_NumExportedPts++;
-		}
-		m_Labels.push_back(label);
-		break;
-	    }
 
-	    case img_XSECT: {
-		if (!current_tube) {
-		    // Start new current_tube.
-		    tubes.push_back(vector<XSect>());
-		    current_tube = &tubes.back();
-		}
+		case img_XSECT: {
+		    if (!current_tube) {
+			// Start new current_tube.
+			tubes.push_back(vector<XSect>());
+			current_tube = &tubes.back();
+		    }
 
-		LabelInfo * lab;
-		wxString label(survey->label, wxConvUTF8);
-		map<wxString, LabelInfo *>::const_iterator p;
-		p = labelmap.find(label);
-		if (p != labelmap.end()) {
-		    lab = p->second;
-		} else {
-		    // Initialise labelmap lazily - we may have no
-		    // cross-sections.
-		    list<LabelInfo*>::const_iterator i;
-		    if (labelmap.empty()) {
-			i = m_Labels.begin();
+		    LabelInfo * lab;
+		    wxString label(item_label, wxConvUTF8);
+		    map<wxString, LabelInfo *>::const_iterator p;
+		    p = labelmap.find(label);
+		    if (p != labelmap.end()) {
+			lab = p->second;
 		    } else {
-			i = last_mapped_label;
-			++i;
-		    }
-		    while (i != m_Labels.end() && (*i)->GetText() != label) {
-			labelmap[(*i)->GetText()] = *i;
-			++i;
+			// Initialise labelmap lazily - we may have no
+			// cross-sections.
+			size_t i = n_mapped_labels;
+			while (i != m_Labels.size() &&
+			       m_Labels[i]->GetText() != label) {
+			    labelmap[m_Labels[i]->GetText()] = m_Labels[i];
+			    ++i;
+			}
+			if (i == m_Labels.size()) {
+			    // Unattached cross-section - ignore for now.
+			    printf("unattached cross-section\n");
+			    if (current_tube->size() <= 1)
+				tubes.resize(tubes.size() - 1);
+			    current_tube = NULL;
+			    n_mapped_labels = i;
+			    break;
+			}
+			lab = m_Labels[i];
+			labelmap[label] = lab;
+			n_mapped_labels = i + 1;
 		    }
-		    last_mapped_label = i;
-		    if (i == m_Labels.end()) {
-			// Unattached cross-section - ignore for now.
-			printf("unattached cross-section\n");
-			if (current_tube->size() <= 1)
-			    tubes.resize(tubes.size() - 1);
-			current_tube = NULL;
-			if (!m_Labels.empty())
-			    --last_mapped_label;
-			break;
+
+		    int date = item.days1;
+		    if (date != -1) {
+			date += (item.days2 - date) / 2;
+			if (date < m_DateMin) m_DateMin = date;
+			if (date > datemax) datemax = date;
 		    }
-		    lab = *i;
-		    labelmap[label] = lab;
-		}
 
-		int date = survey->days1;
-		if (date != -1) {
-		    date += (survey->days2 - date) / 2;
-		    if (date < m_DateMin) m_DateMin = date;
-		    if (date > datemax) datemax = date;
+		    current_tube->emplace_back(lab, date, item.l, item.r, item.u, item.d);
+		    break;
 		}
 
-		current_tube->emplace_back(lab, date, survey->l, survey->r, survey->u, survey->d);
-		break;
-	    }
-
-	    case img_XSECT_END:
-		// Finish off current_tube.
-		// If there's only one cross-section in the tube, just
-		// discard it for now.  FIXME: we should handle this
-		// when we come to skinning the tubes.
-		if (current_tube && current_tube->size() <= 1)
-		    tubes.resize(tubes.size() - 1);
-		current_tube = NULL;
-		break;
-
-	    case img_ERROR_INFO: {
-		if (survey->E == 0.0) {
-		    // Currently cavern doesn't spot all articulating traverses
-		    // so we assume that any traverse with no error isn't part
-		    // of a loop.  FIXME: fix cavern!
+		case img_XSECT_END:
+		    // Finish off current_tube.
+		    // If there's only one cross-section in the tube, just
+		    // discard it for now.  FIXME: we should handle this
+		    // when we come to skinning the tubes.
+		    if (current_tube && current_tube->size() <= 1)
+			tubes.resize(tubes.size() - 1);
+		    current_tube = NULL;
 		    break;
-		}
-		m_HasErrorInformation = true;
-		for (size_t f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
-		    list<traverse>::reverse_iterator t = traverses[f].rbegin();
-		    size_t n = n_traverses[f];
-		    n_traverses[f] = 0;
-		    while (n) {
-			assert(t != traverses[f].rend());
-			t->n_legs = survey->n_legs;
-			t->length = survey->length;
-			t->errors[traverse::ERROR_3D] = survey->E;
-			t->errors[traverse::ERROR_H] = survey->H;
-			t->errors[traverse::ERROR_V] = survey->V;
-			--n;
-			++t;
+
+		case img_ERROR_INFO: {
+		    if (item.E == 0.0) {
+			// Currently cavern doesn't spot all articulating traverses
+			// so we assume that any traverse with no error isn't part
+			// of a loop.  FIXME: fix cavern!
+			break;
+		    }
+		    m_HasErrorInformation = true;
+		    for (size_t f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
+			list<traverse>::reverse_iterator t = traverses[f].rbegin();
+			size_t n = n_traverses[f];
+			n_traverses[f] = 0;
+			while (n) {
+			    assert(t != traverses[f].rend());
+			    t->n_legs = item.n_legs;
+			    t->length = item.length;
+			    t->errors[traverse::ERROR_3D] = item.E;
+			    t->errors[traverse::ERROR_H] = item.H;
+			    t->errors[traverse::ERROR_V] = item.V;
+			    --n;
+			    ++t;
+			}
 		    }
+		    break;
 		}
-		break;
-	    }
 
-	    case img_BAD: {
-		m_Labels.clear();
+		case img_BAD: {
+		    ClearLabels();
 
-		// FIXME: Do we need to reset all these? - Olly
-		m_NumFixedPts = 0;
-		m_NumExportedPts = 0;
-		m_NumEntrances = 0;
-		m_HasUndergroundLegs = false;
-		m_HasSplays = false;
-		m_HasSurfaceLegs = false;
+		    // FIXME: Do we need to reset all these? - Olly
+		    m_NumFixedPts = 0;
+		    m_NumExportedPts = 0;
+		    m_NumEntrances = 0;
+		    m_HasUndergroundLegs = false;
+		    m_HasSplays = false;
+		    m_HasSurfaceLegs = false;
 
-		img_close(survey);
+		    img_close(survey);
+
+		    return img_error2msg(img_error());
+		}
 
-		return img_error2msg(img_error());
+		default:
+		    break;
 	    }
+	}
 
-	    default:
-		break;
+	if (progress && result != img_STOP &&
+	    !progress->Update(load_fraction(survey, file_size))) {
+	    img_close(survey);
+	    return LOAD_CANCELLED;
 	}
     } while (result != img_STOP);
 
@@ -381,21 +424,8 @@ int Model::Load(const wxString& file, const wxString& prefix)
     } else {
 	m_cs_proj = wxString();
     }
-    if (strcmp(survey->datestamp, "?") == 0) {
-	/* TRANSLATORS: used a processed survey with no processing date/time info */
-	m_DateStamp = wmsg(/*Date and time not available.*/108);
-    } else if (survey->datestamp[0] == '@') {
-	const struct tm * tm = localtime(&m_DateStamp_numeric);
-	char buf[256];
-	/* TRANSLATORS: This is the date format string used to timestamp .3d
-	 * files internally.  Probably best to keep it the same for all
-	 * translations. */
-	strftime(buf, 256, msg(/*%a,%Y.%m.%d %H:%M:%S %Z*/107), tm);
-	m_DateStamp = wxString(buf, wxConvUTF8);
-    }
-    if (m_DateStamp.empty()) {
-	m_DateStamp = wxString(survey->datestamp, wxConvUTF8);
-    }
+    SetDateStamp(survey->datestamp);
+    string datestamp(survey->datestamp);
     img_close(survey);
 
     // Check we've actually loaded some legs or stations!
@@ -412,7 +442,7 @@ int Model::Load(const wxString& file, const wxString& prefix)
 	traverses[6].empty() &&
 	traverses[7].empty()) {
 	// No legs, so get survey extents from stations
-	list<LabelInfo*>::const_iterator i;
+	vector<LabelInfo*>::const_iterator i;
 	for (i = m_Labels.begin(); i != m_Labels.end(); ++i) {
 	    if ((*i)->GetX() < xmin) xmin = (*i)->GetX();
 	    if ((*i)->GetX() > xmax) xmax = (*i)->GetX();
@@ -439,13 +469,39 @@ int Model::Load(const wxString& file, const wxString& prefix)
 	m_DepthMin -= GetOffset().GetZ();
     }
 
+    if (for_display) BuildSpatialIndex();
+
 #if 0
     printf("time to load = %.3f\n", (double)timer.Time());
 #endif
 
+    if (!cache_key.empty()) {
+	SaveCache(file, cache_key, datestamp.c_str());
+    }
+
     return 0; // OK
 }
 
+void Model::SetDateStamp(const char* datestamp)
+{
+    m_DateStamp = wxString();
+    if (strcmp(datestamp, "?") == 0) {
+	/* TRANSLATORS: used a processed survey with no processing date/time info */
+	m_DateStamp = wmsg(/*Date and time not available.*/108);
+    } else if (datestamp[0] == '@') {
+	const struct tm * tm = localtime(&m_DateStamp_numeric);
+	char buf[256];
+	/* TRANSLATORS: This is the date format string used to timestamp .3d
+	 * files internally.  Probably best to keep it the same for all
+	 * translations. */
+	strftime(buf, 256, msg(/*%a,%Y.%m.%d %H:%M:%S %Z*/107), tm);
+	m_DateStamp = wxString(buf, wxConvUTF8);
+    }
+    if (m_DateStamp.empty()) {
+	m_DateStamp = wxString(datestamp, wxConvUTF8);
+    }
+}
+
 void Model::CentreDataset(const Vector3& vmin)
 {
     // Centre the dataset around the origin.
@@ -465,13 +521,55 @@ void Model::CentreDataset(const Vector3& vmin)
 	}
     }
 
-    list<LabelInfo*>::iterator lpos = m_Labels.begin();
-    while (lpos != m_Labels.end()) {
-	Point & point = **lpos++;
-	point -= m_Offset;
+    for (LabelInfo& label : m_LabelStore) {
+	label -= m_Offset;
     }
 }
 
+// Maximum number of traverses and tubes in each leaf of the spatial index.
+const unsigned SPATIAL_INDEX_LEAF_ITEMS = 64;
+
+// Maximum number of stations in each leaf of the station index.
+const unsigned STATION_INDEX_LEAF_ITEMS = 32;
+
+void Model::BuildSpatialIndex()
+{
+    m_IndexedTraverses.clear();
+    m_IndexedTubes.clear();
+    vector<BoundingBox> boxes;
+    for (unsigned f = 0; f != sizeof(traverses) / sizeof(traverses[0]); ++f) {
+	for (const traverse& t : traverses[f]) {
+	    BoundingBox box;
+	    for (const PointInfo& pt : t) {
+		box.add(pt);
+	    }
+	    boxes.push_back(box);
+	    m_IndexedTraverses.emplace_back(&t, f);
+	}
+    }
+    for (const vector<XSect>& tube : tubes) {
+	// Allow for the passage walls being up to the largest LRUD reading
+	// away from the station in any direction.
+	BoundingBox box;
+	for (const XSect& xsect : tube) {
+	    double r = max(max(xsect.GetL(), xsect.GetR()),
+			   max(xsect.GetU(), xsect.GetD()));
+	    box.add(xsect.GetPoint(), max(r, 0.0));
+	}
+	boxes.push_back(box);
+	m_IndexedTubes.push_back(&tube);
+    }
+    m_SpatialIndex.build(boxes, SPATIAL_INDEX_LEAF_ITEMS);
+
+    boxes.clear();
+    boxes.reserve(m_LabelStore.size());
+    for (const LabelInfo& label : m_LabelStore) {
+	boxes.emplace_back();
+	boxes.back().add(label);
+    }
+    m_StationIndex.build(boxes, STATION_INDEX_LEAF_ITEMS);
+}
+
 void
 Model::do_prepare_tubes() const
 {
@@ -684,6 +782,7 @@ SurveyFilter::add(const wxString& name)
 	}
     }
     filters.insert(name);
+    sorted_filters.assign(filters.begin(), filters.end());
 }
 
 void
@@ -694,6 +793,7 @@ SurveyFilter::remove(const wxString& name)
 	return;
     }
     if (redundant_filters.empty()) {
+	sorted_filters.assign(filters.begin(), filters.end());
 	return;
     }
     auto it = redundant_filters.upper_bound(name);
@@ -709,6 +809,7 @@ SurveyFilter::remove(const wxString& name)
 	filters.insert(s);
 	it = redundant_filters.erase(it);
     }
+    sorted_filters.assign(filters.begin(), filters.end());
 }
 
 void
@@ -728,28 +829,47 @@ SurveyFilter::SetSeparator(wxChar separator_)
     std::set<wxString, std::greater<wxString>> old_redundant_filters;
     swap(filters, old_filters);
     swap(redundant_filters, old_redundant_filters);
-    for (auto& s : filters) {
+    for (auto& s : old_filters) {
 	add(s);
     }
-    for (auto& s : redundant_filters) {
+    for (auto& s : old_redundant_filters) {
 	add(s);
     }
 }
 
+// Compare s with the len characters at name, returning a value <, == or > 0
+// as s is <, == or > than name in the order wxString::compare() gives.
+static int
+compare_name(const wxString& s, const wxChar* name, size_t len)
+{
+    auto i = s.begin();
+    for (size_t j = 0; j != len; ++i, ++j) {
+	if (i == s.end()) return -1;
+	wxChar ch = *i;
+	if (ch != name[j]) return ch < name[j] ? -1 : 1;
+    }
+    return i == s.end() ? 0 : 1;
+}
+
 bool
-SurveyFilter::CheckVisible(const wxString& name) const
+SurveyFilter::CheckVisible(const wxChar* name, size_t len) const
 {
-    auto it = filters.lower_bound(name);
-    if (it == filters.end()) {
+    // Find the first filter <= name - sorted_filters is in descending order.
+    auto it = lower_bound(sorted_filters.begin(), sorted_filters.end(), 0,
+			  [=](const wxString& s, int) {
+			      return compare_name(s, name, len) > 0;
+			  });
+    if (it == sorted_filters.end()) {
 	// There's no filter <= name so name is excluded.
 	return false;
     }
-    if (*it == name) {
+    if (compare_name(*it, name, len) == 0) {
 	// Exact match.
 	return true;
     }
     // Check if a survey prefixing name is visible.
-    if (name.StartsWith(*it) && name[it->size()] == separator)
-	return true;
-    return false;
+    size_t prefix_len = it->length();
+    return prefix_len < len &&
+	   name[prefix_len] == separator &&
+	   compare_name(*it, name, prefix_len) == 0;
 }
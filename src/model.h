@@ -26,12 +26,16 @@
 
 #include "wx.h"
 
+#include "bvh.h"
 #include "labelinfo.h"
 #include "vector3.h"
 
 #include <ctime>
+#include <deque>
 #include <list>
 #include <set>
+#include <string>
+#include <utility>
 #include <vector>
 
 using namespace std;
@@ -69,7 +73,7 @@ public:
 	right_bearing = right_bearing_;
     }
     int GetDate() const { return date; }
-    const wxString& GetLabel() const { return stn->GetText(); }
+    wxString GetLabel() const { return stn->GetText(); }
     const Point& GetPoint() const { return *stn; }
     double GetX() const { return stn->GetX(); }
     double GetY() const { return stn->GetY(); }
@@ -109,11 +113,17 @@ class traverse : public vector<PointInfo> {
 	    }
 	}
     }
+
+    explicit
+    traverse(const wxString& name_) : name(name_) { }
 };
 
 class SurveyFilter {
     std::set<wxString, std::greater<wxString>> filters;
     std::set<wxString, std::greater<wxString>> redundant_filters;
+    // A copy of filters in the same order, which CheckVisible() can binary
+    // search for a name which isn't in a wxString.
+    std::vector<wxString> sorted_filters;
     // Default to the Survex standard separator - then a filter created before
     // the survey separator is known is likely to not need rebuilding.
     wxChar separator = '.';
@@ -125,13 +135,33 @@ class SurveyFilter {
 
     void remove(const wxString& survey);
 
-    void clear() { filters.clear(); redundant_filters.clear(); }
+    void clear() {
+	filters.clear();
+	redundant_filters.clear();
+	sorted_filters.clear();
+    }
 
     bool empty() const { return filters.empty(); }
 
     void SetSeparator(wxChar separator_);
 
-    bool CheckVisible(const wxString& name) const;
+    bool CheckVisible(const wxString& name) const {
+	return CheckVisible(name.wc_str(), name.length());
+    }
+
+    // Avoids constructing a wxString, which matters in per-frame loops over
+    // the labels.
+    bool CheckVisible(const wxChar* name, size_t len) const;
+};
+
+/// Interface for reporting progress while a Model is being loaded.
+class ModelLoadProgress {
+  public:
+    virtual ~ModelLoadProgress() { }
+
+    // Called periodically during loading with the fraction of the file
+    // read so far (between 0 and 1).  Return false to abandon loading.
+    virtual bool Update(double fraction) = 0;
 };
 
 /// Cave model.
@@ -140,9 +170,17 @@ class Model {
     mutable list<vector<XSect>> tubes;
 
   public: // FIXME
-    list<LabelInfo*> m_Labels;
+    // Pointers to the labels, which MainFrm sorts into the order it wants.
+    vector<LabelInfo*> m_Labels;
 
   private:
+    // The labels themselves, in the order they were read.  We use a deque
+    // so that pointers to labels remain valid as more are added.
+    deque<LabelInfo> m_LabelStore;
+
+    // The names of the labels.
+    LabelNamePool m_LabelNames;
+
     Vector3 m_Ext;
     double m_DepthMin, m_DepthExt;
     int m_DateMin, m_DateExt;
@@ -157,6 +195,7 @@ class Model {
     bool m_HasErrorInformation = false;
     bool m_IsExtendedElevation = false;
     mutable bool m_TubesPrepared = false;
+    bool m_LoadedFromCache = false;
 
     // Character separating survey levels (often '.')
     wxChar m_separator;
@@ -167,12 +206,70 @@ class Model {
 
     Vector3 m_Offset;
 
+    // Spatial index over the traverses and tubes, so the parts of the model
+    // which are out of view can be skipped when drawing.  The items are the
+    // traverses in m_IndexedTraverses (with the flags they're stored under)
+    // followed by the tubes in m_IndexedTubes.
+    BVH m_SpatialIndex;
+    vector<pair<const traverse*, unsigned>> m_IndexedTraverses;
+    vector<const vector<XSect>*> m_IndexedTubes;
+
+    // Spatial index over the stations, for finding those near a point on
+    // screen.  The items are the labels in m_LabelStore.
+    BVH m_StationIndex;
+
     void do_prepare_tubes() const;
 
+    // Build m_SpatialIndex and m_StationIndex.
+    void BuildSpatialIndex();
+
     void CentreDataset(const Vector3& vmin);
 
+    LabelInfo* AddLabel(const img_point& pt, const wxString& name, int flags) {
+	m_LabelStore.emplace_back(pt, m_LabelNames.add(name), name.length(),
+				  flags, m_Labels.size());
+	LabelInfo* label = &m_LabelStore.back();
+	m_Labels.push_back(label);
+	return label;
+    }
+
+    void ClearLabels() {
+	m_Labels.clear();
+	m_LabelStore.clear();
+	m_LabelNames.clear();
+    }
+
+    // Set m_DateStamp from the datestamp in the .3d file.  If this is of
+    // the "@<seconds since epoch>" form, m_DateStamp_numeric must already
+    // have been set.
+    void SetDateStamp(const char* datestamp);
+
+    // Load the model from the cache file for file, if there's a valid one.
+    // Returns true if successful, otherwise sets key to the key to use to
+    // save the cache (or leaves it empty if file shouldn't be cached).
+    bool LoadCache(const wxString& file, const wxString& prefix, string& key);
+
+    // Save the model to the cache file for file.
+    void SaveCache(const wxString& file, const string& key,
+		   const char* datestamp) const;
+
   public:
-    int Load(const wxString& file, const wxString& prefix);
+    // Returned by Load() if progress->Update() asked to abandon loading.
+    enum { LOAD_CANCELLED = -1 };
+
+    // Returns 0 on success, otherwise a message number or LOAD_CANCELLED.
+    //
+    // If for_display is true, the model is also set up for aven to draw:
+    // the spatial indices are built, and a cache file alongside file is used
+    // (and written) to speed up loading the same file again.
+    //
+    // Load() only modifies this object (and the cache file), so it's safe to
+    // call from a worker thread to load into a Model which isn't in use.
+    int Load(const wxString& file, const wxString& prefix,
+	     ModelLoadProgress* progress = NULL, bool for_display = false);
+
+    // True if the last Load() got the model from the cache file.
+    bool LoadedFromCache() const { return m_LoadedFromCache; }
 
     const Vector3& GetExtent() const { return m_Ext; }
 
@@ -239,6 +336,30 @@ class Model {
 	return traverses[flags].end();
     }
 
+    const BVH& GetSpatialIndex() const { return m_SpatialIndex; }
+
+    const BVH& GetStationIndex() const { return m_StationIndex; }
+
+    const LabelInfo* GetIndexedStation(unsigned item) const {
+	return &m_LabelStore[item];
+    }
+
+    // If item of the spatial index is a traverse, return it and set flags to
+    // the flags it's stored under, otherwise return NULL.
+    const traverse* GetIndexedTraverse(unsigned item, unsigned& flags) const {
+	if (item >= m_IndexedTraverses.size()) return NULL;
+	flags = m_IndexedTraverses[item].second;
+	return m_IndexedTraverses[item].first;
+    }
+
+    // If item of the spatial index is a tube, return it, otherwise return
+    // NULL.
+    const vector<XSect>* GetIndexedTube(unsigned item) const {
+	if (item < m_IndexedTraverses.size()) return NULL;
+	prepare_tubes();
+	return m_IndexedTubes[item - m_IndexedTraverses.size()];
+    }
+
     list<vector<XSect>>::const_iterator tubes_begin() const {
 	prepare_tubes();
 	return tubes.begin();
@@ -257,27 +378,27 @@ class Model {
 	return tubes.end();
     }
 
-    list<LabelInfo*>::const_iterator GetLabels() const {
+    vector<LabelInfo*>::const_iterator GetLabels() const {
 	return m_Labels.begin();
     }
 
-    list<LabelInfo*>::const_iterator GetLabelsEnd() const {
+    vector<LabelInfo*>::const_iterator GetLabelsEnd() const {
 	return m_Labels.end();
     }
 
-    list<LabelInfo*>::const_reverse_iterator GetRevLabels() const {
+    vector<LabelInfo*>::const_reverse_iterator GetRevLabels() const {
 	return m_Labels.rbegin();
     }
 
-    list<LabelInfo*>::const_reverse_iterator GetRevLabelsEnd() const {
+    vector<LabelInfo*>::const_reverse_iterator GetRevLabelsEnd() const {
 	return m_Labels.rend();
     }
 
-    list<LabelInfo*>::iterator GetLabelsNC() {
+    vector<LabelInfo*>::iterator GetLabelsNC() {
 	return m_Labels.begin();
     }
 
-    list<LabelInfo*>::iterator GetLabelsNCEnd() {
+    vector<LabelInfo*>::iterator GetLabelsNCEnd() {
 	return m_Labels.end();
     }
 
@@ -0,0 +1,559 @@
+//
+//  modelcache.cc
+//
+//  Cache of the model built from a processed survey data file.
+//
+//  Copyright (C) 2026 agent
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+
+// Building the model from a large .3d file takes a noticeable time, mostly
+// spent decoding items and converting labels to wxString.  So after loading
+// a .3d file we save the model we built in a file alongside it, and next
+// time we load the same file we check if it is unchanged (by its size,
+// modification time and a hash of its contents) and if so load the model
+// from the cache instead.
+//
+// The cache stores each kind of data as contiguous arrays of each field,
+// with all the strings in a single pool, so loading it is mostly memcpy().
+// Like cavern's solve cache, the file is in the native byte order and
+// floating point format, and is ignored if it was written by a build which
+// differs in these (or any other way which the header checks).
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "model.h"
+
+#include <wx/filefn.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+using namespace std;
+
+static const char cache_magic[] = "Svx\nAven cache\n";
+
+#define MODEL_CACHE_VERSION 1
+
+// Files smaller than this load quickly enough that caching isn't worthwhile.
+#define MODEL_CACHE_MIN_SIZE 262144
+
+#define MODEL_CACHE_EXT wxT(".aven-cache")
+
+static string
+cache_header()
+{
+    // A value which isn't exactly representable, so the bit pattern tells us
+    // if the floating point format matches.
+    double probe = -1.0 / 3.0;
+    string header(cache_magic, sizeof(cache_magic) - 1);
+    header += char(MODEL_CACHE_VERSION);
+    header += char(sizeof(int));
+    header += char(sizeof(wxChar));
+    header.append(reinterpret_cast<const char*>(&probe), sizeof(probe));
+    return header;
+}
+
+namespace {
+
+class CacheWriter {
+    string buf;
+
+  public:
+    CacheWriter() { }
+
+    explicit CacheWriter(const string& header) : buf(header) { }
+
+    template<typename T>
+    void put(T v) {
+	buf.append(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    template<typename T>
+    void put_array(const vector<T>& v) {
+	put(uint32_t(v.size()));
+	if (!v.empty())
+	    buf.append(reinterpret_cast<const char*>(&v[0]), v.size() * sizeof(T));
+    }
+
+    void put_string(const string& s) {
+	put(uint32_t(s.size()));
+	buf += s;
+    }
+
+    const string& get_buffer() const { return buf; }
+};
+
+class CacheReader {
+    const char* p;
+    const char* end;
+
+  public:
+    bool ok = true;
+
+    CacheReader(const char* p_, const char* end_) : p(p_), end(end_) { }
+
+    template<typename T>
+    T get() {
+	T v = T();
+	if (size_t(end - p) < sizeof(T)) {
+	    ok = false;
+	} else {
+	    memcpy(&v, p, sizeof(T));
+	    p += sizeof(T);
+	}
+	return v;
+    }
+
+    template<typename T>
+    void get_array(vector<T>& v) {
+	size_t n = get<uint32_t>();
+	if (!ok || size_t(end - p) / sizeof(T) < n) {
+	    ok = false;
+	    return;
+	}
+	v.resize(n);
+	if (n) memcpy(&v[0], p, n * sizeof(T));
+	p += n * sizeof(T);
+    }
+
+    void get_string(string& s) {
+	size_t n = get<uint32_t>();
+	if (!ok || size_t(end - p) < n) {
+	    ok = false;
+	    return;
+	}
+	s.assign(p, n);
+	p += n;
+    }
+
+    bool at_end() const { return p == end; }
+};
+
+// Collects strings into a pool of nul-terminated strings.
+class StringPool {
+    string pool;
+
+  public:
+    uint32_t add(const wxString& s) {
+	uint32_t offset = pool.size();
+	pool += s.utf8_str();
+	pool += '\0';
+	return offset;
+    }
+
+    const string& get() const { return pool; }
+};
+
+}
+
+static inline string
+to_utf8(const wxString& s)
+{
+    return string(s.utf8_str());
+}
+
+static inline wxString
+from_pool(const string& pool, uint32_t offset)
+{
+    return wxString::FromUTF8Unchecked(pool.data() + offset);
+}
+
+bool
+Model::LoadCache(const wxString& file, const wxString& prefix, string& key)
+{
+    key.clear();
+
+    wxStructStat st;
+    if (wxStat(file, &st) != 0 || st.st_size < MODEL_CACHE_MIN_SIZE) {
+	return false;
+    }
+
+    // Hash the contents of the file - the size and modification time alone
+    // could fail to spot that it has changed (e.g. if it gets rewritten
+    // within the timestamp granularity of the filing system).
+    FILE* fh = wxFopen(file, wxT("rb"));
+    if (!fh) return false;
+    // 64-bit FNV-1a.
+    uint64_t h = 14695981039346656037ULL;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fh)) > 0) {
+	for (size_t i = 0; i != n; ++i) {
+	    h = (h ^ (unsigned char)buf[i]) * 1099511628211ULL;
+	}
+    }
+    bool read_error = ferror(fh);
+    fclose(fh);
+    if (read_error) return false;
+
+    CacheWriter k;
+    k.put(uint64_t(st.st_size));
+    k.put(int64_t(st.st_mtime));
+    k.put(h);
+    k.put_string(to_utf8(prefix));
+    key = k.get_buffer();
+
+    fh = wxFopen(file + MODEL_CACHE_EXT, wxT("rb"));
+    // It's not an error if there isn't a cache yet.
+    if (!fh) return false;
+    string data;
+    while ((n = fread(buf, 1, sizeof(buf), fh)) > 0) {
+	data.append(buf, n);
+    }
+    read_error = ferror(fh);
+    fclose(fh);
+    if (read_error) return false;
+
+    const string header = cache_header();
+    if (data.size() < header.size() + key.size() ||
+	memcmp(data.data(), header.data(), header.size()) != 0 ||
+	memcmp(data.data() + header.size(), key.data(), key.size()) != 0) {
+	return false;
+    }
+    CacheReader r(data.data() + header.size() + key.size(),
+		  data.data() + data.size());
+
+    // Read everything into local variables first, so we don't modify the
+    // model if the cache turns out to be truncated or inconsistent.
+    int32_t is_extended_elevation = r.get<int32_t>();
+    int32_t num_fixed_pts = r.get<int32_t>();
+    int32_t num_exported_pts = r.get<int32_t>();
+    int32_t num_entrances = r.get<int32_t>();
+    uint32_t has_flags = r.get<uint32_t>();
+    int32_t complete_dateinfo_ = r.get<int32_t>();
+    int32_t date_min = r.get<int32_t>();
+    int32_t date_ext = r.get<int32_t>();
+    uint32_t separator = r.get<uint32_t>();
+    double ext_x = r.get<double>();
+    double ext_y = r.get<double>();
+    double ext_z = r.get<double>();
+    double depth_min = r.get<double>();
+    double depth_ext = r.get<double>();
+    double offset_x = r.get<double>();
+    double offset_y = r.get<double>();
+    double offset_z = r.get<double>();
+    int64_t datestamp_numeric = r.get<int64_t>();
+    string title, cs, datestamp, pool;
+    r.get_string(title);
+    r.get_string(cs);
+    r.get_string(datestamp);
+    r.get_string(pool);
+    // The pool must be nul-terminated so from_pool() can't overrun it.
+    if (!pool.empty() && pool.back() != '\0') return false;
+
+    vector<double> lab_x, lab_y, lab_z;
+    vector<int32_t> lab_flags;
+    vector<uint32_t> lab_text;
+    r.get_array(lab_x);
+    r.get_array(lab_y);
+    r.get_array(lab_z);
+    r.get_array(lab_flags);
+    r.get_array(lab_text);
+    size_t n_labels = lab_x.size();
+    if (!r.ok ||
+	lab_y.size() != n_labels ||
+	lab_z.size() != n_labels ||
+	lab_flags.size() != n_labels ||
+	lab_text.size() != n_labels) {
+	return false;
+    }
+    for (uint32_t offset : lab_text) {
+	if (offset >= pool.size()) return false;
+    }
+
+    const size_t n_flags = sizeof(traverses) / sizeof(traverses[0]);
+    vector<uint32_t> trav_size[n_flags];
+    vector<int32_t> trav_legs[n_flags], trav_flags[n_flags], trav_style[n_flags];
+    vector<double> trav_length[n_flags], trav_err[n_flags][3];
+    vector<uint32_t> trav_name[n_flags];
+    vector<double> pt_x[n_flags], pt_y[n_flags], pt_z[n_flags];
+    vector<int32_t> pt_date[n_flags];
+    for (size_t f = 0; f != n_flags; ++f) {
+	r.get_array(trav_size[f]);
+	r.get_array(trav_legs[f]);
+	r.get_array(trav_flags[f]);
+	r.get_array(trav_style[f]);
+	r.get_array(trav_length[f]);
+	for (int e = 0; e != 3; ++e) r.get_array(trav_err[f][e]);
+	r.get_array(trav_name[f]);
+	r.get_array(pt_x[f]);
+	r.get_array(pt_y[f]);
+	r.get_array(pt_z[f]);
+	r.get_array(pt_date[f]);
+	size_t n_travs = trav_size[f].size();
+	size_t n_pts = pt_x[f].size();
+	if (!r.ok ||
+	    trav_legs[f].size() != n_travs ||
+	    trav_flags[f].size() != n_travs ||
+	    trav_style[f].size() != n_travs ||
+	    trav_length[f].size() != n_travs ||
+	    trav_err[f][0].size() != n_travs ||
+	    trav_err[f][1].size() != n_travs ||
+	    trav_err[f][2].size() != n_travs ||
+	    trav_name[f].size() != n_travs ||
+	    pt_y[f].size() != n_pts ||
+	    pt_z[f].size() != n_pts ||
+	    pt_date[f].size() != n_pts) {
+	    return false;
+	}
+	size_t total = 0;
+	for (size_t t = 0; t != n_travs; ++t) {
+	    if (trav_size[f][t] < 2 || trav_name[f][t] >= pool.size())
+		return false;
+	    total += trav_size[f][t];
+	}
+	if (total != n_pts) return false;
+    }
+
+    vector<uint32_t> tube_size;
+    vector<uint32_t> xs_label;
+    vector<int32_t> xs_date;
+    vector<double> xs_l, xs_r, xs_u, xs_d;
+    r.get_array(tube_size);
+    r.get_array(xs_label);
+    r.get_array(xs_date);
+    r.get_array(xs_l);
+    r.get_array(xs_r);
+    r.get_array(xs_u);
+    r.get_array(xs_d);
+    size_t n_xsects = xs_label.size();
+    if (!r.ok || !r.at_end() ||
+	xs_date.size() != n_xsects ||
+	xs_l.size() != n_xsects ||
+	xs_r.size() != n_xsects ||
+	xs_u.size() != n_xsects ||
+	xs_d.size() != n_xsects) {
+	return false;
+    }
+    size_t total = 0;
+    for (uint32_t size : tube_size) {
+	if (size < 2) return false;
+	total += size;
+    }
+    if (total != n_xsects) return false;
+    for (uint32_t label : xs_label) {
+	if (label >= n_labels) return false;
+    }
+
+    // The cache is valid, so build the model from it.
+    m_IsExtendedElevation = is_extended_elevation;
+    m_NumFixedPts = num_fixed_pts;
+    m_NumExportedPts = num_exported_pts;
+    m_NumEntrances = num_entrances;
+    m_HasUndergroundLegs = (has_flags & 0x01);
+    m_HasSplays = (has_flags & 0x02);
+    m_HasDupes = (has_flags & 0x04);
+    m_HasSurfaceLegs = (has_flags & 0x08);
+    m_HasErrorInformation = (has_flags & 0x10);
+    complete_dateinfo = complete_dateinfo_;
+    m_DateMin = date_min;
+    m_DateExt = date_ext;
+    m_separator = wxChar(separator);
+    m_Ext.assign(ext_x, ext_y, ext_z);
+    m_DepthMin = depth_min;
+    m_DepthExt = depth_ext;
+    m_Offset.assign(offset_x, offset_y, offset_z);
+    m_Title = wxString::FromUTF8Unchecked(title.data(), title.size());
+    m_cs_proj = wxString::FromUTF8Unchecked(cs.data(), cs.size());
+    m_DateStamp_numeric = time_t(datestamp_numeric);
+    SetDateStamp(datestamp.c_str());
+
+    ClearLabels();
+    m_Labels.reserve(n_labels);
+    for (size_t i = 0; i != n_labels; ++i) {
+	img_point pt;
+	pt.x = lab_x[i];
+	pt.y = lab_y[i];
+	pt.z = lab_z[i];
+	AddLabel(pt, from_pool(pool, lab_text[i]), lab_flags[i]);
+    }
+
+    for (size_t f = 0; f != n_flags; ++f) {
+	traverses[f].clear();
+	size_t j = 0;
+	for (size_t t = 0; t != trav_size[f].size(); ++t) {
+	    traverses[f].emplace_back(from_pool(pool, trav_name[f][t]));
+	    traverse& trav = traverses[f].back();
+	    trav.n_legs = trav_legs[f][t];
+	    trav.flags = trav_flags[f][t];
+	    trav.style = trav_style[f][t];
+	    trav.length = trav_length[f][t];
+	    for (int e = 0; e != 3; ++e) trav.errors[e] = trav_err[f][e][t];
+	    trav.reserve(trav_size[f][t]);
+	    for (size_t end = j + trav_size[f][t]; j != end; ++j) {
+		Point pt(Vector3(pt_x[f][j], pt_y[f][j], pt_z[f][j]));
+		trav.push_back(PointInfo(pt, pt_date[f][j]));
+	    }
+	}
+    }
+
+    tubes.clear();
+    m_TubesPrepared = false;
+    size_t j = 0;
+    for (uint32_t size : tube_size) {
+	tubes.push_back(vector<XSect>());
+	vector<XSect>& tube = tubes.back();
+	tube.reserve(size);
+	for (size_t end = j + size; j != end; ++j) {
+	    tube.emplace_back(m_Labels[xs_label[j]], xs_date[j],
+			      xs_l[j], xs_r[j], xs_u[j], xs_d[j]);
+	}
+    }
+
+    return true;
+}
+
+void
+Model::SaveCache(const wxString& file, const string& key,
+		 const char* datestamp) const
+{
+    StringPool pool;
+
+    vector<double> lab_x, lab_y, lab_z;
+    vector<int32_t> lab_flags;
+    vector<uint32_t> lab_text;
+    // XSect gives us access to the Point its station is at, so we use that to
+    // find the index of the label.
+    unordered_map<const Point*, uint32_t> label_index;
+    for (const LabelInfo* label : m_Labels) {
+	// Only cross-sections need to look labels up.
+	if (!tubes.empty()) label_index[label] = lab_x.size();
+	lab_x.push_back(label->GetX());
+	lab_y.push_back(label->GetY());
+	lab_z.push_back(label->GetZ());
+	lab_flags.push_back(label->get_flags());
+	lab_text.push_back(pool.add(label->GetText()));
+    }
+
+    const size_t n_flags = sizeof(traverses) / sizeof(traverses[0]);
+    vector<uint32_t> trav_size[n_flags];
+    vector<int32_t> trav_legs[n_flags], trav_flags[n_flags], trav_style[n_flags];
+    vector<double> trav_length[n_flags], trav_err[n_flags][3];
+    vector<uint32_t> trav_name[n_flags];
+    vector<double> pt_x[n_flags], pt_y[n_flags], pt_z[n_flags];
+    vector<int32_t> pt_date[n_flags];
+    for (size_t f = 0; f != n_flags; ++f) {
+	for (const traverse& trav : traverses[f]) {
+	    trav_size[f].push_back(trav.size());
+	    trav_legs[f].push_back(trav.n_legs);
+	    trav_flags[f].push_back(trav.flags);
+	    trav_style[f].push_back(trav.style);
+	    trav_length[f].push_back(trav.length);
+	    for (int e = 0; e != 3; ++e) trav_err[f][e].push_back(trav.errors[e]);
+	    trav_name[f].push_back(pool.add(trav.name));
+	    for (const PointInfo& pt : trav) {
+		pt_x[f].push_back(pt.GetX());
+		pt_y[f].push_back(pt.GetY());
+		pt_z[f].push_back(pt.GetZ());
+		pt_date[f].push_back(pt.GetDate());
+	    }
+	}
+    }
+
+    vector<uint32_t> tube_size;
+    vector<uint32_t> xs_label;
+    vector<int32_t> xs_date;
+    vector<double> xs_l, xs_r, xs_u, xs_d;
+    for (const vector<XSect>& tube : tubes) {
+	tube_size.push_back(tube.size());
+	for (const XSect& xs : tube) {
+	    auto it = label_index.find(&xs.GetPoint());
+	    // Every cross-section refers to a label in m_Labels.
+	    if (it == label_index.end()) return;
+	    xs_label.push_back(it->second);
+	    xs_date.push_back(xs.GetDate());
+	    xs_l.push_back(xs.GetL());
+	    xs_r.push_back(xs.GetR());
+	    xs_u.push_back(xs.GetU());
+	    xs_d.push_back(xs.GetD());
+	}
+    }
+
+    CacheWriter w(cache_header() + key);
+    w.put(int32_t(m_IsExtendedElevation));
+    w.put(int32_t(m_NumFixedPts));
+    w.put(int32_t(m_NumExportedPts));
+    w.put(int32_t(m_NumEntrances));
+    w.put(uint32_t((m_HasUndergroundLegs ? 0x01 : 0) |
+		   (m_HasSplays ? 0x02 : 0) |
+		   (m_HasDupes ? 0x04 : 0) |
+		   (m_HasSurfaceLegs ? 0x08 : 0) |
+		   (m_HasErrorInformation ? 0x10 : 0)));
+    w.put(int32_t(complete_dateinfo));
+    w.put(int32_t(m_DateMin));
+    w.put(int32_t(m_DateExt));
+    w.put(uint32_t(m_separator));
+    w.put(m_Ext.GetX());
+    w.put(m_Ext.GetY());
+    w.put(m_Ext.GetZ());
+    w.put(m_DepthMin);
+    w.put(m_DepthExt);
+    w.put(m_Offset.GetX());
+    w.put(m_Offset.GetY());
+    w.put(m_Offset.GetZ());
+    w.put(int64_t(m_DateStamp_numeric));
+    w.put_string(to_utf8(m_Title));
+    w.put_string(to_utf8(m_cs_proj));
+    w.put_string(datestamp);
+    w.put_string(pool.get());
+
+    w.put_array(lab_x);
+    w.put_array(lab_y);
+    w.put_array(lab_z);
+    w.put_array(lab_flags);
+    w.put_array(lab_text);
+
+    for (size_t f = 0; f != n_flags; ++f) {
+	w.put_array(trav_size[f]);
+	w.put_array(trav_legs[f]);
+	w.put_array(trav_flags[f]);
+	w.put_array(trav_style[f]);
+	w.put_array(trav_length[f]);
+	for (int e = 0; e != 3; ++e) w.put_array(trav_err[f][e]);
+	w.put_array(trav_name[f]);
+	w.put_array(pt_x[f]);
+	w.put_array(pt_y[f]);
+	w.put_array(pt_z[f]);
+	w.put_array(pt_date[f]);
+    }
+
+    w.put_array(tube_size);
+    w.put_array(xs_label);
+    w.put_array(xs_date);
+    w.put_array(xs_l);
+    w.put_array(xs_r);
+    w.put_array(xs_u);
+    w.put_array(xs_d);
+
+    // Write to a temporary file and rename it into place so a reader never
+    // sees a partly written cache.  Failing to write the cache isn't an
+    // error (e.g. the directory may not be writable).
+    wxString cache_file = file + MODEL_CACHE_EXT;
+    wxString tmp_file = cache_file + wxT(".tmp");
+    FILE* fh = wxFopen(tmp_file, wxT("wb"));
+    if (!fh) return;
+    const string& data = w.get_buffer();
+    bool ok = (fwrite(data.data(), data.size(), 1, fh) == 1);
+    if (fclose(fh) != 0) ok = false;
+    if (!ok || !wxRenameFile(tmp_file, cache_file, true)) {
+	wxRemoveFile(tmp_file);
+    }
+}
@@ -0,0 +1,157 @@
+//
+//  modeltest.cc
+//
+//  Check loading a Model via aven's cache gives the same model as loading it
+//  directly from the .3d file.
+//
+//  Copyright (C) 2026 agent
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "message.h"
+#include "model.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+
+using namespace std;
+
+static void
+append(string& out, const char* fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    out += buf;
+}
+
+static void
+append(string& out, const wxString& s)
+{
+    out += s.utf8_str();
+    out += '\n';
+}
+
+static void
+append(string& out, const Vector3& p)
+{
+    append(out, "%.17g %.17g %.17g", p.GetX(), p.GetY(), p.GetZ());
+}
+
+// Describe everything in model which aven uses in a form we can compare.
+static string
+describe(Model& model)
+{
+    string out;
+    append(out, model.GetSurveyTitle());
+    append(out, model.GetDateString());
+    append(out, model.GetCSProj());
+    append(out, "%ld %d %d %d %d\n", long(model.GetDateStamp()),
+	   int(model.HasCompleteDateInfo()), model.GetDateMin(),
+	   model.GetDateExtent(), int(model.GetSeparator()));
+    append(out, model.GetExtent());
+    append(out, model.GetOffset());
+    append(out, " %.17g %.17g\n", model.GetDepthMin(), model.GetDepthExtent());
+    append(out, "%d %d %d %d%d%d%d%d%d%d\n",
+	   model.GetNumFixedPts(), model.GetNumExportedPts(),
+	   model.GetNumEntrances(), int(model.HasUndergroundLegs()),
+	   int(model.HasSplays()), int(model.HasDupes()),
+	   int(model.HasSurfaceLegs()), int(model.HasTubes()),
+	   int(model.HasErrorInformation()),
+	   int(model.IsExtendedElevation()));
+
+    for (auto i = model.GetLabels(); i != model.GetLabelsEnd(); ++i) {
+	const LabelInfo* label = *i;
+	append(out, *label);
+	append(out, " %d ", label->get_flags());
+	append(out, label->GetText());
+    }
+
+    for (unsigned f = 0; f != 8; ++f) {
+	for (auto t = model.traverses_begin(f, NULL);
+	     t != model.traverses_end(f);
+	     t = model.traverses_next(f, NULL, t)) {
+	    append(out, "traverse %u %d %d %d %.17g %.17g %.17g %.17g ",
+		   f, t->n_legs, t->flags, t->style, t->length,
+		   t->errors[0], t->errors[1], t->errors[2]);
+	    append(out, t->name);
+	    for (const PointInfo& pt : *t) {
+		append(out, pt);
+		append(out, " %d\n", pt.GetDate());
+	    }
+	}
+    }
+
+    for (auto t = model.tubes_begin(); t != model.tubes_end(); ++t) {
+	out += "tube\n";
+	for (const XSect& xs : *t) {
+	    append(out, "%d %.17g %.17g %.17g %.17g %.17g ",
+		   xs.GetDate(), xs.GetL(), xs.GetR(), xs.GetU(), xs.GetD(),
+		   xs.get_right_bearing());
+	    append(out, xs.GetLabel());
+	}
+    }
+
+    return out;
+}
+
+int
+main(int argc, char** argv)
+{
+    msg_init(argv);
+
+    if (argc < 2 || argc > 3) {
+	fprintf(stderr, "Syntax: %s 3DFILE [SURVEY]\n", argv[0]);
+	return 1;
+    }
+    wxString file(argv[1], wxConvUTF8);
+    wxString survey;
+    if (argc == 3) survey = wxString(argv[2], wxConvUTF8);
+
+    // Load the file as aven does, which will use the cache if it's valid
+    // and otherwise update it.
+    Model model;
+    int err = model.Load(file, survey, NULL, true);
+    if (err) {
+	fprintf(stderr, "%s: Load() failed: %d\n", argv[0], err);
+	return 1;
+    }
+    // Report which happened so the caller can check the cache was used (or
+    // not) as expected.
+    puts(model.LoadedFromCache() ? "from cache" : "not from cache");
+
+    Model reference;
+    err = reference.Load(file, survey);
+    if (err) {
+	fprintf(stderr, "%s: Load() failed: %d\n", argv[0], err);
+	return 1;
+    }
+
+    if (describe(model) != describe(reference)) {
+	fprintf(stderr, "%s: Loading via the cache gave a different model\n",
+		argv[0]);
+	return 1;
+    }
+
+    return 0;
+}
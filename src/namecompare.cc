@@ -27,7 +27,26 @@ inline bool u_digit(unsigned ch) {
     return (ch - unsigned('0')) <= unsigned('9' - '0');
 }
 
-int name_cmp(const wxString &a, const wxString &b, int separator) {
+namespace {
+
+/* Wrapper so we can compare names held in a wxChar buffer without having to
+ * construct a wxString. */
+class wxchar_span {
+   const wxChar *p;
+   size_t len;
+
+  public:
+   wxchar_span(const wxChar *p_, size_t len_) : p(p_), len(len_) { }
+
+   size_t size() const { return len; }
+
+   wxChar operator[](size_t i) const { return p[i]; }
+};
+
+}
+
+template<typename S>
+static int name_cmp_(const S &a, const S &b, int separator) {
    size_t i = 0;
    size_t shorter = std::min(a.size(), b.size());
    while (i != shorter) {
@@ -77,3 +96,12 @@ int name_cmp(const wxString &a, const wxString &b, int separator) {
    }
    return int(a.size()) - int(b.size());
 }
+
+int name_cmp(const wxString &a, const wxString &b, int separator) {
+   return name_cmp_(a, b, separator);
+}
+
+int name_cmp(const wxChar *a, size_t a_len, const wxChar *b, size_t b_len,
+	     int separator) {
+   return name_cmp_(wxchar_span(a, a_len), wxchar_span(b, b_len), separator);
+}
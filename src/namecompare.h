@@ -20,3 +20,7 @@
 #include "wx.h"
 
 extern int name_cmp(const wxString &a, const wxString &b, int separator);
+
+/* Compare names held in wxChar buffers of the given lengths. */
+extern int name_cmp(const wxChar *a, size_t a_len,
+		    const wxChar *b, size_t b_len, int separator);
@@ -35,6 +35,7 @@
 #include "netbits.h"
 #include "matrix.h"
 #include "out.h"
+#include "profile.h"
 
 /* We want to split station list into a list of components, each of which
  * consists of a list of "articulations" - the first has all the fixed points
@@ -412,6 +413,14 @@ articulate(void)
 
    {
       component *comp = component_list;
+      node **lists, **listends;
+      long n_lists = 0, c;
+
+      for (comp = component_list; comp; comp = comp->next) n_lists++;
+      lists = osmalloc((n_lists + 1) * ossizeof(node *));
+      listends = osmalloc((n_lists + 1) * ossizeof(node *));
+      comp = component_list;
+      n_lists = 0;
 
 #ifdef DEBUG_ARTIC
       printf("\nDump of %d components:\n", cComponents);
@@ -458,7 +467,28 @@ articulate(void)
 	    printf(")\n");
 	 }
 #endif
-	 solve_matrix(list);
+	 lists[n_lists] = list;
+	 listends[n_lists] = listend;
+	 n_lists++;
+
+	 old_comp = comp;
+	 comp = comp->next;
+	 osfree(old_comp);
+      }
+
+      /* The components are independent, so can be solved in parallel. */
+      profile_begin(PROF_SOLVE_MATRIX);
+      solve_matrices(lists, n_lists);
+      if (profiling) {
+	 long n_stns = 0;
+	 for (c = 0; c < n_lists; c++) {
+	    for (stn = lists[c]; stn; stn = stn->next) ++n_stns;
+	 }
+	 profile_end(PROF_SOLVE_MATRIX, n_stns);
+      }
+
+      for (c = 0; c < n_lists; c++) {
+	 node *list = lists[c], *listend = listends[c];
 #ifdef DEBUG_ARTIC
 	 putnl();
 	 FOR_EACH_STN(stn, list) {
@@ -470,11 +500,9 @@ articulate(void)
 	 listend->next = stnlist;
 	 if (stnlist) stnlist->prev = listend;
 	 stnlist = list;
-
-	 old_comp = comp;
-	 comp = comp->next;
-	 osfree(old_comp);
       }
+      osfree(listends);
+      osfree(lists);
 #ifdef DEBUG_ARTIC
       printf("done articulating\n");
 #endif
@@ -211,7 +211,7 @@ remove_stn_from_list(node **list, node *stn) {
    }
 }
 
-/* Create (uses osmalloc) a forward leg containing the data in leg, or
+/* Create (from linkfor_arena) a forward leg containing the data in leg, or
  * the reversed data in the reverse of leg, if leg doesn't hold data
  */
 linkfor *
@@ -219,7 +219,7 @@ copy_link(linkfor *leg)
 {
    linkfor *legOut;
    int d;
-   legOut = osnew(linkfor);
+   legOut = osarena_new(&linkfor_arena, linkfor);
    if (data_here(leg)) {
       for (d = 2; d >= 0; d--) legOut->d[d] = leg->d[d];
    } else {
@@ -245,6 +245,18 @@ copy_link(linkfor *leg)
    return legOut;
 }
 
+/* Free a leg - only the forward leg holds the data, and the reverse leg is
+ * the smaller linkrev struct, so we can tell which arena it came from. */
+void
+free_leg(linkfor *leg)
+{
+   if (data_here(leg)) {
+      osarena_free(&linkfor_arena, leg);
+   } else {
+      osarena_free(&linkrev_arena, leg);
+   }
+}
+
 /* Adds to the forward leg “leg”, the data in leg2, or the reversed data
  * in the reverse of leg2, if leg2 doesn't hold data
  */
@@ -277,8 +289,8 @@ addleg_(node *fr, node *to,
     * - this should be trapped by the caller */
    SVX_ASSERT(fr->name != to->name);
 
-   leg = osnew(linkfor);
-   leg2 = (linkfor*)osnew(linkrev);
+   leg = osarena_new(&linkfor_arena, linkfor);
+   leg2 = (linkfor*)osarena_new(&linkrev_arena, linkrev);
 
    i = freeleg(&fr);
    j = freeleg(&to);
@@ -528,9 +540,9 @@ freeleg(node **stnptr)
 
    /* All legs used, so split node in two */
    oldstn = stn;
-   stn = osnew(node);
-   leg = osnew(linkfor);
-   leg2 = (linkfor*)osnew(linkrev);
+   stn = osarena_new(&node_arena, node);
+   leg = osarena_new(&linkfor_arena, linkfor);
+   leg2 = (linkfor*)osarena_new(&linkrev_arena, linkrev);
 
    *stnptr = stn;
 
@@ -571,7 +583,7 @@ StnFromPfx(prefix *name)
 {
    node *stn;
    if (name->stn != NULL) return (name->stn);
-   stn = osnew(node);
+   stn = osarena_new(&node_arena, node);
    stn->name = name;
    if (name->pos == NULL) {
       name->pos = osnew(pos);
@@ -22,6 +22,7 @@ void clear_last_leg(void);
 node *StnFromPfx(prefix *name);
 
 linkfor *copy_link(linkfor *leg);
+void free_leg(linkfor *leg);
 linkfor *addto_link(linkfor *leg, const linkfor *leg2);
 
 void addlegbyname(prefix *fr_name, prefix *to_name, bool fToFirst,
@@ -42,6 +42,8 @@
 #include "netskel.h"
 #include "network.h"
 #include "out.h"
+#include "profile.h"
+#include "watch.h"
 
 #define sqrdd(X) (sqrd((X)[0]) + sqrd((X)[1]) + sqrd((X)[2]))
 
@@ -72,6 +74,7 @@ static void remove_travs(void);
 static void replace_travs(void);
 static void replace_trailing_travs(void);
 static void write_passage_models(void);
+static long count_stations(void);
 
 static void concatenate_trav(node *stn, int i);
 
@@ -147,23 +150,33 @@ solve_network(void /*node *stnlist*/)
 
    first_solve = 0;
 
-   remove_trailing_travs();
-   validate(); dump_network();
-   remove_travs();
-   validate(); dump_network();
-   remove_subnets();
-   validate(); dump_network();
-   articulate();
-   validate(); dump_network();
-   replace_subnets();
-   validate(); dump_network();
-   replace_travs();
-   validate(); dump_network();
-   replace_trailing_travs();
-   validate(); dump_network();
+#define PHASE(F, P) BLK(\
+   profile_begin(P);\
+   F();\
+   profile_end(P, profiling ? count_stations() : 0);\
+   validate(); dump_network();)
+
+   PHASE(remove_trailing_travs, PROF_REMOVE_TRAILING_TRAVS);
+   PHASE(remove_travs, PROF_REMOVE_TRAVS);
+   PHASE(remove_subnets, PROF_REMOVE_SUBNETS);
+   PHASE(articulate, PROF_ARTICULATE);
+   PHASE(replace_subnets, PROF_REPLACE_SUBNETS);
+   PHASE(replace_travs, PROF_REPLACE_TRAVS);
+   PHASE(replace_trailing_travs, PROF_REPLACE_TRAILING_TRAVS);
 
    /* Now write out any passage models. */
-   write_passage_models();
+   PHASE(write_passage_models, PROF_PASSAGE_MODELS);
+#undef PHASE
+}
+
+/* Count the stations currently in the network, for profile_end(). */
+static long
+count_stations(void)
+{
+   long n = 0;
+   node *stn;
+   for (stn = stnlist; stn; stn = stn->next) ++n;
+   return n;
 }
 
 static void
@@ -262,7 +275,7 @@ concatenate_trav(node *stn, int i)
    if (fixed(stn2) || !two_node(stn2)) return;
 
    trav = osnew(stack);
-   newleg2 = (linkfor*)osnew(linkrev);
+   newleg2 = (linkfor*)osarena_new(&linkrev_arena, linkrev);
 
 #if PRINT_NETBITS
    printf("Concatenating trav "); print_prefix(stn->name); printf("<%p>",stn);
@@ -441,6 +454,14 @@ replace_travs(void)
 
    if (!pimg) {
       char *fnm = add_ext(fnm_output_base, EXT_SVX_3D);
+      if (watching) {
+	 /* Write to a temporary file which cavern renames over the .3d file
+	  * once it's complete, so anything watching the .3d file never sees a
+	  * partially written file, and it's left alone if there are errors. */
+	 fnm_3d_tmp = add_ext(fnm, "tmp");
+	 osfree(fnm);
+	 fnm = osstrdup(fnm_3d_tmp);
+      }
       filename_register_output(fnm);
       pimg = img_open_write_cs(fnm, survey_title, proj_str_out, 0);
       if (!pimg) fatalerror(img_error(), fnm);
@@ -581,10 +602,10 @@ replace_travs(void)
 		     POS(stn1, 0), POS(stn1, 1), POS(stn1, 2));
 
       fArtic = stn1->leg[i]->l.reverse & FLAG_ARTICULATION;
-      osfree(stn1->leg[i]);
+      free_leg(stn1->leg[i]);
       stn1->leg[i] = ptr->join1; /* put old link back in */
 
-      osfree(stn2->leg[j]);
+      free_leg(stn2->leg[j]);
       stn2->leg[j] = ptr->join2; /* and the other end */
 
 #ifdef BLUNDER_DETECTION
@@ -1008,8 +1029,8 @@ replace_trailing_travs(void)
 		  totvert += fabs(leg->d[2]);
 	       }
 	    }
-	    osfree(leg);
-	    osfree(legRev);
+	    osarena_free(&linkfor_arena, leg);
+	    osarena_free(&linkrev_arena, legRev);
 	    stn1->leg[i] = stnB->leg[iB] = NULL;
 	 }
       }
@@ -1021,7 +1042,7 @@ replace_trailing_travs(void)
    for (stn1 = stnlist; stn1; stn1 = stn2) {
       stn2 = stn1->next;
       stn1->name->stn = NULL;
-      osfree(stn1);
+      osarena_free(&node_arena, stn1);
    }
    stnlist = NULL;
 }
@@ -64,6 +64,8 @@ typedef struct StackRed {
 
 static stackRed *ptrRed; /* Ptr to TRaverse linked list for C*-*< , -*=*- */
 
+static osarena stackred_arena = OSARENA_INIT("stackRed", stackRed);
+
 /* can be altered by -z<letters> on command line */
 unsigned long optimize = BITA('l') | BITA('p') | BITA('d');
 /* Lollipops, Parallel legs, Iterate mx, Delta* */
@@ -116,8 +118,8 @@ remove_subnets(void)
 
 	       dirn3 = reverse_leg_dirn(stn2->leg[dirn2]);
 
-	       trav = osnew(stackRed);
-	       newleg2 = (linkfor*)osnew(linkrev);
+	       trav = osarena_new(&stackred_arena, stackRed);
+	       newleg2 = (linkfor*)osarena_new(&linkrev_arena, linkrev);
 
 	       newleg = copy_link(stn3->leg[dirn3]);
 
@@ -205,7 +207,7 @@ remove_subnets(void)
 	       stn4 = stn2->leg[dirn2]->l.to;
 	       dirn4 = reverse_leg_dirn(stn2->leg[dirn2]);
 
-	       trav = osnew(stackRed);
+	       trav = osarena_new(&stackred_arena, stackRed);
 
 	       newleg = copy_link(stn->leg[(dirn + 1) % 3]);
 	       /* use newleg2 for scratch */
@@ -249,8 +251,8 @@ remove_subnets(void)
 		    }
 #endif
 		 }
-	       osfree(newleg2);
-	       newleg2 = (linkfor*)osnew(linkrev);
+	       osarena_free(&linkfor_arena, newleg2);
+	       newleg2 = (linkfor*)osarena_new(&linkrev_arena, linkrev);
 
 	       addto_link(newleg, stn2->leg[dirn2]);
 	       addto_link(newleg, stn3->leg[dirn3]);
@@ -393,7 +395,7 @@ remove_subnets(void)
 	       SVX_ASSERT(stn5->leg[dirn5]->l.to == stn2);
 	       SVX_ASSERT(stn6->leg[dirn6]->l.to == stn3);
 
-	       trav = osnew(stackRed);
+	       trav = osarena_new(&stackred_arena, stackRed);
 		 {
 		    linkfor *legAZ, *legBZ, *legCZ;
 		    node *stnZ;
@@ -416,9 +418,9 @@ remove_subnets(void)
 		       BUG("loop of zero variance found");
 		    }
 
-		    legAZ = osnew(linkfor);
-		    legBZ = osnew(linkfor);
-		    legCZ = osnew(linkfor);
+		    legAZ = osarena_new(&linkfor_arena, linkfor);
+		    legBZ = osarena_new(&linkfor_arena, linkfor);
+		    legCZ = osarena_new(&linkfor_arena, linkfor);
 
 		    /* AZBZ */
 		    /* done above: addvv(&sum, &legBC->v, &legCA->v); */
@@ -452,9 +454,9 @@ remove_subnets(void)
 		    subdd(&temp, &temp, &temp2);
 		    mulsd(&legCZ->d, &sumCZAZ, &temp);
 
-		    osfree(legAB);
-		    osfree(legBC);
-		    osfree(legCA);
+		    osarena_free(&linkfor_arena, legAB);
+		    osarena_free(&linkfor_arena, legBC);
+		    osarena_free(&linkfor_arena, legCA);
 
 		    /* Now add two, subtract third, and scale by 0.5 */
 		    addss(&sum, &sumAZBZ, &sumCZAZ);
@@ -469,11 +471,11 @@ remove_subnets(void)
 		    subss(&sum, &sum, &sumAZBZ);
 		    mulsc(&legCZ->v, &sum, 0.5);
 
-		    nameZ = osnew(prefix);
+		    nameZ = osarena_new(&prefix_arena, prefix);
 		    nameZ->pos = osnew(pos);
 		    nameZ->ident = NULL;
 		    nameZ->shape = 3;
-		    stnZ = osnew(node);
+		    stnZ = osarena_new(&node_arena, node);
 		    stnZ->name = nameZ;
 		    nameZ->stn = stnZ;
 		    nameZ->up = NULL;
@@ -486,9 +488,9 @@ remove_subnets(void)
 		    legBZ->l.reverse = 1 | FLAG_DATAHERE | FLAG_REPLACEMENTLEG;
 		    legCZ->l.to = stnZ;
 		    legCZ->l.reverse = 2 | FLAG_DATAHERE | FLAG_REPLACEMENTLEG;
-		    stnZ->leg[0] = (linkfor*)osnew(linkrev);
-		    stnZ->leg[1] = (linkfor*)osnew(linkrev);
-		    stnZ->leg[2] = (linkfor*)osnew(linkrev);
+		    stnZ->leg[0] = (linkfor*)osarena_new(&linkrev_arena, linkrev);
+		    stnZ->leg[1] = (linkfor*)osarena_new(&linkrev_arena, linkrev);
+		    stnZ->leg[2] = (linkfor*)osarena_new(&linkrev_arena, linkrev);
 		    stnZ->leg[0]->l.to = stn4;
 		    stnZ->leg[0]->l.reverse = dirn4;
 		    stnZ->leg[1]->l.to = stn5;
@@ -621,9 +623,9 @@ replace_subnets(void)
 	 add_stn_to_list(&stnlist, stn);
 	 add_stn_to_list(&stnlist, stn2);
 
-	 osfree(stn3->leg[dirn3]);
+	 free_leg(stn3->leg[dirn3]);
 	 stn3->leg[dirn3] = ptrRed->join1;
-	 osfree(stn4->leg[dirn4]);
+	 free_leg(stn4->leg[dirn4]);
 	 stn4->leg[dirn4] = ptrRed->join2;
       } else if (IS_PARALLEL(ptrRed)) {
 	 /* parallel legs */
@@ -690,9 +692,9 @@ replace_subnets(void)
 	 add_stn_to_list(&stnlist, stn);
 	 add_stn_to_list(&stnlist, stn2);
 
-	 osfree(stn3->leg[dirn3]);
+	 free_leg(stn3->leg[dirn3]);
 	 stn3->leg[dirn3] = ptrRed->join1;
-	 osfree(stn4->leg[dirn4]);
+	 free_leg(stn4->leg[dirn4]);
 	 stn4->leg[dirn4] = ptrRed->join2;
       } else if (IS_DELTASTAR(ptrRed)) {
 	 node *stnZ;
@@ -748,26 +750,26 @@ replace_subnets(void)
 	    }
 	    fix(stn2);
 	    add_stn_to_list(&stnlist, stn2);
-	    osfree(leg);
+	    osarena_free(&linkfor_arena, leg);
 	    stn[i]->leg[dirn[i]] = legs[i];
 	    /* transfer the articulation status of the radial legs */
 	    if (stnZ->leg[i]->l.reverse & FLAG_ARTICULATION) {
 	       legs[i]->l.reverse |= FLAG_ARTICULATION;
 	       reverse_leg(legs[i])->l.reverse |= FLAG_ARTICULATION;
 	    }
-	    osfree(stnZ->leg[i]);
+	    osarena_free(&linkrev_arena, stnZ->leg[i]);
 	    stnZ->leg[i] = NULL;
 	 }
 /*printf("---%f %f %f\n",POS(stnZ, 0), POS(stnZ, 1), POS(stnZ, 2));*/
 	 remove_stn_from_list(&stnlist, stnZ);
-	 osfree(stnZ->name);
-	 osfree(stnZ);
+	 osarena_free(&prefix_arena, stnZ->name);
+	 osarena_free(&node_arena, stnZ);
       } else {
 	 BUG("ptrRed has unknown type");
       }
 
       ptrOld = ptrRed;
       ptrRed = ptrRed->next;
-      osfree(ptrOld);
+      osarena_free(&stackred_arena, ptrOld);
    }
 }
@@ -54,6 +54,38 @@ void *osmalloc(OSSIZE_T);
 void *osrealloc(void *, OSSIZE_T);
 char *osstrdup(const char *str);
 
+/* An arena allocates lots of objects of the same type from large blocks,
+ * which avoids the per-object overhead of malloc() and keeps objects which
+ * are allocated together close together in memory.  Freed objects are kept
+ * on a free list for reuse (memory is never returned to the system).
+ *
+ * static osarena node_arena = OSARENA_INIT("node", node);
+ * node *stn = osarena_new(&node_arena, node);
+ * osarena_free(&node_arena, stn);
+ */
+typedef struct osarena {
+   const char *name;
+   OSSIZE_T size;
+   char *next, *end; /* unused space in the current block */
+   void *free_list;
+   /* Number of objects and bytes currently allocated, and the peaks. */
+   unsigned long count, peak_count;
+   OSSIZE_T bytes, peak_bytes;
+   struct osarena *next_arena; /* list of arenas used, for osarena_report() */
+} osarena;
+
+#define OSARENA_INIT(NAME, T) { (NAME), ossizeof(T), NULL, NULL, NULL, 0, 0, 0, 0, NULL }
+
+#define osarena_new(A, T) ((T*)osarena_alloc((A)))
+
+void *osarena_alloc(osarena *arena);
+void osarena_free(osarena *arena, void *p);
+/* Allocate a copy of str from arena (which must only be used for strings -
+ * these can't be freed individually). */
+char *osarena_strdup(osarena *arena, const char *str);
+/* Report peak usage of each arena which has been used to stdout. */
+void osarena_report(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -188,6 +188,42 @@ class svxPrintout : public wxPrintout {
 
     bool fBlankPage;
 
+    // The survey data is projected onto the page grid once, with lines
+    // recorded as polylines in the coordinates MoveTo() and DrawTo() take,
+    // and each page keeps a list of the polylines and station marks which
+    // may be visible on it.  Pages can then be drawn without looking at
+    // anything which is off the page.
+    struct PagePoint {
+	long x, y;
+    };
+
+    struct Polyline {
+	// The points are points[first] to points[first + count - 1].
+	unsigned first, count;
+	const wxPen* pen;
+    };
+
+    // A station cross and/or label.
+    struct Mark {
+	long x, y;
+	const LabelInfo* label;
+    };
+
+    vector<PagePoint> points;
+    vector<Polyline> polylines;
+    vector<Mark> marks;
+
+    // page_polylines[pg - 1] lists (in drawing order) the polylines which
+    // may be visible on page pg, and similarly for page_marks.
+    vector<vector<unsigned>> page_polylines, page_marks;
+
+    // The page size in pixels the index was built for.
+    int index_page_width, index_page_depth;
+
+    // If true, MoveTo() and DrawTo() add to polylines instead of drawing.
+    bool recording;
+    const wxPen* recording_pen;
+
     int check_intersection(long x_p, long y_p);
     void draw_info_box();
     void draw_scale_bar(double x, double y, double MaxLength);
@@ -212,6 +248,10 @@ class svxPrintout : public wxPrintout {
     void NewPage(int pg, int pagesX, int pagesY);
     void PlotLR(const vector<XSect> & centreline);
     void PlotUD(const vector<XSect> & centreline);
+    void SetUpPageGeometry();
+    void BuildPageIndex();
+    void AddToPages(vector<vector<unsigned>>& pages, unsigned item,
+		    long x_min, long y_min, long x_max, long y_max) const;
   public:
     svxPrintout(MainFrm *mainfrm, layout *l, wxPageSetupDialogData *data, const wxString & title);
     bool OnPrintPage(int pageNum);
@@ -1068,7 +1108,8 @@ svxPrintDlg::RecalcBounds()
 	for (auto label = mainfrm->GetLabels();
 	     label != mainfrm->GetLabelsEnd();
 	     ++label) {
-	    if (filter && !filter->CheckVisible((*label)->GetText()))
+	    if (filter && !filter->CheckVisible((*label)->get_text_data(),
+						(*label)->get_text_length()))
 		continue;
 	    double x = (*label)->GetX();
 	    double y = (*label)->GetY();
@@ -1093,10 +1134,16 @@ static int fontsize, fontsize_labels;
 
 static const char *fontname = "Arial", *fontname_labels = "Arial";
 
+#define POINTS_PER_INCH 72.0
+#define POINTS_PER_MM (POINTS_PER_INCH / MM_PER_INCH)
+#define PWX_CROSS_SIZE (int)(2 * m_layout->scX / POINTS_PER_MM)
+
 svxPrintout::svxPrintout(MainFrm *mainfrm_, layout *l,
 			 wxPageSetupDialogData *data, const wxString & title)
     : wxPrintout(title), font_labels(NULL), font_default(NULL),
-      scan_for_blank_pages(false)
+      scan_for_blank_pages(false),
+      index_page_width(0), index_page_depth(0),
+      recording(false), recording_pen(NULL)
 {
     mainfrm = mainfrm_;
     m_layout = l;
@@ -1511,57 +1558,80 @@ svxPrintout::drawticks(int tsize, int x, int y)
    }
 }
 
-bool
-svxPrintout::OnPrintPage(int pageNum) {
+void
+svxPrintout::SetUpPageGeometry()
+{
     GetPageSizePixels(&xpPageWidth, &ypPageDepth);
-    pdc = GetDC();
-    pdc->SetBackgroundMode(wxTRANSPARENT);
-#ifdef AVEN_PRINT_PREVIEW
-    if (IsPreview()) {
-	int dcx, dcy;
-	pdc->GetSize(&dcx, &dcy);
-	pdc->SetUserScale((double)dcx / xpPageWidth, (double)dcy / ypPageDepth);
-    }
-#endif
 
     layout * l = m_layout;
-    {
-	int pwidth, pdepth;
-	GetPageSizeMM(&pwidth, &pdepth);
-	l->scX = (double)xpPageWidth / pwidth;
-	l->scY = (double)ypPageDepth / pdepth;
-	font_scaling_x = l->scX * (25.4 / 72.0);
-	font_scaling_y = l->scY * (25.4 / 72.0);
-	long MarginLeft = m_data->GetMarginTopLeft().x;
-	long MarginTop = m_data->GetMarginTopLeft().y;
-	long MarginBottom = m_data->GetMarginBottomRight().y;
-	long MarginRight = m_data->GetMarginBottomRight().x;
-	xpPageWidth -= (int)(l->scX * (MarginLeft + MarginRight));
-	ypPageDepth -= (int)(l->scY * (FOOTER_HEIGHT_MM + MarginBottom + MarginTop));
-	// xpPageWidth -= 1;
-	pdepth -= FOOTER_HEIGHT_MM;
-	x_offset = (long)(l->scX * MarginLeft);
-	y_offset = (long)(l->scY * MarginTop);
-	l->PaperWidth = pwidth -= MarginLeft + MarginRight;
-	l->PaperDepth = pdepth -= MarginTop + MarginBottom;
+    int pwidth, pdepth;
+    GetPageSizeMM(&pwidth, &pdepth);
+    l->scX = (double)xpPageWidth / pwidth;
+    l->scY = (double)ypPageDepth / pdepth;
+    font_scaling_x = l->scX * (25.4 / 72.0);
+    font_scaling_y = l->scY * (25.4 / 72.0);
+    long MarginLeft = m_data->GetMarginTopLeft().x;
+    long MarginTop = m_data->GetMarginTopLeft().y;
+    long MarginBottom = m_data->GetMarginBottomRight().y;
+    long MarginRight = m_data->GetMarginBottomRight().x;
+    xpPageWidth -= (int)(l->scX * (MarginLeft + MarginRight));
+    ypPageDepth -= (int)(l->scY * (FOOTER_HEIGHT_MM + MarginBottom + MarginTop));
+    // xpPageWidth -= 1;
+    pdepth -= FOOTER_HEIGHT_MM;
+    x_offset = (long)(l->scX * MarginLeft);
+    y_offset = (long)(l->scY * MarginTop);
+    l->PaperWidth = pwidth -= MarginLeft + MarginRight;
+    l->PaperDepth = pdepth -= MarginTop + MarginBottom;
+}
+
+void
+svxPrintout::AddToPages(vector<vector<unsigned>>& pages, unsigned item,
+			long x_min, long y_min, long x_max, long y_max) const
+{
+    // Allow a pixel either side for the pen width and for anything lying
+    // exactly on the boundary between two pages.
+    --x_min;
+    --y_min;
+    ++x_max;
+    ++y_max;
+    const layout * l = m_layout;
+    if (x_max < 0 || x_min > long(l->pagesX) * xpPageWidth) return;
+    if (y_max < 0 || y_min > long(l->pagesY) * ypPageDepth) return;
+    int x0 = x_min <= 0 ? 0 : int(x_min / xpPageWidth);
+    int x1 = min(int(x_max / xpPageWidth), l->pagesX - 1);
+    int y0 = y_min <= 0 ? 0 : int(y_min / ypPageDepth);
+    int y1 = min(int(y_max / ypPageDepth), l->pagesY - 1);
+    for (int y = y0; y <= y1; ++y) {
+	// Page rows are numbered from the top, but y increases up the page.
+	int pg0 = (l->pagesY - 1 - y) * l->pagesX;
+	for (int x = x0; x <= x1; ++x) {
+	    pages[pg0 + x].push_back(item);
+	}
     }
+}
+
+void
+svxPrintout::BuildPageIndex()
+{
+    points.clear();
+    polylines.clear();
+    marks.clear();
+    page_polylines.clear();
+    page_marks.clear();
+    index_page_width = xpPageWidth;
+    index_page_depth = ypPageDepth;
+    if (xpPageWidth <= 0 || ypPageDepth <= 0) return;
 
+    layout * l = m_layout;
     double SIN = sin(rad(l->rot));
     double COS = cos(rad(l->rot));
     double SINT = sin(rad(l->tilt));
     double COST = cos(rad(l->tilt));
 
-    NewPage(pageNum, l->pagesX, l->pagesY);
-
-    if (l->Legend && pageNum == (l->pagesY - 1) * l->pagesX + 1) {
-	SetFont(font_default);
-	draw_info_box();
-    }
-
-    pdc->SetClippingRegion(x_offset, y_offset, xpPageWidth + 1, ypPageDepth + 1);
-
     const double Sc = 1000 / l->Scale;
 
+    recording = true;
+
     const SurveyFilter* filter = mainfrm->GetTreeFilter();
     int show_mask = l->get_effective_show_mask();
     if (show_mask & (LEGS|SURF)) {
@@ -1575,11 +1645,11 @@ svxPrintout::OnPrintPage(int pageNum) {
 		continue;
 	    }
 	    if (f & img_FLAG_SPLAY) {
-		pdc->SetPen(*pen_splay);
+		recording_pen = pen_splay;
 	    } else if (f & img_FLAG_SURFACE) {
-		pdc->SetPen(*pen_surface_leg);
+		recording_pen = pen_surface_leg;
 	    } else {
-		pdc->SetPen(*pen_leg);
+		recording_pen = pen_leg;
 	    }
 	    list<traverse>::const_iterator trav = mainfrm->traverses_begin(f, filter);
 	    list<traverse>::const_iterator tend = mainfrm->traverses_end(f);
@@ -1606,7 +1676,7 @@ svxPrintout::OnPrintPage(int pageNum) {
 
     if ((show_mask & XSECT) &&
 	(l->tilt == 0.0 || l->tilt == 90.0 || l->tilt == -90.0)) {
-	pdc->SetPen(*pen_splay);
+	recording_pen = pen_splay;
 	list<vector<XSect>>::const_iterator trav = mainfrm->tubes_begin();
 	list<vector<XSect>>::const_iterator tend = mainfrm->tubes_end();
 	for ( ; trav != tend; ++trav) {
@@ -1619,12 +1689,40 @@ svxPrintout::OnPrintPage(int pageNum) {
 	}
     }
 
+    recording = false;
+
+    page_polylines.resize(l->pages);
+    for (unsigned i = 0; i != polylines.size(); ++i) {
+	const Polyline& polyline = polylines[i];
+	// A MoveTo() which wasn't followed by a DrawTo() draws nothing.
+	if (polyline.count < 2) continue;
+	long x_min = LONG_MAX, y_min = LONG_MAX;
+	long x_max = LONG_MIN, y_max = LONG_MIN;
+	for (unsigned j = polyline.first; j != polyline.first + polyline.count; ++j) {
+	    const PagePoint& p = points[j];
+	    x_min = min(x_min, p.x);
+	    x_max = max(x_max, p.x);
+	    y_min = min(y_min, p.y);
+	    y_max = max(y_max, p.y);
+	}
+	AddToPages(page_polylines, i, x_min, y_min, x_max, y_max);
+    }
+
+    page_marks.resize(l->pages);
     if (show_mask & (LABELS|STNS)) {
-	if (show_mask & LABELS) SetFont(font_labels);
+	double xsc = 1.0, ysc = 1.0;
+	if (show_mask & LABELS) {
+	    // Measure the labels as WriteString() will draw them.
+	    SetFont(font_labels);
+	    pdc->GetUserScale(&xsc, &ysc);
+	    pdc->SetUserScale(xsc * font_scaling_x, ysc * font_scaling_y);
+	}
+	const long cross_size = PWX_CROSS_SIZE;
 	for (auto label = mainfrm->GetLabels();
 	     label != mainfrm->GetLabelsEnd();
 	     ++label) {
-	    if (filter && !filter->CheckVisible((*label)->GetText()))
+	    if (filter && !filter->CheckVisible((*label)->get_text_data(),
+						(*label)->get_text_length()))
 		continue;
 	    double px = (*label)->GetX();
 	    double py = (*label)->GetY();
@@ -1635,15 +1733,92 @@ svxPrintout::OnPrintPage(int pageNum) {
 		long xnew, ynew;
 		xnew = (long)((X * Sc + l->xOrg) * l->scX);
 		ynew = (long)((Y * Sc + l->yOrg) * l->scY);
+		long x_min = xnew, y_min = ynew, x_max = xnew, y_max = ynew;
 		if (show_mask & STNS) {
-		    pdc->SetPen(*pen_cross);
-		    DrawCross(xnew, ynew);
+		    x_min -= cross_size;
+		    y_min -= cross_size;
+		    x_max += cross_size;
+		    y_max += cross_size;
 		}
 		if (show_mask & LABELS) {
-		    pdc->SetTextForeground(colour_labels);
-		    MoveTo(xnew, ynew);
-		    WriteString((*label)->GetText());
+		    // The text extends right and up from the station.
+		    wxCoord w, h;
+		    pdc->GetTextExtent((*label)->GetText(), &w, &h);
+		    x_max = max(x_max, xnew + long(ceil(w * font_scaling_x)));
+		    y_max = max(y_max, ynew + long(ceil(h * font_scaling_y)));
 		}
+		AddToPages(page_marks, marks.size(), x_min, y_min, x_max, y_max);
+		marks.push_back(Mark{xnew, ynew, *label});
+	    }
+	}
+	if (show_mask & LABELS) {
+	    pdc->SetUserScale(xsc, ysc);
+	}
+    }
+}
+
+bool
+svxPrintout::OnPrintPage(int pageNum) {
+    pdc = GetDC();
+    pdc->SetBackgroundMode(wxTRANSPARENT);
+#ifdef AVEN_PRINT_PREVIEW
+    if (IsPreview()) {
+	int pagex, pagey, dcx, dcy;
+	GetPageSizePixels(&pagex, &pagey);
+	pdc->GetSize(&dcx, &dcy);
+	pdc->SetUserScale((double)dcx / pagex, (double)dcy / pagey);
+    }
+#endif
+
+    SetUpPageGeometry();
+    if (index_page_width != xpPageWidth || index_page_depth != ypPageDepth) {
+	// OnBeginPrinting() should have built the index for this page size,
+	// but rebuild it if not.
+	BuildPageIndex();
+    }
+
+    layout * l = m_layout;
+
+    NewPage(pageNum, l->pagesX, l->pagesY);
+
+    if (l->Legend && pageNum == (l->pagesY - 1) * l->pagesX + 1) {
+	SetFont(font_default);
+	draw_info_box();
+    }
+
+    pdc->SetClippingRegion(x_offset, y_offset, xpPageWidth + 1, ypPageDepth + 1);
+
+    if (size_t(pageNum - 1) >= page_polylines.size()) return true;
+
+    const wxPen* pen = NULL;
+    for (unsigned i : page_polylines[pageNum - 1]) {
+	const Polyline& polyline = polylines[i];
+	if (polyline.pen != pen) {
+	    pen = polyline.pen;
+	    pdc->SetPen(*pen);
+	}
+	const PagePoint* p = &points[polyline.first];
+	MoveTo(p->x, p->y);
+	for (unsigned j = 1; j != polyline.count; ++j) {
+	    ++p;
+	    DrawTo(p->x, p->y);
+	}
+    }
+
+    const vector<unsigned>& page_mark_list = page_marks[pageNum - 1];
+    if (!page_mark_list.empty()) {
+	int show_mask = l->get_effective_show_mask();
+	if (show_mask & LABELS) SetFont(font_labels);
+	for (unsigned i : page_mark_list) {
+	    const Mark& mark = marks[i];
+	    if (show_mask & STNS) {
+		pdc->SetPen(*pen_cross);
+		DrawCross(mark.x, mark.y);
+	    }
+	    if (show_mask & LABELS) {
+		pdc->SetTextForeground(colour_labels);
+		MoveTo(mark.x, mark.y);
+		WriteString(mark.label->GetText());
 	    }
 	}
     }
@@ -1692,6 +1867,14 @@ svxPrintout::OnBeginPrinting() {
 			      wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL,
 			      false, wxString(fontname, wxConvUTF8),
 			      wxFONTENCODING_ISO8859_1);
+
+    // Work out what needs drawing on each page once, rather than looking at
+    // everything for every page.
+    pdc = GetDC();
+    if (pdc) {
+	SetUpPageGeometry();
+	BuildPageIndex();
+    }
 }
 
 void
@@ -1703,6 +1886,13 @@ svxPrintout::OnEndPrinting() {
     delete pen_leg;
     delete pen_surface_leg;
     delete pen_splay;
+
+    points.clear();
+    polylines.clear();
+    marks.clear();
+    page_polylines.clear();
+    page_marks.clear();
+    index_page_width = index_page_depth = 0;
 }
 
 int
@@ -1768,9 +1958,25 @@ svxPrintout::check_intersection(long x_p, long y_p)
 #undef R
 }
 
+// Split long polylines up when recording so each piece covers only a small
+// area and so only needs drawing on a page or two.
+const unsigned MAX_POLYLINE_POINTS = 32;
+
 void
 svxPrintout::MoveTo(long x, long y)
 {
+    if (recording) {
+	if (polylines.empty() || polylines.back().count > 1) {
+	    polylines.push_back(Polyline{unsigned(points.size()), 1,
+					 recording_pen});
+	    points.push_back(PagePoint{x, y});
+	} else {
+	    // Nothing was drawn from the previous position.
+	    polylines.back().pen = recording_pen;
+	    points.back() = PagePoint{x, y};
+	}
+	return;
+    }
     x_t = x_offset + x - clip.x_min;
     y_t = y_offset + clip.y_max - y;
 }
@@ -1778,6 +1984,18 @@ svxPrintout::MoveTo(long x, long y)
 void
 svxPrintout::DrawTo(long x, long y)
 {
+    if (recording) {
+	if (polylines.back().count == MAX_POLYLINE_POINTS) {
+	    // Start a new polyline from the end of this one.
+	    PagePoint p = points.back();
+	    polylines.push_back(Polyline{unsigned(points.size()), 1,
+					 recording_pen});
+	    points.push_back(p);
+	}
+	points.push_back(PagePoint{x, y});
+	++polylines.back().count;
+	return;
+    }
     long x_p = x_t, y_p = y_t;
     x_t = x_offset + x - clip.x_min;
     y_t = y_offset + clip.y_max - y;
@@ -1788,10 +2006,6 @@ svxPrintout::DrawTo(long x, long y)
     }
 }
 
-#define POINTS_PER_INCH 72.0
-#define POINTS_PER_MM (POINTS_PER_INCH / MM_PER_INCH)
-#define PWX_CROSS_SIZE (int)(2 * m_layout->scX / POINTS_PER_MM)
-
 void
 svxPrintout::DrawCross(long x, long y)
 {
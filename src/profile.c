@@ -0,0 +1,177 @@
+/* profile.c
+ * Record time and memory used by each phase of cavern's processing
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <time.h>
+#ifdef HAVE_GETTIMEOFDAY
+# include <sys/time.h>
+#endif
+#ifdef HAVE_GETRUSAGE
+# include <sys/resource.h>
+#endif
+
+#include "debug.h"
+#include "message.h"
+#include "profile.h"
+
+int profiling = 0;
+
+typedef struct {
+   const char *name;
+   /* Number of times this phase has been run - solve_network() gets called
+    * once for each *solve in the data as well as at the end. */
+   long calls;
+   double wall, cpu;
+   /* Time this phase was last started. */
+   double wall_start;
+   clock_t cpu_start;
+   /* Peak resident set size of the process (in KB) when the phase last
+    * ended, or -1 if unknown. */
+   long peak_rss;
+   long items;
+} phase_info;
+
+static phase_info phases[PROF_COUNT] = {
+   { "parse", 0, 0, 0, 0, 0, -1, 0 },
+   { "remove_trailing_travs", 0, 0, 0, 0, 0, -1, 0 },
+   { "remove_travs", 0, 0, 0, 0, 0, -1, 0 },
+   { "remove_subnets", 0, 0, 0, 0, 0, -1, 0 },
+   { "articulate", 0, 0, 0, 0, 0, -1, 0 },
+   { "solve_matrix", 0, 0, 0, 0, 0, -1, 0 },
+   { "replace_subnets", 0, 0, 0, 0, 0, -1, 0 },
+   { "replace_travs", 0, 0, 0, 0, 0, -1, 0 },
+   { "replace_trailing_travs", 0, 0, 0, 0, 0, -1, 0 },
+   { "write_passage_models", 0, 0, 0, 0, 0, -1, 0 },
+   { "close_3d", 0, 0, 0, 0, 0, -1, 0 }
+};
+
+double
+elapsed_time(void)
+{
+#ifdef CLOCK_MONOTONIC
+   struct timespec ts;
+   if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+      return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+   struct timeval tv;
+   if (gettimeofday(&tv, NULL) == 0)
+      return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+   return (double)time(NULL);
+}
+
+static long
+peak_rss_kb(void)
+{
+#ifdef HAVE_GETRUSAGE
+   struct rusage ru;
+   if (getrusage(RUSAGE_SELF, &ru) == 0) {
+# ifdef __APPLE__
+      /* macOS reports ru_maxrss in bytes rather than KB. */
+      return (long)(ru.ru_maxrss / 1024);
+# else
+      return (long)ru.ru_maxrss;
+# endif
+   }
+#endif
+   return -1;
+}
+
+void
+profile_begin(profile_phase phase)
+{
+   phase_info *p;
+   if (!profiling) return;
+   SVX_ASSERT(phase < PROF_COUNT);
+   p = &phases[phase];
+   p->wall_start = elapsed_time();
+   p->cpu_start = clock();
+}
+
+void
+profile_end(profile_phase phase, long items)
+{
+   phase_info *p;
+   clock_t now;
+   if (!profiling) return;
+   SVX_ASSERT(phase < PROF_COUNT);
+   p = &phases[phase];
+   now = clock();
+   p->wall += elapsed_time() - p->wall_start;
+   p->cpu += (now - p->cpu_start) / (double)CLOCKS_PER_SEC;
+   p->peak_rss = peak_rss_kb();
+   p->items = items;
+   ++p->calls;
+}
+
+void
+profile_report(const char *fnm)
+{
+   int i;
+   if (!profiling) return;
+
+   printf("%-24s %6s %10s %10s %14s %12s\n",
+	  "Phase", "Calls", "Wall (s)", "CPU (s)", "Peak RSS (KB)", "Items");
+   for (i = 0; i < PROF_COUNT; i++) {
+      const phase_info *p = &phases[i];
+      char name[32];
+      if (p->calls == 0) continue;
+      /* Indent solve_matrix to show its time is included in articulate's. */
+      snprintf(name, sizeof(name), "%s%s",
+	       i == PROF_SOLVE_MATRIX ? "  " : "", p->name);
+      printf("%-24s %6ld %10.3f %10.3f ", name, p->calls, p->wall, p->cpu);
+      if (p->peak_rss >= 0) {
+	 printf("%14ld", p->peak_rss);
+      } else {
+	 printf("%14s", "-");
+      }
+      printf(" %12ld\n", p->items);
+   }
+
+   if (fnm) {
+      FILE *fh = fopen(fnm, "w");
+      const char *sep = "";
+      if (!fh) fatalerror(/*Failed to open output file “%s”*/47, fnm);
+      fputs("{\"phases\":[", fh);
+      for (i = 0; i < PROF_COUNT; i++) {
+	 const phase_info *p = &phases[i];
+	 if (p->calls == 0) continue;
+	 fprintf(fh, "%s\n{\"name\":\"%s\",\"calls\":%ld,"
+		     "\"wall\":%.6f,\"cpu\":%.6f,\"peak_rss_kb\":",
+		 sep, p->name, p->calls, p->wall, p->cpu);
+	 if (p->peak_rss >= 0) {
+	    fprintf(fh, "%ld", p->peak_rss);
+	 } else {
+	    fputs("null", fh);
+	 }
+	 fprintf(fh, ",\"items\":%ld", p->items);
+	 if (i == PROF_SOLVE_MATRIX) fputs(",\"parent\":\"articulate\"", fh);
+	 fputc('}', fh);
+	 sep = ",";
+      }
+      fputs("\n]}\n", fh);
+      if (ferror(fh) || fclose(fh) != 0)
+	 fatalerror(/*Error writing to file “%s”*/110, fnm);
+   }
+}
@@ -0,0 +1,56 @@
+/* profile.h
+ * Record time and memory used by each phase of cavern's processing
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* The order here is the order phases are listed in the report. */
+typedef enum {
+   PROF_PARSE,
+   PROF_REMOVE_TRAILING_TRAVS,
+   PROF_REMOVE_TRAVS,
+   PROF_REMOVE_SUBNETS,
+   PROF_ARTICULATE,
+   PROF_SOLVE_MATRIX, /* Nested inside PROF_ARTICULATE. */
+   PROF_REPLACE_SUBNETS,
+   PROF_REPLACE_TRAVS,
+   PROF_REPLACE_TRAILING_TRAVS,
+   PROF_PASSAGE_MODELS,
+   PROF_CLOSE_3D,
+   PROF_COUNT
+} profile_phase;
+
+/* Return a wall clock time in seconds, for measuring how long something
+ * takes. */
+double elapsed_time(void);
+
+/* Non-zero if --profile was specified. */
+extern int profiling;
+
+void profile_begin(profile_phase phase);
+
+/* items is a phase-specific count (e.g. stations left in the network) which
+ * is reported alongside the time taken. */
+void profile_end(profile_phase phase, long items);
+
+/* Print a table of the phases to stdout, and if fnm isn't NULL, also write
+ * the data to that file in JSON format. */
+void profile_report(const char *fnm);
+
+#endif
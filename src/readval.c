@@ -47,13 +47,14 @@ int root_depr_count = 0;
 static prefix *
 new_anon_station(void)
 {
-    prefix *name = osnew(prefix);
+    prefix *name = osarena_new(&prefix_arena, prefix);
     name->pos = NULL;
     name->ident = NULL;
     name->shape = 0;
     name->stn = NULL;
     name->up = pcs->Prefix;
     name->down = NULL;
+    name->child_index = NULL;
     name->filename = file.filename;
     name->line = file.line;
     name->min_export = name->max_export = 0;
@@ -64,6 +65,133 @@ new_anon_station(void)
     return name;
 }
 
+/* Once we've had to step through more than this many siblings to find a
+ * name, build an index for that survey's children. */
+#define CHILD_INDEX_THRESHOLD 32
+
+/* Number of children per block in the index (blocks are split when they get
+ * to twice this size). */
+#define CHILD_INDEX_BLOCK 32
+
+/* Index to the children of a survey with lots of them.  The children are
+ * still kept in the sorted list linked by ->right, which we split into
+ * blocks of consecutive entries, noting the first entry and the length of
+ * each.  A binary chop on the first entries followed by a short linear
+ * search of one block then finds a name, or where to insert it - in effect
+ * it's a two level B-tree with the sibling list as the leaves.  This means
+ * that adding stations in a random order to a survey with tens of thousands
+ * of them isn't quadratic.
+ */
+typedef struct Child_index {
+   prefix **first;
+   unsigned *count;
+   size_t n_blocks, max_blocks;
+} child_index;
+
+static void
+build_child_index(prefix *survey)
+{
+   child_index *index = osnew(child_index);
+   prefix *p;
+   unsigned n = 0;
+   index->n_blocks = 0;
+   index->max_blocks = 16;
+   index->first = osmalloc(index->max_blocks * ossizeof(prefix *));
+   index->count = osmalloc(index->max_blocks * ossizeof(unsigned));
+   for (p = survey->down; p; p = p->right) {
+      if (n == 0) {
+	 if (index->n_blocks == index->max_blocks) {
+	    index->max_blocks *= 2;
+	    index->first = osrealloc(index->first,
+				     index->max_blocks * ossizeof(prefix *));
+	    index->count = osrealloc(index->count,
+				     index->max_blocks * ossizeof(unsigned));
+	 }
+	 index->first[index->n_blocks++] = p;
+      }
+      index->count[index->n_blocks - 1] = ++n;
+      if (n == CHILD_INDEX_BLOCK) n = 0;
+   }
+   survey->child_index = index;
+}
+
+/* Look for name amongst the children of survey using its index.
+ *
+ * Returns the child if found, otherwise NULL.  Either way, *p_prev is set to
+ * the last child before name (or NULL if name would be first) and *p_block to
+ * the block which name is in or should be added to.
+ */
+static prefix *
+find_in_child_index(const prefix *survey, const char *name,
+		    prefix **p_prev, size_t *p_block)
+{
+   const child_index *index = survey->child_index;
+   size_t lo = 0, hi = index->n_blocks;
+   prefix *p, *prev = NULL;
+   unsigned n;
+
+   /* Find the last block whose first entry is <= name. */
+   while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (strcmp(index->first[mid]->ident, name) <= 0) {
+	 lo = mid;
+      } else {
+	 hi = mid;
+      }
+   }
+   *p_block = lo;
+
+   p = index->first[lo];
+   for (n = index->count[lo]; n; --n) {
+      int cmp = strcmp(p->ident, name);
+      if (cmp == 0) {
+	 *p_prev = prev;
+	 return p;
+      }
+      if (cmp > 0) break;
+      prev = p;
+      p = p->right;
+   }
+   *p_prev = prev;
+   return NULL;
+}
+
+/* Record in survey's index that newptr has been added to block (after prev,
+ * or at the very start if prev is NULL). */
+static void
+add_to_child_index(prefix *survey, size_t block, prefix *newptr,
+		   const prefix *prev)
+{
+   child_index *index = survey->child_index;
+   prefix *p;
+   unsigned n;
+
+   if (prev == NULL) {
+      SVX_ASSERT(block == 0);
+      index->first[0] = newptr;
+   }
+   if (++index->count[block] < CHILD_INDEX_BLOCK * 2) return;
+
+   /* Split the block in two. */
+   if (index->n_blocks == index->max_blocks) {
+      index->max_blocks *= 2;
+      index->first = osrealloc(index->first,
+			       index->max_blocks * ossizeof(prefix *));
+      index->count = osrealloc(index->count,
+			       index->max_blocks * ossizeof(unsigned));
+   }
+   p = index->first[block];
+   for (n = CHILD_INDEX_BLOCK; n; --n) p = p->right;
+   memmove(index->first + block + 2, index->first + block + 1,
+	   (index->n_blocks - block - 1) * sizeof(prefix *));
+   memmove(index->count + block + 2, index->count + block + 1,
+	   (index->n_blocks - block - 1) * sizeof(unsigned));
+   index->first[block + 1] = p;
+   index->count[block + 1] = index->count[block] - CHILD_INDEX_BLOCK;
+   index->count[block] = CHILD_INDEX_BLOCK;
+   ++index->n_blocks;
+}
+
 /* if prefix is omitted: if PFX_OPT set return NULL, otherwise use longjmp */
 extern prefix *
 read_prefix(unsigned pfx_flags)
@@ -220,11 +348,10 @@ anon_wall_station:
       ptr = ptr->down;
       if (ptr == NULL) {
 	 /* Special case first time around at each level */
-	 name = osrealloc(name, i);
-	 ptr = osnew(prefix);
-	 ptr->ident = name;
-	 name = NULL;
+	 ptr = osarena_new(&prefix_arena, prefix);
+	 ptr->ident = osarena_strdup(&ident_arena, name);
 	 ptr->right = ptr->down = NULL;
+	 ptr->child_index = NULL;
 	 ptr->pos = NULL;
 	 ptr->shape = 0;
 	 ptr->stn = NULL;
@@ -243,27 +370,48 @@ anon_wall_station:
 	 static prefix *cached_survey = NULL, *cached_station = NULL;
 	 prefix *ptrPrev = NULL;
 	 int cmp = 1; /* result of strcmp ( -ve for <, 0 for =, +ve for > ) */
-	 if (cached_survey == back_ptr) {
-	    cmp = strcmp(cached_station->ident, name);
-	    if (cmp <= 0) ptr = cached_station;
-	 }
-	 while (ptr && (cmp = strcmp(ptr->ident, name))<0) {
-	    ptrPrev = ptr;
-	    ptr = ptr->right;
+	 size_t block = 0;
+	 if (back_ptr->child_index) {
+	    prefix *found = find_in_child_index(back_ptr, name, &ptrPrev,
+						&block);
+	    if (found) {
+	       ptr = found;
+	       cmp = 0;
+	    } else {
+	       ptr = ptrPrev ? ptrPrev->right : back_ptr->down;
+	    }
+	 } else {
+	    unsigned steps = 0;
+	    if (cached_survey == back_ptr) {
+	       cmp = strcmp(cached_station->ident, name);
+	       if (cmp <= 0) ptr = cached_station;
+	    }
+	    while (ptr && (cmp = strcmp(ptr->ident, name))<0) {
+	       ptrPrev = ptr;
+	       ptr = ptr->right;
+	       ++steps;
+	    }
+	    if (steps > CHILD_INDEX_THRESHOLD) {
+	       /* Build the index now (before we add a new child, which is
+		* simpler than working out which block it's in). */
+	       build_child_index(back_ptr);
+	       if (cmp) {
+		  (void)find_in_child_index(back_ptr, name, &ptrPrev, &block);
+	       }
+	    }
 	 }
 	 if (cmp) {
 	    /* ie we got to one that was higher, or the end */
 	    prefix *newptr;
-	    name = osrealloc(name, i);
-	    newptr = osnew(prefix);
-	    newptr->ident = name;
-	    name = NULL;
+	    newptr = osarena_new(&prefix_arena, prefix);
+	    newptr->ident = osarena_strdup(&ident_arena, name);
 	    if (ptrPrev == NULL)
 	       back_ptr->down = newptr;
 	    else
 	       ptrPrev->right = newptr;
 	    newptr->right = ptr;
 	    newptr->down = NULL;
+	    newptr->child_index = NULL;
 	    newptr->pos = NULL;
 	    newptr->shape = 0;
 	    newptr->stn = NULL;
@@ -274,6 +422,8 @@ anon_wall_station:
 	    newptr->sflags = BIT(SFLAGS_SURVEY);
 	    if (fSuspectTypo && !fImplicitPrefix)
 	       newptr->sflags |= BIT(SFLAGS_SUSPECTTYPO);
+	    if (back_ptr->child_index)
+	       add_to_child_index(back_ptr, block, newptr, ptrPrev);
 	    ptr = newptr;
 	    fNew = fTrue;
 	 }
@@ -0,0 +1,226 @@
+/* solvecache.c
+ * Cache the solutions of the matrices for components of the network
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* When re-processing a large dataset after editing one part of it, most of
+ * the independent components of the network which need matrices solving are
+ * unchanged.  With --solve-cache we save the solution for each component in
+ * a file alongside the .3d file, keyed by a hash of everything which goes
+ * into solving it, and reuse it next time if the key matches.
+ *
+ * The file is in the native byte order and floating point format, and is
+ * ignored if it was written by a build which differs in these (or any other
+ * way which the header checks).  The entries are written out in the order
+ * they are used so the file only ever contains entries from the last run.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "cavern.h"
+#include "filelist.h"
+#include "filename.h"
+#include "message.h"
+#include "solvecache.h"
+
+int solve_caching = 0;
+
+typedef struct cache_entry {
+   solve_cache_key key;
+   real *coords;
+   bool used;
+   struct cache_entry *next;
+} cache_entry;
+
+#define CACHE_HTAB_SIZE 0x400
+
+static cache_entry *htab[CACHE_HTAB_SIZE];
+
+/* Entries used or added by this run, in order. */
+static cache_entry **used = NULL;
+static long n_used = 0, max_used = 0;
+
+static bool loaded = fFalse;
+
+static const char cache_magic[] = "Svx\nSolve cache\n";
+
+#define SOLVE_CACHE_VERSION 1
+
+/* Fill in the header which follows the magic string. */
+static void
+make_header(unsigned char *header)
+{
+   /* A value which isn't exactly representable, so the bit pattern tells us
+    * if the floating point format matches. */
+   real probe = (real)-1.0 / (real)3.0;
+   header[0] = SOLVE_CACHE_VERSION;
+   header[1] = (unsigned char)sizeof(long);
+   header[2] = (unsigned char)sizeof(real);
+   memcpy(header + 3, &probe, sizeof(real));
+}
+
+#define HEADER_SIZE (3 + sizeof(real))
+
+static void
+mark_used(cache_entry *entry)
+{
+   if (entry->used) return;
+   entry->used = fTrue;
+   if (n_used == max_used) {
+      max_used = max_used ? max_used * 2 : 64;
+      used = osrealloc(used, max_used * ossizeof(cache_entry *));
+   }
+   used[n_used++] = entry;
+}
+
+static cache_entry *
+add_entry(const solve_cache_key *key, real *coords)
+{
+   cache_entry *entry = osnew(cache_entry);
+   unsigned h = key->h1 & (CACHE_HTAB_SIZE - 1);
+   entry->key = *key;
+   entry->coords = coords;
+   entry->used = fFalse;
+   entry->next = htab[h];
+   htab[h] = entry;
+   return entry;
+}
+
+static void
+load_cache(void)
+{
+   char *fnm;
+   FILE *fh;
+   char magic[sizeof(cache_magic) - 1];
+   unsigned char header[HEADER_SIZE], expected[HEADER_SIZE];
+
+   loaded = fTrue;
+   fnm = add_ext(fnm_output_base, EXT_SVX_CACHE);
+   fh = fopen(fnm, "rb");
+   osfree(fnm);
+   /* It's not an error if there isn't a cache yet. */
+   if (!fh) return;
+
+   make_header(expected);
+   if (fread(magic, sizeof(magic), 1, fh) != 1 ||
+       memcmp(magic, cache_magic, sizeof(magic)) != 0 ||
+       fread(header, sizeof(header), 1, fh) != 1 ||
+       memcmp(header, expected, sizeof(header)) != 0) {
+      fclose(fh);
+      return;
+   }
+
+   while (1) {
+      solve_cache_key key;
+      real *coords;
+      if (fread(&key.h1, sizeof(key.h1), 1, fh) != 1 ||
+	  fread(&key.h2, sizeof(key.h2), 1, fh) != 1 ||
+	  fread(&key.n, sizeof(key.n), 1, fh) != 1) {
+	 break;
+      }
+      /* Sanity check - a truncated or corrupt file shouldn't make us try to
+       * allocate a silly amount of memory. */
+      if (key.n <= 0 || key.n > LONG_MAX / (3 * (long)sizeof(real))) break;
+      coords = osmalloc(key.n * 3 * ossizeof(real));
+      if (fread(coords, sizeof(real), key.n * 3, fh) != (size_t)key.n * 3) {
+	 osfree(coords);
+	 break;
+      }
+      add_entry(&key, coords);
+   }
+   fclose(fh);
+}
+
+void
+solve_cache_key_init(solve_cache_key *key, long n)
+{
+   key->h1 = 2166136261UL;
+   key->h2 = 5381;
+   key->n = n;
+   solve_cache_key_add(key, &n, sizeof(n));
+}
+
+void
+solve_cache_key_add(solve_cache_key *key, const void *data, size_t len)
+{
+   const unsigned char *p = (const unsigned char *)data;
+   unsigned long h1 = key->h1, h2 = key->h2;
+   while (len--) {
+      /* FNV-1a and a variant of Bernstein's hash. */
+      h1 = ((h1 ^ *p) * 16777619UL) & 0xffffffffUL;
+      h2 = ((h2 * 33) ^ *p) & 0xffffffffUL;
+      ++p;
+   }
+   key->h1 = h1;
+   key->h2 = h2;
+}
+
+const real *
+solve_cache_find(const solve_cache_key *key)
+{
+   cache_entry *entry;
+   if (!loaded) load_cache();
+   for (entry = htab[key->h1 & (CACHE_HTAB_SIZE - 1)]; entry; entry = entry->next) {
+      if (entry->key.h1 == key->h1 && entry->key.h2 == key->h2 &&
+	  entry->key.n == key->n) {
+	 mark_used(entry);
+	 return entry->coords;
+      }
+   }
+   return NULL;
+}
+
+void
+solve_cache_add(const solve_cache_key *key, const real *coords)
+{
+   real *copy;
+   if (!loaded) load_cache();
+   copy = osmalloc(key->n * 3 * ossizeof(real));
+   memcpy(copy, coords, key->n * 3 * sizeof(real));
+   mark_used(add_entry(key, copy));
+}
+
+void
+solve_cache_save(void)
+{
+   FILE *fh;
+   unsigned char header[HEADER_SIZE];
+   long i;
+
+   /* If there weren't any matrices to solve, leave any existing cache. */
+   if (!loaded) return;
+
+   fh = safe_fopen_with_ext(fnm_output_base, EXT_SVX_CACHE, "wb");
+   make_header(header);
+   fwrite(cache_magic, sizeof(cache_magic) - 1, 1, fh);
+   fwrite(header, sizeof(header), 1, fh);
+   for (i = 0; i < n_used; i++) {
+      const cache_entry *entry = used[i];
+      fwrite(&entry->key.h1, sizeof(entry->key.h1), 1, fh);
+      fwrite(&entry->key.h2, sizeof(entry->key.h2), 1, fh);
+      fwrite(&entry->key.n, sizeof(entry->key.n), 1, fh);
+      fwrite(entry->coords, sizeof(real), entry->key.n * 3, fh);
+   }
+   safe_fclose(fh);
+}
@@ -0,0 +1,53 @@
+/* solvecache.h
+ * Cache the solutions of the matrices for components of the network
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOLVECACHE_H
+#define SOLVECACHE_H
+
+#include <stddef.h>
+
+#include "cavern.h"
+
+/* Identifies the input to solving one matrix: the legs, their variances, the
+ * positions of any fixed points they connect to, and how the matrix will be
+ * solved.  We use two independent 32-bit hashes of all this so a false
+ * match is vanishingly unlikely. */
+typedef struct {
+   unsigned long h1, h2;
+   long n; /* number of stations being solved for */
+} solve_cache_key;
+
+/* Non-zero if --solve-cache was specified. */
+extern int solve_caching;
+
+void solve_cache_key_init(solve_cache_key *key, long n);
+
+void solve_cache_key_add(solve_cache_key *key, const void *data, size_t len);
+
+/* Return the solved coordinates (3 per station) stored for key, or NULL if
+ * there aren't any. */
+const real *solve_cache_find(const solve_cache_key *key);
+
+/* Store the solved coordinates for key (coords is copied). */
+void solve_cache_add(const solve_cache_key *key, const real *coords);
+
+/* Write out the entries which have been used or added by this run. */
+void solve_cache_save(void);
+
+#endif
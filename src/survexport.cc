@@ -41,8 +41,11 @@
 #include "str.h"
 #include "useful.h"
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -51,7 +54,9 @@ main(int argc, char **argv)
 {
    double pan = 0;
    double tilt = -90.0;
-   export_format format = FMT_MAX_PLUS_ONE_;
+   // The formats specified by command line options, in order.
+   vector<export_format> formats;
+   export_format default_format = FMT_MAX_PLUS_ONE_;
    int show_mask = 0;
    const char *survey = NULL;
    double grid = 0.0; /* grid spacing (or 0 for no grid) */
@@ -64,7 +69,7 @@ main(int argc, char **argv)
        /* Default to .pos output if installed as 3dtopos. */
        char* progname = baseleaf_from_fnm(argv[0]);
        if (strcasecmp(progname, "3dtopos") == 0) {
-	   format = FMT_POS;
+	   default_format = FMT_POS;
        }
        osfree(progname);
    }
@@ -181,7 +186,7 @@ main(int argc, char **argv)
 
    int long_index;
    bool always_include_defaults = false;
-   cmdline_init(argc, argv, short_opts, long_opts, &long_index, help, 1, 2);
+   cmdline_init(argc, argv, short_opts, long_opts, &long_index, help, 1, -1);
    while (1) {
       long_index = -1;
       int opt = cmdline_getopt();
@@ -344,7 +349,7 @@ main(int argc, char **argv)
 	 break;
        default:
 	 if (opt >= OPT_FMT_BASE && opt < OPT_FMT_BASE + FMT_MAX_PLUS_ONE_) {
-	     format = export_format(opt - OPT_FMT_BASE);
+	     formats.push_back(export_format(opt - OPT_FMT_BASE));
 	 }
       }
       if (bit) {
@@ -384,9 +389,26 @@ main(int argc, char **argv)
    if (filter) survey = NULL;
 
    const char* fnm_in = argv[optind++];
-   const char* fnm_out = argv[optind];
-   if (fnm_out) {
-      if (format == FMT_MAX_PLUS_ONE_) {
+   if (formats.empty() && default_format != FMT_MAX_PLUS_ONE_) {
+      formats.push_back(default_format);
+   }
+
+   // Each format option is used for the output file in the same position,
+   // and any further output files have their format selected based on
+   // extension.  Any further format options have the output filename
+   // generated from the input filename.
+   size_t n_outputs = argc - optind;
+   vector<ExportJob> jobs(max(formats.size(), n_outputs));
+   if (jobs.empty()) {
+      fatalerror(/*Export format not specified*/253);
+   }
+   for (size_t j = 0; j < jobs.size(); ++j) {
+      ExportJob& job = jobs[j];
+      const char* fnm_out = j < n_outputs ? argv[optind + j] : NULL;
+      export_format format = FMT_MAX_PLUS_ONE_;
+      if (j < formats.size()) {
+	 format = formats[j];
+      } else {
 	 // Select format based on extension.
 	 size_t len = strlen(fnm_out);
 	 for (size_t i = 0; i < FMT_MAX_PLUS_ONE_; ++i) {
@@ -402,43 +424,48 @@ main(int argc, char **argv)
 	    fatalerror(/*Export format not specified and not known from output file extension*/252);
 	 }
       }
-   } else {
-      if (format == FMT_MAX_PLUS_ONE_) {
-	 fatalerror(/*Export format not specified*/253);
+      if (!fnm_out) {
+	 char *baseleaf = baseleaf_from_fnm(fnm_in);
+	 /* note : memory allocated by fnm_out gets leaked in this case... */
+	 fnm_out = add_ext(baseleaf, export_format_info[format].extension);
+	 osfree(baseleaf);
       }
-      char *baseleaf = baseleaf_from_fnm(fnm_in);
-      /* note : memory allocated by fnm_out gets leaked in this case... */
-      fnm_out = add_ext(baseleaf, export_format_info[format].extension);
-      osfree(baseleaf);
-   }
 
-   const auto& format_info_mask = export_format_info[format].mask;
-   unsigned not_allowed = show_mask &~ format_info_mask;
-   if (not_allowed) {
-       printf("warning: The following options are not supported for this export format and will be ignored:\n");
-       int i = 0;
-       unsigned bit = 1;
-       while (not_allowed) {
-	   if (not_allowed & bit) {
+      int job_show_mask = show_mask;
+      const auto& format_info_mask = export_format_info[format].mask;
+      unsigned not_allowed = job_show_mask &~ format_info_mask;
+      if (not_allowed) {
+	 printf("warning: The following options are not supported for this export format and will be ignored:\n");
+	 int i = 0;
+	 unsigned bit = 1;
+	 while (not_allowed) {
+	    if (not_allowed & bit) {
 	       // E.g. --walls maps to two bits in show_mask, but the options
 	       // are only put on the least significant in such cases.
 	       if (!optmap[i].empty())
-		   printf("%s\n", optmap[i].c_str());
+		  printf("%s\n", optmap[i].c_str());
 	       not_allowed &= ~bit;
-	   }
-	   ++i;
-	   bit <<= 1;
-       }
-       show_mask &= format_info_mask;
-   }
+	    }
+	    ++i;
+	    bit <<= 1;
+	 }
+	 job_show_mask &= format_info_mask;
+      }
 
-   if (always_include_defaults || show_mask == 0) {
-       show_mask |= export_format_info[format].defaults;
-   }
+      if (always_include_defaults || job_show_mask == 0) {
+	 job_show_mask |= export_format_info[format].defaults;
+      }
 
-   if (!(format_info_mask & ORIENTABLE)) {
-       pan = 0.0;
-       tilt = -90.0;
+      job.fnm_out = fnm_out;
+      job.format = format;
+      job.show_mask = job_show_mask;
+      if (format_info_mask & ORIENTABLE) {
+	 job.pan = pan;
+	 job.tilt = tilt;
+      } else {
+	 job.pan = 0.0;
+	 job.tilt = -90.0;
+      }
    }
 
    Model model;
@@ -446,22 +473,26 @@ main(int argc, char **argv)
    if (err) fatalerror(err, fnm_in);
    if (filter) filter->SetSeparator(model.GetSeparator());
 
-   try {
-       if (!Export(fnm_out, model.GetSurveyTitle(),
-		   model.GetDateString(),
-		   model, filter,
-		   pan, tilt, show_mask, format,
-		   grid, text_height, marker_size,
-		   scale)) {
-	  fatalerror(/*Couldn’t write file “%s”*/402, fnm_out);
-       }
-   } catch (const wxString & m) {
-       wxString r = msg_appname();
-       r += ": ";
-       r += wmsg(/*error*/93);
-       r += ": ";
-       r += m;
-       wcerr << r.c_str() << '\n';
+   // wxThread needs wxWidgets to be initialised, but we only need threads
+   // if there's more than one output.
+   unique_ptr<wxInitializer> wx_init;
+   if (jobs.size() > 1) wx_init.reset(new wxInitializer());
+
+   ExportInParallel(jobs, model.GetSurveyTitle(), model.GetDateString(),
+		    model, filter, grid, text_height, marker_size, scale);
+
+   for (const ExportJob& job : jobs) {
+      if (!job.error.empty()) {
+	 wxString r = msg_appname();
+	 r += ": ";
+	 r += wmsg(/*error*/93);
+	 r += ": ";
+	 r += job.error;
+	 wcerr << r.c_str() << '\n';
+      } else if (!job.ok) {
+	 fatalerror(/*Couldn’t write file “%s”*/402,
+		    static_cast<const char*>(job.fnm_out.mb_str()));
+      }
    }
 
    return 0;
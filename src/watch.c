@@ -0,0 +1,281 @@
+/* watch.c
+ * Re-run processing of survey data whenever the input files change
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* cavern's state isn't set up to be reset and rebuilt, so each time we
+ * process the data it's done by a fresh child process.  The child tells us
+ * the name of each file it reads over a pipe, and we then wait for any of
+ * those to change (using inotify if available, otherwise by polling).
+ *
+ * This means each run re-reads and re-parses every input file - the only
+ * work saved is solving unchanged parts of the network, via --solve-cache.
+ * FIXME: Keep the parsed survey data resident and only re-read the files
+ * which changed, which needs the prefix tree and network to support having
+ * the contributions from a file removed.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "watch.h"
+
+int watching = 0;
+
+#if WATCH_SUPPORTED
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+#include "debug.h"
+#include "filename.h"
+#include "message.h"
+
+/* In a child process, the pipe to report the files we read over. */
+static int report_fd = -1;
+
+typedef struct {
+   char *fnm;
+   /* What the file looked like when it was read - if any of this changes we
+    * reprocess. */
+   bool exists;
+   dev_t dev;
+   ino_t ino;
+   off_t size;
+   time_t mtime;
+} input_file;
+
+static input_file *inputs = NULL;
+static size_t n_inputs = 0, max_inputs = 0;
+
+static void
+stat_input(input_file *in)
+{
+   struct stat sb;
+   in->exists = (stat(in->fnm, &sb) == 0);
+   if (in->exists) {
+      in->dev = sb.st_dev;
+      in->ino = sb.st_ino;
+      in->size = sb.st_size;
+      in->mtime = sb.st_mtime;
+   }
+}
+
+static bool
+input_changed(const input_file *in)
+{
+   input_file now = *in;
+   stat_input(&now);
+   if (now.exists != in->exists) return fTrue;
+   if (!now.exists) return fFalse;
+   return now.dev != in->dev || now.ino != in->ino ||
+	  now.size != in->size || now.mtime != in->mtime;
+}
+
+static bool
+any_input_changed(void)
+{
+   size_t i;
+   for (i = 0; i < n_inputs; i++) {
+      if (input_changed(&inputs[i])) return fTrue;
+   }
+   return fFalse;
+}
+
+static void
+add_input(const char *fnm)
+{
+   size_t i;
+   for (i = 0; i < n_inputs; i++) {
+      if (strcmp(inputs[i].fnm, fnm) == 0) return;
+   }
+   if (n_inputs == max_inputs) {
+      max_inputs = max_inputs ? max_inputs * 2 : 16;
+      inputs = osrealloc(inputs, max_inputs * ossizeof(input_file));
+   }
+   inputs[n_inputs].fnm = osstrdup(fnm);
+   /* Check the file now rather than once the child has finished, so that
+    * we notice if it changes while the data is being processed. */
+   stat_input(&inputs[n_inputs]);
+   ++n_inputs;
+}
+
+static void
+clear_inputs(void)
+{
+   while (n_inputs) osfree(inputs[--n_inputs].fnm);
+}
+
+/* Read the '\0'-terminated filenames the child reports until it closes the
+ * pipe. */
+static void
+read_reports(int fd)
+{
+   char *buf = NULL;
+   size_t len = 0, alloc = 0;
+   while (1) {
+      ssize_t n;
+      char *p, *end;
+      if (alloc - len < 4096) {
+	 alloc = alloc ? alloc * 2 : 8192;
+	 buf = osrealloc(buf, alloc);
+      }
+      n = read(fd, buf + len, alloc - len);
+      if (n < 0) {
+	 if (errno == EINTR) continue;
+	 break;
+      }
+      if (n == 0) break;
+      len += n;
+      /* Handle all the complete filenames, and keep any partial one. */
+      p = buf;
+      end = buf + len;
+      while (1) {
+	 char *z = memchr(p, '\0', end - p);
+	 if (!z) break;
+	 add_input(p);
+	 p = z + 1;
+      }
+      len = end - p;
+      memmove(buf, p, len);
+   }
+   osfree(buf);
+}
+
+static void
+wait_for_change(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+   int ifd = inotify_init();
+   if (ifd >= 0) {
+      size_t i;
+      /* Watch the directories rather than the files themselves, as many
+       * editors save by writing a new file and renaming it into place. */
+      for (i = 0; i < n_inputs; i++) {
+	 char *pth = path_from_fnm(inputs[i].fnm);
+	 (void)inotify_add_watch(ifd, *pth ? pth : ".",
+				 IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|
+				 IN_CREATE|IN_DELETE);
+	 osfree(pth);
+      }
+      while (1) {
+	 char buf[4096];
+	 /* Check before the first read() too, as an input may have changed
+	  * after the previous check but before the watches were added, in
+	  * which case we'd never get an event for it.  After that, the event
+	  * may be for some other file in the same directory (such as the .3d
+	  * file we just wrote!) */
+	 if (any_input_changed()) {
+	    close(ifd);
+	    return;
+	 }
+	 if (read(ifd, buf, sizeof(buf)) < 0 && errno != EINTR) {
+	    /* Fall back to polling. */
+	    break;
+	 }
+      }
+      close(ifd);
+   }
+#endif
+   while (!any_input_changed()) sleep(1);
+}
+
+void
+watch_inputs(char **files)
+{
+   while (1) {
+      int fds[2];
+      pid_t pid;
+      int status;
+      size_t i;
+
+      if (pipe(fds) < 0)
+	 fatalerror(/*Couldn’t run external command: “%s”*/17, msg_appname());
+      fflush(stdout);
+      fflush(stderr);
+      pid = fork();
+      if (pid < 0)
+	 fatalerror(/*Couldn’t run external command: “%s”*/17, msg_appname());
+      if (pid == 0) {
+	 /* In the child process, which should go and process the data. */
+	 close(fds[0]);
+	 report_fd = fds[1];
+	 return;
+      }
+
+      close(fds[1]);
+      /* The set of files may change between runs (e.g. if an *include is
+       * added), so start afresh each time.  Also watch the files named on
+       * the command line in case the child couldn't even open them. */
+      clear_inputs();
+      for (i = 0; files[i]; i++) add_input(files[i]);
+      read_reports(fds[0]);
+      close(fds[0]);
+      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) { }
+
+      putnl();
+      /* TRANSLATORS: cavern --watch has finished processing the survey data
+       * and is waiting for one of the input files to be changed before
+       * processing it again. */
+      puts(msg(/*Waiting for input files to change…*/527));
+      wait_for_change();
+   }
+}
+
+void
+watch_note_input(const char *fnm)
+{
+   const char *p = fnm;
+   size_t len = strlen(fnm) + 1;
+   if (report_fd < 0) return;
+   while (len) {
+      ssize_t n = write(report_fd, p, len);
+      if (n < 0) {
+	 if (errno == EINTR) continue;
+	 /* The watching process has gone away - not much we can do. */
+	 close(report_fd);
+	 report_fd = -1;
+	 return;
+      }
+      p += n;
+      len -= n;
+   }
+}
+
+#else
+
+void
+watch_inputs(char **files)
+{
+   (void)files;
+}
+
+void
+watch_note_input(const char *fnm)
+{
+   (void)fnm;
+}
+
+#endif
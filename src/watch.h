@@ -0,0 +1,42 @@
+/* watch.h
+ * Re-run processing of survey data whenever the input files change
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+/* --watch needs fork(), so isn't supported on all platforms. */
+#ifdef HAVE_FORK
+# define WATCH_SUPPORTED 1
+#else
+# define WATCH_SUPPORTED 0
+#endif
+
+/* Non-zero if --watch was specified. */
+extern int watching;
+
+/* Process the data in a child process, then wait for any of the input files
+ * to change and repeat.  This only returns in each child process, which
+ * should process the data files and exit.  files is the NULL-terminated list
+ * of files given on the command line. */
+void watch_inputs(char **files);
+
+/* Report to the watching process that we've read fnm. */
+void watch_note_input(const char *fnm);
+
+#endif
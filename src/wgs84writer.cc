@@ -0,0 +1,201 @@
+/* wgs84writer.cc
+ * Batch conversion of coordinates to WGS84 for export formats which use it.
+ */
+/* Copyright (C) 2012 Olaf Kähler
+ * Copyright (C) 2012,2013,2014,2015,2016,2017,2018,2019 Olly Betts
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "wgs84writer.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aven.h"
+#include "message.h"
+
+using namespace std;
+
+#define WGS84_DATUM_STRING "EPSG:4326"
+
+static void discarding_proj_logger(void *, int, const char *) { }
+
+WGS84Writer::WGS84Writer(const char* input_datum)
+{
+    // The new context is a copy of the default one, so picks up any search
+    // path msg_init() set there.
+    ctx = proj_context_create();
+
+    /* Prevent stderr spew from PROJ. */
+    proj_log_func(ctx, nullptr, discarding_proj_logger);
+
+    pj = proj_create_crs_to_crs(ctx, input_datum, WGS84_DATUM_STRING, NULL);
+
+    if (pj) {
+	// Normalise the output order so x is longitude and y latitude - by
+	// default new PROJ has them switched for EPSG:4326 which just seems
+	// confusing.
+	PJ* pj_norm = proj_normalize_for_visualization(ctx, pj);
+	proj_destroy(pj);
+	pj = pj_norm;
+    }
+
+    if (!pj) {
+	if (ctx)
+	    proj_context_destroy(ctx);
+	wxString m = wmsg(/*Failed to initialise input coordinate system “%s”*/287);
+	m = wxString::Format(m.c_str(), input_datum);
+	throw m;
+    }
+}
+
+WGS84Writer::~WGS84Writer()
+{
+    if (pj)
+	proj_destroy(pj);
+    if (ctx)
+	proj_context_destroy(ctx);
+}
+
+void
+WGS84Writer::put_escaped(const char* s)
+{
+    while (*s) {
+	switch (*s) {
+	    case '<':
+		text += "&lt;";
+		break;
+	    case '>':
+		text += "&gt;";
+		break;
+	    case '&':
+		text += "&amp;";
+		break;
+	    default:
+		text += *s;
+	}
+	++s;
+    }
+}
+
+// Enough for -DBL_MAX to 8 decimal places plus the nul sprintf() adds.
+const size_t FORMAT_FIXED_MAX = 1 + 309 + 1 + 8 + 1;
+
+// Write v to p with the given number of decimal places (at most 8), giving
+// the same output as sprintf(p, "%.*f", places, v).  Returns a pointer to
+// the end of what was written (which isn't nul-terminated).
+//
+// p must have room for FORMAT_FIXED_MAX characters.
+
+static char*
+format_fixed(char* p, double v, unsigned places)
+{
+    static const double scale[] = {
+	1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8
+    };
+    double a = fabs(v);
+    double t = a * scale[places];
+    // Handle infinity, NaN, and values too large to represent exactly as an
+    // integer after scaling using sprintf().
+    if (!(t < 4503599627370496.0)) {
+	return p + sprintf(p, "%.*f", int(places), v);
+    }
+
+    // printf() rounds the exact decimal value of v, so round to an integer
+    // then adjust if the product was rounded onto a tie.  The rounding error
+    // of the product is exactly representable so fma() can give it to us.
+    double n = nearbyint(t);
+    double d = t - n;
+    if (d == 0.5 || d == -0.5) {
+	double err = fma(a, scale[places], -t);
+	if (d == 0.5 && err > 0.0) {
+	    n += 1.0;
+	} else if (d == -0.5 && err < 0.0) {
+	    n -= 1.0;
+	}
+    }
+
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* q = end;
+    uint64_t u = uint64_t(n);
+    do {
+	*--q = '0' + u % 10;
+	u /= 10;
+    } while (u);
+    // Ensure there's at least one digit before the decimal point.
+    while (end - q <= ptrdiff_t(places)) *--q = '0';
+
+    if (signbit(v)) *p++ = '-';
+    size_t int_digits = (end - q) - places;
+    memcpy(p, q, int_digits);
+    p += int_digits;
+    if (places) {
+	*p++ = '.';
+	memcpy(p, q + int_digits, places);
+	p += places;
+    }
+    return p;
+}
+
+void
+WGS84Writer::flush(FILE* fh)
+{
+    if (!coords.empty()) {
+	// Older versions of proj_trans_generic() don't pick between
+	// alternative coordinate operations in the way proj_trans() does, so
+	// only use it where it should give the same results.
+#if PROJ_VERSION_MAJOR >= 8
+	PJ_COORD* c = &coords[0];
+	size_t n = coords.size();
+	proj_trans_generic(pj, PJ_FWD,
+			   &c->xyzt.x, sizeof(PJ_COORD), n,
+			   &c->xyzt.y, sizeof(PJ_COORD), n,
+			   &c->xyzt.z, sizeof(PJ_COORD), n,
+			   &c->xyzt.t, sizeof(PJ_COORD), n);
+#else
+	for (auto& coord : coords) {
+	    coord = proj_trans(pj, PJ_FWD, coord);
+	}
+#endif
+	// FIXME report errors (components will be HUGE_VAL)
+    }
+
+    buf.clear();
+    buf.reserve(text.size() + fields.size() * 16);
+    size_t pos = 0;
+    for (const Field& field : fields) {
+	buf.append(text, pos, field.pos - pos);
+	pos = field.pos;
+	char tmp[FORMAT_FIXED_MAX];
+	char* end = format_fixed(tmp, coords[field.point].v[field.component],
+				 field.places);
+	buf.append(tmp, end - tmp);
+    }
+    buf.append(text, pos, string::npos);
+    fwrite(buf.data(), 1, buf.size(), fh);
+
+    coords.clear();
+    text.clear();
+    fields.clear();
+}
@@ -0,0 +1,114 @@
+/* wgs84writer.h
+ * Batch conversion of coordinates to WGS84 for export formats which use it.
+ */
+/* Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SURVEX_WGS84WRITER_H
+#define SURVEX_WGS84WRITER_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <proj.h>
+
+// Output text containing coordinates converted to WGS84.
+//
+// Rather than converting each point with its own call to proj_trans() and
+// formatting it with fprintf(), points and text are queued up and at flush()
+// all the queued points are converted together, then the output is formatted
+// into a buffer which is written with a single fwrite().
+//
+// The output is the same as if each coordinate was written with printf()
+// using format "%.<places>f".
+class WGS84Writer {
+    // PROJ contexts mustn't be used by more than one thread at once, and
+    // survexport can run several exports in parallel, so each writer has its
+    // own.
+    PJ_CONTEXT* ctx = NULL;
+
+    PJ* pj = NULL;
+
+    // Points queued for conversion.
+    std::vector<PJ_COORD> coords;
+
+    // Literal text queued for output.
+    std::string text;
+
+    // A coordinate to be inserted into text.
+    struct Field {
+	// The offset in text to insert at.
+	size_t pos;
+	// The index in coords.
+	unsigned point;
+	// 0 for longitude, 1 for latitude, 2 for altitude.
+	unsigned char component;
+	// Number of decimal places.
+	unsigned char places;
+    };
+
+    std::vector<Field> fields;
+
+    // The formatted output.
+    std::string buf;
+
+  public:
+    // Throws wxString if input_datum can't be converted to WGS84.
+    explicit WGS84Writer(const char* input_datum);
+
+    ~WGS84Writer();
+
+    // Queue a point for conversion, returning a handle for it.
+    //
+    // The handle is only valid until the next call to flush().
+    unsigned add_point(double x, double y, double z) {
+	PJ_COORD coord = {x, y, z, HUGE_VAL};
+	coords.push_back(coord);
+	return coords.size() - 1;
+    }
+
+    void put(const char* s) { text += s; }
+
+    void put(char ch) { text += ch; }
+
+    // Write s with '<', '>' and '&' escaped.
+    void put_escaped(const char* s);
+
+    void put_lon(unsigned point) { put_coord(point, 0, 8); }
+
+    void put_lat(unsigned point) { put_coord(point, 1, 8); }
+
+    void put_alt(unsigned point) { put_coord(point, 2, 2); }
+
+    void put_coord(unsigned point, unsigned component, unsigned places) {
+	fields.push_back(Field{text.size(), point,
+			       (unsigned char)component,
+			       (unsigned char)places});
+    }
+
+    // True if it's worth calling flush() yet.
+    bool want_flush() const {
+	return coords.size() >= 4096 || text.size() >= 65536;
+    }
+
+    // Convert the queued points and write out everything queued to fh.
+    void flush(FILE* fh);
+};
+
+#endif
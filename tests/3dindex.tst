@@ -0,0 +1,131 @@
+#!/bin/sh
+#
+# Survex test suite - check reading a .3d file with a survey index
+# Copyright (C) 2026 agent
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+# force VERBOSE if we're run on a subset of tests
+test -n "$*" && VERBOSE=1
+
+test -x "$testdir"/../src/cavern || testdir=.
+
+: ${CAVERN="$testdir"/../src/cavern}
+: ${DUMP3D="$testdir"/../src/dump3d}
+
+# Surveys to read with a filter - the whole survey, top level surveys at the
+# start, middle and end, a subsurvey, and surveys which don't exist.
+: ${TESTS=${*:-"top top.s0 top.s9 top.s19 top.s12.a1 top.s top.s20"}}
+
+LC_ALL=C
+export LC_ALL
+SURVEXLANG=en
+export SURVEXLANG
+
+# Suppress checking for leaks on exit if we're build with lsan - we don't
+# generally waste effort to free all allocations as the OS will reclaim
+# memory on exit.
+LSAN_OPTIONS=leak_check_at_exit=0
+export LSAN_OPTIONS
+
+vg_error=123
+vg_log=vg.log
+if [ -n "$VALGRIND" ] ; then
+  rm -f "$vg_log"
+  CAVERN="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $CAVERN"
+  DUMP3D="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $DUMP3D"
+fi
+
+# Run a command, failing the test if it fails or valgrind reports problems.
+run() {
+  "$@"
+  exitcode=$?
+  if [ -n "$VALGRIND" ] ; then
+    if [ $exitcode = "$vg_error" ] ; then
+      cat "$vg_log"
+      rm "$vg_log"
+      exit 1
+    fi
+    rm "$vg_log"
+  fi
+  test $exitcode = 0 || exit 1
+}
+
+# Reduce dump3d output to the legs (with the point each starts from), stations
+# and passages.  Skipped chunks don't return their img_MOVE and img_ERROR_INFO
+# items, so we can't compare those directly.
+normalise() {
+  awk '$1 == "MOVE" { pt = $2 " " $3 " " $4; next }
+       $1 == "LINE" { print "LINE " pt " ->", substr($0, 6); pt = $2 " " $3 " " $4; next }
+       $1 == "NODE" || $1 == "XSECT" || $1 == "XSECT_END" || $1 == "STOP" { print }'
+}
+
+# The test files in the repo are all too small to get an index, so generate
+# a survey with enough data to be split into lots of chunks.
+rm -f tmp.* tmp_noidx.3d
+awk 'BEGIN {
+  print "*fix top.s0.a0.0 0 0 0"
+  print "*begin top"
+  for (s = 0; s < 20; ++s) {
+    print "*begin s" s
+    for (a = 0; a < 3; ++a) {
+      print "*begin a" a
+      print "*date " (1990 + s) ".01.0" (a + 1)
+      for (i = 0; i < 300; ++i) {
+	print i, i + 1, 2 + (i * 7 + s) % 9, (i * 37 + s * 11 + a * 5) % 360, (i % 5) - 2
+      }
+      print "*data passage station left right up down"
+      for (i = 0; i < 300; i += 5) print i, 1, 2, 3, 4
+      print "*end a" a
+      if (a) print "*equate a" a - 1 ".300 a" a ".0"
+    }
+    print "*end s" s
+    if (s) print "*equate s" s - 1 ".a2.300 s" s ".a0.0"
+  }
+  print "*end top"
+}' > tmp.svx
+
+run $CAVERN tmp.svx --output=tmp > tmp.out
+# Check that we did write an index.
+test x"`tail -c 8 tmp.3d`" = xSvx3dIdx || exit 1
+# Readers ignore anything after the end of data marker, but the index is
+# only used if it's at the very end of the file.
+cp tmp.3d tmp_noidx.3d
+echo >> tmp_noidx.3d
+
+# Check the index is actually used - reading with it skips the img_MOVE at the
+# start of the data when that's in a survey we don't want.
+run $DUMP3D -s top.s9 tmp.3d > tmp.idx
+run $DUMP3D -s top.s9 tmp_noidx.3d > tmp.noidx
+cmp -s tmp.noidx tmp.idx && exit 1
+
+for survey in $TESTS ; do
+  echo "$survey"
+  run $DUMP3D -s "$survey" tmp.3d > tmp.dump
+  normalise < tmp.dump > tmp.idx
+  run $DUMP3D -s "$survey" tmp_noidx.3d > tmp.dump
+  normalise < tmp.dump > tmp.noidx
+  if test -n "$VERBOSE" ; then
+    diff tmp.noidx tmp.idx || exit 1
+  else
+    cmp -s tmp.noidx tmp.idx || exit 1
+  fi
+done
+rm -f tmp.* tmp_noidx.3d
+
+test -n "$VERBOSE" && echo "Test passed"
+exit 0
@@ -27,6 +27,7 @@ test -n "$*" && VERBOSE=1
 
 test -x "$testdir"/../src/cavern || testdir=.
 
+: ${CAVERN="$testdir"/../src/cavern}
 : ${DIFFPOS="$testdir"/../src/diffpos}
 : ${SURVEXPORT="$testdir"/../src/survexport}
 
@@ -42,6 +43,7 @@ vg_error=123
 vg_log=vg.log
 if [ -n "$VALGRIND" ] ; then
   rm -f "$vg_log"
+  CAVERN="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $CAVERN"
   SURVEXPORT="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $SURVEXPORT"
   DIFFPOS="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $DIFFPOS"
 fi
@@ -80,5 +82,57 @@ for file in $TESTS ; do
   test -s diffpos.tmp && exit 1
   rm -f tmp.pos diffpos.tmp
 done
+
+# Check writing several output files in one run.
+echo "multiple outputs"
+rm -f tmp.pos tmp2.pos tmp.csv
+$SURVEXPORT --pos "$srcdir/v3.3d" tmp.pos tmp2.pos tmp.csv
+exitcode=$?
+if [ -n "$VALGRIND" ] ; then
+  if [ $exitcode = "$vg_error" ] ; then
+    cat "$vg_log"
+    rm "$vg_log"
+    exit 1
+  fi
+  rm "$vg_log"
+fi
+test $exitcode = 0 || exit 1
+test -s tmp.csv || exit 1
+cmp tmp.pos tmp2.pos || exit 1
+$DIFFPOS "$srcdir/v3.3d" tmp.pos > diffpos.tmp
+test -s diffpos.tmp && exit 1
+rm -f tmp.pos tmp2.pos tmp.csv diffpos.tmp
+
+# Check writing several output files in one run with formats which use PROJ to
+# convert coordinates, since each output is written by its own thread.
+echo "multiple outputs using PROJ"
+rm -f tmp.3d tmp.out tmp.kml tmp2.kml tmp.gpx
+$CAVERN "$srcdir/kmlexport.svx" --output=tmp > tmp.out
+exitcode=$?
+if [ -n "$VALGRIND" ] ; then
+  if [ $exitcode = "$vg_error" ] ; then
+    cat "$vg_log"
+    rm "$vg_log"
+    exit 1
+  fi
+  rm "$vg_log"
+fi
+test $exitcode = 0 || exit 1
+$SURVEXPORT --defaults tmp.3d tmp.kml tmp2.kml tmp.gpx > /dev/null
+exitcode=$?
+if [ -n "$VALGRIND" ] ; then
+  if [ $exitcode = "$vg_error" ] ; then
+    cat "$vg_log"
+    rm "$vg_log"
+    exit 1
+  fi
+  rm "$vg_log"
+fi
+test $exitcode = 0 || exit 1
+test -s tmp.gpx || exit 1
+cmp "$srcdir/kmlexport.kml" tmp.kml || exit 1
+cmp tmp.kml tmp2.kml || exit 1
+rm -f tmp.3d tmp.out tmp.kml tmp2.kml tmp.gpx
+
 test -n "$VERBOSE" && echo "Test passed"
 exit 0
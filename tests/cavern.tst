@@ -71,7 +71,7 @@ testdir=`(cd "$testdir" && pwd)`
  badunits badbegin anonstn anonstnbad anonstnrev doubleinc reenterlots\
  cs csbad csbadsdfix csfeet cslonglat omitfixaroundsolve repeatreading\
  mixedeols utf8bom nonewlineateof suspectreadings cmd_data_default\
- quadrant_bearing bad_quadrant_bearing\
+ quadrant_bearing bad_quadrant_bearing threads profile solvecache\
  gpxexport jsonexport kmlexport\
 "}}
 
@@ -132,6 +132,7 @@ for file in $TESTS ; do
 
   # One of:
   # yes : diffpos 3D file output with <testcase_name>.pos
+  # profile : As yes, but also run with --profile and check the report
   # no : Check that a 3D file is produced, but not positions in it
   # fail : Check that a 3D file is NOT produced
   # dxf : Convert to DXF with survexport and compare with <testcase_name>.dxf
@@ -140,6 +141,9 @@ for file in $TESTS ; do
   # kml : Convert to KML with survexport and compare with <testcase_name>.kml
   pos=
 
+  # extra options to pass to cavern
+  cavernopts=
+
   case $file in
     *.dat)
       # .dat files can't start with a comment.  All the current .dat tests
@@ -170,6 +174,9 @@ for file in $TESTS ; do
 	  pos=*) pos=`expr "$1" : 'pos=\(.*\)'` ;;
 	  warn=*) warn=`expr "$1" : 'warn=\(.*\)'` ;;
 	  error=*) error=`expr "$1" : 'error=\(.*\)'` ;;
+	  cavernopt=*)
+	    cavernopts="$cavernopts "`expr "$1" : 'cavernopt=\(.*\)'`
+	    ;;
 	  survexportopt=*)
 	    survexportopts="$survexportopts "`expr "$1" : 'survexportopt=\(.*\)'`
 	    ;;
@@ -191,8 +198,11 @@ for file in $TESTS ; do
   posfile=$basefile.pos
   rm -f tmp.*
   pwd=`pwd`
+  if test profile = "$pos" ; then
+    cavernopts="$cavernopts --profile=$pwd/tmp.json"
+  fi
   cd "$srcdir"
-  srcdir=. $CAVERN "$input" --output="$pwd/tmp" > "$pwd/tmp.out"
+  srcdir=. $CAVERN$cavernopts "$input" --output="$pwd/tmp" > "$pwd/tmp.out"
   exitcode=$?
   cd "$pwd"
   test -n "$VERBOSE" && cat tmp.out
@@ -232,7 +242,7 @@ for file in $TESTS ; do
   fi
 
   case $pos in
-  yes)
+  yes|profile)
     if test -n "$VERBOSE" ; then
       $DIFFPOS "$posfile" tmp.3d
       exitcode=$?
@@ -249,6 +259,16 @@ for file in $TESTS ; do
       rm "$vg_log"
     fi
     [ "$exitcode" = 0 ] || exit 1
+    if test profile = "$pos" ; then
+      # Check every phase is in the table and the JSON file.  The timings
+      # will vary so we can't check those.
+      for phase in parse remove_trailing_travs remove_travs remove_subnets \
+	  articulate solve_matrix replace_subnets replace_travs \
+	  replace_trailing_travs write_passage_models close_3d ; do
+	grep -q "^ *$phase  *[0-9]" tmp.out || exit 1
+	grep -q '^{"name":"'"$phase"'","calls":[0-9]*,"wall":[0-9.]*,"cpu":[0-9.]*,"peak_rss_kb":-*[0-9]*,"items":[0-9]*' tmp.json || exit 1
+      done
+    fi
     ;;
   dxf|gpx|json|kml)
     # $pos gives us the file extension here.
@@ -34,7 +34,7 @@ testdir=`(cd "$testdir" && pwd)`
 : ${CAVERN="$testdir"/../src/cavern}
 : ${IMGTEST="$testdir"/../src/imgtest}
 
-: ${TESTS=${*:-"simple survey"}}
+: ${TESTS=${*:-"simple survey items"}}
 
 # Suppress checking for leaks on exit if we're build with lsan - we don't
 # generally waste effort to free all allocations as the OS will reclaim
@@ -0,0 +1,135 @@
+#!/bin/sh
+#
+# Survex test suite - check aven's cache of the model built from a .3d file
+# Copyright (C) 2026 agent
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+# force VERBOSE if we're run on a subset of tests
+test -n "$*" && VERBOSE=1
+
+test -x "$testdir"/../src/cavern || testdir=.
+
+: ${CAVERN="$testdir"/../src/cavern}
+: ${MODELTEST="$testdir"/../src/modeltest}
+
+LC_ALL=C
+export LC_ALL
+SURVEXLANG=en
+export SURVEXLANG
+
+# Suppress checking for leaks on exit if we're build with lsan - we don't
+# generally waste effort to free all allocations as the OS will reclaim
+# memory on exit.
+LSAN_OPTIONS=leak_check_at_exit=0
+export LSAN_OPTIONS
+
+vg_error=123
+vg_log=vg.log
+if [ -n "$VALGRIND" ] ; then
+  rm -f "$vg_log"
+  CAVERN="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $CAVERN"
+  MODELTEST="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $MODELTEST"
+fi
+
+# Run a command, failing the test if it fails or valgrind reports problems.
+run() {
+  "$@"
+  exitcode=$?
+  if [ -n "$VALGRIND" ] ; then
+    if [ $exitcode = "$vg_error" ] ; then
+      cat "$vg_log"
+      rm "$vg_log"
+      exit 1
+    fi
+    rm "$vg_log"
+  fi
+  test $exitcode = 0 || exit 1
+}
+
+# Load tmp.3d as aven would and check the result is the same as loading it
+# without the cache, and that the cache was used (or not) as expected by $1.
+# modeltest reports which, and checks the models match.
+check() {
+  expect=$1
+  shift
+  echo "$expect: $*"
+  run $MODELTEST tmp.3d ${1+"$@"} > tmp.out
+  test -n "$VERBOSE" && cat tmp.out
+  test x"`cat tmp.out`" = x"$expect" || exit 1
+  test -f tmp.3d.aven-cache || exit 1
+}
+
+# Small files aren't cached, so generate a survey with enough data, including
+# passages so there are tubes.
+gen() {
+  awk 'BEGIN {
+    print "*fix top.s0.a0.0 0 0 0"
+    print "*begin top"
+    for (s = 0; s < 12; ++s) {
+      print "*begin s" s
+      for (a = 0; a < 3; ++a) {
+	print "*begin a" a
+	print "*date " (1990 + s) ".01.0" (a + 1)
+	for (i = 0; i < 300; ++i) {
+	  print i, i + 1, 2 + (i * 7 + s) % 9, (i * 37 + s * 11 + a * 5 + '"$1"') % 360, (i % 5) - 2
+	}
+	print "*data passage station left right up down"
+	for (i = 0; i < 300; i += 5) print i, 1, 2, 3, 4
+	print "*end a" a
+	if (a) print "*equate a" a - 1 ".300 a" a ".0"
+      }
+      print "*end s" s
+      if (s) print "*equate s" s - 1 ".a2.300 s" s ".a0.0"
+    }
+    print "*end top"
+  }' > tmp.svx
+  run $CAVERN tmp.svx --output=tmp > tmp.out
+}
+
+rm -f tmp.* tmp.3d.aven-cache
+gen 0
+
+# The first load builds the model from the file and writes the cache, which
+# the next load should use.
+check "not from cache"
+check "from cache"
+
+# The cache is for a particular survey prefix.
+check "not from cache" top.s5
+check "from cache" top.s5
+check "not from cache"
+
+# Check that the cache isn't used if the file changes without changing its
+# size or modification time, by changing a character in the title.
+cp -p tmp.3d tmp.bak
+sed 's/^tmp$/TMP/' tmp.3d > tmp.new
+cmp -s tmp.3d tmp.new && exit 1
+cat tmp.new > tmp.3d
+touch -r tmp.bak tmp.3d
+check "not from cache"
+check "from cache"
+
+# Or if the file is reprocessed with different data.
+gen 90
+check "not from cache"
+check "from cache"
+
+rm -f tmp.* tmp.3d.aven-cache
+
+test -n "$VERBOSE" && echo "Test passed"
+exit 0
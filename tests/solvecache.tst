@@ -0,0 +1,111 @@
+#!/bin/sh
+#
+# Survex test suite - check reprocessing with cavern --solve-cache
+# Copyright (C) 2026 agent
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+# allow us to run tests standalone more easily
+: ${srcdir="$testdir"}
+
+# force VERBOSE if we're run on a subset of tests
+test -n "$*" && VERBOSE=1
+
+test -x "$testdir"/../src/cavern || testdir=.
+
+: ${CAVERN="$testdir"/../src/cavern}
+: ${DIFFPOS="$testdir"/../src/diffpos}
+: ${SURVEXPORT="$testdir"/../src/survexport}
+
+: ${TESTS=${*:-"solvecache"}}
+
+LC_ALL=C
+export LC_ALL
+SURVEXLANG=en
+export SURVEXLANG
+
+# Suppress checking for leaks on exit if we're build with lsan - we don't
+# generally waste effort to free all allocations as the OS will reclaim
+# memory on exit.
+LSAN_OPTIONS=leak_check_at_exit=0
+export LSAN_OPTIONS
+
+# Omit the datestamp so the two runs should give byte-for-byte identical 3d
+# files.
+SOURCE_DATE_EPOCH=1
+export SOURCE_DATE_EPOCH
+
+vg_error=123
+vg_log=vg.log
+if [ -n "$VALGRIND" ] ; then
+  rm -f "$vg_log"
+  CAVERN="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $CAVERN"
+  DIFFPOS="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $DIFFPOS"
+  SURVEXPORT="$VALGRIND --log-file=$vg_log --error-exitcode=$vg_error $SURVEXPORT"
+fi
+
+# Run a command, failing the test if it fails or valgrind reports problems.
+run() {
+  "$@"
+  exitcode=$?
+  if [ -n "$VALGRIND" ] ; then
+    if [ $exitcode = "$vg_error" ] ; then
+      cat "$vg_log"
+      rm "$vg_log"
+      exit 1
+    fi
+    rm "$vg_log"
+  fi
+  test $exitcode = 0 || exit 1
+}
+
+for file in $TESTS ; do
+  echo $file
+  rm -f tmp.* tmp1.*
+  pwd=`pwd`
+
+  # The first run has nothing cached so should solve every matrix.
+  cd "$srcdir"
+  run $CAVERN --solve-cache -zt "$file.svx" --output="$pwd/tmp" > "$pwd/tmp.out"
+  cd "$pwd"
+  test -n "$VERBOSE" && cat tmp.out
+  test -s tmp.cache || exit 1
+  grep -q '^Matrix of .*: assembly' tmp.out || exit 1
+  grep -q '^Matrix of .*: solution from cache' tmp.out && exit 1
+  mv tmp.3d tmp1.3d
+  run $SURVEXPORT --pos tmp1.3d tmp1.pos > /dev/null
+
+  # Nothing has changed so the second run should get every solution from the
+  # cache, and give the same results.
+  cd "$srcdir"
+  run $CAVERN --solve-cache -zt "$file.svx" --output="$pwd/tmp" > "$pwd/tmp.out"
+  cd "$pwd"
+  test -n "$VERBOSE" && cat tmp.out
+  grep -q '^Matrix of .*: solution from cache' tmp.out || exit 1
+  grep -q '^Matrix of .*: assembly' tmp.out && exit 1
+  cmp tmp1.3d tmp.3d || exit 1
+  run $SURVEXPORT --pos tmp.3d tmp.pos > /dev/null
+  cmp tmp1.pos tmp.pos || exit 1
+  run $DIFFPOS tmp1.3d tmp.3d > diffpos.tmp
+  test -n "$VERBOSE" && cat diffpos.tmp
+  test -s diffpos.tmp && exit 1
+
+  rm -f tmp.* tmp1.* diffpos.tmp
+done
+
+test -n "$VERBOSE" && echo "Test passed"
+exit 0
@@ -0,0 +1,182 @@
+#!/bin/sh
+#
+# Survex test suite - stress tests / benchmarks
+# Copyright (C) 2026 agent
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# These take too long to run as part of "make check", but are useful for
+# checking that things scale sensibly with the size of the input.  Run
+# with e.g.:
+#
+#   ./stress.tst
+#   ./stress.tst randomorder
+#   STRESS_STATIONS=500000 ./stress.tst
+#   STRESS_STATIONS=1000000 ./stress.tst export
+#
+# The time taken by each test is reported.  Tests which run extend fail if it
+# takes longer than STRESS_EXTEND_TIME_LIMIT seconds (default 30), which is
+# much longer than it should take but far less than the time taken when
+# extend's algorithms were quadratic in the number of stations.
+
+testdir=`echo $0 | sed 's!/[^/]*$!!' || echo '.'`
+
+test -x "$testdir"/../src/cavern || testdir=.
+
+: ${CAVERN="$testdir"/../src/cavern}
+: ${EXTEND="$testdir"/../src/extend}
+: ${SURVEXPORT="$testdir"/../src/survexport}
+
+: ${TESTS=${*:-"randomorder extend export"}}
+
+# Number of stations in each generated survey.
+: ${STRESS_STATIONS=100000}
+
+: ${STRESS_EXTEND_TIME_LIMIT=30}
+
+LC_ALL=C
+export LC_ALL
+SURVEXLANG=en
+export SURVEXLANG
+
+# Suppress checking for leaks on exit if we're build with lsan - we don't
+# generally waste effort to free all allocations as the OS will reclaim
+# memory on exit.
+LSAN_OPTIONS=leak_check_at_exit=0
+export LSAN_OPTIONS
+
+for test in $TESTS ; do
+  echo "$test"
+  rm -f tmp.*
+  run_cavern=yes
+  run_extend=
+  run_export=
+  case $test in
+    randomorder)
+      # A single survey with lots of stations, which are first mentioned in
+      # a random order.  The legs form a long traverse, with some cross
+      # connections so there's a network to solve.
+      awk -v n="$STRESS_STATIONS" 'BEGIN {
+	srand(42)
+	for (i = 1; i < n; i++) perm[i] = i
+	for (i = n - 1; i > 1; i--) {
+	  j = 1 + int(rand() * i)
+	  t = perm[i]; perm[i] = perm[j]; perm[j] = t
+	}
+	print "*begin big"
+	print "*fix 0 0 0 0"
+	for (i = 1; i < n; i++) {
+	  k = perm[i]
+	  printf "%d %d %.2f %.1f %.1f\n", k - 1, k, 5 + rand() * 5, rand() * 360, rand() * 20 - 10
+	  if (k % 97 == 0) {
+	    printf "%d %d %.2f %.1f %.1f\n", k - 97, k, 5 + rand() * 5, rand() * 360, rand() * 20 - 10
+	  }
+	}
+	print "*end big"
+      }' > tmp.svx
+      ;;
+    extend)
+      # A branching survey with loops and splays, for timing extend.  Each
+      # station connects back to a random earlier station, so the passages
+      # form a tree, and some of the stations are joined by a second leg to
+      # make loops.  Every tenth station has a splay.
+      awk -v n="$STRESS_STATIONS" 'BEGIN {
+	srand(42)
+	print "*begin big"
+	print "*fix 0 0 0 0"
+	print "*entrance 0"
+	for (i = 1; i < n; i++) {
+	  j = i - 1 - int(rand() * rand() * (i < 50 ? i : 50))
+	  printf "%d %d %.2f %.1f %.1f\n", j, i, 5 + rand() * 5, rand() * 360, rand() * 20 - 10
+	  if (i % 97 == 0) {
+	    printf "%d %d %.2f %.1f %.1f\n", i - 97, i, 5 + rand() * 5, rand() * 360, rand() * 20 - 10
+	  }
+	  if (i % 10 == 0) {
+	    print "*flags splay"
+	    printf "%d s%d %.2f %.1f %.1f\n", i, i, 1 + rand() * 3, rand() * 360, rand() * 40 - 20
+	    print "*flags not splay"
+	  }
+	}
+	print "*end big"
+      }' > tmp.svx
+      run_extend=yes
+      ;;
+    export)
+      # Random walk traverses branching off from random earlier stations,
+      # for timing the exports which look up station names by position.
+      # Compass PLT is simple to generate and survexport can read it
+      # directly, so we don't need to wait for cavern.
+      awk -v n="$STRESS_STATIONS" 'BEGIN {
+	srand(42)
+	print "Z 0 0 0 0 0 0\r"
+	print "NBIG D 1 1 1 CBIG\r"
+	x[0] = y[0] = z[0] = 0
+	print "M 0.000 0.000 0.000 S0 P -9 -9 -9 -9\r"
+	for (i = 1; i < n; i++) {
+	  k = i - 1
+	  if (i % 50 == 0) {
+	    k = int(rand() * i)
+	    printf "M %.3f %.3f %.3f S%d P -9 -9 -9 -9\r\n", y[k], x[k], z[k], k
+	  }
+	  x[i] = x[k] + rand() * 30 - 15
+	  y[i] = y[k] + rand() * 30 - 15
+	  z[i] = z[k] + rand() * 10 - 5
+	  printf "D %.3f %.3f %.3f S%d P -9 -9 -9 -9\r\n", y[i], x[i], z[i], i
+	}
+	print "X 0 0 0 0 0 0\r"
+      }' > tmp.plt
+      run_cavern=
+      run_export=yes
+      ;;
+    *)
+      echo "Unknown stress test '$test'"
+      exit 1
+      ;;
+  esac
+  if test -n "$run_cavern" ; then
+    $CAVERN tmp.svx --output=tmp > tmp.out
+    exitcode=$?
+    test -n "$VERBOSE" && cat tmp.out
+    test $exitcode = 0 || exit 1
+    grep '^\(CPU \)*[Tt]ime used' tmp.out
+  fi
+  if test -n "$run_extend" ; then
+    start=`date +%s`
+    $EXTEND tmp.3d tmp.x.3d > tmp.out
+    exitcode=$?
+    end=`date +%s`
+    test -n "$VERBOSE" && cat tmp.out
+    test $exitcode = 0 || exit 1
+    echo "extend took `expr $end - $start`s"
+    if test `expr $end - $start` -gt "$STRESS_EXTEND_TIME_LIMIT" ; then
+      echo "extend took longer than ${STRESS_EXTEND_TIME_LIMIT}s"
+      exit 1
+    fi
+  fi
+  if test -n "$run_export" ; then
+    for format in svg plt ; do
+      start=`date +%s`
+      $SURVEXPORT --legs --crosses --station-names "--$format" tmp.plt "tmp.x.$format" > tmp.out
+      exitcode=$?
+      end=`date +%s`
+      test -n "$VERBOSE" && cat tmp.out
+      test $exitcode = 0 || exit 1
+      echo "$format export took `expr $end - $start`s"
+    done
+  fi
+  rm -f tmp.*
+done
+test -n "$VERBOSE" && echo "Test passed"
+exit 0